@@ -0,0 +1,153 @@
+/* e1_bench.cpp
+Sustained throughput of the acquisition and save paths against the simulated device.
+Usage: e1_bench [seconds per run] [time scale]...
+The simulated device runs at 200kHz times each time scale; the host keeps up as long as the overflow rate stays at 0 */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#include "edl.h"
+#include "edl_sim.h"
+#include "e1_acquisition.h"
+#include "e1_format.h"
+#include "e1_recorder.h"
+#include "e1_stats.h"
+
+/*! Packets drained by the consumer per read, like a client polling readInto. */
+#define BENCH_READ_PACKETS 65536
+
+static const char * benchPath = "e1_bench.e1rec";
+
+typedef struct {
+    double offeredPps; /*!< Packets per second produced by the device. */
+    double deliveredPps; /*!< Packets per second that reached the consumer. */
+    double cpuNsPerPacket; /*!< Process CPU time per delivered packet, simulation excluded. */
+    double simNsPerPacket; /*!< Share of the CPU time spent generating packets in the simulated driver. */
+    double overflowRate; /*!< Fraction of the produced packets overwritten in the driver buffer. */
+    unsigned long long ringDrops;
+    unsigned long long recorderDrops;
+    double writeMBps;
+    double readLatencyUs; /*!< Mean duration of EDL::readData. */
+    double batchPackets; /*!< Mean packets per EDL::readData. */
+} BenchResult_t;
+
+static EdlErrorCode_t connectSimulator(double timeScale)
+{
+    EdlErrorCode_t res;
+    EdlCommandStruct_t commandStruct;
+    SimConfig_t config;
+    std::vector <std::string> devices;
+
+    simDefaults(config);
+    config.timeScale = timeScale;
+    simConfigure(config);
+
+    init();
+    res = detectDevices(devices);
+    if (res != EdlSuccess) {return res;}
+    res = connectDevice(devices.at(0));
+    if (res != EdlSuccess) {return res;}
+    configInvalidate();
+
+    commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_200_KHZ;
+    return sendCommand(EdlCommandSamplingRate, commandStruct, true);
+}
+
+/*! \a save: 0 acquisition only, 1 uncompressed recording, 2 compressed recording. */
+static bool runBench(double timeScale, double seconds, int save, BenchResult_t &result)
+{
+    SimStats_t simBefore, simAfter;
+    RecorderStats_t recorderStats;
+    std::vector <float> buffer((size_t)BENCH_READ_PACKETS*EDL_CHANNEL_NUM);
+    unsigned long long delivered = 0;
+
+    if (connectSimulator(timeScale) != EdlSuccess) {return false;}
+    if (acquisitionStart(ACQUISITION_RING_PACKETS) != EdlSuccess) {return false;}
+    if (save) {
+        FILE * f = fopen(benchPath, "wb");
+        unsigned int compression = save == 2 ? E1_COMPRESSION_DELTA_PACK : E1_COMPRESSION_NONE;
+        if (f == NULL || recorderStart(f, 0, true, compression) != EdlSuccess) {return false;}
+    }
+
+    simGetStats(simBefore);
+    statsReset();
+    std::clock_t cpuStart = std::clock();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point end = start+std::chrono::microseconds((long long)(seconds*1e6));
+
+    while (std::chrono::steady_clock::now() < end && acquisitionRunning()) {
+        unsigned int got = 0;
+        acquisitionWait(BENCH_READ_PACKETS/4, 10);
+        acquisitionReadInto(buffer.data(), BENCH_READ_PACKETS, got);
+        delivered += got;
+    }
+
+    double elapsed = std::chrono::duration <double> (std::chrono::steady_clock::now()-start).count();
+    double cpu = (double)(std::clock()-cpuStart)/CLOCKS_PER_SEC;
+    simGetStats(simAfter);
+    Stats_t stats;
+    statsGet(stats);
+
+    if (save) {
+        recorderGetStats(recorderStats);
+        recorderStop();
+        remove(benchPath);
+    }
+    acquisitionStop();
+    disconnectDevice();
+
+    unsigned long long producedPackets = simAfter.producedPackets-simBefore.producedPackets;
+    double simSeconds = simAfter.generateSeconds-simBefore.generateSeconds;
+    result.offeredPps = producedPackets/elapsed;
+    result.deliveredPps = delivered/elapsed;
+    result.cpuNsPerPacket = delivered > 0 ? (cpu-simSeconds)*1e9/delivered : 0.0;
+    result.simNsPerPacket = delivered > 0 ? simSeconds*1e9/delivered : 0.0;
+    result.overflowRate = producedPackets > 0 ? (double)(simAfter.overflowPackets-simBefore.overflowPackets)/producedPackets : 0.0;
+    result.ringDrops = acquisitionDroppedPackets();
+    result.recorderDrops = save ? recorderStats.droppedPackets : 0;
+    result.writeMBps = save ? recorderStats.writeMBps : 0.0;
+    result.readLatencyUs = stats.readLatencyNs.samples > 0 ? stats.readLatencyNs.total*1e-3/stats.readLatencyNs.samples : 0.0;
+    result.batchPackets = stats.batchPackets.samples > 0 ? (double)stats.batchPackets.total/stats.batchPackets.samples : 0.0;
+
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 3.0;
+    std::vector <double> scales;
+
+    for (int argIdx = 2; argIdx < argc; argIdx++) {scales.push_back(atof(argv[argIdx]));}
+    if (scales.empty()) {
+        scales.push_back(1.0);
+        scales.push_back(10.0);
+        scales.push_back(50.0);
+    }
+
+    printf("%-12s %7s %14s %14s %10s %10s %10s %10s %10s %10s %9s %9s\n", "path", "scale", "offered pk/s", "delivered pk/s",
+           "cpu ns/pk", "sim ns/pk", "overflow", "ring drop", "rec drop", "write MB/s", "read us", "batch");
+
+    static const char * paths[] = {"acquisition", "save", "compressed"};
+
+    for (int save = 0; save <= 2; save++) {
+        for (size_t scaleIdx = 0; scaleIdx < scales.size(); scaleIdx++) {
+            BenchResult_t result;
+            if (!runBench(scales[scaleIdx], seconds, save, result)) {
+                printf("%-12s %7.1f failed\n", paths[save], scales[scaleIdx]);
+                return 1;
+            }
+            printf("%-12s %7.1f %14.0f %14.0f %10.2f %10.2f %9.3f%% %10llu %10llu %10.1f %9.1f %9.0f\n", paths[save],
+                   scales[scaleIdx], result.offeredPps, result.deliveredPps, result.cpuNsPerPacket, result.simNsPerPacket,
+                   result.overflowRate*100.0, result.ringDrops, result.recorderDrops, result.writeMBps,
+                   result.readLatencyUs, result.batchPackets);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,463 @@
+/* e1_acquisition.cpp
+Background reader thread: the only place that calls EDL::readData once acquisition is started */
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "e1_acquisition.h"
+#include "e1_stats.h"
+#include "e1_scheduler.h"
+
+static std::mutex edlCallMutex;
+static PacketRing ring;
+static std::thread reader;
+static std::atomic <bool> running(false);
+static std::atomic <int> lastError(EdlSuccess);
+static std::atomic <unsigned long long> droppedPackets(0);
+static std::atomic <double> maxReadPeriod(SCHEDULER_MAX_PERIOD_S);
+
+/*! Packets read from the driver since acquisitionStart, updated under edlCallMutex. */
+static std::atomic <uint64_t> streamPackets(0);
+/*! Packets estimated lost by the device and the driver since acquisitionStart, updated by the reader thread. */
+static std::atomic <uint64_t> missingPackets(0);
+/*! Batch being dispatched to the sinks, written by the reader thread only. */
+static AcquisitionBlock_t block;
+/*! Gaps recorded since acquisitionStart, appended to by the reader thread. */
+static std::mutex gapsMutex;
+static std::vector <AcquisitionGap_t> gaps;
+/*! Driver flags consumed by acquisitionStreamPosition, reported by the reader thread at its next poll. */
+static std::atomic <bool> pendingOverflow(false);
+static std::atomic <bool> pendingLostData(false);
+
+/*! Registered sinks and filter. The reader holds sinkMutex while dispatching, so removal waits for an in-flight batch. */
+static std::mutex sinkMutex;
+static std::vector <std::pair <PacketSink_t, void *> > rawSinks;
+static std::vector <std::pair <PacketSink_t, void *> > sinks;
+static std::pair <PacketFilter_t, void *> filter((PacketFilter_t)NULL, (void *)NULL);
+
+/*! Consumers blocked in acquisitionWait. The reader only touches waitMutex when someone is waiting. */
+static std::mutex waitMutex;
+static std::condition_variable waitCondition;
+static std::atomic <unsigned int> waiters(0);
+
+std::mutex & edlMutex()
+{
+    return edlCallMutex;
+}
+
+static void wakeWaiters()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load() > 0) {
+        std::lock_guard <std::mutex> lock(waitMutex);
+        waitCondition.notify_all();
+    }
+}
+
+static void recordGap(uint64_t streamPacket, uint64_t missing, uint64_t nowNs, unsigned int cause)
+{
+    AcquisitionGap_t gap;
+
+    gap.streamPacket = streamPacket;
+    gap.deviceSample = streamPacket+missingPackets.load(std::memory_order_relaxed);
+    gap.missingPackets = missing;
+    gap.hostTimeNs = nowNs;
+    gap.cause = cause;
+    gap.reserved = 0;
+
+    std::lock_guard <std::mutex> lock(gapsMutex);
+	/*! A ring nobody reads drops every batch: consecutive drops make one gap, so the list does not grow with time. */
+    if (cause == ACQUISITION_GAP_RING_FULL && !gaps.empty() && gaps.back().cause == ACQUISITION_GAP_RING_FULL &&
+        gaps.back().streamPacket+gaps.back().missingPackets == streamPacket) {
+        gaps.back().missingPackets += missing;
+        return;
+    }
+    gaps.push_back(gap);
+}
+
+/*! Records a failing driver call of the reader thread.
+ * \return false if the thread must stop: the device is gone, or the calls keep failing. */
+static bool driverError(EdlErrorCode_t res, unsigned int &consecutive)
+{
+    statsCount(StatsDriverErrors);
+    lastError.store(res);
+    return res != EdlDeviceNotConnectedError && ++consecutive < ACQUISITION_MAX_DRIVER_ERRORS;
+}
+
+static void readerLoop()
+{
+    EdlErrorCode_t res = EdlSuccess;
+    EdlDeviceStatus_t status;
+    unsigned int readPacketsNum;
+    ReadScheduler scheduler;
+    unsigned int rateId = commandRadioId(EdlCommandSamplingRate);
+    double period = maxReadPeriod.load();
+
+	/*! Loss estimate: the packets that arrived between two status polls (read, plus the change of the driver backlog)
+	 * fall short of the device rate times the time between the polls by the packets lost. The flags tell when to look. */
+    uint64_t pollNs = statsNowNs();
+    uint64_t pollArrived = 0;
+    unsigned int pollRateId = rateId;
+    unsigned int gapCause = 0;
+    uint64_t gapPackets = 0;
+    unsigned int driverErrors = 0;
+
+	/*! The vector is reused across reads, so after the first few reads EDL::readData no longer reallocates it. */
+    std::vector <float> data;
+    data.reserve(ACQUISITION_RING_PACKETS/8*EDL_CHANNEL_NUM);
+    scheduler.reset(samplingRateHz(rateId), period);
+
+    while (running.load(std::memory_order_relaxed)) {
+        if (commandRadioId(EdlCommandSamplingRate) != rateId) {
+            rateId = commandRadioId(EdlCommandSamplingRate);
+            scheduler.setRate(samplingRateHz(rateId));
+        }
+        if (maxReadPeriod.load(std::memory_order_relaxed) != period) {
+            period = maxReadPeriod.load();
+            scheduler.reset(samplingRateHz(rateId), period);
+        }
+
+        {
+            std::unique_lock <std::mutex> lock(edlCallMutex);
+            res = getDeviceStatus(status);
+            if (res != EdlSuccess) {
+                lock.unlock();
+                if (!driverError(res, driverErrors)) {break;}
+                schedulerSleepUntil(statsNowNs()+(uint64_t)(period*1e9));
+                continue;
+            }
+
+			/*! The flags are reset by getDeviceStatus: report them whether or not this poll reads. */
+            if (pendingOverflow.exchange(false)) {status.bufferOverflowFlag = true;}
+            if (pendingLostData.exchange(false)) {status.lostDataFlag = true;}
+			/*! Reported through the stats and the gap list: console output here would hold up every driver call. */
+            if (status.bufferOverflowFlag) {statsCount(StatsBufferOverflowEvents);}
+            if (status.lostDataFlag) {statsCount(StatsLostDataEvents);}
+
+            uint64_t nowNs = statsNowNs();
+            uint64_t arrived = streamPackets.load(std::memory_order_relaxed)+status.availableDataPackets;
+            if (status.bufferOverflowFlag || status.lostDataFlag) {
+                gapCause |= (status.bufferOverflowFlag ? ACQUISITION_GAP_BUFFER_OVERFLOW : 0) | (status.lostDataFlag ? ACQUISITION_GAP_LOST_DATA : 0);
+                /*! Across a rate change the device rate is not known: the gap is recorded, its size is not. */
+                if (pollRateId == rateId) {
+                    double expected = (nowNs-pollNs)*1e-9*samplingRateHz(rateId);
+                    double missing = std::floor(expected-(double)(arrived-pollArrived)+0.5);
+                    if (missing > 0.0) {gapPackets += (uint64_t)missing;}
+                }
+            }
+            pollNs = nowNs;
+            pollArrived = arrived;
+            pollRateId = rateId;
+
+            uint64_t waitNs;
+            if (!scheduler.poll(statsNowNs(), status.availableDataPackets, status.bufferOverflowFlag || status.lostDataFlag, waitNs)) {
+                lock.unlock();
+                /*! Not a full batch yet: the consumers are served from the ring, so only this thread waits. */
+                schedulerSleepUntil(statsNowNs()+waitNs);
+                continue;
+            }
+
+            readPacketsNum = 0;
+            uint64_t readStartNs = statsNowNs();
+            res = readData(status.availableDataPackets, readPacketsNum, data);
+            uint64_t readEndNs = statsNowNs();
+            /*! #EdlNotEnoughAvailableDataError still returns the packets that were available; other errors return none. */
+            if (res == EdlNotEnoughAvailableDataError) {res = EdlSuccess;}
+            if (res != EdlSuccess) {readPacketsNum = 0;}
+            statsRecord(StatsReadLatencyNs, readEndNs-readStartNs);
+            scheduler.read(readEndNs, readPacketsNum);
+
+            block.streamPacket = streamPackets.load(std::memory_order_relaxed);
+            block.hostTimeNs = readEndNs;
+            block.packets = readPacketsNum;
+            block.gapCause = 0;
+            block.missingPackets = 0;
+            if (gapCause != 0 && readPacketsNum > 0) {
+                missingPackets.store(missingPackets.load(std::memory_order_relaxed)+gapPackets, std::memory_order_relaxed);
+                statsCount(StatsMissingPackets, gapPackets);
+                recordGap(block.streamPacket, gapPackets, readEndNs, gapCause);
+                block.gapCause = gapCause;
+                block.missingPackets = gapPackets;
+                gapCause = 0;
+                gapPackets = 0;
+            }
+            block.deviceSample = block.streamPacket+missingPackets.load(std::memory_order_relaxed);
+            streamPackets.store(block.streamPacket+readPacketsNum, std::memory_order_relaxed);
+        }
+
+        statsCount(StatsReadCalls);
+        statsCount(StatsPacketsRead, readPacketsNum);
+        statsRecord(StatsBatchPackets, readPacketsNum);
+
+        if (res != EdlSuccess) {
+            if (!driverError(res, driverErrors)) {break;}
+            continue;
+        }
+        driverErrors = 0;
+
+        if (readPacketsNum > 0) {
+            std::lock_guard <std::mutex> lock(sinkMutex);
+            for (size_t sinkIdx = 0; sinkIdx < rawSinks.size(); sinkIdx++) {
+                rawSinks[sinkIdx].first(data.data(), readPacketsNum, rawSinks[sinkIdx].second);
+            }
+            if (filter.first != NULL) {
+                filter.first(data.data(), readPacketsNum, filter.second);
+            }
+            for (size_t sinkIdx = 0; sinkIdx < sinks.size(); sinkIdx++) {
+                sinks[sinkIdx].first(data.data(), readPacketsNum, sinks[sinkIdx].second);
+            }
+        }
+
+        unsigned int written = ring.write(data.data(), readPacketsNum);
+        if (written < readPacketsNum) {
+            /*! Never block the driver on a slow consumer: drop the newest packets instead. */
+            droppedPackets.fetch_add(readPacketsNum-written, std::memory_order_relaxed);
+            statsCount(StatsRingDroppedPackets, readPacketsNum-written);
+            recordGap(block.streamPacket+written, readPacketsNum-written, block.hostTimeNs, ACQUISITION_GAP_RING_FULL);
+        }
+        statsRecord(StatsRingOccupancyPackets, ring.readable());
+        wakeWaiters();
+    }
+
+    running.store(false);
+    wakeWaiters();
+}
+
+EdlErrorCode_t acquisitionStart(unsigned int ringPackets)
+{
+    EdlErrorCode_t res;
+
+    if (running.load()) {return EdlSuccess;}
+    if (reader.joinable()) {reader.join();}
+
+    if (ring.capacity() < ringPackets) {
+        ring.allocate(ringPackets);
+    } else {
+        ring.reset();
+    }
+    droppedPackets.store(0);
+    lastError.store(EdlSuccess);
+
+	/*! Get rid of data acquired during the device configuration */
+    {
+        std::lock_guard <std::mutex> lock(edlCallMutex);
+        res = purgeData();
+    }
+    if (res != EdlSuccess) {return res;}
+
+    streamPackets.store(0);
+    missingPackets.store(0);
+    {
+        std::lock_guard <std::mutex> lock(gapsMutex);
+        gaps.clear();
+    }
+    running.store(true);
+    reader = std::thread(readerLoop);
+
+    return EdlSuccess;
+}
+
+void acquisitionStop()
+{
+    running.store(false);
+    if (reader.joinable()) {reader.join();}
+}
+
+bool acquisitionRunning()
+{
+    return running.load();
+}
+
+EdlErrorCode_t acquisitionLastError()
+{
+    return (EdlErrorCode_t)lastError.load();
+}
+
+PacketRing & acquisitionRing()
+{
+    return ring;
+}
+
+unsigned int acquisitionWait(unsigned int minPackets, unsigned int timeoutMs)
+{
+    unsigned int available = ring.readable();
+    if (available >= minPackets || timeoutMs == 0) {return available;}
+
+    std::unique_lock <std::mutex> lock(waitMutex);
+    waiters.fetch_add(1);
+    waitCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [minPackets] {
+        return ring.readable() >= minPackets || !running.load();
+    });
+    waiters.fetch_sub(1);
+
+    return ring.readable();
+}
+
+void acquisitionAddSink(PacketSink_t sink, void * context, bool raw)
+{
+    std::lock_guard <std::mutex> lock(sinkMutex);
+    (raw ? rawSinks : sinks).push_back(std::make_pair(sink, context));
+}
+
+static void removeSink(std::vector <std::pair <PacketSink_t, void *> > &list, PacketSink_t sink, void * context)
+{
+    for (size_t sinkIdx = 0; sinkIdx < list.size(); sinkIdx++) {
+        if (list[sinkIdx].first == sink && list[sinkIdx].second == context) {
+            list.erase(list.begin()+sinkIdx);
+            break;
+        }
+    }
+}
+
+void acquisitionRemoveSink(PacketSink_t sink, void * context)
+{
+    std::lock_guard <std::mutex> lock(sinkMutex);
+    removeSink(rawSinks, sink, context);
+    removeSink(sinks, sink, context);
+}
+
+void acquisitionSetFilter(PacketFilter_t newFilter, void * context)
+{
+    std::lock_guard <std::mutex> lock(sinkMutex);
+    filter = std::make_pair(newFilter, context);
+}
+
+void acquisitionSetReadPeriod(double seconds)
+{
+    maxReadPeriod.store(std::max(seconds, SCHEDULER_MIN_PERIOD_S));
+}
+
+double acquisitionReadPeriod()
+{
+    return maxReadPeriod.load();
+}
+
+uint64_t acquisitionStreamPackets()
+{
+    return streamPackets.load();
+}
+
+EdlErrorCode_t acquisitionStreamPosition(uint64_t &packet)
+{
+    EdlErrorCode_t res;
+    EdlDeviceStatus_t status;
+
+    std::lock_guard <std::mutex> lock(edlCallMutex);
+    if (!running.load()) {return EdlDeviceNotConnectedError;}
+    res = getDeviceStatus(status);
+    if (res != EdlSuccess) {return res;}
+
+	/*! This call consumed the flags: hand them over to the reader thread. */
+    if (status.bufferOverflowFlag) {pendingOverflow.store(true);}
+    if (status.lostDataFlag) {pendingLostData.store(true);}
+    packet = streamPackets.load()+status.availableDataPackets;
+
+    return EdlSuccess;
+}
+
+unsigned long long acquisitionDroppedPackets()
+{
+    return droppedPackets.load();
+}
+
+const AcquisitionBlock_t & acquisitionBlock()
+{
+    return block;
+}
+
+uint64_t acquisitionDeviceSamples()
+{
+    return streamPackets.load()+missingPackets.load();
+}
+
+unsigned int acquisitionGaps(unsigned int first, AcquisitionGap_t * out, unsigned int maxGaps)
+{
+    unsigned int copied = 0;
+
+    std::lock_guard <std::mutex> lock(gapsMutex);
+    while (first+copied < gaps.size() && copied < maxGaps) {
+        out[copied] = gaps[first+copied];
+        copied++;
+    }
+
+    return copied;
+}
+
+static void deinterleave(const float * src, unsigned int packets, float * dst, size_t stride)
+{
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        float * out = dst+channelIdx*stride;
+        const float * in = src+channelIdx;
+        for (unsigned int packetIdx = 0; packetIdx < packets; packetIdx++) {
+            out[packetIdx] = in[(size_t)packetIdx*EDL_CHANNEL_NUM];
+        }
+    }
+}
+
+/*! Reads the driver on the caller's thread and copies the packets into \a dst, interleaved or deinterleaved.
+ * The staging buffer belongs to the calling thread, so concurrent direct readers never share it. */
+static EdlErrorCode_t readDirect(float * dst, unsigned int maxPackets, bool channels, unsigned int &got)
+{
+    EdlErrorCode_t res;
+    EdlDeviceStatus_t status;
+    static thread_local std::vector <float> staging;
+
+    got = 0;
+    std::lock_guard <std::mutex> lock(edlCallMutex);
+    res = getDeviceStatus(status);
+    if (res != EdlSuccess) {return res;}
+
+    unsigned int toRead = status.availableDataPackets < maxPackets ? status.availableDataPackets : maxPackets;
+    if (toRead == 0) {return EdlSuccess;}
+
+    if (staging.capacity() < (size_t)toRead*EDL_CHANNEL_NUM) {
+        staging.reserve((size_t)toRead*EDL_CHANNEL_NUM);
+    }
+    res = readData(toRead, got, staging);
+    if (res == EdlNotEnoughAvailableDataError) {res = EdlSuccess;}
+    if (got > toRead) {got = toRead;}
+
+    if (channels) {
+        deinterleave(staging.data(), got, dst, maxPackets);
+    } else {
+        memcpy(dst, staging.data(), (size_t)got*EDL_CHANNEL_NUM*sizeof(float));
+    }
+
+    return res;
+}
+
+EdlErrorCode_t acquisitionReadInto(float * dst, unsigned int maxPackets, unsigned int &got)
+{
+    if (running.load() || ring.readable() > 0) {
+        got = ring.read(dst, maxPackets);
+		/*! An empty ring is no error while the reader thread runs: lastError may hold one it recovered from. */
+        return got > 0 || running.load() ? EdlSuccess : acquisitionLastError();
+    }
+
+    return readDirect(dst, maxPackets, false, got);
+}
+
+EdlErrorCode_t acquisitionReadChannelsInto(float * dst, unsigned int maxPackets, unsigned int &got)
+{
+    if (running.load() || ring.readable() > 0) {
+        const float * first;
+        const float * second;
+        unsigned int firstPackets, secondPackets;
+
+        got = ring.peek(first, firstPackets, second, secondPackets);
+        if (got > maxPackets) {got = maxPackets;}
+        if (firstPackets > got) {firstPackets = got;}
+        secondPackets = got-firstPackets;
+
+        deinterleave(first, firstPackets, dst, maxPackets);
+        deinterleave(second, secondPackets, dst+firstPackets, maxPackets);
+        ring.consume(got);
+        return got > 0 || running.load() ? EdlSuccess : acquisitionLastError();
+    }
+
+    return readDirect(dst, maxPackets, true, got);
+}
@@ -0,0 +1,175 @@
+/*! \file e1_acquisition.h
+ * \brief Declares the background acquisition thread that drains the EDL driver into a PacketRing.
+ */
+#ifndef E1_ACQUISITION_H
+#define E1_ACQUISITION_H
+
+#include <mutex>
+
+#include "edl.h"
+#include "e1_config.h"
+#include "e1_ring.h"
+
+/*! \def ACQUISITION_RING_PACKETS
+ * \brief Default ring capacity in data packets: about 2.6 s at 200kHz.
+ */
+#define ACQUISITION_RING_PACKETS (1 << 19)
+
+/*! \def MINIMUM_DATA_PACKETS_TO_READ
+ * \brief Smallest batch the reader thread waits for before calling EDL::readData; see ReadScheduler for the actual batch.
+ */
+#define MINIMUM_DATA_PACKETS_TO_READ 10
+
+/*! \def ACQUISITION_MAX_DRIVER_ERRORS
+ * \brief Consecutive failing driver calls after which the reader thread gives up. It stops at once if the device is gone.
+ */
+#define ACQUISITION_MAX_DRIVER_ERRORS 100
+
+/*! Bits of AcquisitionGap_t::cause. */
+#define ACQUISITION_GAP_BUFFER_OVERFLOW 1 /*!< The driver buffer overflowed: its oldest packets were overwritten. */
+#define ACQUISITION_GAP_LOST_DATA 2 /*!< The device lost packets before they reached the driver. */
+#define ACQUISITION_GAP_RING_FULL 4 /*!< The ring was full: the sinks saw the packets, the ring consumer never will. */
+
+/*! \struct AcquisitionBlock_t
+ * \brief Batch of packets read by one EDL::readData call. See acquisitionBlock.
+ */
+typedef struct {
+    uint64_t streamPacket; /*!< Stream index of the first packet: packets read since acquisitionStart. */
+    uint64_t deviceSample; /*!< Device sample index of the first packet: its stream index plus the packets estimated lost before it. */
+    uint64_t hostTimeNs; /*!< statsNowNs when EDL::readData returned the batch. */
+    unsigned int packets; /*!< Packets in the batch. */
+    unsigned int gapCause; /*!< ACQUISITION_GAP_* bits of the device and driver losses right before the batch, 0 if none. */
+    uint64_t missingPackets; /*!< Packets estimated lost right before the batch. */
+} AcquisitionBlock_t;
+
+/*! \struct AcquisitionGap_t
+ * \brief Hole in the acquired stream. Returned by acquisitionGaps.
+ *
+ * Device and driver losses are only flagged by EDL::getDeviceStatus: their size is estimated from the host clock, as the
+ * packets the device must have produced since the previous status poll minus the packets that arrived, and they are
+ * placed before the first packet read after the flag. Ring losses are exact.
+ */
+typedef struct {
+    uint64_t streamPacket; /*!< Stream index of the first packet after the gap; of the first packet dropped for #ACQUISITION_GAP_RING_FULL. */
+    uint64_t deviceSample; /*!< Device sample index of the same packet. */
+    uint64_t missingPackets; /*!< Packets lost: estimated, and 0 when the sampling rate changed meanwhile, for device and driver losses. */
+    uint64_t hostTimeNs; /*!< statsNowNs when the gap was detected. */
+    unsigned int cause; /*!< ACQUISITION_GAP_* bits. */
+    unsigned int reserved;
+} AcquisitionGap_t;
+
+/*! \brief Function called by the reader thread with every batch of packets it reads, before they reach the ring.
+ * Sinks run on the reader thread, so they must return quickly and never block on I/O.
+ *
+ * \param packets [in] \a packetsNum interleaved data packets of #EDL_CHANNEL_NUM samples each.
+ * \param context [in] Pointer given to acquisitionAddSink.
+ */
+typedef void (*PacketSink_t)(const float * packets, unsigned int packetsNum, void * context);
+
+/*! \brief Function called by the reader thread to modify every batch of packets in place, e.g. to filter them.
+ * Raw sinks see the packets before the filter; the other sinks and the ring see them after.
+ */
+typedef void (*PacketFilter_t)(float * packets, unsigned int packetsNum, void * context);
+
+/*! \brief Mutex serializing every call into the EDL library.
+ * The reader thread holds it only for the duration of a single EDL call.
+ */
+std::mutex & edlMutex();
+
+/*! \brief Purges the driver and starts the reader thread.
+ * Calling this method while the thread is already running does nothing.
+ *
+ * \param ringPackets [in] Capacity of the packet ring.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t acquisitionStart(unsigned int ringPackets);
+
+/*! \brief Stops and joins the reader thread. Packets still in the ring remain readable. */
+void acquisitionStop();
+
+/*! \brief Returns true while the reader thread is running. */
+bool acquisitionRunning();
+
+/*! \brief Returns the error code that stopped the reader thread or, while it runs, the last driver error it recovered from;
+ * #EdlSuccess if there was none. Every failing call is also counted in Stats_t::driverErrors.
+ */
+EdlErrorCode_t acquisitionLastError();
+
+/*! \brief Returns the ring filled by the reader thread.
+ * The caller of this method is the ring's only consumer.
+ */
+PacketRing & acquisitionRing();
+
+/*! \brief Blocks until at least \a minPackets packets are readable, the timeout expires or the reader thread stops.
+ *
+ * \return Number of readable packets.
+ */
+unsigned int acquisitionWait(unsigned int minPackets, unsigned int timeoutMs);
+
+/*! \brief Copies up to \a maxPackets interleaved data packets into \a dst.
+ * While the reader thread runs the packets come straight from its ring; otherwise the driver is read directly
+ * through a staging buffer of the calling thread that is reused across its calls.
+ *
+ * \param dst [out] Caller-owned buffer of at least \a maxPackets * #EDL_CHANNEL_NUM floats.
+ * \param maxPackets [in] Capacity of \a dst in data packets.
+ * \param got [out] Number of data packets copied.
+ * \return #EdlErrorCode_t Error code: #EdlSuccess with \a got 0 while the reader thread runs and the ring is empty,
+ * whatever errors it recovered from; acquisitionLastError if the thread stopped and the ring is drained, before the
+ * next call reads the driver directly.
+ */
+EdlErrorCode_t acquisitionReadInto(float * dst, unsigned int maxPackets, unsigned int &got);
+
+/*! \brief Same as acquisitionReadInto, but deinterleaves the packets:
+ * the samples of channel \a c are written contiguously starting at \a dst + \a c * \a maxPackets.
+ */
+EdlErrorCode_t acquisitionReadChannelsInto(float * dst, unsigned int maxPackets, unsigned int &got);
+
+/*! \brief Registers a sink fed by the reader thread.
+ *
+ * \param raw [in] If true the sink is fed the packets as read from the driver, before the acquisition filter.
+ */
+void acquisitionAddSink(PacketSink_t sink, void * context, bool raw = false);
+
+/*! \brief Unregisters a sink. After this returns the sink is no longer being called. */
+void acquisitionRemoveSink(PacketSink_t sink, void * context);
+
+/*! \brief Installs the filter applied by the reader thread; NULL removes it.
+ * After this returns the previous filter is no longer being called.
+ */
+void acquisitionSetFilter(PacketFilter_t filter, void * context);
+
+/*! \brief Sets the longest interval between two driver reads, i.e. the latency bound of the consumers.
+ * Longer periods mean fewer, larger reads. Default #SCHEDULER_MAX_PERIOD_S.
+ */
+void acquisitionSetReadPeriod(double seconds);
+
+/*! \brief Returns the longest interval between two driver reads set by acquisitionSetReadPeriod. */
+double acquisitionReadPeriod();
+
+/*! \brief Number of packets read from the driver since acquisitionStart: the stream index of the next packet read.
+ * Sinks called with \a packetsNum packets see the stream index of their first packet as acquisitionStreamPackets()-packetsNum.
+ */
+uint64_t acquisitionStreamPackets();
+
+/*! \brief Stream index of the next packet the device will produce: packets read plus packets waiting in the driver.
+ * Called right after a command, it tells from which packet on the command can have taken effect.
+ *
+ * \return #EdlErrorCode_t Error code: #EdlDeviceNotConnectedError if the reader thread is not running.
+ */
+EdlErrorCode_t acquisitionStreamPosition(uint64_t &packet);
+
+/*! \brief Number of packets the reader thread dropped because the ring was full. */
+unsigned long long acquisitionDroppedPackets();
+
+/*! \brief Returns the batch being dispatched. Valid on the reader thread only, from within sinks and filters. */
+const AcquisitionBlock_t & acquisitionBlock();
+
+/*! \brief Device sample index of the next packet read: acquisitionStreamPackets plus the packets estimated lost so far. */
+uint64_t acquisitionDeviceSamples();
+
+/*! \brief Copies up to \a maxGaps gaps recorded since acquisitionStart, from the \a first-th on, in stream order.
+ * \return Number of gaps copied.
+ */
+unsigned int acquisitionGaps(unsigned int first, AcquisitionGap_t * gaps, unsigned int maxGaps);
+
+#endif // E1_ACQUISITION_H
@@ -0,0 +1,306 @@
+/* e1_codec.cpp
+Lossless sample codec: converter codes or ordered float bits, delta coded and packed 4 lanes at a time */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define E1_CODEC_SSE2
+#endif
+
+#include "e1_codec.h"
+
+/*! Widest uncertainty, in codes, on the code of the largest sample that codecGridScale still resolves by trial. */
+#define CODEC_GRID_CODES 16
+
+/*! Bytes before the packed blocks of a section of \a blocks blocks: header, widths, bases, padding to 16. */
+static size_t blocksOffset(uint32_t blocks)
+{
+    size_t offset = sizeof(CodecSectionHeader_t)+((blocks+3) & ~3u)+(size_t)blocks*sizeof(int32_t);
+    return (offset+15) & ~(size_t)15;
+}
+
+float codecAdcScale(unsigned int channel, unsigned int rangeId)
+{
+    const float codes = (float)(1 << (CODEC_ADC_BITS-1));
+
+    if (channel == 0) {return CODEC_VOLTAGE_FULL_SCALE_MV/codes;}
+	/*! Current channels: the range names, 200pA in pA or 20nA in nA, taken as the full scale of the converter. */
+    return (rangeId == EDL_RADIO_RANGE_20_NA ? 20.0f : 200.0f)/codes;
+}
+
+size_t codecBound(unsigned int samples)
+{
+    uint32_t blocks = (samples+E1_CODEC_BLOCK_VALUES-1)/E1_CODEC_BLOCK_VALUES;
+    return blocksOffset(blocks)+(size_t)blocks*E1_CODEC_BLOCK_VALUES*sizeof(uint32_t);
+}
+
+/*! Integer whose order is the order of the float with bit pattern \a bits; its own inverse. */
+static inline int32_t orderedBits(uint32_t bits)
+{
+    int32_t i = (int32_t)bits;
+    return i < 0 ? i ^ 0x7FFFFFFF : i;
+}
+
+/*! Code of \a value if it is exactly code * scale, as decoded. */
+static inline bool adcCode(float value, float scale, int32_t &code)
+{
+    float q = value/scale;
+    if (!(std::fabs(q) < 16777216.0f)) {return false;}
+    code = (int32_t)std::lrint(q);
+    float decoded = (float)code*scale;
+	/*! Compare the bit patterns: -0.0 must not become +0.0. */
+    return memcmp(&decoded, &value, sizeof(float)) == 0;
+}
+
+/*! True if every value is exactly a code times \a scale. */
+static bool onGrid(const float * values, unsigned int samples, float scale)
+{
+    int32_t code;
+
+    for (unsigned int k = 0; k < samples; k++) {
+        if (!adcCode(values[k], scale, code)) {return false;}
+    }
+    return true;
+}
+
+float codecGridScale(const float * values, unsigned int samples, float nominal)
+{
+    if (samples == 0) {return 0.0f;}
+    if (nominal > 0.0f && onGrid(values, samples, nominal)) {return nominal;}
+
+	/*! Noise moves the signal by a single code often enough: the smallest step between neighbours is one code, up to
+	 * the rounding of the two samples. */
+    float step = 0.0f, largest = 0.0f;
+    for (unsigned int k = 0; k < samples; k++) {
+        if (std::isinf(values[k]) || std::isnan(values[k])) {return 0.0f;}
+        largest = std::max(largest, std::fabs(values[k]));
+        float d = k > 0 ? std::fabs(values[k]-values[k-1]) : 0.0f;
+        if (d > 0.0f && (step == 0.0f || d < step)) {step = d;}
+    }
+    if (!(step > 0.0f)) {return 0.0f;}
+
+	/*! That step only locates the code of the largest sample within a few codes; each of them gives a step exact to
+	 * the rounding of the sample, tried along with its neighbouring floats. */
+    double code = (double)largest/step;
+    double spread = code*largest*std::ldexp(1.0, -23)/step;
+    if (spread > CODEC_GRID_CODES) {return 0.0f;}
+    double lowest = std::max(1.0, std::floor(code-spread-1.0));
+    for (double c = lowest; c <= std::ceil(code+spread+1.0); c += 1.0) {
+        float candidate = std::nextafter((float)(largest/c), 0.0f);
+        for (unsigned int tries = 0; tries < 3; tries++) {
+            if (candidate > 0.0f && onGrid(values, samples, candidate)) {return candidate;}
+            candidate = std::nextafter(candidate, std::numeric_limits <float>::infinity());
+        }
+    }
+    return 0.0f;
+}
+
+static inline uint32_t zigzag(uint32_t delta)
+{
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t z)
+{
+    return (z >> 1) ^ (0u-(z & 1));
+}
+
+/*! Packs the 128 values at \a in, \a width bits each, into 4 * \a width words: vector j is values 4j..4j+3. */
+static void pack(const uint32_t * in, unsigned int width, uint32_t * out)
+{
+#ifdef E1_CODEC_SSE2
+    __m128i acc = _mm_setzero_si128();
+    unsigned int shift = 0;
+    for (unsigned int j = 0; j < E1_CODEC_BLOCK_VALUES/4; j++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in+4*j));
+        acc = _mm_or_si128(acc, _mm_sll_epi32(v, _mm_cvtsi32_si128(shift)));
+        shift += width;
+        if (shift >= 32) {
+            _mm_store_si128((__m128i *)out, acc);
+            out += 4;
+            shift -= 32;
+            acc = shift > 0 ? _mm_srl_epi32(v, _mm_cvtsi32_si128(width-shift)) : _mm_setzero_si128();
+        }
+    }
+#else
+    for (unsigned int lane = 0; lane < 4; lane++) {
+        uint32_t acc = 0;
+        unsigned int shift = 0;
+        uint32_t * word = out+lane;
+        for (unsigned int j = 0; j < E1_CODEC_BLOCK_VALUES/4; j++) {
+            uint32_t v = in[4*j+lane];
+            acc |= v << shift;
+            shift += width;
+            if (shift >= 32) {
+                *word = acc;
+                word += 4;
+                shift -= 32;
+                acc = shift > 0 ? v >> (width-shift) : 0;
+            }
+        }
+    }
+#endif
+}
+
+/*! Inverse of pack. */
+static void unpack(const uint32_t * in, unsigned int width, uint32_t * out)
+{
+    if (width == 0) {
+        memset(out, 0, E1_CODEC_BLOCK_VALUES*sizeof(uint32_t));
+        return;
+    }
+
+    const uint32_t mask = width == 32 ? 0xFFFFFFFFu : (1u << width)-1;
+#ifdef E1_CODEC_SSE2
+    const __m128i m = _mm_set1_epi32((int)mask);
+    __m128i w = _mm_load_si128((const __m128i *)in);
+    unsigned int shift = 0;
+    for (unsigned int j = 0; j < E1_CODEC_BLOCK_VALUES/4; j++) {
+        __m128i v = _mm_srl_epi32(w, _mm_cvtsi32_si128(shift));
+        shift += width;
+        if (shift >= 32) {
+            shift -= 32;
+            in += 4;
+			/*! The last value ends exactly on a word: never load past the block. */
+            if (j+1 < E1_CODEC_BLOCK_VALUES/4) {w = _mm_load_si128((const __m128i *)in);}
+            if (shift > 0) {v = _mm_or_si128(v, _mm_sll_epi32(w, _mm_cvtsi32_si128(width-shift)));}
+        }
+        _mm_storeu_si128((__m128i *)(out+4*j), _mm_and_si128(v, m));
+    }
+#else
+    for (unsigned int lane = 0; lane < 4; lane++) {
+        const uint32_t * word = in+lane;
+        unsigned int shift = 0;
+        for (unsigned int j = 0; j < E1_CODEC_BLOCK_VALUES/4; j++) {
+            uint32_t v = *word >> shift;
+            shift += width;
+            if (shift >= 32) {
+                shift -= 32;
+                word += 4;
+                if (shift > 0) {v |= *word << (width-shift);}
+            }
+            out[4*j+lane] = v & mask;
+        }
+    }
+#endif
+}
+
+size_t codecEncode(const float * values, unsigned int samples, float scale, char * out)
+{
+    CodecSectionHeader_t * header = (CodecSectionHeader_t *)out;
+    uint32_t blocks = (samples+E1_CODEC_BLOCK_VALUES-1)/E1_CODEC_BLOCK_VALUES;
+    uint8_t * widths = (uint8_t *)(header+1);
+    int32_t * bases = (int32_t *)(widths+((blocks+3) & ~3u));
+    uint32_t * packed = (uint32_t *)(out+blocksOffset(blocks));
+    int32_t code;
+
+	/*! Codes only if every sample of the channel is one: a single exception would cost the whole section its meaning. */
+    bool codes = scale > 0.0f;
+    for (unsigned int k = 0; codes && k < samples; k++) {
+        codes = adcCode(values[k], scale, code);
+    }
+
+    header->encoding = codes ? E1_CODEC_ADC_CODES : E1_CODEC_FLOAT_BITS;
+    header->scale = codes ? scale : 0.0f;
+    header->blocks = blocks;
+    memset(widths, 0, (char *)bases-(char *)widths);
+    memset(bases+blocks, 0, out+blocksOffset(blocks)-(char *)(bases+blocks));
+
+    for (uint32_t blockIdx = 0; blockIdx < blocks; blockIdx++) {
+        const float * x = values+(size_t)blockIdx*E1_CODEC_BLOCK_VALUES;
+        unsigned int n = std::min((unsigned int)E1_CODEC_BLOCK_VALUES, samples-blockIdx*E1_CODEC_BLOCK_VALUES);
+        int32_t integers[E1_CODEC_BLOCK_VALUES];
+        uint32_t deltas[E1_CODEC_BLOCK_VALUES];
+
+        for (unsigned int k = 0; k < n; k++) {
+            if (codes) {
+                adcCode(x[k], scale, integers[k]);
+            } else {
+                uint32_t bits;
+                memcpy(&bits, x+k, sizeof(bits));
+                integers[k] = orderedBits(bits);
+            }
+        }
+
+		/*! Differences wrap around in 32 bits, so any two integers have one. */
+        uint32_t any = 0;
+        deltas[0] = 0;
+        for (unsigned int k = 1; k < n; k++) {
+            deltas[k] = zigzag((uint32_t)integers[k]-(uint32_t)integers[k-1]);
+            any |= deltas[k];
+        }
+        for (unsigned int k = n; k < E1_CODEC_BLOCK_VALUES; k++) {deltas[k] = 0;}
+
+        unsigned int width = 0;
+        while (width < 32 && (any >> width) != 0) {width++;}
+        widths[blockIdx] = (uint8_t)width;
+        bases[blockIdx] = integers[0];
+        if (width > 0) {pack(deltas, width, packed);}
+        packed += 4*width;
+    }
+
+    header->bytes = (uint32_t)((char *)packed-out);
+    return header->bytes;
+}
+
+bool codecValid(const char * section, size_t available, unsigned int samples)
+{
+    CodecSectionHeader_t header;
+
+    if (available < sizeof(header)) {return false;}
+    memcpy(&header, section, sizeof(header));
+    if (header.blocks != (samples+E1_CODEC_BLOCK_VALUES-1)/E1_CODEC_BLOCK_VALUES || header.bytes > available) {return false;}
+    if (header.encoding != E1_CODEC_FLOAT_BITS && (header.encoding != E1_CODEC_ADC_CODES || !(header.scale > 0.0f))) {return false;}
+    if (blocksOffset(header.blocks) > header.bytes) {return false;}
+
+    const uint8_t * widths = (const uint8_t *)section+sizeof(header);
+    size_t bytes = blocksOffset(header.blocks);
+    for (uint32_t blockIdx = 0; blockIdx < header.blocks; blockIdx++) {
+        if (widths[blockIdx] > 32) {return false;}
+        bytes += 16*(size_t)widths[blockIdx];
+    }
+    return bytes == header.bytes;
+}
+
+void codecDecode(const char * section, unsigned int first, unsigned int count, float * dst, unsigned int stride)
+{
+    const CodecSectionHeader_t * header = (const CodecSectionHeader_t *)section;
+    const uint8_t * widths = (const uint8_t *)(header+1);
+    const int32_t * bases = (const int32_t *)(widths+((header->blocks+3) & ~3u));
+    const uint32_t * packed = (const uint32_t *)(section+blocksOffset(header->blocks));
+    const bool codes = header->encoding == E1_CODEC_ADC_CODES;
+    const float scale = header->scale;
+
+    if (count == 0) {return;}
+    uint32_t blockIdx = first/E1_CODEC_BLOCK_VALUES;
+    for (uint32_t skipped = 0; skipped < blockIdx; skipped++) {packed += 4*widths[skipped];}
+
+    while (count > 0) {
+        uint32_t deltas[E1_CODEC_BLOCK_VALUES];
+        unsigned int from = first-blockIdx*E1_CODEC_BLOCK_VALUES;
+        unsigned int n = std::min(count, E1_CODEC_BLOCK_VALUES-from);
+        unpack(packed, widths[blockIdx], deltas);
+
+        uint32_t integer = (uint32_t)bases[blockIdx];
+        for (unsigned int k = 1; k <= from; k++) {integer += unzigzag(deltas[k]);}
+        for (unsigned int k = 0; k < n; k++) {
+            if (k > 0) {integer += unzigzag(deltas[from+k]);}
+            if (codes) {
+                *dst = (float)(int32_t)integer*scale;
+            } else {
+                uint32_t bits = (uint32_t)orderedBits(integer);
+                memcpy(dst, &bits, sizeof(bits));
+            }
+            dst += stride;
+        }
+
+        packed += 4*widths[blockIdx];
+        first += n;
+        count -= n;
+        blockIdx++;
+    }
+}
@@ -0,0 +1,61 @@
+/*! \file e1_codec.h
+ * \brief Declares the lossless sample codec of compressed recordings: integer samples, delta coding and bit packing
+ * in blocks of #E1_CODEC_BLOCK_VALUES samples (layout in e1_format.h).
+ *
+ * The samples of a channel are turned back into the codes of the converter when they are exact multiples of one
+ * step, as the device delivers them (see codecGridScale); any other channel is coded from the bit patterns of its floats.
+ * Either way decoding returns the very same floats.
+ */
+#ifndef E1_CODEC_H
+#define E1_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "edl.h"
+#include "e1_format.h"
+
+/*! \def CODEC_ADC_BITS
+ * \brief Resolution of the converters: the full scale of a range spans 2^CODEC_ADC_BITS codes.
+ */
+#define CODEC_ADC_BITS 16
+
+/*! \def CODEC_VOLTAGE_FULL_SCALE_MV
+ * \brief Full scale of the voltage channel, in mV.
+ */
+#define CODEC_VOLTAGE_FULL_SCALE_MV 512.0f
+
+/*! \brief Nominal value of one code of channel \a channel in range \a rangeId (EdlCommandRange radio id), in the unit of the channel.
+ * The device specifications give neither the converter full scales nor the LSB: these assume the range names are the
+ * full scales. They are only a first guess, checked against the samples by codecGridScale.
+ */
+float codecAdcScale(unsigned int channel, unsigned int rangeId);
+
+/*! \brief Returns the step of the grid the \a samples \a values lie on, such that each of them is exactly a code
+ * times it: \a nominal if it fits, otherwise the step derived from the smallest difference between neighbours.
+ * \return The step, or 0 if the values lie on neither (filtered or converted data): codecEncode then codes the float bits.
+ */
+float codecGridScale(const float * values, unsigned int samples, float nominal);
+
+/*! \brief Largest section codecEncode can produce for \a samples samples. */
+size_t codecBound(unsigned int samples);
+
+/*! \brief Encodes the \a samples \a values of one channel into a section at \a out, which must be 16 byte aligned and
+ * hold codecBound(\a samples) bytes.
+ *
+ * \param scale [in] Value of one code (see codecAdcScale), tried first. 0 codes the float bit patterns directly.
+ * \return Bytes written, CodecSectionHeader_t::bytes.
+ */
+size_t codecEncode(const float * values, unsigned int samples, float scale, char * out);
+
+/*! \brief Checks that the section at \a section, with \a available bytes left in the chunk, is well formed and holds
+ * \a samples samples. Cheap: reads the block widths only.
+ */
+bool codecValid(const char * section, size_t available, unsigned int samples);
+
+/*! \brief Decodes samples [\a first, \a first + \a count) of a section checked with codecValid into \a dst,
+ * one every \a stride floats. Only the blocks that hold them are unpacked.
+ */
+void codecDecode(const char * section, unsigned int first, unsigned int count, float * dst, unsigned int stride);
+
+#endif // E1_CODEC_H
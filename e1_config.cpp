@@ -0,0 +1,260 @@
+/* e1_config.cpp
+Shadow device configuration: every command goes through sendCommand, which knows what the device already has */
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "e1_config.h"
+#include "e1_acquisition.h"
+#include "e1_stats.h"
+
+/*! Setting kinds, from the comments of EdlCommandId_t. */
+typedef enum {
+    CommandRadio,
+    CommandCheckbox,
+    CommandPushButton,
+    CommandValue
+} CommandType_t;
+
+/*! Shadow state, guarded by the EDL mutex.
+ * applied holds what the device has; stacked holds what the library has stacked for the next send. */
+static EdlCommandStruct_t applied[EdlCommandIdNum];
+static bool appliedValid[EdlCommandIdNum] = {false};
+static EdlCommandStruct_t stacked[EdlCommandIdNum];
+static bool stackedValid[EdlCommandIdNum] = {false};
+static unsigned int stackedNum = 0;
+static int lastStackedId = -1; /*!< Last radio or checkbox command stacked: re-sent with sendFlag set to flush the stack on commit. */
+
+/*! Held by the thread inside a transaction from configBegin to configCommit: transactions of several threads run one after the other. */
+static std::mutex transactionMutex;
+static bool transaction = false;
+static std::thread::id transactionOwner; /*!< Thread whose commands are stacked, valid while transaction is set. */
+static bool applyRequested = false;
+static EdlCommandStruct_t applyStruct;
+
+static std::atomic <unsigned long long> skippedCommands(0);
+
+/*! Copy of the applied radio ids of EdlCommandRange, EdlCommandSamplingRate and EdlCommandFinalBandwidth for lock free readers. */
+static std::atomic <unsigned int> radioIds[EdlCommandFinalBandwidth+1] = {
+    {UNKNOWN_RADIO_ID}, {UNKNOWN_RADIO_ID}, {UNKNOWN_RADIO_ID}
+};
+
+/*! EDL::setCommand, timed. */
+static EdlErrorCode_t timedSetCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct, bool sendFlag)
+{
+    uint64_t startNs = statsNowNs();
+    EdlErrorCode_t res = setCommand(commandId, commandStruct, sendFlag);
+
+    statsRecord(StatsCommandRttNs, statsNowNs()-startNs);
+    statsCount(StatsCommandsSent);
+    if (res != EdlSuccess) {statsCount(StatsCommandErrors);}
+
+    return res;
+}
+
+static CommandType_t commandType(EdlCommandId_t commandId)
+{
+    if (commandId <= EdlCommandFinalBandwidth) {return CommandRadio;}
+    if (commandId <= EdlCommandReset) {return CommandCheckbox;}
+    if (commandId == EdlCommandApplyProtocol) {return CommandPushButton;}
+    return CommandValue;
+}
+
+/*! True if sending \a next when \a current is in place would change nothing on the device. */
+static bool redundant(EdlCommandId_t commandId, const EdlCommandStruct_t &current, const EdlCommandStruct_t &next)
+{
+    switch (commandType(commandId)) {
+    case CommandRadio:
+        return current.radioId == next.radioId;
+
+    case CommandCheckbox:
+		/*! EdlCommandReset acts on every send, so only the compensation checkbox can be redundant. */
+        return commandId == EdlCommandDigitalCompensation && current.checkboxChecked == next.checkboxChecked;
+
+    default:
+        return false;
+    }
+}
+
+/*! The stack was sent: the device now has the stacked settings. */
+static void applyStacked()
+{
+    for (unsigned int commandIdx = 0; commandIdx < EdlCommandIdNum; commandIdx++) {
+        if (!stackedValid[commandIdx]) {continue;}
+        applied[commandIdx] = stacked[commandIdx];
+        appliedValid[commandIdx] = true;
+        stackedValid[commandIdx] = false;
+        if (commandIdx <= EdlCommandFinalBandwidth) {radioIds[commandIdx].store(applied[commandIdx].radioId);}
+    }
+    stackedNum = 0;
+    lastStackedId = -1;
+}
+
+/*! The send failed: whatever was stacked may or may not have reached the device. */
+static void forgetStacked()
+{
+    for (unsigned int commandIdx = 0; commandIdx < EdlCommandIdNum; commandIdx++) {
+        if (!stackedValid[commandIdx]) {continue;}
+        appliedValid[commandIdx] = false;
+        stackedValid[commandIdx] = false;
+        if (commandIdx <= EdlCommandFinalBandwidth) {radioIds[commandIdx].store(UNKNOWN_RADIO_ID);}
+    }
+    stackedNum = 0;
+    lastStackedId = -1;
+}
+
+static void invalidate()
+{
+    for (unsigned int commandIdx = 0; commandIdx < EdlCommandIdNum; commandIdx++) {
+        appliedValid[commandIdx] = false;
+        stackedValid[commandIdx] = false;
+    }
+    for (unsigned int commandIdx = 0; commandIdx <= EdlCommandFinalBandwidth; commandIdx++) {
+        radioIds[commandIdx].store(UNKNOWN_RADIO_ID);
+    }
+    stackedNum = 0;
+    lastStackedId = -1;
+}
+
+EdlErrorCode_t sendCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct, bool sendFlag)
+{
+    EdlErrorCode_t res;
+
+    std::lock_guard <std::mutex> lock(edlMutex());
+    if (commandId >= EdlCommandIdNum) {return timedSetCommand(commandId, commandStruct, sendFlag);}
+
+    CommandType_t type = commandType(commandId);
+    if (transaction && std::this_thread::get_id() == transactionOwner) {
+        if (type == CommandPushButton) {
+            /*! Push buttons can't be stacked: apply the protocol when the transaction is committed. */
+            applyStruct = commandStruct;
+            applyRequested = true;
+            return EdlSuccess;
+        }
+        sendFlag = false;
+    }
+
+    const EdlCommandStruct_t * current = stackedValid[commandId] ? &stacked[commandId] :
+                                         appliedValid[commandId] ? &applied[commandId] : NULL;
+    if (current != NULL && redundant(commandId, *current, commandStruct) && !(sendFlag && stackedNum > 0)) {
+        skippedCommands.fetch_add(1);
+        return EdlSuccess;
+    }
+
+    res = timedSetCommand(commandId, commandStruct, sendFlag);
+    if (res != EdlSuccess) {
+        if (sendFlag) {forgetStacked();}
+        return res;
+    }
+
+    if (type != CommandPushButton) {
+        if (!stackedValid[commandId]) {stackedNum++;}
+        stacked[commandId] = commandStruct;
+        stackedValid[commandId] = true;
+        if (type != CommandValue) {lastStackedId = commandId;}
+    }
+
+    if (sendFlag) {
+        applyStacked();
+        if (commandId == EdlCommandReset && commandStruct.checkboxChecked == EDL_CHECKBOX_CHECKED) {
+			/*! The device went back to its defaults, which are not known here. */
+            invalidate();
+        }
+    }
+
+    return res;
+}
+
+void configBegin()
+{
+    {
+        std::lock_guard <std::mutex> lock(edlMutex());
+		/*! Already open on this thread: keep stacking into it. */
+        if (transaction && std::this_thread::get_id() == transactionOwner) {return;}
+    }
+    transactionMutex.lock();
+
+    std::lock_guard <std::mutex> lock(edlMutex());
+    transaction = true;
+    transactionOwner = std::this_thread::get_id();
+    applyRequested = false;
+}
+
+EdlErrorCode_t configCommit()
+{
+    EdlErrorCode_t res = EdlSuccess;
+
+    std::lock_guard <std::mutex> lock(edlMutex());
+    if (!transaction || std::this_thread::get_id() != transactionOwner) {return EdlSuccess;}
+    transaction = false;
+	/*! Let the next transaction begin once the stack is sent. */
+    std::lock_guard <std::mutex> owned(transactionMutex, std::adopt_lock);
+
+    if (applyRequested) {
+        applyRequested = false;
+        res = timedSetCommand(EdlCommandApplyProtocol, applyStruct, true);
+    } else if (lastStackedId >= 0) {
+		/*! Re-sending the last stacked setting flushes the whole stack with it. */
+        res = timedSetCommand((EdlCommandId_t)lastStackedId, stacked[lastStackedId], true);
+    } else {
+        /*! Nothing stacked but protocol parameters: they wait for the next EdlCommandApplyProtocol, as without a transaction. */
+        return EdlSuccess;
+    }
+
+    if (res == EdlSuccess) {
+        applyStacked();
+    } else {
+        forgetStacked();
+    }
+
+    return res;
+}
+
+void configAbort()
+{
+    std::lock_guard <std::mutex> lock(edlMutex());
+    if (!transaction || std::this_thread::get_id() != transactionOwner) {return;}
+    transaction = false;
+    applyRequested = false;
+    transactionMutex.unlock();
+}
+
+bool configInTransaction()
+{
+    std::lock_guard <std::mutex> lock(edlMutex());
+    return transaction && std::this_thread::get_id() == transactionOwner;
+}
+
+bool configShadow(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct)
+{
+    std::lock_guard <std::mutex> lock(edlMutex());
+    if (commandId >= EdlCommandIdNum || !appliedValid[commandId]) {return false;}
+    commandStruct = applied[commandId];
+    return true;
+}
+
+void configInvalidate()
+{
+    std::lock_guard <std::mutex> lock(edlMutex());
+    invalidate();
+}
+
+unsigned long long configSkippedCommands()
+{
+    return skippedCommands.load();
+}
+
+unsigned int commandRadioId(EdlCommandId_t commandId)
+{
+    if (commandId > EdlCommandFinalBandwidth) {return UNKNOWN_RADIO_ID;}
+    return radioIds[commandId].load();
+}
+
+double samplingRateHz(unsigned int samplingRateId)
+{
+    static const double rates[] = {1250.0, 5000.0, 10000.0, 20000.0, 50000.0, 100000.0, 200000.0};
+
+    if (samplingRateId > EDL_RADIO_SAMPLING_RATE_200_KHZ) {return 0.0;}
+    return rates[samplingRateId];
+}
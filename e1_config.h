@@ -0,0 +1,91 @@
+/*! \file e1_config.h
+ * \brief Declares the single path through which commands reach the device: a shadow copy of the device
+ * configuration that skips redundant commands, and configuration transactions that apply several commands in one send.
+ */
+#ifndef E1_CONFIG_H
+#define E1_CONFIG_H
+
+#include "edl.h"
+
+/*! \def UNKNOWN_RADIO_ID
+ * \brief Returned by commandRadioId for radio commands that have not been sent yet.
+ */
+#define UNKNOWN_RADIO_ID 0xFFFFFFFF
+
+/*! \brief EDL::setCommand serialized against the reader thread, through the shadow configuration.
+ * A radio command, or EdlCommandDigitalCompensation, whose setting equals the one already on the device (or already
+ * stacked) is skipped and returns #EdlSuccess, unless \a sendFlag must flush other stacked commands.
+ * Value commands are always stacked, since protocols need all their parameters before EdlCommandApplyProtocol.
+ * Inside a transaction of the calling thread \a sendFlag is ignored and push buttons are deferred to configCommit.
+ *
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t sendCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct, bool sendFlag);
+
+/*! \brief Starts a transaction owned by the calling thread: its following commands are only stacked until configCommit.
+ * Waits for a transaction of another thread to be committed first; continues the one already open on the calling thread. Commands of other threads are not part of it; those
+ * sent with \a sendFlag set meanwhile (e.g. by the offset compensation) flush the stack early.
+ */
+void configBegin();
+
+/*! \brief Ends the transaction of the calling thread and applies every stacked command with a single send.
+ * Does nothing on a thread that did not begin one.
+ *
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t configCommit();
+
+/*! \brief Ends the transaction of the calling thread without sending anything: a deferred push button is dropped.
+ * Settings already stacked stay stacked, as outside a transaction, and reach the device with the next send.
+ */
+void configAbort();
+
+/*! \brief Returns true while the calling thread has a transaction open. */
+bool configInTransaction();
+
+/*! \class ConfigTransaction
+ * \brief Transaction of the calling thread scoped to a block: begun on construction and aborted on destruction unless
+ * committed, so that no return path keeps the other threads waiting in configBegin. Nested ones share the transaction
+ * of the outermost, which the first of them to commit or abort ends.
+ */
+class ConfigTransaction
+{
+public:
+    ConfigTransaction() : open(true) {configBegin();}
+    ~ConfigTransaction() {if (open) {configAbort();}}
+
+    /*! \brief Sends the stacked commands, see configCommit. */
+    EdlErrorCode_t commit()
+    {
+        open = false;
+        return configCommit();
+    }
+
+private:
+    ConfigTransaction(const ConfigTransaction &);
+    ConfigTransaction & operator=(const ConfigTransaction &);
+
+    bool open;
+};
+
+/*! \brief Copies the setting last applied to the device for \a commandId.
+ *
+ * \return false if the setting is unknown: never sent since the last configInvalidate.
+ */
+bool configShadow(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct);
+
+/*! \brief Forgets the shadow configuration, e.g. after connecting a device whose state is unknown. */
+void configInvalidate();
+
+/*! \brief Number of redundant commands skipped so far. */
+unsigned long long configSkippedCommands();
+
+/*! \brief Returns the radio id last applied for a radio type command, or #UNKNOWN_RADIO_ID.
+ * Lock free: can be called from the reader thread.
+ */
+unsigned int commandRadioId(EdlCommandId_t commandId);
+
+/*! \brief Converts an EdlCommandSamplingRate radio id into Hz; returns 0 for unknown ids. */
+double samplingRateHz(unsigned int samplingRateId);
+
+#endif // E1_CONFIG_H
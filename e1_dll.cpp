@@ -2,12 +2,31 @@
 Created from caller.cpp to provide function API to be used in python
 EYafuso 2019 */
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include "stdio.h"
+#ifdef _WIN32
 #include "windows.h"
+#else
+#include <unistd.h>
+#define Sleep(ms) usleep((ms)*1000)
+#endif
 #include "edl.h"
-
-#define MINIMUM_DATA_PACKETS_TO_READ 10
+#include "e1_acquisition.h"
+#include "e1_recorder.h"
+#include "e1_reader.h"
+#include "e1_pyramid.h"
+#include "e1_events.h"
+#include "e1_filter.h"
+#include "e1_offset.h"
+#include "e1_stats.h"
+#include "e1_publisher.h"
+#include "e1_protocol.h"
+#include "e1_sealtest.h"
+#include "e1_session.h"
+#include "e1_spectrum.h"
+#include "e1_subscription.h"
 
 extern "C" __declspec(dllexport) int setSampleRate(int nSampleRate)
 {
@@ -16,7 +35,7 @@ extern "C" __declspec(dllexport) int setSampleRate(int nSampleRate)
 
     if (nSampleRate < 1 || nSampleRate > 6) {return -1;}
     commandStruct.radioId = nSampleRate;
-    res = setCommand(EdlCommandSamplingRate, commandStruct, true);
+    res = sendCommand(EdlCommandSamplingRate, commandStruct, true);
     if (res != 0) {return res;}
 
     return 0;
@@ -29,7 +48,7 @@ extern "C" __declspec(dllexport) int setRange(int nRange)
 
     if (nRange < 0 || nRange > 1) {return -1;}
     commandStruct.radioId = nRange;
-    res = setCommand(EdlCommandRange, commandStruct, false);
+    res = sendCommand(EdlCommandRange, commandStruct, false);
     if (res != 0) {return res;}
 
     return 0;
@@ -43,207 +62,893 @@ extern "C" __declspec(dllexport) int setBandwidth(int nBandwidth)
     if (nBandwidth < 0 || nBandwidth > 3) {return -1;}
 
     commandStruct.radioId = nBandwidth;
-    res = setCommand(EdlCommandFinalBandwidth, commandStruct, true);
+    res = sendCommand(EdlCommandFinalBandwidth, commandStruct, true);
     if (res != 0) {return res;}
 
     return 0;
 }
 
 
-extern "C" __declspec(dllexport) int compensateDigitalOffset()
+extern "C" __declspec(dllexport) int beginConfig()
 {
-    EdlCommandStruct_t commandStruct;
-    EdlErrorCode_t res;
+    configBegin();
 
-	/*! Select the constant protocol: protocol 0. */
-    commandStruct.value = 0.0;
-    res = setCommand(EdlCommandMainTrial, commandStruct, false);
-    if (res != 0) {return res;}
+    return 0;
+}
 
-	/*! Set the vHold to 0mV. */
-    commandStruct.value = 0.0;
-    res = setCommand(EdlCommandVhold, commandStruct, false);
-    if (res != 0) {return res;}
+extern "C" __declspec(dllexport) int commitConfig()
+{
+    EdlErrorCode_t res;
 
-	/*! Apply the protocol. */
-    res = setCommand(EdlCommandApplyProtocol, commandStruct, true);
-    if (res != 0) {return res;}
+    res = configCommit();
+    if (res != EdlSuccess) {return res;}
 
-	/*! Start the digital compensation. */
-    commandStruct.checkboxChecked = EDL_CHECKBOX_CHECKED;
-    res = setCommand(EdlCommandDigitalCompensation, commandStruct, true);
-    if (res != 0) {return res;}
+    return 0;
+}
 
-	/*! Wait for some seconds. */
-	Sleep(5000);
+/*! Ends the transaction of beginConfig without sending it, e.g. when the caller gives up halfway. */
+extern "C" __declspec(dllexport) int abortConfig()
+{
+    configAbort();
 
-	/*! Stop the digital compensation. */
-    commandStruct.checkboxChecked = EDL_CHECKBOX_UNCHECKED;
-    res = setCommand(EdlCommandDigitalCompensation, commandStruct, true);
-    if (res != 0) {return res;}
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int getCommandState(int commandId, EdlCommandStruct_t * commandStruct)
+{
+    if (commandId < 0 || commandId >= EdlCommandIdNum || commandStruct == NULL) {return -1;}
+    if (!configShadow((EdlCommandId_t)commandId, *commandStruct)) {return -1;}
 
     return 0;
 }
 
+/*! Same as getCommandState the other way round: sends \a commandStruct, and every stacked command if \a apply.
+ * Can be called from a subscription callback, e.g. to change Vhold as soon as a blockade starts. */
+extern "C" __declspec(dllexport) int setCommandState(int commandId, const EdlCommandStruct_t * commandStruct, int apply)
+{
+    EdlCommandStruct_t command;
+    EdlErrorCode_t res;
 
-void setSealTestProtocol()
+    if (commandId < 0 || commandId >= EdlCommandIdNum || commandStruct == NULL) {return -1;}
+    command = *commandStruct;
+    res = sendCommand((EdlCommandId_t)commandId, command, apply != 0);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int startOffsetCompensation(double tolerance, unsigned int timeoutMs,
+                                                            OffsetCompensationCallback_t callback, void * context)
 {
-    EdlCommandStruct_t commandStruct;
+    EdlErrorCode_t res;
+    OffsetCompensationConfig_t config;
 
-    /*! Select the seal test protocol: protocol 1. */
-    commandStruct.value = 2.0;
-    setCommand(EdlCommandMainTrial, commandStruct, false);
+    offsetCompensationDefaults(config);
+    if (tolerance > 0.0) {config.tolerance = tolerance;}
+    if (timeoutMs > 0) {config.timeoutMs = timeoutMs;}
 
-    /*! Set the vHold to 0mV. */
-    commandStruct.value = 0.0;
-    setCommand(EdlCommandVhold, commandStruct, false);
+    res = offsetCompensationStart(config, callback, context);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
 
-    /*! Set the pulse amplitude to 50mV: 100mV positive to negative delta voltage. */
-    commandStruct.value = 50.0;
-    setCommand(EdlCommandVstep, commandStruct, false);
+extern "C" __declspec(dllexport) int getOffsetCompensationStatus(double * residual)
+{
+    double value;
+    int status = offsetCompensationStatus(value);
 
-    /*! Set the pulse period to 20ms. */
-    commandStruct.value = 20.0;
-    setCommand(EdlCommandTpu, commandStruct, false);
+    if (residual != NULL) {*residual = value;}
 
-    /*! Set the command period to 50ms. */
-    commandStruct.value = 50.0;
-    setCommand(EdlCommandTpe, commandStruct, false);
+    return status;
+}
 
-    /*! Apply the protocol. */
-    setCommand(EdlCommandApplyProtocol, commandStruct, true);
+extern "C" __declspec(dllexport) int waitOffsetCompensation(unsigned int timeoutMs)
+{
+    return offsetCompensationWait(timeoutMs);
 }
 
-EdlErrorCode_t readAndSaveSomeData(FILE * f)
+extern "C" __declspec(dllexport) int cancelOffsetCompensation()
+{
+    offsetCompensationCancel();
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int compensateDigitalOffset()
 {
     EdlErrorCode_t res;
+    OffsetCompensationConfig_t config;
+
+	/*! Blocking variant: returns as soon as the offset has settled, after OFFSET_COMPENSATION_TIMEOUT_MS at most. */
+    offsetCompensationDefaults(config);
+    res = offsetCompensationStart(config, NULL, NULL);
+    if (res != EdlSuccess) {return res;}
+
+    if (offsetCompensationWait(config.timeoutMs+1000) == OFFSET_COMPENSATION_FAILED) {return EdlUnknownError;}
+
+    return 0;
+}
 
-	/*! Declare an #EdlDeviceStatus_t variable to collect the device status. */
-    EdlDeviceStatus_t status;
 
-	/*! Declare a variable to collect the number of read data packets. */
-    unsigned int readPacketsNum;
+void setSealTestProtocol()
+{
+    Protocol_t protocol;
+    SealTestConfig_t config;
+
+    /*! Seal test protocol (trial 2), Vhold 0mV, 50mV pulses (100mV positive to negative delta voltage),
+     * 20ms pulse period and 50ms command period. */
+    static const char * sealTest =
+        "set MainTrial 2\n"
+        "set Vhold 0\n"
+        "set Vstep 50\n"
+        "set Tpu 20\n"
+        "set Tpe 50\n"
+        "apply\n";
+
+    if (protocolCompile(sealTest, protocol, NULL, NULL) != EdlSuccess) {return;}
+    if (protocolStart(protocol, NULL) != EdlSuccess) {return;}
+    if (protocolWait(1000) != PROTOCOL_DONE) {return;}
+
+    /*! Follow the seal from the pulses just applied. */
+    sealTestDefaults(config);
+    sealTestStart(config);
+}
 
-	/*! Declare a vector to collect the read data packets. */
-    std::vector <float> data;
+EdlErrorCode_t readAndSaveSomeData(FILE * f)
+{
+    EdlErrorCode_t res;
 
     Sleep(500);
 
-    std::cout << "purge old data" << std::endl;
-	/*! Get rid of data acquired during the device configuration */
-	res = purgeData();
+	/*! The recorder's writer thread puts the packets on disk in large blocks; the reader thread only copies them into memory. */
+    res = recorderStart(f, 0, false, E1_COMPRESSION_NONE);
+    if (res != EdlSuccess) {
+        std::cout << "failed to start recorder" << std::endl;
+        return res;
+    }
 
-	/*! If the purgeData returns an error code output an error and return. */
+	/*! The reader thread purges old data and drains the driver. */
+    res = acquisitionStart(ACQUISITION_RING_PACKETS);
     if (res != EdlSuccess) {
-        std::cout << "failed to purge data" << std::endl;
+        std::cout << "failed to start acquisition" << std::endl;
+        recorderStop();
         return res;
     }
 
     std::cout << "collecting data... ";
 	unsigned int c;
     for (c = 0; c < 1e3; c++) {
-        res = getDeviceStatus(status);
-        if (res != EdlSuccess) {
-            std::cout << "failed to get device status" << std::endl;
+        if (!acquisitionRunning()) {
+	        /*! If the reader thread stopped (e.g. the device is not connected) output an error, close the file for data storage and return. */
+            res = acquisitionLastError();
+            std::cout << "acquisition stopped with error " << res << std::endl;
+            recorderStop();
+            fclose(f);
             return res;
         }
-
-		if (status.bufferOverflowFlag) {
-			std::cout << std::endl << "lost some data due to buffer overflow; increase MINIMUM_DATA_PACKETS_TO_READ to improve performance" << std::endl;
-		}
-
-		if (status.lostDataFlag) {
-			std::cout << std::endl << "lost some data from the device; decrease sampling frequency or close unused applications to improve performance" << std::endl;
-			std::cout << "data loss may also occur immediately after sending a command to the device" << std::endl;
-		}
-
-        if (status.availableDataPackets >= MINIMUM_DATA_PACKETS_TO_READ) {
-		    /*! If at least MINIMUM_DATA_PACKETS_TO_READ data packet are available read them. */
-			res = readData(status.availableDataPackets, readPacketsNum, data);
-
-	        /*! If the device is not connected output an error, close the file for data storage and return. */
-            if (res == EdlDeviceNotConnectedError) {
-				std::cout << "the device is not connected" << std::endl;
-                fclose(f);
-				return res;
-
-			} else {
-	            /*! If the number of available data packets is lower than the number of required packets output an error, but the read is performed nonetheless
-				 * with the available data. */
-				if (res == EdlNotEnoughAvailableDataError) {
-					std::cout << "not enough available data, only "  << readPacketsNum << " packets have been read" << std::endl;
-				}
-
-	            /*! The output vector consists of \a readPacketsNum data packets of #EDL_CHANNEL_NUM floating point data each.
-				 * The first item in each data packet is the value voltage channel [mV];
-				 * the following items are the values of the current channels either in pA or nA, depending on value assigned to #EdlCommandSamplingRate. */
-                for (unsigned int readPacketsIdx = 0; readPacketsIdx < readPacketsNum; readPacketsIdx++) {
-                    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
-                        fwrite((unsigned char *)&data.at(readPacketsIdx*EDL_CHANNEL_NUM+channelIdx), sizeof(float), 1, f);
-                    }
-                }
-			}
-        } else {
-		    /*! If the read was not performed wait 1 ms before trying to read again. */
-            Sleep(1);
-		}
+        Sleep(1);
     }
+    recorderStop();
+	/*! Release the driver: nobody drains the ring once this returns. */
+    acquisitionStop();
 	std::cout << "done" << std::endl;
 
     return res;
 }
 
-void configureWorkingModality() {
-	/*! Declare an #EdlCommandStruct_t to be used as configuration for the commands. */
-    EdlCommandStruct_t commandStruct;
+extern "C" __declspec(dllexport) int initEDL()
+{
+    EdlErrorCode_t res;
+    SessionConfig_t config;
 
-	/*! Set the sampling rate to 5kHz. Stack the command (do not apply). */
-    commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_5_KHZ;
-    setCommand(EdlCommandSamplingRate, commandStruct, false);
+    std::ios::sync_with_stdio(true);
 
-	/*! Set the current range to 200pA. Stack the command (do not apply). */
-    commandStruct.radioId = EDL_RADIO_RANGE_200_PA;
-    setCommand(EdlCommandRange, commandStruct, false);
+	/*! Connects to the device of the last session if it is still there, and keeps its offset compensation if it still holds. */
+    sessionDefaults(config);
+    res = sessionConnect(config);
+    if (res != EdlSuccess) {return res;}
+
+	/*! Otherwise returns once the compensation has ended, as it always did: reconnectEDL is the call that does not wait. */
+    int status = offsetCompensationWait(config.compensation.timeoutMs+1000);
+    if (status == OFFSET_COMPENSATION_FAILED || status == OFFSET_COMPENSATION_RUNNING) {return EdlUnknownError;}
 
-	/*! Disable current filters (final bandwidth equal to half sampling rate). Apply all of the stacked commands. */
-    commandStruct.radioId = EDL_RADIO_FINAL_BANDWIDTH_SR_2;
-    setCommand(EdlCommandFinalBandwidth, commandStruct, true);
+    return 0;
 }
 
-extern "C" __declspec(dllexport) int initEDL()
+extern "C" __declspec(dllexport) int setSessionStatePath(const char * path)
 {
-    init();
+    sessionSetStatePath(path);
+
+    return 0;
+}
 
+/*! Connects again as initEDL does, but on a background thread and without waiting for the offset compensation:
+ * poll getConnectionStatus or call waitConnection, then waitOffsetCompensation. */
+extern "C" __declspec(dllexport) int reconnectEDL()
+{
     EdlErrorCode_t res;
+    SessionConfig_t config;
 
-    std::vector <std::string> devices;
-    std::ios::sync_with_stdio(true);
+    protocolCancel();
+    sealTestStop();
+    spectrumStop();
+    publisherStop(true);
+    recorderStop();
 
-    res = detectDevices(devices);
+    sessionDefaults(config);
+    res = sessionConnectAsync(config);
     if (res != EdlSuccess) {return res;}
 
-    res = connectDevice(devices.at(0));
+    return 0;
+}
+
+/*! Returns the SESSION_* status; \a error and \a warm can be NULL. */
+extern "C" __declspec(dllexport) int getConnectionStatus(int * error, unsigned int * warm)
+{
+    EdlErrorCode_t lastError;
+    unsigned int warmFlags;
+
+    int status = sessionStatus(lastError, warmFlags);
+    if (error != NULL) {*error = lastError;}
+    if (warm != NULL) {*warm = warmFlags;}
+
+    return status;
+}
+
+extern "C" __declspec(dllexport) int waitConnection(unsigned int timeoutMs)
+{
+    return sessionWait(timeoutMs);
+}
+
+extern "C" __declspec(dllexport) int startAcquisition()
+{
+    EdlErrorCode_t res;
+
+    res = acquisitionStart(ACQUISITION_RING_PACKETS);
     if (res != EdlSuccess) {return res;}
 
-    configureWorkingModality();
+    return 0;
+}
 
-    compensateDigitalOffset();
+extern "C" __declspec(dllexport) int stopAcquisition()
+{
+    acquisitionStop();
 
     return 0;
 }
 
-extern "C" __declspec(dllexport) int closeEDL()
+extern "C" __declspec(dllexport) int waitForData(unsigned int minPackets, unsigned int timeoutMs)
+{
+    return acquisitionWait(minPackets, timeoutMs);
+}
+
+/*! Fills a caller-owned buffer (e.g. a numpy array of shape (maxPackets, EDL_CHANNEL_NUM)) with interleaved data packets. */
+extern "C" __declspec(dllexport) int readInto(float * dst, unsigned int maxPackets, unsigned int * got)
 {
     EdlErrorCode_t res;
 
-    unsigned int c = 0;
-    while (c++ < 1e3)
-    {
-		res = disconnectDevice();
-		if (res == EdlSuccess) {break;}
-        Sleep(1);
+    if (dst == NULL || got == NULL) {return -1;}
+    res = acquisitionReadInto(dst, maxPackets, *got);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+/*! Fills a caller-owned buffer of shape (EDL_CHANNEL_NUM, maxPackets) one channel per row. */
+extern "C" __declspec(dllexport) int readChannelsInto(float * dst, unsigned int maxPackets, unsigned int * got)
+{
+    EdlErrorCode_t res;
+
+    if (dst == NULL || got == NULL) {return -1;}
+    res = acquisitionReadChannelsInto(dst, maxPackets, *got);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+/*! Same as startRecording, with \a compression E1_COMPRESSION_*: #E1_COMPRESSION_DELTA_PACK stores the samples losslessly
+ * as delta coded, bit packed converter codes. Read back with openRecording as any other recording. */
+extern "C" __declspec(dllexport) int startCompressedRecording(const char * path, unsigned int preallocateMB, unsigned int compression)
+{
+    EdlErrorCode_t res;
+    FILE * f;
+
+    if (path == NULL || recorderRunning()) {return -1;}
+    f = fopen(path, "wb");
+    if (f == NULL) {return -1;}
+
+    res = recorderStart(f, (unsigned long long)preallocateMB << 20, true, compression);
+    if (res != EdlSuccess) {
+        fclose(f);
+        return res;
+    }
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int startRecording(const char * path, unsigned int preallocateMB)
+{
+    return startCompressedRecording(path, preallocateMB, E1_COMPRESSION_NONE);
+}
+
+/*! Same as startCompressedRecording, but only the segments around the triggers of \a config are recorded; NULL uses gateDefaults.
+ * The segment index is read back with getRecordingSegments. */
+extern "C" __declspec(dllexport) int startGatedRecording(const char * path, unsigned int preallocateMB, unsigned int compression,
+                                                         const GateConfig_t * config)
+{
+    EdlErrorCode_t res;
+    GateConfig_t gate;
+    FILE * f;
+
+    if (path == NULL || recorderRunning()) {return -1;}
+    if (config != NULL) {
+        gate = *config;
+    } else {
+        gateDefaults(gate);
+    }
+    f = fopen(path, "wb");
+    if (f == NULL) {return -1;}
+
+    res = recorderStart(f, (unsigned long long)preallocateMB << 20, true, compression, &gate);
+    if (res != EdlSuccess) {
+        fclose(f);
+        return res;
+    }
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int stopRecording()
+{
+    recorderStop();
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int getRecorderStats(RecorderStats_t * stats)
+{
+    if (stats == NULL) {return -1;}
+    recorderGetStats(*stats);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int openRecording(const char * path, void ** handle)
+{
+    EdlErrorCode_t res;
+    RecordingFile_t * recording;
+
+    if (handle == NULL) {return -1;}
+    res = recordingOpen(path, recording);
+    if (res != EdlSuccess) {return res;}
+    *handle = recording;
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int closeRecording(void * handle)
+{
+    recordingClose((RecordingFile_t *)handle);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int getRecordingHeader(void * handle, RecordingHeader_t * header)
+{
+    if (handle == NULL || header == NULL) {return -1;}
+    *header = recordingHeader((RecordingFile_t *)handle);
+
+    return 0;
+}
+
+/*! Converts seconds from the start of the recording into the packet index expected by the read functions. */
+extern "C" __declspec(dllexport) unsigned long long recordingPacketAtTime(void * handle, double seconds)
+{
+    if (handle == NULL) {return 0;}
+    return recordingPacketAt((RecordingFile_t *)handle, seconds);
+}
+
+/*! Copies up to \a maxSegments entries of the segment index of a gated recording, starting from segment \a first.
+ * Returns the number of entries copied: 0 past the last segment or if the recording is not gated. */
+extern "C" __declspec(dllexport) int getRecordingSegments(void * handle, unsigned long long first, SegmentIndexEntry_t * dst,
+                                                          unsigned int maxSegments)
+{
+    const SegmentIndexEntry_t * segments;
+
+    if (handle == NULL || dst == NULL) {return -1;}
+    uint64_t count = recordingSegments((RecordingFile_t *)handle, segments);
+    if (first >= count) {return 0;}
+
+    unsigned int n = (unsigned int)std::min <uint64_t> (maxSegments, count-first);
+    memcpy(dst, segments+first, (size_t)n*sizeof(SegmentIndexEntry_t));
+    return (int)n;
+}
+
+/*! Converts a packet index of a recording into its device sample index, which counts the packets that went missing. */
+extern "C" __declspec(dllexport) unsigned long long recordingSampleAtPacket(void * handle, unsigned long long packet)
+{
+    if (handle == NULL) {return 0;}
+    return recordingSampleAt((RecordingFile_t *)handle, packet);
+}
+
+/*! Copies up to \a maxGaps entries of the gap index of a recording, starting from gap \a first.
+ * Returns the number of entries copied: 0 past the last gap. */
+extern "C" __declspec(dllexport) int getRecordingGaps(void * handle, unsigned long long first, GapIndexEntry_t * dst,
+                                                      unsigned int maxGaps)
+{
+    const GapIndexEntry_t * gaps;
+
+    if (handle == NULL || dst == NULL) {return -1;}
+    uint64_t count = recordingGaps((RecordingFile_t *)handle, gaps);
+    if (first >= count) {return 0;}
+
+    unsigned int n = (unsigned int)std::min <uint64_t> (maxGaps, count-first);
+    memcpy(dst, gaps+first, (size_t)n*sizeof(GapIndexEntry_t));
+    return (int)n;
+}
+
+extern "C" __declspec(dllexport) int readRecordingPackets(void * handle, unsigned long long firstPacket, unsigned int packets,
+                                                          float * dst, unsigned int * got)
+{
+    EdlErrorCode_t res;
+
+    if (handle == NULL || dst == NULL || got == NULL) {return -1;}
+    res = recordingReadPackets((RecordingFile_t *)handle, firstPacket, packets, dst, *got);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int readRecordingChannel(void * handle, unsigned int channel, unsigned long long firstPacket,
+                                                          unsigned int packets, float * dst, unsigned int * got)
+{
+    EdlErrorCode_t res;
+
+    if (handle == NULL || dst == NULL || got == NULL) {return -1;}
+    res = recordingReadChannel((RecordingFile_t *)handle, channel, firstPacket, packets, dst, *got);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int startDisplay()
+{
+    EdlErrorCode_t res;
+
+    res = pyramidStart();
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int stopDisplay()
+{
+    pyramidStop();
+
+    return 0;
+}
+
+/*! Seconds since startDisplay covered by the display pyramid. */
+extern "C" __declspec(dllexport) double getDisplayLatestTime()
+{
+    return pyramidLatestTime();
+}
+
+/*! Fills \a out with 3 rows of \a pixels floats (min, max, mean) covering \a t0 to \a t1 seconds since startDisplay. */
+extern "C" __declspec(dllexport) int getDisplayWindow(unsigned int channel, double t0, double t1, unsigned int pixels, float * out)
+{
+    EdlErrorCode_t res;
+
+    if (channel >= EDL_CHANNEL_NUM || pixels == 0 || out == NULL || !(t1 > t0)) {return -1;}
+    res = pyramidWindow(channel, t0, t1, pixels, out);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+/*! Starts detecting events on the live stream. A NULL \a config selects the defaults of eventDetectorDefaults. */
+extern "C" __declspec(dllexport) int startEventDetection(const EventDetectorConfig_t * config)
+{
+    EdlErrorCode_t res;
+    EventDetectorConfig_t defaults;
+
+    if (config == NULL) {
+        eventDetectorDefaults(defaults);
+        config = &defaults;
     }
+    res = eventsStart(*config);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int stopEventDetection()
+{
+    eventsStop();
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int popEvents(DetectedEvent_t * dst, unsigned int maxEvents, unsigned int * got)
+{
+    if (dst == NULL || got == NULL) {return -1;}
+    *got = eventsPop(dst, maxEvents);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int getEventBaseline(double * mean, double * sigma)
+{
+    if (mean == NULL || sigma == NULL) {return -1;}
+    eventsBaseline(*mean, *sigma);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int setLowpassFilter(int type, int order, double cutoffHz)
+{
+    EdlErrorCode_t res;
+    FilterSpec_t spec = filterStageSpec();
+
+    if (type < FILTER_LOWPASS_NONE || type > FILTER_LOWPASS_BESSEL || order < 1 || order > FILTER_MAX_ORDER) {return -1;}
+
+    spec.lowpassType = type;
+    spec.lowpassOrder = order;
+    spec.lowpassHz = cutoffHz;
+    res = filterStageConfigure(spec);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int setNotchFilter(double frequencyHz, double q, int harmonics)
+{
+    EdlErrorCode_t res;
+    FilterSpec_t spec = filterStageSpec();
+
+    if (frequencyHz < 0.0 || harmonics < 0) {return -1;}
+
+    spec.notchHz = frequencyHz;
+    spec.notchQ = q;
+    spec.notchHarmonics = harmonics;
+    res = filterStageConfigure(spec);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int setFirFilter(const float * taps, int tapsNum)
+{
+    EdlErrorCode_t res;
+    FilterSpec_t spec = filterStageSpec();
+
+    if (tapsNum < 0 || tapsNum > FILTER_MAX_FIR_TAPS || (tapsNum > 0 && taps == NULL)) {return -1;}
+
+    spec.firTaps.assign(taps, taps+tapsNum);
+    spec.firLowpassHz = 0.0;
+    res = filterStageConfigure(spec);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int setFirLowpass(double cutoffHz, int tapsNum)
+{
+    EdlErrorCode_t res;
+    FilterSpec_t spec = filterStageSpec();
+
+    if (tapsNum < 3 || tapsNum > FILTER_MAX_FIR_TAPS || !(cutoffHz > 0.0)) {return -1;}
+
+	/*! The cutoff is kept in Hz: the taps are designed again whenever the sampling rate changes. */
+    spec.firTaps.clear();
+    spec.firLowpassHz = cutoffHz;
+    spec.firLowpassTaps = tapsNum;
+    res = filterStageConfigure(spec);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int clearFilters()
+{
+    EdlErrorCode_t res;
+
+    res = filterStageConfigure(filterSpecNone());
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int getStats(Stats_t * stats)
+{
+    if (stats == NULL) {return -1;}
+    statsGet(*stats);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int resetStats()
+{
+    statsReset();
+
+    return 0;
+}
+
+/*! Copies up to \a maxGaps gaps of the acquired stream from the \a first-th on and returns how many were copied. */
+extern "C" __declspec(dllexport) int getStreamGaps(unsigned int first, AcquisitionGap_t * gaps, unsigned int maxGaps)
+{
+    if (gaps == NULL) {return -1;}
+    return (int)acquisitionGaps(first, gaps, maxGaps);
+}
+
+/*! Device sample index of the next packet read: packets read since startAcquisition plus the packets estimated lost. */
+extern "C" __declspec(dllexport) unsigned long long getDeviceSamples()
+{
+    return acquisitionDeviceSamples();
+}
+
+extern "C" __declspec(dllexport) int setReadPeriod(double ms)
+{
+    acquisitionSetReadPeriod(ms*1e-3);
+
+    return 0;
+}
+
+/*! Calls \a callback from the acquisition thread with the packets as they are read, see SubscriptionConfig_t; NULL
+ * \a config passes every batch. Returns the subscription id, from 1 on, or -1. */
+extern "C" __declspec(dllexport) int subscribe(const SubscriptionConfig_t * config, SubscriptionCallback_t callback, void * context)
+{
+    SubscriptionConfig_t defaults;
+    int id;
+
+    if (config == NULL) {
+        subscriptionDefaults(defaults);
+        config = &defaults;
+    }
+    if (subscriptionAdd(*config, callback, context, id) != EdlSuccess) {return -1;}
+
+    return id;
+}
+
+/*! Not from within a callback. */
+extern "C" __declspec(dllexport) int unsubscribe(int id)
+{
+    EdlErrorCode_t res;
+
+    res = subscriptionRemove(id);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int getSubscriptionStats(int id, SubscriptionStats_t * stats)
+{
+    if (stats == NULL || !subscriptionStats(id, *stats)) {return -1;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int startPublishing(const char * name, unsigned int packets, int raw)
+{
+    EdlErrorCode_t res;
+
+    res = publisherStart(name, packets, raw != 0);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int stopPublishing()
+{
+    publisherStop(false);
+
+    return 0;
+}
+
+/*! Returns the sequence number past the last packet published, with the number of attached readers and the cursor of the slowest. */
+extern "C" __declspec(dllexport) unsigned long long getPublisherReaders(unsigned int * readers, unsigned long long * slowestCursor)
+{
+    unsigned int readersNum;
+    uint64_t slowest;
+    uint64_t head = publisherReaders(readersNum, slowest);
+
+    if (readers != NULL) {*readers = readersNum;}
+    if (slowestCursor != NULL) {*slowestCursor = slowest;}
+    return head;
+}
+
+/*! Sets the trial rules assumed when compiling and starting protocols; \a maxAbsMv 0 leaves the voltages unchecked. */
+extern "C" __declspec(dllexport) int setProtocolRules(double maxAbsMv, int nonNegativeTimes, int integerCounts, int pulseTimes)
+{
+    ProtocolRules_t rules;
+
+    if (!(maxAbsMv >= 0.0)) {return -1;}
+    rules.maxAbsMv = maxAbsMv;
+    rules.nonNegativeTimes = nonNegativeTimes;
+    rules.integerCounts = integerCounts;
+    rules.pulseTimes = pulseTimes;
+    protocolSetRules(rules);
+
+    return 0;
+}
+
+/*! Compiles the protocol file \a path; \a error receives PROTOCOL_ERROR_BYTES bytes of diagnostic. */
+extern "C" __declspec(dllexport) int loadProtocol(const char * path, void ** handle, char * error)
+{
+    EdlErrorCode_t res;
+    Protocol_t * protocol;
+
+    if (handle == NULL) {return -1;}
+    protocol = new Protocol_t;
+    res = protocolLoad(path, *protocol, error);
+    if (res != EdlSuccess) {
+        delete protocol;
+        return res;
+    }
+    *handle = protocol;
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int compileProtocol(const char * text, void ** handle, char * error)
+{
+    EdlErrorCode_t res;
+    Protocol_t * protocol;
+
+    if (handle == NULL) {return -1;}
+    protocol = new Protocol_t;
+    res = protocolCompile(text, *protocol, NULL, error);
+    if (res != EdlSuccess) {
+        delete protocol;
+        return res;
+    }
+    *handle = protocol;
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int freeProtocol(void * handle)
+{
+    delete (Protocol_t *)handle;
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int getProtocolInfo(void * handle, unsigned int * steps, double * durationMs)
+{
+    if (handle == NULL) {return -1;}
+    if (steps != NULL) {*steps = (unsigned int)((Protocol_t *)handle)->steps.size();}
+    if (durationMs != NULL) {*durationMs = ((Protocol_t *)handle)->durationMs;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int startProtocol(void * handle, char * error)
+{
+    EdlErrorCode_t res;
+
+    if (handle == NULL) {return -1;}
+    res = protocolStart(*(Protocol_t *)handle, error);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+/*! Returns the PROTOCOL_* status; \a stepsApplied can be NULL. */
+extern "C" __declspec(dllexport) int getProtocolStatus(unsigned int * stepsApplied)
+{
+    unsigned int applied;
+    int protocolState = protocolStatus(applied);
+
+    if (stepsApplied != NULL) {*stepsApplied = applied;}
+    return protocolState;
+}
+
+extern "C" __declspec(dllexport) int waitProtocol(unsigned int timeoutMs)
+{
+    return protocolWait(timeoutMs);
+}
+
+extern "C" __declspec(dllexport) int cancelProtocol()
+{
+    protocolCancel();
+
+    return 0;
+}
+
+/*! Copies up to \a maxMarks marks from the \a first-th on and returns how many were copied. */
+extern "C" __declspec(dllexport) int getProtocolMarks(unsigned int first, ProtocolMark_t * marks, unsigned int maxMarks)
+{
+    if (marks == NULL) {return -1;}
+    return (int)protocolMarks(first, marks, maxMarks);
+}
+
+/*! Starts the seal test analyzer; parameters <= 0 are taken from the device configuration. */
+extern "C" __declspec(dllexport) int startSealTest(double vstepMv, double tpuMs, double tpeMs, unsigned int averagedPeriods)
+{
+    EdlErrorCode_t res;
+    SealTestConfig_t config;
+
+    sealTestDefaults(config);
+    if (vstepMv != 0.0) {config.vstepMv = vstepMv;}
+    if (tpuMs > 0.0) {config.tpuMs = tpuMs;}
+    if (tpeMs > 0.0) {config.tpeMs = tpeMs;}
+    if (averagedPeriods > 0) {config.averagedPeriods = averagedPeriods;}
+    res = sealTestStart(config);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int stopSealTest()
+{
+    sealTestStop();
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int getSealTest(SealTestResult_t * result)
+{
+    if (result == NULL) {return -1;}
+    sealTestGet(*result);
+
+    return 0;
+}
+
+/*! Starts the noise analyzer; \a config can be NULL for the defaults (see spectrumDefaults). */
+extern "C" __declspec(dllexport) int startSpectrum(const SpectrumConfig_t * config)
+{
+    EdlErrorCode_t res;
+    SpectrumConfig_t defaults;
+
+    if (config == NULL) {
+        spectrumDefaults(defaults);
+        config = &defaults;
+    }
+    res = spectrumStart(*config);
+    if (res != EdlSuccess) {return res;}
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int stopSpectrum()
+{
+    spectrumStop();
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int restartSpectrum()
+{
+    spectrumRestart();
+
+    return 0;
+}
+
+/*! Copies up to \a maxBins PSD bins of \a channel into \a psd, which can be NULL, and returns how many were copied. */
+extern "C" __declspec(dllexport) int getSpectrum(unsigned int channel, double * psd, unsigned int maxBins, SpectrumInfo_t * info)
+{
+    if (info == NULL) {return -1;}
+    if (!spectrumGet(channel, psd, maxBins, *info)) {return -1;}
+
+    return psd == NULL ? 0 : (int)std::min(maxBins, info->bins);
+}
+
+extern "C" __declspec(dllexport) int closeEDL()
+{
+    EdlErrorCode_t res;
+
+    offsetCompensationCancel();
+    protocolCancel();
+    sealTestStop();
+    spectrumStop();
+    subscriptionRemoveAll();
+    publisherStop(true);
+    recorderStop();
+    acquisitionStop();
 
+    res = sessionDisconnect();
     if (res != EdlSuccess) {return -1;}
 
     return 0;
@@ -0,0 +1,315 @@
+/* e1_events.cpp
+Streaming event detector: the baseline is learnt and the thresholds are tested a block of samples at a time */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define E1_EVENTS_SSE
+#endif
+
+#include "e1_events.h"
+#include "e1_acquisition.h"
+#include "e1_ring.h"
+
+/*! \def EVENT_BLOCK_SAMPLES
+ * \brief Samples tested together by the vectorized kernels. The baseline is updated once per block.
+ */
+#define EVENT_BLOCK_SAMPLES 64
+
+/*! Samples of the channel deinterleaved per call of the sink. */
+#define EVENT_SLICE_PACKETS 4096
+
+/*! Fraction of a baseline time constant to learn before detecting. */
+#define EVENT_WARMUP_FRACTION 0.25
+
+static unsigned int firstCrossing(const float * x, unsigned int n, float threshold, bool below)
+{
+    unsigned int k = 0;
+
+#ifdef E1_EVENTS_SSE
+    const __m128 t = _mm_set1_ps(threshold);
+    for (; k+4 <= n; k += 4) {
+        __m128 v = _mm_loadu_ps(x+k);
+        int mask = _mm_movemask_ps(below ? _mm_cmplt_ps(v, t) : _mm_cmpgt_ps(v, t));
+        if (mask != 0) {
+            while ((mask & 1) == 0) {mask >>= 1; k++;}
+            return k;
+        }
+    }
+#endif
+
+    for (; k < n; k++) {
+        if (below ? x[k] < threshold : x[k] > threshold) {return k;}
+    }
+    return n;
+}
+
+/*! Sum and sum of squares of \a x - \a shift (shifting by the baseline keeps float precision), minimum and maximum of \a x. */
+static void blockMoments(const float * x, unsigned int n, float shift, double &sum, double &sumSquares, float &mn, float &mx)
+{
+    unsigned int k = 0;
+    float s = 0.0f, q = 0.0f;
+    mn = x[0];
+    mx = x[0];
+
+#ifdef E1_EVENTS_SSE
+    if (n >= 4) {
+        const __m128 vshift = _mm_set1_ps(shift);
+        __m128 vs = _mm_setzero_ps();
+        __m128 vq = _mm_setzero_ps();
+        __m128 vmn = _mm_loadu_ps(x);
+        __m128 vmx = vmn;
+        for (; k+4 <= n; k += 4) {
+            __m128 v = _mm_loadu_ps(x+k);
+            __m128 d = _mm_sub_ps(v, vshift);
+            vs = _mm_add_ps(vs, d);
+            vq = _mm_add_ps(vq, _mm_mul_ps(d, d));
+            vmn = _mm_min_ps(vmn, v);
+            vmx = _mm_max_ps(vmx, v);
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, vs); s = lanes[0]+lanes[1]+lanes[2]+lanes[3];
+        _mm_storeu_ps(lanes, vq); q = lanes[0]+lanes[1]+lanes[2]+lanes[3];
+        _mm_storeu_ps(lanes, vmn); mn = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+        _mm_storeu_ps(lanes, vmx); mx = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    }
+#endif
+
+    for (; k < n; k++) {
+        float d = x[k]-shift;
+        s += d;
+        q += d*d;
+        mn = std::min(mn, x[k]);
+        mx = std::max(mx, x[k]);
+    }
+    sum = s;
+    sumSquares = q;
+}
+
+void eventDetectorDefaults(EventDetectorConfig_t &config)
+{
+    config.channel = 1;
+    config.baselineSeconds = 1.0;
+    config.startSigmas = 5.0;
+    config.endSigmas = 1.0;
+    config.minDwellSeconds = 0.0;
+    config.maxDwellSeconds = 10.0;
+}
+
+EventDetector::EventDetector()
+{
+    EventDetectorConfig_t defaults;
+    eventDetectorDefaults(defaults);
+    reset(defaults, 1.0);
+}
+
+void EventDetector::reset(const EventDetectorConfig_t &newConfig, double newRateHz, uint64_t firstSample)
+{
+    config = newConfig;
+    rateHz = newRateHz;
+    tauSamples = std::max(config.baselineSeconds*rateHz, (double)EVENT_BLOCK_SAMPLES);
+    sampleIdx = firstSample;
+    mean = 0.0;
+    variance = 0.0;
+    learntSamples = 0.0;
+    open = false;
+}
+
+double EventDetector::baselineSigma() const
+{
+    return std::sqrt(variance);
+}
+
+/*! Folds a block into the baseline: a cumulative average while warming up, then an exponential one with time constant tauSamples. */
+void EventDetector::learn(const float * samples, unsigned int samplesNum)
+{
+    double sum, sumSquares;
+    float mn, mx;
+
+    if (samplesNum == 0) {return;}
+    blockMoments(samples, samplesNum, (float)mean, sum, sumSquares, mn, mx);
+
+    double delta = sum/samplesNum;
+    double blockVariance = std::max(sumSquares/samplesNum-delta*delta, 0.0);
+    double alpha = samplesNum/std::min(learntSamples+samplesNum, tauSamples);
+
+    mean += alpha*delta;
+    variance = (1.0-alpha)*variance+alpha*blockVariance+alpha*(1.0-alpha)*delta*delta;
+    learntSamples += samplesNum;
+}
+
+void EventDetector::finish(uint64_t endSample, std::vector <DetectedEvent_t> &events)
+{
+    open = false;
+    event.endSample = endSample;
+    event.dwellSeconds = eventSamples/rateHz;
+    event.meanBlockade = depthSum/eventSamples;
+    if (event.dwellSeconds >= config.minDwellSeconds) {events.push_back(event);}
+}
+
+void EventDetector::process(const float * samples, unsigned int samplesNum, std::vector <DetectedEvent_t> &events)
+{
+    unsigned int idx = 0;
+
+    while (idx < samplesNum) {
+        unsigned int block = std::min(samplesNum-idx, (unsigned int)EVENT_BLOCK_SAMPLES);
+        const float * x = samples+idx;
+
+        if (!open) {
+            if (learntSamples < tauSamples*EVENT_WARMUP_FRACTION) {
+                learn(x, block);
+                idx += block;
+                sampleIdx += block;
+                continue;
+            }
+
+			/*! Blockades move the current towards zero, whatever its sign. */
+            sign = mean >= 0.0 ? 1.0 : -1.0;
+            double startDepth = config.startSigmas*baselineSigma();
+            unsigned int k = firstCrossing(x, block, (float)(mean-sign*startDepth), sign > 0.0);
+
+            learn(x, k);
+            idx += k;
+            sampleIdx += k;
+            if (k < block) {
+                open = true;
+                eventSamples = 0;
+                depthSum = 0.0;
+                event.startSample = sampleIdx;
+                event.baseline = mean;
+                event.baselineSigma = baselineSigma();
+                event.maxBlockade = 0.0;
+            }
+        } else {
+            double endDepth = config.endSigmas*event.baselineSigma;
+            unsigned int k = firstCrossing(x, block, (float)(event.baseline-sign*endDepth), sign < 0.0);
+
+            if (k > 0) {
+                double sum, sumSquares;
+                float mn, mx;
+                blockMoments(x, k, (float)event.baseline, sum, sumSquares, mn, mx);
+                depthSum -= sign*sum;
+                event.maxBlockade = std::max(event.maxBlockade, sign > 0.0 ? event.baseline-mn : mx-event.baseline);
+                eventSamples += k;
+            }
+            idx += k;
+            sampleIdx += k;
+
+            if (k < block) {
+                finish(sampleIdx, events);
+            } else if (eventSamples > config.maxDwellSeconds*rateHz) {
+                /*! Too long for a translocation: the baseline has moved. Learn it again. */
+                open = false;
+                learntSamples = 0.0;
+            }
+        }
+    }
+}
+
+static EventDetector liveDetector;
+static EventDetectorConfig_t liveConfig;
+static double liveRateHz = 0.0;
+static unsigned int liveRateId = 0;
+static bool liveSeeded = false;
+static SpscQueue <DetectedEvent_t> queue;
+static std::vector <DetectedEvent_t> completed;
+static float scratch[EVENT_SLICE_PACKETS];
+static bool detecting = false;
+static std::atomic <unsigned long long> droppedEvents(0);
+
+/*! Baseline snapshot for eventsBaseline, refreshed once per batch. */
+static std::mutex baselineMutex;
+static double baselineMean = 0.0;
+static double baselineSigmaValue = 0.0;
+
+static void eventsSink(const float * packets, unsigned int packetsNum, void *)
+{
+    const AcquisitionBlock_t &batch = acquisitionBlock();
+
+	/*! After a change of the sampling rate the dwell limits and the baseline window are counted in other samples:
+	 * start over at the new rate, as the pyramid does. */
+    unsigned int rateId = commandRadioId(EdlCommandSamplingRate);
+    if (rateId != liveRateId) {
+        double rateHz = samplingRateHz(rateId);
+        liveRateId = rateId;
+        if (rateHz > 0.0) {liveRateHz = rateHz;}
+        liveSeeded = false;
+    }
+
+	/*! Number the samples as the device does. After a loss the open event and the baseline no longer hold: start over. */
+    if (!liveSeeded || batch.gapCause != 0 || batch.deviceSample != liveDetector.nextSample()) {
+        liveDetector.reset(liveConfig, liveRateHz, batch.deviceSample);
+        liveSeeded = true;
+    }
+
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx += EVENT_SLICE_PACKETS) {
+        unsigned int n = std::min(packetsNum-packetIdx, (unsigned int)EVENT_SLICE_PACKETS);
+        const float * src = packets+(size_t)packetIdx*EDL_CHANNEL_NUM+liveConfig.channel;
+        for (unsigned int k = 0; k < n; k++) {
+            scratch[k] = src[(size_t)k*EDL_CHANNEL_NUM];
+        }
+        liveDetector.process(scratch, n, completed);
+    }
+
+    for (size_t eventIdx = 0; eventIdx < completed.size(); eventIdx++) {
+        if (!queue.push(completed[eventIdx])) {droppedEvents.fetch_add(1);}
+    }
+    completed.clear();
+
+    std::unique_lock <std::mutex> lock(baselineMutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        baselineMean = liveDetector.baseline();
+        baselineSigmaValue = liveDetector.baselineSigma();
+    }
+}
+
+EdlErrorCode_t eventsStart(const EventDetectorConfig_t &config)
+{
+    unsigned int rateId = commandRadioId(EdlCommandSamplingRate);
+    double rateHz = samplingRateHz(rateId);
+
+    if (config.channel < 1 || config.channel >= EDL_CHANNEL_NUM || rateHz <= 0.0 ||
+        config.baselineSeconds <= 0.0 || config.endSigmas > config.startSigmas) {return EdlUnknownError;}
+
+    eventsStop();
+    liveConfig = config;
+    liveRateHz = rateHz;
+    liveRateId = rateId;
+    liveSeeded = false;
+    if (queue.capacity() < EVENT_QUEUE_SIZE) {queue.allocate(EVENT_QUEUE_SIZE);}
+    completed.reserve(1024);
+    droppedEvents.store(0);
+
+    acquisitionAddSink(eventsSink, NULL);
+    detecting = true;
+
+    return EdlSuccess;
+}
+
+void eventsStop()
+{
+    if (!detecting) {return;}
+    acquisitionRemoveSink(eventsSink, NULL);
+    detecting = false;
+}
+
+unsigned int eventsPop(DetectedEvent_t * dst, unsigned int maxEvents)
+{
+    return queue.pop(dst, maxEvents);
+}
+
+void eventsBaseline(double &mean, double &sigma)
+{
+    std::lock_guard <std::mutex> lock(baselineMutex);
+    mean = baselineMean;
+    sigma = baselineSigmaValue;
+}
+
+unsigned long long eventsDropped()
+{
+    return droppedEvents.load();
+}
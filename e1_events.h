@@ -0,0 +1,108 @@
+/*! \file e1_events.h
+ * \brief Declares the streaming nanopore event (translocation) detector.
+ */
+#ifndef E1_EVENTS_H
+#define E1_EVENTS_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "edl.h"
+
+/*! \def EVENT_QUEUE_SIZE
+ * \brief Detected events buffered until popped by the caller.
+ */
+#define EVENT_QUEUE_SIZE 65536
+
+/*! \struct EventDetectorConfig_t
+ * \brief Event detector settings. Passed to startEventDetection.
+ */
+typedef struct {
+    unsigned int channel; /*!< Current channel to monitor: 1 to #EDL_CHANNEL_NUM - 1. */
+    double baselineSeconds; /*!< Time constant of the running baseline mean and standard deviation. */
+    double startSigmas; /*!< An event starts when the current moves this many standard deviations from the baseline towards zero. */
+    double endSigmas; /*!< An event ends when the current comes back within this many standard deviations. Lower than \a startSigmas. */
+    double minDwellSeconds; /*!< Shorter events are discarded. */
+    double maxDwellSeconds; /*!< Longer events are treated as a baseline change: discarded, and the baseline is learnt again. */
+} EventDetectorConfig_t;
+
+/*! \struct DetectedEvent_t
+ * \brief A detected event. Depths are measured from the baseline towards zero current, in the channel unit.
+ */
+typedef struct {
+    unsigned long long startSample; /*!< Index of the first sample of the event. */
+    unsigned long long endSample; /*!< Index of the first sample after the event. */
+    double dwellSeconds; /*!< Event duration. */
+    double baseline; /*!< Baseline when the event started. */
+    double baselineSigma; /*!< Baseline standard deviation when the event started. */
+    double meanBlockade; /*!< Mean depth. */
+    double maxBlockade; /*!< Maximum depth. */
+} DetectedEvent_t;
+
+/*! \brief Fills \a config with the default settings. */
+void eventDetectorDefaults(EventDetectorConfig_t &config);
+
+/*! \class EventDetector
+ * \brief Adaptive-baseline, hysteresis-threshold event detector on one channel.
+ * The state is carried across calls to process, so samples can be fed in blocks of any size.
+ */
+class EventDetector
+{
+public:
+    EventDetector();
+
+    /*! \brief Applies \a config and forgets the baseline. The next sample processed gets index \a firstSample. */
+    void reset(const EventDetectorConfig_t &config, double rateHz, uint64_t firstSample = 0);
+
+    /*! \brief Processes \a samplesNum consecutive samples of the monitored channel and appends the events completed in them to \a events. */
+    void process(const float * samples, unsigned int samplesNum, std::vector <DetectedEvent_t> &events);
+
+    /*! \brief Index of the next sample to be processed. */
+    uint64_t nextSample() const {return sampleIdx;}
+
+    /*! \brief True while an event is open. */
+    bool inEvent() const {return open;}
+
+    double baseline() const {return mean;}
+    double baselineSigma() const;
+
+private:
+    void learn(const float * samples, unsigned int samplesNum);
+    void finish(uint64_t endSample, std::vector <DetectedEvent_t> &events);
+
+    EventDetectorConfig_t config;
+    double rateHz;
+    double tauSamples;
+    uint64_t sampleIdx;
+
+    double mean;
+    double variance;
+    double learntSamples;
+
+    bool open;
+    double sign;
+    DetectedEvent_t event;
+    double depthSum;
+    uint64_t eventSamples;
+};
+
+/*! \brief Starts detecting events on the packets read by the acquisition thread.
+ * Their samples are numbered like acquisitionDeviceSamples; a loss of packets discards the event in progress and
+ * learns the baseline again from the first packet after it. So does a change of the sampling rate, after which the
+ * durations are counted at the new rate.
+ */
+EdlErrorCode_t eventsStart(const EventDetectorConfig_t &config);
+
+/*! \brief Stops the detection. Events already detected can still be popped. */
+void eventsStop();
+
+/*! \brief Moves up to \a maxEvents detected events into \a dst. \return Number of events moved. */
+unsigned int eventsPop(DetectedEvent_t * dst, unsigned int maxEvents);
+
+/*! \brief Current baseline of the live detector. */
+void eventsBaseline(double &mean, double &sigma);
+
+/*! \brief Events lost because the queue was full. */
+unsigned long long eventsDropped();
+
+#endif // E1_EVENTS_H
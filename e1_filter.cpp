@@ -0,0 +1,390 @@
+/* e1_filter.cpp
+Streaming IIR/FIR filters for the current channels; designs are computed once, state is carried across reads */
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <mutex>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define E1_FILTER_SSE2
+#endif
+
+#include "e1_filter.h"
+#include "e1_acquisition.h"
+
+/*! Samples of a channel filtered per pass of the acquisition stage. */
+#define FILTER_SLICE_PACKETS 4096
+
+static const double pi = 3.14159265358979323846;
+
+typedef std::complex <double> Complex_t;
+
+FilterSpec_t filterSpecNone()
+{
+    FilterSpec_t spec;
+
+    spec.lowpassType = FILTER_LOWPASS_NONE;
+    spec.lowpassOrder = 4;
+    spec.lowpassHz = 0.0;
+    spec.notchHz = 0.0;
+    spec.notchQ = 30.0;
+    spec.notchHarmonics = 0;
+    spec.firLowpassHz = 0.0;
+    spec.firLowpassTaps = 0;
+
+    return spec;
+}
+
+/*! Analog Butterworth poles for a -3dB frequency of 1 rad/s. */
+static void butterworthPoles(unsigned int order, std::vector <Complex_t> &poles)
+{
+    poles.clear();
+    for (unsigned int k = 0; k < order; k++) {
+        poles.push_back(std::polar(1.0, pi*(2.0*k+order+1)/(2.0*order)));
+    }
+}
+
+/*! Analog Bessel poles for a -3dB frequency of 1 rad/s: roots of the reverse Bessel polynomial (Durand-Kerner),
+ * rescaled from unit group delay to the -3dB frequency. */
+static void besselPoles(unsigned int order, std::vector <Complex_t> &poles)
+{
+    std::vector <double> coefficients(order+1);
+    for (unsigned int k = 0; k <= order; k++) {
+        double c = 1.0;
+        /*! (2n-k)! / (2^(n-k) k! (n-k)!), computed as a running product to stay in range. */
+        for (unsigned int j = order-k+1; j <= 2*order-k; j++) {c *= j;}
+        for (unsigned int j = 2; j <= k; j++) {c /= j;}
+        c /= std::pow(2.0, (double)(order-k));
+        coefficients[k] = c;
+    }
+
+    poles.assign(order, Complex_t());
+    for (unsigned int k = 0; k < order; k++) {
+        poles[k] = std::pow(Complex_t(0.4, 0.9), (double)k);
+    }
+    for (unsigned int iteration = 0; iteration < 500; iteration++) {
+        double change = 0.0;
+        for (unsigned int k = 0; k < order; k++) {
+            Complex_t value = coefficients[order];
+            for (int j = (int)order-1; j >= 0; j--) {value = value*poles[k]+coefficients[j];}
+            Complex_t denominator = coefficients[order];
+            for (unsigned int j = 0; j < order; j++) {
+                if (j != k) {denominator *= poles[k]-poles[j];}
+            }
+            Complex_t step = value/denominator;
+            poles[k] -= step;
+            change = std::max(change, std::abs(step));
+        }
+        if (change < 1e-14) {break;}
+    }
+
+	/*! Bisect the -3dB frequency of prod(-p) / prod(jw - p), then normalize it to 1 rad/s. */
+    double lo = 1e-3, hi = 1e3;
+    for (unsigned int iteration = 0; iteration < 200; iteration++) {
+        double w = std::sqrt(lo*hi);
+        double gain = 1.0;
+        for (unsigned int k = 0; k < order; k++) {gain *= std::norm(poles[k])/std::norm(Complex_t(0.0, w)-poles[k]);}
+        if (gain > 0.5) {lo = w;} else {hi = w;}
+    }
+    for (unsigned int k = 0; k < order; k++) {poles[k] /= std::sqrt(lo*hi);}
+}
+
+bool designLowpass(unsigned int type, unsigned int order, double cutoffHz, double rateHz, std::vector <Biquad_t> &sections)
+{
+    std::vector <Complex_t> poles;
+
+    sections.clear();
+    if (order < 1 || order > FILTER_MAX_ORDER || !(cutoffHz > 0.0) || !(cutoffHz < 0.5*rateHz)) {return false;}
+
+    if (type == FILTER_LOWPASS_BUTTERWORTH) {
+        butterworthPoles(order, poles);
+    } else if (type == FILTER_LOWPASS_BESSEL) {
+        besselPoles(order, poles);
+    } else {
+        return false;
+    }
+
+	/*! Bilinear transform with the cutoff prewarped; zeros at Nyquist, gain set for unit DC gain. */
+    double fs2 = 2.0*rateHz;
+    double warped = fs2*std::tan(pi*cutoffHz/rateHz);
+    for (unsigned int k = 0; k < order; k++) {
+        Complex_t s = poles[k]*warped;
+        Complex_t z = (fs2+s)/(fs2-s);
+        Biquad_t section;
+
+        if (std::fabs(poles[k].imag()) < 1e-9) {
+            section.a1 = -z.real();
+            section.a2 = 0.0;
+            double g = (1.0+section.a1)/2.0;
+            section.b0 = g;
+            section.b1 = g;
+            section.b2 = 0.0;
+        } else if (poles[k].imag() > 0.0) {
+            section.a1 = -2.0*z.real();
+            section.a2 = std::norm(z);
+            double g = (1.0+section.a1+section.a2)/4.0;
+            section.b0 = g;
+            section.b1 = 2.0*g;
+            section.b2 = g;
+        } else {
+            continue;
+        }
+        sections.push_back(section);
+    }
+
+    return true;
+}
+
+Biquad_t designNotch(double frequencyHz, double q, double rateHz)
+{
+    Biquad_t section;
+    double w0 = 2.0*pi*frequencyHz/rateHz;
+    double alpha = std::sin(w0)/(2.0*q);
+    double a0 = 1.0+alpha;
+
+    section.b0 = 1.0/a0;
+    section.b1 = -2.0*std::cos(w0)/a0;
+    section.b2 = 1.0/a0;
+    section.a1 = -2.0*std::cos(w0)/a0;
+    section.a2 = (1.0-alpha)/a0;
+
+    return section;
+}
+
+std::vector <float> designFirLowpass(double cutoffHz, unsigned int tapsNum, double rateHz)
+{
+    std::vector <float> taps;
+    std::vector <double> h(tapsNum);
+    double fc = cutoffHz/rateHz;
+    double sum = 0.0;
+
+    if (tapsNum < 3 || tapsNum > FILTER_MAX_FIR_TAPS || !(fc > 0.0) || !(fc < 0.5)) {return taps;}
+
+    for (unsigned int k = 0; k < tapsNum; k++) {
+        double m = k-(tapsNum-1)/2.0;
+        double sinc = m == 0.0 ? 2.0*fc : std::sin(2.0*pi*fc*m)/(pi*m);
+        double window = 0.42-0.5*std::cos(2.0*pi*k/(tapsNum-1))+0.08*std::cos(4.0*pi*k/(tapsNum-1));
+        h[k] = sinc*window;
+        sum += h[k];
+    }
+    for (unsigned int k = 0; k < tapsNum; k++) {taps.push_back((float)(h[k]/sum));}
+
+    return taps;
+}
+
+FilterChain::FilterChain() : primed(false)
+{
+}
+
+bool FilterChain::configure(const FilterSpec_t &spec, double rateHz)
+{
+    std::vector <Biquad_t> designed;
+
+    sections.clear();
+    taps.clear();
+    primed = false;
+	/*! Without a known sampling rate only an empty spec can be applied. */
+    if (!(rateHz > 0.0)) {
+        return spec.lowpassType == FILTER_LOWPASS_NONE && !(spec.notchHz > 0.0) && spec.firTaps.empty() && !(spec.firLowpassHz > 0.0);
+    }
+
+    if (spec.lowpassType != FILTER_LOWPASS_NONE) {
+        if (!designLowpass(spec.lowpassType, spec.lowpassOrder, spec.lowpassHz, rateHz, designed)) {return false;}
+        sections.insert(sections.end(), designed.begin(), designed.end());
+    }
+
+    if (spec.notchHz > 0.0) {
+        if (!(spec.notchQ > 0.0)) {return false;}
+        for (unsigned int harmonic = 1; harmonic <= spec.notchHarmonics+1; harmonic++) {
+            if (harmonic*spec.notchHz >= 0.5*rateHz) {break;}
+            sections.push_back(designNotch(harmonic*spec.notchHz, spec.notchQ, rateHz));
+        }
+    }
+
+    if (spec.firLowpassHz > 0.0) {
+		/*! Designed for this rate, so that the cutoff stays at firLowpassHz whatever the rate. */
+        std::vector <float> designedTaps = designFirLowpass(spec.firLowpassHz, spec.firLowpassTaps, rateHz);
+        if (designedTaps.empty()) {return false;}
+        taps.assign(designedTaps.rbegin(), designedTaps.rend());
+    } else {
+        if (spec.firTaps.size() > FILTER_MAX_FIR_TAPS) {return false;}
+        taps.assign(spec.firTaps.rbegin(), spec.firTaps.rend());
+    }
+
+    s1.assign(sections.size(), 0.0);
+    s2.assign(sections.size(), 0.0);
+    history.assign(taps.empty() ? 0 : taps.size()-1, 0.0f);
+
+    return true;
+}
+
+/*! Sets every state to the steady state of a constant \a input, so that starting the filter causes no transient. */
+void FilterChain::prime(double input)
+{
+    std::fill(history.begin(), history.end(), (float)input);
+
+    double v = input;
+    if (!taps.empty()) {
+        double gain = 0.0;
+        for (size_t k = 0; k < taps.size(); k++) {gain += taps[k];}
+        v *= gain;
+    }
+
+    for (size_t k = 0; k < sections.size(); k++) {
+        const Biquad_t &c = sections[k];
+        double y = v*(c.b0+c.b1+c.b2)/(1.0+c.a1+c.a2);
+        s2[k] = c.b2*v-c.a2*y;
+        s1[k] = c.b1*v-c.a1*y+s2[k];
+        v = y;
+    }
+
+    primed = true;
+}
+
+void FilterChain::process(float * samples, unsigned int samplesNum)
+{
+    if (samplesNum == 0 || !active()) {return;}
+    if (!primed) {prime(samples[0]);}
+
+    if (!taps.empty()) {
+        const unsigned int tapsNum = (unsigned int)taps.size();
+        const size_t kept = tapsNum-1;
+        history.resize(kept+samplesNum);
+        std::copy(samples, samples+samplesNum, history.begin()+kept);
+
+        const float * xb = history.data();
+        const float * r = taps.data();
+        unsigned int i = 0;
+#ifdef E1_FILTER_SSE2
+		/*! Four outputs at a time: each tap is broadcast against four consecutive inputs. */
+        for (; i+4 <= samplesNum; i += 4) {
+            __m128 acc = _mm_setzero_ps();
+            for (unsigned int m = 0; m < tapsNum; m++) {
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(r[m]), _mm_loadu_ps(xb+i+m)));
+            }
+            _mm_storeu_ps(samples+i, acc);
+        }
+#endif
+        for (; i < samplesNum; i++) {
+            float acc = 0.0f;
+            for (unsigned int m = 0; m < tapsNum; m++) {acc += r[m]*xb[i+m];}
+            samples[i] = acc;
+        }
+
+        std::copy(history.end()-kept, history.end(), history.begin());
+        history.resize(kept);
+    }
+
+    size_t sectionIdx = 0;
+#ifdef E1_FILTER_SSE2
+	/*! Sections in pairs: lane 0 runs section k on sample i while lane 1 runs section k+1 on sample i-1. Section k
+	 * alone on the first sample and section k+1 alone on the last one keep the output aligned with the input. */
+    for (; sectionIdx+2 <= sections.size(); sectionIdx += 2) {
+        const Biquad_t &lo = sections[sectionIdx];
+        const Biquad_t &hi = sections[sectionIdx+1];
+        const __m128d b0 = _mm_set_pd(hi.b0, lo.b0);
+        const __m128d b1 = _mm_set_pd(hi.b1, lo.b1);
+        const __m128d b2 = _mm_set_pd(hi.b2, lo.b2);
+        const __m128d a1 = _mm_set_pd(hi.a1, lo.a1);
+        const __m128d a2 = _mm_set_pd(hi.a2, lo.a2);
+
+        double x = samples[0];
+        double previous = lo.b0*x+s1[sectionIdx];
+        s1[sectionIdx] = lo.b1*x-lo.a1*previous+s2[sectionIdx];
+        s2[sectionIdx] = lo.b2*x-lo.a2*previous;
+
+        __m128d z1 = _mm_loadu_pd(&s1[sectionIdx]);
+        __m128d z2 = _mm_loadu_pd(&s2[sectionIdx]);
+        for (unsigned int i = 1; i < samplesNum; i++) {
+            __m128d xs = _mm_set_pd(previous, samples[i]);
+            __m128d y = _mm_add_pd(_mm_mul_pd(b0, xs), z1);
+            z1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1, xs), _mm_mul_pd(a1, y)), z2);
+            z2 = _mm_sub_pd(_mm_mul_pd(b2, xs), _mm_mul_pd(a2, y));
+            previous = _mm_cvtsd_f64(y);
+            samples[i-1] = (float)_mm_cvtsd_f64(_mm_unpackhi_pd(y, y));
+        }
+        _mm_storeu_pd(&s1[sectionIdx], z1);
+        _mm_storeu_pd(&s2[sectionIdx], z2);
+
+        double y = hi.b0*previous+s1[sectionIdx+1];
+        s1[sectionIdx+1] = hi.b1*previous-hi.a1*y+s2[sectionIdx+1];
+        s2[sectionIdx+1] = hi.b2*previous-hi.a2*y;
+        samples[samplesNum-1] = (float)y;
+    }
+#endif
+
+    for (; sectionIdx < sections.size(); sectionIdx++) {
+        const Biquad_t &c = sections[sectionIdx];
+        double z1 = s1[sectionIdx];
+        double z2 = s2[sectionIdx];
+        for (unsigned int i = 0; i < samplesNum; i++) {
+            double x = samples[i];
+            double y = c.b0*x+z1;
+            z1 = c.b1*x-c.a1*y+z2;
+            z2 = c.b2*x-c.a2*y;
+            samples[i] = (float)y;
+        }
+        s1[sectionIdx] = z1;
+        s2[sectionIdx] = z2;
+    }
+}
+
+static std::mutex stageMutex;
+static FilterSpec_t stageSpec = filterSpecNone();
+static FilterChain chains[EDL_CHANNEL_NUM];
+static double stageRateHz = 0.0;
+static float scratch[FILTER_SLICE_PACKETS];
+
+/*! Acquisition filter hook: filters the current channels in place; the voltage channel is left untouched. */
+static void filterStage(float * packets, unsigned int packetsNum, void *)
+{
+    std::lock_guard <std::mutex> lock(stageMutex);
+
+	/*! Redesign if the sampling rate was changed after the filters were configured. */
+    double rateHz = samplingRateHz(commandRadioId(EdlCommandSamplingRate));
+    if (rateHz != stageRateHz) {
+        stageRateHz = rateHz;
+        for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            chains[channelIdx].configure(stageSpec, rateHz);
+        }
+    }
+
+    for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx += FILTER_SLICE_PACKETS) {
+            unsigned int n = std::min(packetsNum-packetIdx, (unsigned int)FILTER_SLICE_PACKETS);
+            float * p = packets+(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx;
+            for (unsigned int k = 0; k < n; k++) {scratch[k] = p[(size_t)k*EDL_CHANNEL_NUM];}
+            chains[channelIdx].process(scratch, n);
+            for (unsigned int k = 0; k < n; k++) {p[(size_t)k*EDL_CHANNEL_NUM] = scratch[k];}
+        }
+    }
+}
+
+EdlErrorCode_t filterStageConfigure(const FilterSpec_t &spec)
+{
+    FilterChain check;
+    double rateHz = samplingRateHz(commandRadioId(EdlCommandSamplingRate));
+
+    if (!check.configure(spec, rateHz)) {return EdlUnknownError;}
+
+    {
+        std::lock_guard <std::mutex> lock(stageMutex);
+        stageSpec = spec;
+        stageRateHz = rateHz;
+        for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            chains[channelIdx].configure(stageSpec, rateHz);
+        }
+    }
+
+    acquisitionSetFilter(check.active() ? filterStage : NULL, NULL);
+
+    return EdlSuccess;
+}
+
+FilterSpec_t filterStageSpec()
+{
+    std::lock_guard <std::mutex> lock(stageMutex);
+    return stageSpec;
+}
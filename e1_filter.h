@@ -0,0 +1,108 @@
+/*! \file e1_filter.h
+ * \brief Declares the streaming digital filters applied to the current channels as packets are read.
+ */
+#ifndef E1_FILTER_H
+#define E1_FILTER_H
+
+#include <vector>
+
+#include "edl.h"
+
+/*! Value for FilterSpec_t::lowpassType: no lowpass. */
+#define FILTER_LOWPASS_NONE 0
+
+/*! Value for FilterSpec_t::lowpassType: maximally flat magnitude. */
+#define FILTER_LOWPASS_BUTTERWORTH 1
+
+/*! Value for FilterSpec_t::lowpassType: maximally flat group delay, no overshoot on steps. */
+#define FILTER_LOWPASS_BESSEL 2
+
+/*! \def FILTER_MAX_ORDER
+ * \brief Highest lowpass order accepted.
+ */
+#define FILTER_MAX_ORDER 10
+
+/*! \def FILTER_MAX_FIR_TAPS
+ * \brief Longest FIR accepted.
+ */
+#define FILTER_MAX_FIR_TAPS 1024
+
+/*! \struct FilterSpec_t
+ * \brief Filters applied, in order: FIR, lowpass, notch.
+ */
+typedef struct {
+    unsigned int lowpassType; /*!< FILTER_LOWPASS_*. */
+    unsigned int lowpassOrder; /*!< 1 to #FILTER_MAX_ORDER. */
+    double lowpassHz; /*!< -3dB frequency, below half the sampling rate. */
+    double notchHz; /*!< Mains frequency to reject (50 or 60); 0 disables the notch. */
+    double notchQ; /*!< Notch quality factor: notch width is notchHz / notchQ. */
+    unsigned int notchHarmonics; /*!< Number of harmonics of notchHz rejected as well. */
+    std::vector <float> firTaps; /*!< FIR coefficients; empty disables the FIR. Ignored if \a firLowpassHz is set. */
+    double firLowpassHz; /*!< Cutoff of a FIR lowpass designed with designFirLowpass for the sampling rate in effect, and
+                          * designed again when it changes; 0 uses \a firTaps instead. */
+    unsigned int firLowpassTaps; /*!< Taps of that FIR lowpass. */
+} FilterSpec_t;
+
+/*! \struct Biquad_t
+ * \brief Second order section, normalized so that a0 = 1.
+ */
+typedef struct {
+    double b0, b1, b2, a1, a2;
+} Biquad_t;
+
+/*! \brief Returns a spec with every filter disabled. */
+FilterSpec_t filterSpecNone();
+
+/*! \brief Designs a Butterworth or Bessel lowpass as a cascade of sections with unit DC gain.
+ *
+ * \return false if the arguments are out of range.
+ */
+bool designLowpass(unsigned int type, unsigned int order, double cutoffHz, double rateHz, std::vector <Biquad_t> &sections);
+
+/*! \brief Designs a notch at \a frequencyHz. */
+Biquad_t designNotch(double frequencyHz, double q, double rateHz);
+
+/*! \brief Designs a windowed-sinc (Blackman) FIR lowpass with \a tapsNum taps and unit DC gain. */
+std::vector <float> designFirLowpass(double cutoffHz, unsigned int tapsNum, double rateHz);
+
+/*! \class FilterChain
+ * \brief Filters one channel. The state is carried across calls to process, so the output is seamless across reads.
+ * Consecutive IIR sections are evaluated two at a time with SSE2, the second one sample behind the first within each
+ * call; the output stays aligned with the input, as without SSE2.
+ */
+class FilterChain
+{
+public:
+    FilterChain();
+
+    /*! \brief Designs the filters of \a spec for \a rateHz and clears the state. \return false if \a spec is invalid. */
+    bool configure(const FilterSpec_t &spec, double rateHz);
+
+    /*! \brief True if the chain does anything. */
+    bool active() const {return !sections.empty() || !taps.empty();}
+
+    /*! \brief Filters \a samplesNum samples in place. */
+    void process(float * samples, unsigned int samplesNum);
+
+private:
+    void prime(double input);
+
+    std::vector <Biquad_t> sections;
+    std::vector <double> s1; /*!< Transposed direct form II state, one per section. */
+    std::vector <double> s2;
+    std::vector <float> taps; /*!< FIR taps, reversed. */
+    std::vector <float> history; /*!< Last taps - 1 FIR inputs followed by the current block. */
+    bool primed;
+};
+
+/*! \brief Applies \a spec to every current channel of the packets read by the acquisition thread.
+ * Raw sinks, such as the recorder, still receive unfiltered packets.
+ *
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t filterStageConfigure(const FilterSpec_t &spec);
+
+/*! \brief Returns the spec currently applied by the acquisition filter stage. */
+FilterSpec_t filterStageSpec();
+
+#endif // E1_FILTER_H
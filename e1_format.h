@@ -0,0 +1,171 @@
+/*! \file e1_format.h
+ * \brief Defines the on-disk layout of recordings written by the recorder.
+ *
+ * A recording consists of:
+ * - a #RecordingHeader_t padded to #E1_RECORDING_HEADER_BYTES bytes;
+ * - #RecordingHeader_t::chunkNum chunks of exactly #RecordingHeader_t::chunkBytes bytes each, so chunk \a i starts at
+ *   \a headerBytes + \a i * \a chunkBytes. Each chunk is a #ChunkHeader_t followed by the samples stored one channel after
+ *   the other: channel \a c occupies \a chunkPackets floats starting at float \a c * \a chunkPackets of the payload.
+ *   Only the first #ChunkHeader_t::packets of them are valid;
+ * - a trailing seek index: #E1_RECORDING_INDEX_MAGIC, a uint64_t entry count and one #ChunkIndexEntry_t per chunk.
+ *
+ * All fields are little endian. \a indexOffset is 0 while the recording is in progress (or if it was never finalized):
+ * readers then recover the chunks from the file size.
+ *
+ * Compressed and gated recordings (#E1_RECORDING_VERSION_PACKED) differ in the chunks: each one takes
+ * #ChunkHeader_t::storedBytes bytes, a multiple of 16, and chunks follow each other without gaps, so only the seek index
+ * (or, before finalization, the chain of \a storedBytes) locates them. Uncompressed chunks of these recordings hold
+ * their channels #ChunkHeader_t::packets floats apart instead of \a chunkPackets.
+ *
+ * Gated recordings (#E1_RECORDING_GATED in \a flags) only hold the packets around triggers: each segment is a run of
+ * chunks sharing their #ChunkHeader_t::triggerPacket, and starts a new chunk. The segment index follows the seek index:
+ * #E1_RECORDING_SEGMENTS_MAGIC, a uint64_t entry count and one #SegmentIndexEntry_t per segment.
+ *
+ * Recordings with #E1_RECORDING_SAMPLES in \a flags end with the gap index: #E1_RECORDING_GAPS_MAGIC, a uint64_t entry
+ * count and one #GapIndexEntry_t per hole the device or the driver left in the stream. Those packets are missing, not
+ * NaN: the stream packet index goes on after them, the device sample index (#ChunkHeader_t::firstSample) skips them.
+ *
+ * In compressed recordings (\a compression #E1_COMPRESSION_DELTA_PACK) the payload is one section per channel, each a
+ * #CodecSectionHeader_t followed by:
+ * - one width byte per block of #E1_CODEC_BLOCK_VALUES samples, padded to 4 bytes;
+ * - one int32_t base per block: the integer value of the first sample of the block;
+ * - padding to 16 bytes, then the blocks: block \a b takes 16 * \a width[b] bytes and holds the zigzag encoded
+ *   differences between consecutive samples (0 for the first one), \a width[b] bits each. Sample \a k of the block
+ *   goes to lane \a k % 4 of 4 interleaved 32 bit words, so 4 lanes are packed and unpacked at once.
+ * A block depends on nothing but its base: any sample is decoded without the preceding blocks.
+ */
+#ifndef E1_FORMAT_H
+#define E1_FORMAT_H
+
+#include <stdint.h>
+
+#define E1_RECORDING_MAGIC "E1REC\0\0\0"
+#define E1_RECORDING_VERSION 1
+#define E1_RECORDING_VERSION_PACKED 2
+#define E1_RECORDING_HEADER_BYTES 4096
+#define E1_CHUNK_MAGIC "CHNK"
+#define E1_RECORDING_INDEX_MAGIC "E1INDEX\0"
+#define E1_RECORDING_SEGMENTS_MAGIC "E1SEGMS\0"
+#define E1_RECORDING_GAPS_MAGIC "E1GAPS\0\0"
+
+/*! Values of RecordingHeader_t::compression. */
+#define E1_COMPRESSION_NONE 0 /*!< Samples stored as float. */
+#define E1_COMPRESSION_DELTA_PACK 1 /*!< Lossless: integer samples, delta coded and bit packed in blocks. */
+
+/*! Bits of RecordingHeader_t::flags. */
+#define E1_RECORDING_GATED 1 /*!< Only the windows around triggers were recorded. */
+#define E1_RECORDING_SAMPLES 2 /*!< Chunks carry #ChunkHeader_t::firstSample and the recording ends with the gap index. */
+
+/*! Bits of GapIndexEntry_t::cause. */
+#define E1_GAP_BUFFER_OVERFLOW 1 /*!< The driver buffer overflowed. */
+#define E1_GAP_LOST_DATA 2 /*!< The device lost packets. */
+
+/*! Values of CodecSectionHeader_t::encoding: how the samples of a channel are turned into integers. */
+#define E1_CODEC_ADC_CODES 1 /*!< Sample = code * \a scale, exactly: the codes of the converter. */
+#define E1_CODEC_FLOAT_BITS 2 /*!< Bit pattern of the float, remapped so that the integers sort like the floats. */
+
+/*! \def E1_CODEC_BLOCK_VALUES
+ * \brief Samples per packed block: 32 per lane of 4.
+ */
+#define E1_CODEC_BLOCK_VALUES 128
+
+/*! \struct RecordingHeader_t
+ * \brief Recording header: the acquisition settings and the geometry of the chunks.
+ */
+typedef struct {
+    char magic[8]; /*!< #E1_RECORDING_MAGIC. */
+    uint32_t version; /*!< #E1_RECORDING_VERSION, or #E1_RECORDING_VERSION_PACKED for compressed or gated recordings. */
+    uint32_t headerBytes; /*!< Offset of the first chunk. */
+    uint32_t channelNum; /*!< Channels per packet: #EDL_CHANNEL_NUM when recorded. */
+    uint32_t samplingRateId; /*!< EdlCommandSamplingRate radio id, e.g. #EDL_RADIO_SAMPLING_RATE_200_KHZ. */
+    double samplingRateHz; /*!< Sampling rate in Hz. */
+    uint32_t rangeId; /*!< EdlCommandRange radio id: #EDL_RADIO_RANGE_200_PA or #EDL_RADIO_RANGE_20_NA. */
+    uint32_t bandwidthId; /*!< EdlCommandFinalBandwidth radio id. */
+    int64_t startTimeUs; /*!< Host time of the start of the recording, in microseconds since the Unix epoch. */
+    uint32_t chunkBytes; /*!< Size of every chunk, chunk header included. */
+    uint32_t chunkPackets; /*!< Packets a full chunk holds. */
+    uint64_t chunkNum; /*!< Number of chunks. */
+    uint64_t packetNum; /*!< Stream packet index following the last recorded packet. */
+    uint64_t indexOffset; /*!< Offset of the seek index, 0 if not finalized. */
+    uint32_t compression; /*!< E1_COMPRESSION_*: always #E1_COMPRESSION_NONE for #E1_RECORDING_VERSION. */
+    uint32_t flags; /*!< E1_RECORDING_* bits: only #E1_RECORDING_SAMPLES for #E1_RECORDING_VERSION. */
+    uint64_t segmentNum; /*!< Number of segments of a gated recording. */
+    uint64_t segmentOffset; /*!< Offset of the segment index, 0 if not gated or not finalized. */
+    uint32_t preTriggerPackets; /*!< Gated recordings: packets kept before the trigger that opens a segment. */
+    uint32_t postTriggerPackets; /*!< Gated recordings: packets kept after the last trigger of a segment. */
+    uint64_t gapNum; /*!< Number of entries of the gap index. */
+    uint64_t gapOffset; /*!< Offset of the gap index, 0 if not finalized. */
+    uint64_t missingPackets; /*!< Packets estimated lost by the device and the driver during the recording. */
+} RecordingHeader_t;
+
+/*! \struct ChunkHeader_t
+ * \brief Header at the start of every chunk.
+ */
+typedef struct {
+    char magic[4]; /*!< #E1_CHUNK_MAGIC. */
+    uint32_t packets; /*!< Valid packets in the chunk: less than \a chunkPackets only for the last chunk of the recording or of a segment. */
+    uint64_t chunkIdx; /*!< Position of the chunk in the file. */
+    uint64_t firstPacket; /*!< Stream packet index of the first packet. Differs from \a chunkIdx * \a chunkPackets after dropped packets. */
+    int64_t hostTimeUs; /*!< Host time at which the first packet was received, in microseconds since the Unix epoch. */
+    uint32_t storedBytes; /*!< Size of the chunk on disk, header included: \a chunkBytes in #E1_RECORDING_VERSION recordings. */
+    uint32_t triggers; /*!< Gated recordings: triggers that fired within the packets of the chunk. */
+    uint64_t triggerPacket; /*!< Gated recordings: stream packet index of the trigger that opened the segment of the chunk. */
+    uint64_t firstSample; /*!< #E1_RECORDING_SAMPLES: device sample index of the first packet, counted from the first recorded packet. */
+    uint8_t reserved[8];
+} ChunkHeader_t;
+
+/*! \struct CodecSectionHeader_t
+ * \brief Header of the samples of one channel in a compressed chunk.
+ */
+typedef struct {
+    uint32_t encoding; /*!< E1_CODEC_*. */
+    float scale; /*!< Value of one code for #E1_CODEC_ADC_CODES. */
+    uint32_t bytes; /*!< Size of the section, this header included: the next section starts right after it. */
+    uint32_t blocks; /*!< Blocks of #E1_CODEC_BLOCK_VALUES samples, the last one padded. */
+} CodecSectionHeader_t;
+
+/*! \struct ChunkIndexEntry_t
+ * \brief Seek index entry, one per chunk.
+ */
+typedef struct {
+    uint64_t offset; /*!< Offset of the chunk in the file. */
+    uint64_t firstPacket; /*!< Same as ChunkHeader_t::firstPacket. */
+    uint32_t packets; /*!< Same as ChunkHeader_t::packets. */
+    uint32_t reserved;
+    int64_t hostTimeUs; /*!< Same as ChunkHeader_t::hostTimeUs. */
+} ChunkIndexEntry_t;
+
+/*! \struct SegmentIndexEntry_t
+ * \brief Segment index entry of a gated recording, one per segment.
+ */
+typedef struct {
+    uint64_t offset; /*!< Offset of the first chunk of the segment in the file. */
+    uint64_t firstPacket; /*!< Stream packet index of the first packet of the segment, pre-trigger history included. */
+    uint64_t packets; /*!< Packets spanned by the segment: dropped packets count, as in the chunks. */
+    uint64_t triggerPacket; /*!< Stream packet index of the trigger that opened the segment. */
+    int64_t hostTimeUs; /*!< Host time at which the first packet of the segment was recorded. */
+    uint64_t firstChunk; /*!< Index of the first chunk of the segment. */
+    uint32_t chunks; /*!< Chunks of the segment. */
+    uint32_t triggers; /*!< Triggers that fired within the segment; each one extended it. */
+} SegmentIndexEntry_t;
+
+/*! \struct GapIndexEntry_t
+ * \brief Gap index entry, one per hole in the stream. Its size is estimated (see AcquisitionGap_t).
+ */
+typedef struct {
+    uint64_t packet; /*!< Stream packet index of the first packet after the gap. */
+    uint64_t firstSample; /*!< Device sample index of that packet, as in #ChunkHeader_t::firstSample. */
+    uint64_t missingPackets; /*!< Packets missing before it: firstSample - packet grows by this much. */
+    int64_t hostTimeUs; /*!< Host time at which the gap was detected. */
+    uint32_t cause; /*!< E1_GAP_* bits; 0 for gaps recovered from the chunks of a recording that was not finalized. */
+    uint32_t reserved;
+} GapIndexEntry_t;
+
+static_assert(sizeof(RecordingHeader_t) <= E1_RECORDING_HEADER_BYTES, "recording header too large");
+static_assert(sizeof(ChunkHeader_t) == 64, "chunk header must keep the payload 64 byte aligned");
+static_assert(sizeof(ChunkIndexEntry_t) == 32, "unexpected index entry padding");
+static_assert(sizeof(SegmentIndexEntry_t) == 56, "unexpected segment entry padding");
+static_assert(sizeof(GapIndexEntry_t) == 40, "unexpected gap entry padding");
+static_assert(sizeof(CodecSectionHeader_t) == 16, "codec sections must keep the packed blocks 16 byte aligned");
+
+#endif // E1_FORMAT_H
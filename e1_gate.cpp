@@ -0,0 +1,155 @@
+/* e1_gate.cpp
+Trigger of gated recordings, evaluated a sample at a time on the reader thread, and the pre-trigger packet history */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "e1_gate.h"
+
+void gateDefaults(GateConfig_t &config)
+{
+    config.channel = 1;
+    config.trigger = GATE_TRIGGER_RMS;
+    config.level = 10.0;
+    config.direction = 1;
+    config.windowSeconds = 1e-3;
+    config.preSeconds = 0.05;
+    config.postSeconds = 0.1;
+}
+
+bool gatePackets(const GateConfig_t &config, double rateHz, unsigned int &windowPackets,
+                 unsigned int &prePackets, unsigned int &postPackets)
+{
+    if (config.channel == 0 || config.channel >= EDL_CHANNEL_NUM || config.trigger > GATE_TRIGGER_RMS) {return false;}
+    if ((config.direction != 1 && config.direction != -1) || !(rateHz > 0.0)) {return false;}
+    if (!(config.preSeconds >= 0.0) || !(config.postSeconds >= 0.0) || !(config.windowSeconds >= 0.0)) {return false;}
+
+    double window = std::floor(config.windowSeconds*rateHz+0.5);
+    double pre = std::floor(config.preSeconds*rateHz+0.5);
+    double post = std::floor(config.postSeconds*rateHz+0.5);
+    if (pre > GATE_MAX_PRE_PACKETS || post > 4294967295.0) {return false;}
+    if (config.trigger != GATE_TRIGGER_THRESHOLD && (window < 2.0 || window > GATE_MAX_WINDOW_PACKETS)) {return false;}
+
+    windowPackets = config.trigger == GATE_TRIGGER_THRESHOLD ? 1 : (unsigned int)window;
+    prePackets = (unsigned int)pre;
+    postPackets = (unsigned int)post;
+    return true;
+}
+
+TriggerGate::TriggerGate()
+{
+    GateConfig_t defaults;
+    gateDefaults(defaults);
+    reset(defaults, 2);
+}
+
+void TriggerGate::reset(const GateConfig_t &config, unsigned int windowPackets)
+{
+    trigger = config.trigger;
+    level = (float)config.level;
+    sign = config.direction < 0 ? -1.0f : 1.0f;
+    window = std::max(windowPackets, 1u);
+    history.assign(trigger == GATE_TRIGGER_THRESHOLD ? 0 : window, 0.0f);
+    historyPos = 0;
+    seen = 0;
+    shift = 0.0;
+    sum = 0.0;
+    sumSquares = 0.0;
+    firing = false;
+    edges = 0;
+}
+
+bool TriggerGate::fires(float x)
+{
+    float value;
+
+    if (trigger == GATE_TRIGGER_THRESHOLD) {
+        value = x;
+    } else {
+		/*! history[historyPos] is the sample one window old, about to be replaced by x. */
+        float old = history[historyPos];
+        history[historyPos] = x;
+        historyPos = historyPos+1 == window ? 0 : historyPos+1;
+        seen++;
+
+        if (trigger == GATE_TRIGGER_SLOPE) {
+            if (seen <= window) {return false;}
+            value = x-old;
+        } else {
+			/*! Sums of the samples shifted by an early one keep their precision; they are recomputed every window so rounding never builds up. */
+            if (seen == 1) {shift = x;}
+            if (historyPos == 0) {
+                sum = 0.0;
+                sumSquares = 0.0;
+                for (unsigned int k = 0; k < window; k++) {
+                    double d = history[k]-shift;
+                    sum += d;
+                    sumSquares += d*d;
+                }
+            } else {
+                double d = x-shift;
+                sum += d;
+                sumSquares += d*d;
+                if (seen > window) {
+                    d = old-shift;
+                    sum -= d;
+                    sumSquares -= d*d;
+                }
+            }
+            if (seen < window) {return false;}
+            double mean = sum/window;
+            value = (float)std::sqrt(std::max(sumSquares/window-mean*mean, 0.0));
+        }
+    }
+
+    return sign*(value-level) > 0.0f;
+}
+
+unsigned int TriggerGate::scan(const float * samples, unsigned int samplesNum, unsigned int stride)
+{
+    for (unsigned int k = 0; k < samplesNum; k++) {
+        if (fires(samples[(size_t)k*stride])) {
+            if (!firing) {edges++;}
+            firing = true;
+            return k;
+        }
+        firing = false;
+    }
+    return samplesNum;
+}
+
+void PacketHistory::allocate(unsigned int packets)
+{
+    capacity = packets;
+    buffer.assign((size_t)packets*EDL_CHANNEL_NUM, 0.0f);
+    head = 0;
+    count = 0;
+}
+
+void PacketHistory::push(const float * packets, unsigned int packetsNum)
+{
+    if (capacity == 0) {return;}
+    if (packetsNum > capacity) {
+        packets += (size_t)(packetsNum-capacity)*EDL_CHANNEL_NUM;
+        packetsNum = capacity;
+    }
+
+    unsigned int first = std::min(packetsNum, capacity-head);
+    memcpy(&buffer[(size_t)head*EDL_CHANNEL_NUM], packets, (size_t)first*EDL_CHANNEL_NUM*sizeof(float));
+    if (packetsNum > first) {
+        memcpy(&buffer[0], packets+(size_t)first*EDL_CHANNEL_NUM, (size_t)(packetsNum-first)*EDL_CHANNEL_NUM*sizeof(float));
+    }
+    head = (head+packetsNum) % capacity;
+    count = std::min(count+packetsNum, capacity);
+}
+
+void PacketHistory::spans(const float * &first, unsigned int &firstNum, const float * &second, unsigned int &secondNum) const
+{
+    unsigned int start = (head+capacity-count) % std::max(capacity, 1u);
+
+    first = buffer.data()+(size_t)start*EDL_CHANNEL_NUM;
+    firstNum = std::min(count, capacity-start);
+    second = buffer.data();
+    secondNum = count-firstNum;
+}
@@ -0,0 +1,117 @@
+/*! \file e1_gate.h
+ * \brief Declares the trigger and the pre-trigger history of gated recordings: only the windows around triggers are recorded.
+ */
+#ifndef E1_GATE_H
+#define E1_GATE_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "edl.h"
+
+/*! \def GATE_MAX_PRE_PACKETS
+ * \brief Largest pre-trigger history: about 5 s at 200kHz.
+ */
+#define GATE_MAX_PRE_PACKETS (1 << 20)
+
+/*! \def GATE_MAX_WINDOW_PACKETS
+ * \brief Largest window of the slope and RMS triggers.
+ */
+#define GATE_MAX_WINDOW_PACKETS (1 << 16)
+
+/*! Values of GateConfig_t::trigger. */
+#define GATE_TRIGGER_THRESHOLD 0 /*!< The sample itself. */
+#define GATE_TRIGGER_SLOPE 1 /*!< Sample minus the sample \a windowSeconds earlier. */
+#define GATE_TRIGGER_RMS 2 /*!< RMS of the samples over the last \a windowSeconds, around their mean. */
+
+/*! \struct GateConfig_t
+ * \brief Gated recording settings. Passed to startGatedRecording.
+ */
+typedef struct {
+    unsigned int channel; /*!< Current channel the trigger is evaluated on: 1 to #EDL_CHANNEL_NUM - 1. */
+    unsigned int trigger; /*!< GATE_TRIGGER_*. */
+    double level; /*!< Trigger level, in the channel unit (per window for the slope). */
+    int direction; /*!< 1: fires while the triggered value is above \a level; -1: while it is below. */
+    double windowSeconds; /*!< Window of #GATE_TRIGGER_SLOPE and #GATE_TRIGGER_RMS. */
+    double preSeconds; /*!< History recorded before the trigger that opens a segment. */
+    double postSeconds; /*!< Time recorded after the last trigger of a segment; any trigger meanwhile extends it. */
+} GateConfig_t;
+
+/*! \brief Fills \a config with the default settings: 1 ms RMS above 10 on channel 1, 50 ms before and 100 ms after. */
+void gateDefaults(GateConfig_t &config);
+
+/*! \brief Checks \a config and converts its times into packets at \a rateHz.
+ * \return false if a setting is out of range.
+ */
+bool gatePackets(const GateConfig_t &config, double rateHz, unsigned int &windowPackets,
+                 unsigned int &prePackets, unsigned int &postPackets);
+
+/*! \class TriggerGate
+ * \brief Evaluates the trigger of a gated recording on the samples of one channel.
+ * The state is carried across calls to scan, so samples can be fed in blocks of any size; each sample must be fed once.
+ */
+class TriggerGate
+{
+public:
+    TriggerGate();
+
+    /*! \brief Applies \a config and forgets the samples seen. Slope and RMS triggers only fire once \a windowPackets samples were seen. */
+    void reset(const GateConfig_t &config, unsigned int windowPackets);
+
+    /*! \brief Feeds samples \a samples[0], \a samples[\a stride], ... up to the first one on which the trigger fires.
+     * \return Index of that sample, which was fed; \a samplesNum if none fires, all of them fed.
+     */
+    unsigned int scan(const float * samples, unsigned int samplesNum, unsigned int stride);
+
+    /*! \brief Number of times the trigger started firing since reset: samples that fire after one that did not. */
+    uint64_t triggers() const {return edges;}
+
+private:
+    bool fires(float x);
+
+    unsigned int trigger;
+    float level;
+    float sign;
+    unsigned int window;
+
+    std::vector <float> history;
+    unsigned int historyPos;
+    uint64_t seen;
+    double shift;
+    double sum;
+    double sumSquares;
+
+    bool firing;
+    uint64_t edges;
+};
+
+/*! \class PacketHistory
+ * \brief Bounded history of the latest data packets: older packets are overwritten by newer ones.
+ */
+class PacketHistory
+{
+public:
+    PacketHistory() : capacity(0), head(0), count(0) {}
+
+    /*! \brief Makes room for \a packets packets and empties the history. */
+    void allocate(unsigned int packets);
+
+    void clear() {count = 0;}
+
+    /*! \brief Number of packets held: at most the capacity. */
+    unsigned int size() const {return count;}
+
+    /*! \brief Appends \a packetsNum interleaved packets, dropping the oldest ones beyond the capacity. */
+    void push(const float * packets, unsigned int packetsNum);
+
+    /*! \brief Returns the packets held, oldest first, as up to two contiguous spans. */
+    void spans(const float * &first, unsigned int &firstNum, const float * &second, unsigned int &secondNum) const;
+
+private:
+    std::vector <float> buffer;
+    unsigned int capacity;
+    unsigned int head; /*!< Slot of the next packet pushed. */
+    unsigned int count;
+};
+
+#endif // E1_GATE_H
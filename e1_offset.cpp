@@ -0,0 +1,320 @@
+/* e1_offset.cpp
+Digital offset compensation that stops as soon as the current offset has settled */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+#include "e1_offset.h"
+#include "e1_acquisition.h"
+
+/*! Packets read per direct driver read when the acquisition thread is not running. */
+#define OFFSET_POLL_PACKETS 4096
+
+static std::thread worker;
+static std::atomic <bool> cancelRequested(false);
+static std::atomic <bool> converged(false);
+static std::atomic <int> status(OFFSET_COMPENSATION_IDLE);
+static std::atomic <double> residualOffset(0.0);
+
+static std::mutex doneMutex;
+static std::condition_variable doneCondition;
+
+static OffsetCompensationConfig_t config;
+static OffsetCompensationCallback_t callback = NULL;
+static void * callbackContext = NULL;
+
+/*! Window accumulators. Touched by one thread at a time: the worker while polling, then the reader thread through the sink. */
+static double windowSums[EDL_CHANNEL_NUM];
+static unsigned int windowSamples = 0;
+static unsigned int windowLength = 1;
+static unsigned int settledWindows = 0;
+
+static void monitor(const float * packets, unsigned int packetsNum)
+{
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        const float * packet = packets+(size_t)packetIdx*EDL_CHANNEL_NUM;
+        for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            windowSums[channelIdx] += packet[channelIdx];
+        }
+
+        if (++windowSamples < windowLength) {continue;}
+
+        double residual = 0.0;
+        for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            residual = std::max(residual, std::fabs(windowSums[channelIdx]/windowSamples));
+            windowSums[channelIdx] = 0.0;
+        }
+        windowSamples = 0;
+        residualOffset.store(residual);
+
+        settledWindows = residual <= config.tolerance ? settledWindows+1 : 0;
+        if (settledWindows >= config.windowsNum && !converged.load()) {
+            std::lock_guard <std::mutex> lock(doneMutex);
+            converged.store(true);
+            doneCondition.notify_all();
+        }
+    }
+}
+
+static void monitorSink(const float * packets, unsigned int packetsNum, void *)
+{
+    monitor(packets, packetsNum);
+}
+
+/*! Reads up to \a maxPackets packets straight from the driver into \a buffer, never from the acquisition ring:
+ * the ring may still hold packets of an earlier acquisition, taken before the protocol or the compensation changed. */
+static EdlErrorCode_t readDriver(unsigned int maxPackets, std::vector <float> &buffer, unsigned int &got)
+{
+    EdlErrorCode_t res;
+    EdlDeviceStatus_t deviceStatus;
+
+    got = 0;
+    std::lock_guard <std::mutex> lock(edlMutex());
+    res = getDeviceStatus(deviceStatus);
+    if (res != EdlSuccess) {return res;}
+    unsigned int toRead = std::min(deviceStatus.availableDataPackets, maxPackets);
+    if (toRead == 0) {return EdlSuccess;}
+
+    res = readData(toRead, got, buffer);
+    if (res != EdlSuccess && res != EdlNotEnoughAvailableDataError) {return res;}
+    got = std::min(got, toRead);
+    return EdlSuccess;
+}
+
+static void compensationLoop()
+{
+    EdlErrorCode_t res;
+    EdlCommandStruct_t commandStruct;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()+std::chrono::milliseconds(config.timeoutMs);
+    std::vector <float> buffer;
+    buffer.reserve((size_t)OFFSET_POLL_PACKETS*EDL_CHANNEL_NUM);
+    bool sinkInstalled = false;
+
+	/*! Without the acquisition thread, the driver still holds the packets acquired before the compensation was enabled. */
+    if (!acquisitionRunning()) {
+        std::lock_guard <std::mutex> lock(edlMutex());
+        purgeData();
+    }
+
+    while (!converged.load() && !cancelRequested.load() && std::chrono::steady_clock::now() < deadline) {
+        if (!sinkInstalled && acquisitionRunning()) {
+            /*! The acquisition thread now owns the driver: switch to monitoring the packets it reads. */
+            acquisitionAddSink(monitorSink, NULL);
+            sinkInstalled = true;
+        }
+
+        if (sinkInstalled) {
+            std::unique_lock <std::mutex> lock(doneMutex);
+            doneCondition.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now()+std::chrono::milliseconds(10)), [] {
+                return converged.load() || cancelRequested.load();
+            });
+        } else {
+            unsigned int got = 0;
+            readDriver(OFFSET_POLL_PACKETS, buffer, got);
+            if (got > 0) {
+                monitor(buffer.data(), got);
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    if (sinkInstalled) {acquisitionRemoveSink(monitorSink, NULL);}
+
+	/*! Stop the digital compensation. */
+    commandStruct.checkboxChecked = EDL_CHECKBOX_UNCHECKED;
+    res = sendCommand(EdlCommandDigitalCompensation, commandStruct, true);
+
+    int result;
+    if (res != EdlSuccess) {
+        result = OFFSET_COMPENSATION_FAILED;
+    } else if (converged.load()) {
+        result = OFFSET_COMPENSATION_CONVERGED;
+    } else if (cancelRequested.load()) {
+        result = OFFSET_COMPENSATION_CANCELLED;
+    } else {
+        result = OFFSET_COMPENSATION_TIMED_OUT;
+    }
+
+    {
+        std::lock_guard <std::mutex> lock(doneMutex);
+        status.store(result);
+        doneCondition.notify_all();
+    }
+
+    if (callback != NULL) {callback(result, residualOffset.load(), callbackContext);}
+}
+
+void offsetCompensationDefaults(OffsetCompensationConfig_t &defaults)
+{
+    defaults.tolerance = 1.0;
+    defaults.windowSeconds = 0.02;
+    defaults.windowsNum = 3;
+    defaults.timeoutMs = OFFSET_COMPENSATION_TIMEOUT_MS;
+}
+
+/*! Selects the constant protocol at 0mV, where the current is the offset alone. */
+static EdlErrorCode_t applyZeroProtocol()
+{
+    EdlErrorCode_t res;
+    EdlCommandStruct_t commandStruct;
+
+	/*! Select the constant protocol: protocol 0. */
+    commandStruct.value = 0.0;
+    res = sendCommand(EdlCommandMainTrial, commandStruct, false);
+    if (res != EdlSuccess) {return res;}
+
+	/*! Set the vHold to 0mV. */
+    commandStruct.value = 0.0;
+    res = sendCommand(EdlCommandVhold, commandStruct, false);
+    if (res != EdlSuccess) {return res;}
+
+	/*! Apply the protocol. */
+    return sendCommand(EdlCommandApplyProtocol, commandStruct, true);
+}
+
+EdlErrorCode_t offsetCompensationStart(const OffsetCompensationConfig_t &newConfig, OffsetCompensationCallback_t newCallback, void * context)
+{
+    EdlCommandStruct_t commandStruct;
+    EdlErrorCode_t res;
+
+    if (!(newConfig.tolerance > 0.0) || !(newConfig.windowSeconds > 0.0) || newConfig.windowsNum == 0) {return EdlUnknownError;}
+
+    offsetCompensationCancel();
+
+    config = newConfig;
+    callback = newCallback;
+    callbackContext = context;
+    double rateHz = samplingRateHz(commandRadioId(EdlCommandSamplingRate));
+    windowLength = std::max(1u, (unsigned int)(config.windowSeconds*(rateHz > 0.0 ? rateHz : 1250.0)));
+    std::fill(windowSums, windowSums+EDL_CHANNEL_NUM, 0.0);
+    windowSamples = 0;
+    settledWindows = 0;
+    residualOffset.store(0.0);
+    converged.store(false);
+    cancelRequested.store(false);
+    status.store(OFFSET_COMPENSATION_FAILED);
+
+    res = applyZeroProtocol();
+    if (res != EdlSuccess) {return res;}
+
+	/*! Start the digital compensation. */
+    commandStruct.checkboxChecked = EDL_CHECKBOX_CHECKED;
+    res = sendCommand(EdlCommandDigitalCompensation, commandStruct, true);
+    if (res != EdlSuccess) {return res;}
+
+    status.store(OFFSET_COMPENSATION_RUNNING);
+    worker = std::thread(compensationLoop);
+
+    return EdlSuccess;
+}
+
+int offsetCompensationStatus(double &residual)
+{
+    residual = residualOffset.load();
+    return status.load();
+}
+
+int offsetCompensationWait(unsigned int timeoutMs)
+{
+    std::unique_lock <std::mutex> lock(doneMutex);
+    doneCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [] {
+        return status.load() != OFFSET_COMPENSATION_RUNNING;
+    });
+
+    return status.load();
+}
+
+void offsetCompensationCancel()
+{
+    if (!worker.joinable()) {return;}
+
+    {
+        std::lock_guard <std::mutex> lock(doneMutex);
+        cancelRequested.store(true);
+        doneCondition.notify_all();
+    }
+    if (worker.get_id() != std::this_thread::get_id()) {
+        worker.join();
+    } else {
+        /*! Called from the completion callback: the thread is about to end anyway. */
+        worker.detach();
+    }
+}
+
+EdlErrorCode_t offsetMeasure(const OffsetCompensationConfig_t &measureConfig, double &residual)
+{
+    EdlErrorCode_t res;
+    EdlCommandStruct_t commandStruct;
+
+    residual = 0.0;
+    if (!(measureConfig.windowSeconds > 0.0) || measureConfig.windowsNum == 0 || acquisitionRunning()) {return EdlUnknownError;}
+    offsetCompensationCancel();
+
+	/*! A compensation left enabled, e.g. by a process that crashed meanwhile, would hide the offset. */
+    commandStruct.checkboxChecked = EDL_CHECKBOX_UNCHECKED;
+    res = sendCommand(EdlCommandDigitalCompensation, commandStruct, true);
+    if (res != EdlSuccess) {return res;}
+    res = applyZeroProtocol();
+    if (res != EdlSuccess) {return res;}
+    {
+        std::lock_guard <std::mutex> lock(edlMutex());
+        res = purgeData();
+    }
+    if (res != EdlSuccess) {return res;}
+
+    double rateHz = samplingRateHz(commandRadioId(EdlCommandSamplingRate));
+    unsigned int length = std::max(1u, (unsigned int)(measureConfig.windowSeconds*(rateHz > 0.0 ? rateHz : 1250.0)));
+    std::vector <float> buffer;
+    buffer.reserve((size_t)OFFSET_POLL_PACKETS*EDL_CHANNEL_NUM);
+    double sums[EDL_CHANNEL_NUM] = {0.0};
+    unsigned int samples = 0;
+    unsigned int windows = 0;
+	/*! Twice the time the windows take, in case the driver lags. */
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()+
+        std::chrono::milliseconds((long long)(2000.0*measureConfig.windowsNum*length/(rateHz > 0.0 ? rateHz : 1250.0))+100);
+
+    while (windows < measureConfig.windowsNum) {
+        if (std::chrono::steady_clock::now() > deadline) {return EdlNotEnoughAvailableDataError;}
+
+        unsigned int got = 0;
+        res = readDriver(std::min((unsigned int)OFFSET_POLL_PACKETS, length-samples), buffer, got);
+        if (res != EdlSuccess) {return res;}
+        if (got == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        for (unsigned int packetIdx = 0; packetIdx < got; packetIdx++) {
+            for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+                sums[channelIdx] += buffer[(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx];
+            }
+        }
+        samples += got;
+        if (samples < length) {continue;}
+
+        for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            residual = std::max(residual, std::fabs(sums[channelIdx]/samples));
+            sums[channelIdx] = 0.0;
+        }
+        samples = 0;
+        windows++;
+    }
+
+    return EdlSuccess;
+}
+
+void offsetCompensationRestore(double residual)
+{
+    offsetCompensationCancel();
+
+    std::lock_guard <std::mutex> lock(doneMutex);
+    residualOffset.store(residual);
+    status.store(OFFSET_COMPENSATION_CONVERGED);
+    doneCondition.notify_all();
+}
@@ -0,0 +1,81 @@
+/*! \file e1_offset.h
+ * \brief Declares the asynchronous digital offset compensation.
+ *
+ * The compensation is enabled on the device, then the current channels are monitored and the compensation is
+ * disabled as soon as their offset has settled within a tolerance, or when a timeout expires.
+ * Only one compensation runs at a time; its status doubles as the completion handle.
+ */
+#ifndef E1_OFFSET_H
+#define E1_OFFSET_H
+
+#include "edl.h"
+
+/*! Values returned by offsetCompensationStatus and passed to #OffsetCompensationCallback_t. */
+#define OFFSET_COMPENSATION_IDLE 0 /*!< Never started. */
+#define OFFSET_COMPENSATION_RUNNING 1
+#define OFFSET_COMPENSATION_CONVERGED 2 /*!< The offset settled within the tolerance. */
+#define OFFSET_COMPENSATION_TIMED_OUT 3 /*!< The timeout expired first; the compensation was disabled anyway, as before. */
+#define OFFSET_COMPENSATION_CANCELLED 4
+#define OFFSET_COMPENSATION_FAILED 5 /*!< A command was rejected by the device. */
+
+/*! \def OFFSET_COMPENSATION_TIMEOUT_MS
+ * \brief Default timeout: the fixed wait used before the compensation was monitored.
+ */
+#define OFFSET_COMPENSATION_TIMEOUT_MS 5000
+
+/*! \struct OffsetCompensationConfig_t
+ * \brief Convergence criterion.
+ */
+typedef struct {
+    double tolerance; /*!< Largest residual offset accepted on every current channel, in the channel unit. */
+    double windowSeconds; /*!< The offset is the mean over windows of this length. */
+    unsigned int windowsNum; /*!< Consecutive windows that must be within \a tolerance. */
+    unsigned int timeoutMs; /*!< The compensation is disabled after this time whatever the offset. */
+} OffsetCompensationConfig_t;
+
+/*! \brief Function called from the compensation thread when the compensation ends.
+ *
+ * \param status [in] OFFSET_COMPENSATION_* final status.
+ * \param residual [in] Largest absolute offset of the current channels over the last window.
+ * \param context [in] Pointer given to offsetCompensationStart.
+ */
+typedef void (*OffsetCompensationCallback_t)(int status, double residual, void * context);
+
+/*! \brief Fills \a config with the default criterion. */
+void offsetCompensationDefaults(OffsetCompensationConfig_t &config);
+
+/*! \brief Sets the constant protocol at 0mV, enables the digital compensation and returns.
+ * A background thread disables it once the offset has converged or the timeout expired, then calls \a callback.
+ * The current is monitored through the acquisition thread if it runs, otherwise by direct driver reads of the packets
+ * acquired after the compensation was enabled: older ones are purged, and the acquisition ring is never read.
+ * A compensation still running is cancelled first.
+ *
+ * \param callback [in] Can be NULL.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t offsetCompensationStart(const OffsetCompensationConfig_t &config, OffsetCompensationCallback_t callback, void * context);
+
+/*! \brief Returns the OFFSET_COMPENSATION_* status of the last compensation and its latest residual offset. */
+int offsetCompensationStatus(double &residual);
+
+/*! \brief Blocks until the compensation ends or \a timeoutMs expires. \return OFFSET_COMPENSATION_* status. */
+int offsetCompensationWait(unsigned int timeoutMs);
+
+/*! \brief Stops a running compensation, disabling it on the device, and joins its thread. */
+void offsetCompensationCancel();
+
+/*! \brief Measures the offset left without compensating: sets the constant protocol at 0mV with the compensation disabled,
+ * discards the packets acquired before, then reads \a config.windowsNum windows of \a config.windowSeconds.
+ * Reads the driver directly, so the acquisition thread must not be running.
+ *
+ * \param residual [out] Largest absolute offset of the current channels over the windows.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t offsetMeasure(const OffsetCompensationConfig_t &config, double &residual);
+
+/*! \brief Reports a compensation that was not run as converged with \a residual, e.g. one found still holding after
+ * a reconnection: offsetCompensationStatus and offsetCompensationWait then return #OFFSET_COMPENSATION_CONVERGED.
+ */
+void offsetCompensationRestore(double residual);
+
+#endif // E1_OFFSET_H
@@ -0,0 +1,590 @@
+/* e1_protocol.cpp
+Protocol sequencer: protocol files compiled once into timed command batches, applied from a background thread */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "e1_protocol.h"
+#include "e1_acquisition.h"
+#include "e1_recorder.h"
+#include "e1_scheduler.h"
+#include "e1_stats.h"
+
+/*! Longest uninterrupted sleep of the sequencer thread, so that a cancel is served quickly. */
+#define PROTOCOL_SLEEP_SLICE_NS 10000000ULL
+
+/*! Statement of a protocol file. Repeats hold their body. */
+typedef struct Statement {
+    enum {Set, Apply, Wait, Sweep, Ramp, Repeat} kind;
+    unsigned int line;
+    EdlCommandId_t commandId;
+    double args[4];
+    unsigned int count;
+    std::vector <struct Statement> body;
+} Statement_t;
+
+/*! Expansion state while compiling. */
+typedef struct {
+    double atMs;
+    ProtocolStep_t pending;
+    ProtocolState_t state;
+    ProtocolRules_t rules;
+    Protocol_t * protocol;
+    char * error;
+} Compiler_t;
+
+static std::thread sequencer;
+static std::atomic <bool> cancelRequested(false);
+static std::atomic <int> status(PROTOCOL_IDLE);
+static std::atomic <unsigned int> stepsApplied(0);
+
+static std::mutex doneMutex;
+static std::condition_variable doneCondition;
+
+/*! Protocol being run and its marks, the latter guarded by marksMutex. */
+static Protocol_t running;
+static std::mutex marksMutex;
+static std::vector <ProtocolMark_t> marks;
+
+/*! Rules checked by the compiler and before starting, guarded by rulesMutex. */
+static std::mutex rulesMutex;
+static ProtocolRules_t rules = {PROTOCOL_DEFAULT_MAX_MV, 1, 1, 1};
+
+static const struct {
+    const char * name;
+    EdlCommandId_t commandId;
+} parameters[] = {
+    {"MainTrial", EdlCommandMainTrial},
+    {"Vhold", EdlCommandVhold},
+    {"Vfp", EdlCommandVfp},
+    {"Vstep", EdlCommandVstep},
+    {"Tstep", EdlCommandTstep},
+    {"Tpu", EdlCommandTpu},
+    {"Tpe", EdlCommandTpe},
+    {"N", EdlCommandN},
+    {"Ne", EdlCommandNe},
+    {"Vamp", EdlCommandVamp}
+};
+
+static const char * parameterName(EdlCommandId_t commandId)
+{
+    for (size_t parameterIdx = 0; parameterIdx < sizeof(parameters)/sizeof(parameters[0]); parameterIdx++) {
+        if (parameters[parameterIdx].commandId == commandId) {return parameters[parameterIdx].name;}
+    }
+    return "?";
+}
+
+static bool parameterId(const std::string &name, EdlCommandId_t &commandId)
+{
+    for (size_t parameterIdx = 0; parameterIdx < sizeof(parameters)/sizeof(parameters[0]); parameterIdx++) {
+#ifdef _WIN32
+        if (_stricmp(parameters[parameterIdx].name, name.c_str()) == 0) {
+#else
+        if (strcasecmp(parameters[parameterIdx].name, name.c_str()) == 0) {
+#endif
+            commandId = parameters[parameterIdx].commandId;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fail(char * error, unsigned int line, const char * format, ...)
+{
+    if (error == NULL) {return;}
+
+    va_list args;
+    int n = snprintf(error, PROTOCOL_ERROR_BYTES, "line %u: ", line);
+    va_start(args, format);
+    vsnprintf(error+n, PROTOCOL_ERROR_BYTES-n, format, args);
+    va_end(args);
+}
+
+static ProtocolRules_t currentRules()
+{
+    std::lock_guard <std::mutex> lock(rulesMutex);
+    return rules;
+}
+
+/*! The rules assumed for EdlCommandApplyProtocol. Rules on unknown parameters pass. */
+static bool checkRules(const ProtocolRules_t &checked, const ProtocolState_t &state, unsigned int line, char * error)
+{
+    static const EdlCommandId_t voltages[] = {EdlCommandVhold, EdlCommandVfp, EdlCommandVstep, EdlCommandVamp};
+    static const EdlCommandId_t times[] = {EdlCommandTstep, EdlCommandTpu, EdlCommandTpe};
+    static const EdlCommandId_t counts[] = {EdlCommandMainTrial, EdlCommandN, EdlCommandNe};
+
+    for (size_t idx = 0; idx < sizeof(voltages)/sizeof(voltages[0]); idx++) {
+        EdlCommandId_t id = voltages[idx];
+        if (checked.maxAbsMv > 0.0 && state.known[id] && std::fabs(state.values[id]) > checked.maxAbsMv) {
+            fail(error, line, "|%s| = %g mV exceeds %g mV", parameterName(id), std::fabs(state.values[id]), checked.maxAbsMv);
+            return false;
+        }
+    }
+    for (size_t idx = 0; idx < sizeof(times)/sizeof(times[0]); idx++) {
+        EdlCommandId_t id = times[idx];
+        if (checked.nonNegativeTimes && state.known[id] && state.values[id] < 0.0) {
+            fail(error, line, "%s = %g ms is negative", parameterName(id), state.values[id]);
+            return false;
+        }
+    }
+    for (size_t idx = 0; idx < sizeof(counts)/sizeof(counts[0]); idx++) {
+        EdlCommandId_t id = counts[idx];
+        if (checked.integerCounts && state.known[id] && (state.values[id] < 0.0 || state.values[id] != std::floor(state.values[id]))) {
+            fail(error, line, "%s = %g is not a non-negative integer", parameterName(id), state.values[id]);
+            return false;
+        }
+    }
+
+	/*! Every trial but the constant one (0) pulses with period Tpe and pulse length Tpu. */
+    if (checked.pulseTimes && state.known[EdlCommandMainTrial] && state.values[EdlCommandMainTrial] != 0.0) {
+        if (state.known[EdlCommandTpu] && state.values[EdlCommandTpu] <= 0.0) {
+            fail(error, line, "Tpu must be positive for trial %g", state.values[EdlCommandMainTrial]);
+            return false;
+        }
+        if (state.known[EdlCommandTpu] && state.known[EdlCommandTpe] && state.values[EdlCommandTpe] < state.values[EdlCommandTpu]) {
+            fail(error, line, "Tpe = %g ms is shorter than Tpu = %g ms", state.values[EdlCommandTpe], state.values[EdlCommandTpu]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool parseNumber(const std::string &token, double &value)
+{
+    char * end;
+    value = strtod(token.c_str(), &end);
+    return !token.empty() && *end == '\0' && std::isfinite(value);
+}
+
+/*! Parses the statements up to the matching "end" (or the end of the text if \a depth is 0). */
+static bool parse(std::istream &in, unsigned int &line, unsigned int depth, std::vector <Statement_t> &statements, char * error)
+{
+    std::string text;
+
+    while (std::getline(in, text)) {
+        line++;
+        size_t comment = text.find('#');
+        if (comment != std::string::npos) {text.erase(comment);}
+
+        std::istringstream tokens(text);
+        std::vector <std::string> words;
+        std::string word;
+        while (tokens >> word) {words.push_back(word);}
+        if (words.empty()) {continue;}
+
+        const std::string &keyword = words[0];
+        Statement_t statement;
+        statement.line = line;
+        statement.commandId = EdlCommandIdNum;
+        statement.count = 0;
+        unsigned int argsNum;
+
+        if (keyword == "end") {
+            if (depth == 0) {
+                fail(error, line, "end without repeat");
+                return false;
+            }
+            return true;
+        } else if (keyword == "set") {
+            statement.kind = Statement_t::Set;
+            argsNum = 1;
+        } else if (keyword == "apply") {
+            statement.kind = Statement_t::Apply;
+            argsNum = 0;
+        } else if (keyword == "wait") {
+            statement.kind = Statement_t::Wait;
+            argsNum = 1;
+        } else if (keyword == "sweep") {
+            statement.kind = Statement_t::Sweep;
+            argsNum = 4;
+        } else if (keyword == "ramp") {
+            statement.kind = Statement_t::Ramp;
+            argsNum = 4;
+        } else if (keyword == "repeat") {
+            statement.kind = Statement_t::Repeat;
+            argsNum = 1;
+        } else {
+            fail(error, line, "unknown statement '%s'", keyword.c_str());
+            return false;
+        }
+
+        unsigned int firstArg = 1;
+        if (statement.kind == Statement_t::Set || statement.kind == Statement_t::Sweep || statement.kind == Statement_t::Ramp) {
+            if (words.size() < 2 || !parameterId(words[1], statement.commandId)) {
+                fail(error, line, "'%s' needs a protocol parameter", keyword.c_str());
+                return false;
+            }
+            firstArg = 2;
+        }
+        if (words.size() != firstArg+argsNum) {
+            fail(error, line, "'%s' takes %u numbers", keyword.c_str(), argsNum);
+            return false;
+        }
+        for (unsigned int argIdx = 0; argIdx < argsNum; argIdx++) {
+            if (!parseNumber(words[firstArg+argIdx], statement.args[argIdx])) {
+                fail(error, line, "'%s' is not a number", words[firstArg+argIdx].c_str());
+                return false;
+            }
+        }
+
+        if (statement.kind == Statement_t::Wait && statement.args[0] < 0.0) {
+            fail(error, line, "negative wait");
+            return false;
+        }
+        if (statement.kind == Statement_t::Sweep && (statement.args[2] <= 0.0 || statement.args[3] < 0.0)) {
+            fail(error, line, "sweep needs a positive increment and a non-negative dwell");
+            return false;
+        }
+        if (statement.kind == Statement_t::Ramp &&
+                (statement.args[2] < 1.0 || statement.args[2] != std::floor(statement.args[2]) || statement.args[3] < 0.0)) {
+            fail(error, line, "ramp needs a positive integer number of steps and a non-negative duration");
+            return false;
+        }
+        if (statement.kind == Statement_t::Repeat) {
+            if (statement.args[0] < 0.0 || statement.args[0] != std::floor(statement.args[0])) {
+                fail(error, line, "repeat needs a non-negative integer count");
+                return false;
+            }
+            statement.count = (unsigned int)statement.args[0];
+            if (!parse(in, line, depth+1, statement.body, error)) {return false;}
+        }
+
+        statements.push_back(statement);
+    }
+
+    if (depth > 0) {
+        fail(error, line, "repeat without end");
+        return false;
+    }
+    return true;
+}
+
+static void stack(Compiler_t &compiler, EdlCommandId_t commandId, double value)
+{
+    ProtocolStep_t &pending = compiler.pending;
+    unsigned int settingIdx = 0;
+
+	/*! A parameter set twice before an apply is sent once, with its last value. */
+    while (settingIdx < pending.settingsNum && pending.commandIds[settingIdx] != commandId) {settingIdx++;}
+    if (settingIdx == pending.settingsNum) {pending.settingsNum++;}
+    pending.commandIds[settingIdx] = commandId;
+    pending.values[settingIdx] = value;
+    compiler.state.values[commandId] = value;
+    compiler.state.known[commandId] = true;
+}
+
+static EdlErrorCode_t apply(Compiler_t &compiler, unsigned int line)
+{
+    if (!checkRules(compiler.rules, compiler.state, line, compiler.error)) {return EdlViolatedTrialRuleError;}
+    if (compiler.protocol->steps.size() >= PROTOCOL_MAX_STEPS) {
+        fail(compiler.error, line, "more than %u steps", PROTOCOL_MAX_STEPS);
+        return EdlUnknownError;
+    }
+
+    compiler.pending.atMs = compiler.atMs;
+    compiler.pending.line = line;
+    compiler.protocol->steps.push_back(compiler.pending);
+    compiler.pending.settingsNum = 0;
+
+    return EdlSuccess;
+}
+
+static EdlErrorCode_t emit(Compiler_t &compiler, const std::vector <Statement_t> &statements)
+{
+    EdlErrorCode_t res;
+
+    for (size_t statementIdx = 0; statementIdx < statements.size(); statementIdx++) {
+        const Statement_t &statement = statements[statementIdx];
+        switch (statement.kind) {
+        case Statement_t::Set:
+            stack(compiler, statement.commandId, statement.args[0]);
+            break;
+
+        case Statement_t::Apply:
+            res = apply(compiler, statement.line);
+            if (res != EdlSuccess) {return res;}
+            break;
+
+        case Statement_t::Wait:
+            compiler.atMs += statement.args[0];
+            break;
+
+        case Statement_t::Sweep: {
+            double from = statement.args[0];
+            double to = statement.args[1];
+            double increment = to >= from ? statement.args[2] : -statement.args[2];
+            unsigned long long valuesNum = (unsigned long long)std::floor(std::fabs(to-from)/statement.args[2]+1e-9)+1;
+            if (valuesNum > PROTOCOL_MAX_STEPS) {
+                fail(compiler.error, statement.line, "more than %u steps", PROTOCOL_MAX_STEPS);
+                return EdlUnknownError;
+            }
+            for (unsigned long long valueIdx = 0; valueIdx < valuesNum; valueIdx++) {
+                stack(compiler, statement.commandId, from+valueIdx*increment);
+                res = apply(compiler, statement.line);
+                if (res != EdlSuccess) {return res;}
+                compiler.atMs += statement.args[3];
+            }
+            break;
+        }
+
+        case Statement_t::Ramp: {
+			/*! steps+1 values, the last one applied <ms> after the first and left in effect. */
+            unsigned int stepsNum = (unsigned int)statement.args[2];
+            if (stepsNum >= PROTOCOL_MAX_STEPS) {
+                fail(compiler.error, statement.line, "more than %u steps", PROTOCOL_MAX_STEPS);
+                return EdlUnknownError;
+            }
+            double start = compiler.atMs;
+            for (unsigned int valueIdx = 0; valueIdx <= stepsNum; valueIdx++) {
+                compiler.atMs = start+statement.args[3]*valueIdx/stepsNum;
+                stack(compiler, statement.commandId, statement.args[0]+(statement.args[1]-statement.args[0])*valueIdx/stepsNum);
+                res = apply(compiler, statement.line);
+                if (res != EdlSuccess) {return res;}
+            }
+            break;
+        }
+
+        case Statement_t::Repeat:
+            for (unsigned int repeatIdx = 0; repeatIdx < statement.count; repeatIdx++) {
+                res = emit(compiler, statement.body);
+                if (res != EdlSuccess) {return res;}
+            }
+            break;
+        }
+    }
+
+    return EdlSuccess;
+}
+
+void protocolRulesDefaults(ProtocolRules_t &defaults)
+{
+    defaults.maxAbsMv = PROTOCOL_DEFAULT_MAX_MV;
+    defaults.nonNegativeTimes = 1;
+    defaults.integerCounts = 1;
+    defaults.pulseTimes = 1;
+}
+
+void protocolSetRules(const ProtocolRules_t &newRules)
+{
+    std::lock_guard <std::mutex> lock(rulesMutex);
+    rules = newRules;
+}
+
+EdlErrorCode_t protocolCompile(const char * text, Protocol_t &protocol, const ProtocolState_t * initial, char * error)
+{
+    EdlErrorCode_t res;
+    std::vector <Statement_t> statements;
+    unsigned int line = 0;
+    Compiler_t compiler;
+
+    if (error != NULL) {error[0] = '\0';}
+    protocol.steps.clear();
+    protocol.durationMs = 0.0;
+    if (text == NULL) {return EdlUnknownError;}
+
+    std::istringstream in(text);
+    if (!parse(in, line, 0, statements, error)) {return EdlUnknownError;}
+
+    compiler.atMs = 0.0;
+    compiler.pending.settingsNum = 0;
+    compiler.rules = currentRules();
+    compiler.protocol = &protocol;
+    compiler.error = error;
+    if (initial != NULL) {
+        compiler.state = *initial;
+    } else {
+        memset(&compiler.state, 0, sizeof(compiler.state));
+    }
+
+    res = emit(compiler, statements);
+    if (res == EdlSuccess && compiler.pending.settingsNum > 0) {
+        fail(error, line, "parameters set after the last apply are never applied");
+        res = EdlUnknownError;
+    }
+    if (res != EdlSuccess) {
+        protocol.steps.clear();
+        return res;
+    }
+    protocol.durationMs = compiler.atMs;
+
+    return EdlSuccess;
+}
+
+EdlErrorCode_t protocolLoad(const char * path, Protocol_t &protocol, char * error)
+{
+    if (error != NULL) {error[0] = '\0';}
+    FILE * f = path != NULL ? fopen(path, "rb") : NULL;
+    if (f == NULL) {
+        if (error != NULL) {snprintf(error, PROTOCOL_ERROR_BYTES, "cannot open %s", path != NULL ? path : "(null)");}
+        return EdlUnknownError;
+    }
+
+    std::string text;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {text.append(buffer, n);}
+    fclose(f);
+
+    return protocolCompile(text.c_str(), protocol, NULL, error);
+}
+
+/*! Replays the steps over what the device has now: catches rules on parameters the file leaves to the device. */
+static bool validate(const Protocol_t &protocol, char * error)
+{
+    ProtocolState_t state;
+    EdlCommandStruct_t commandStruct;
+    const ProtocolRules_t checked = currentRules();
+
+    for (unsigned int commandIdx = 0; commandIdx < EdlCommandIdNum; commandIdx++) {
+        state.known[commandIdx] = configShadow((EdlCommandId_t)commandIdx, commandStruct);
+        state.values[commandIdx] = commandStruct.value;
+    }
+
+    for (size_t stepIdx = 0; stepIdx < protocol.steps.size(); stepIdx++) {
+        const ProtocolStep_t &step = protocol.steps[stepIdx];
+        for (unsigned int settingIdx = 0; settingIdx < step.settingsNum; settingIdx++) {
+            state.values[step.commandIds[settingIdx]] = step.values[settingIdx];
+            state.known[step.commandIds[settingIdx]] = true;
+        }
+        if (!checkRules(checked, state, step.line, error)) {return false;}
+    }
+
+    return true;
+}
+
+/*! Sends one step as a configuration transaction: the parameters are stacked, EdlCommandApplyProtocol sends them all.
+ * A rejected parameter aborts the step: the protocol is not applied with the previous value of that parameter. */
+static EdlErrorCode_t send(const ProtocolStep_t &step)
+{
+    EdlErrorCode_t res = EdlSuccess;
+    EdlCommandStruct_t commandStruct;
+
+    ConfigTransaction transaction;
+    for (unsigned int settingIdx = 0; settingIdx < step.settingsNum; settingIdx++) {
+        commandStruct.value = step.values[settingIdx];
+        res = sendCommand(step.commandIds[settingIdx], commandStruct, false);
+        if (res != EdlSuccess) {return res;}
+    }
+    commandStruct.buttonPressed = EDL_BUTTON_PRESSED;
+    sendCommand(EdlCommandApplyProtocol, commandStruct, true);
+
+    return transaction.commit();
+}
+
+static void finish(int finalStatus)
+{
+    std::lock_guard <std::mutex> lock(doneMutex);
+    status.store(finalStatus);
+    doneCondition.notify_all();
+}
+
+static void sequencerLoop()
+{
+    uint64_t startNs = statsNowNs();
+
+    for (size_t stepIdx = 0; stepIdx < running.steps.size(); stepIdx++) {
+        const ProtocolStep_t &step = running.steps[stepIdx];
+        uint64_t deadlineNs = startNs+(uint64_t)(step.atMs*1e6);
+
+        uint64_t nowNs;
+        while (!cancelRequested.load() && (nowNs = statsNowNs()) < deadlineNs) {
+            schedulerSleepUntil(std::min(deadlineNs, nowNs+(uint64_t)PROTOCOL_SLEEP_SLICE_NS));
+        }
+        if (cancelRequested.load()) {
+            finish(PROTOCOL_CANCELLED);
+            return;
+        }
+
+        ProtocolMark_t mark;
+        mark.step = (unsigned int)stepIdx;
+        mark.line = step.line;
+        mark.plannedMs = step.atMs;
+		/*! The step takes effect somewhere between the packets produced right before and right after the send. */
+        uint64_t packet, origin;
+        mark.streamPacketBefore = acquisitionStreamPosition(packet) == EdlSuccess ? (long long)packet : -1;
+        mark.appliedMs = (statsNowNs()-startNs)*1e-6;
+        mark.error = send(step);
+
+		/*! Packets still in the driver were produced before the step: the step shows from the next one on. */
+        mark.streamPacket = acquisitionStreamPosition(packet) == EdlSuccess ? (long long)packet : -1;
+        mark.recordingPacket = mark.streamPacket >= 0 && recorderStreamOrigin(origin) && packet >= origin ? (long long)(packet-origin) : -1;
+
+        {
+            std::lock_guard <std::mutex> lock(marksMutex);
+            marks.push_back(mark);
+        }
+        if (mark.error != EdlSuccess) {
+            finish(PROTOCOL_FAILED);
+            return;
+        }
+        stepsApplied.fetch_add(1);
+    }
+
+    finish(PROTOCOL_DONE);
+}
+
+EdlErrorCode_t protocolStart(const Protocol_t &protocol, char * error)
+{
+    if (error != NULL) {error[0] = '\0';}
+    protocolCancel();
+    if (!validate(protocol, error)) {return EdlViolatedTrialRuleError;}
+
+    running = protocol;
+    {
+        std::lock_guard <std::mutex> lock(marksMutex);
+        marks.clear();
+        marks.reserve(protocol.steps.size());
+    }
+    stepsApplied.store(0);
+    cancelRequested.store(false);
+    status.store(PROTOCOL_RUNNING);
+    sequencer = std::thread(sequencerLoop);
+
+    return EdlSuccess;
+}
+
+int protocolStatus(unsigned int &applied)
+{
+    applied = stepsApplied.load();
+    return status.load();
+}
+
+int protocolWait(unsigned int timeoutMs)
+{
+    std::unique_lock <std::mutex> lock(doneMutex);
+    doneCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [] {
+        return status.load() != PROTOCOL_RUNNING;
+    });
+
+    return status.load();
+}
+
+void protocolCancel()
+{
+    cancelRequested.store(true);
+    if (sequencer.joinable()) {sequencer.join();}
+}
+
+unsigned int protocolMarks(unsigned int first, ProtocolMark_t * out, unsigned int maxMarks)
+{
+    std::lock_guard <std::mutex> lock(marksMutex);
+    unsigned int copied = 0;
+
+    while (first+copied < marks.size() && copied < maxMarks) {
+        out[copied] = marks[first+copied];
+        copied++;
+    }
+
+    return copied;
+}
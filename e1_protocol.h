@@ -0,0 +1,142 @@
+/*! \file e1_protocol.h
+ * \brief Declares the protocol sequencer: declarative protocol files, validated offline and compiled into timed command batches.
+ *
+ * A protocol file is plain text, one statement per line, '#' starts a comment:
+ * \code
+ * set <parameter> <value>                         # stacks a protocol parameter (MainTrial, Vhold, Vfp, Vstep, Tstep, Tpu, Tpe, N, Ne, Vamp)
+ * apply                                           # applies the stacked parameters (EdlCommandApplyProtocol)
+ * wait <ms>                                       # the next step starts this much later
+ * sweep <parameter> <from> <to> <increment> <ms>  # set, apply, wait for each value from <from> to <to> included
+ * ramp <parameter> <from> <to> <steps> <ms>       # the same with <steps> equal increments over <ms> in total
+ * repeat <count> ... end                          # repeats the enclosed statements, can be nested
+ * \endcode
+ * Compiling expands the statements into steps: the parameters set before each apply, with the time of the apply
+ * from the start of the protocol. Every apply is checked against the assumed trial rules (see ProtocolRules_t) to catch
+ * mistakes early; the device may still reject a step with #EdlViolatedTrialRuleError. The sequencer then sends each
+ * step as one configuration transaction (see configBegin) from a background thread, and tags it with the stream index
+ * at which it took effect.
+ */
+#ifndef E1_PROTOCOL_H
+#define E1_PROTOCOL_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "edl.h"
+
+/*! Values returned by protocolStatus. */
+#define PROTOCOL_IDLE 0 /*!< Never started. */
+#define PROTOCOL_RUNNING 1
+#define PROTOCOL_DONE 2 /*!< Every step was applied. */
+#define PROTOCOL_CANCELLED 3
+#define PROTOCOL_FAILED 4 /*!< A step was rejected by the device; see ProtocolMark_t::error. */
+
+/*! \def PROTOCOL_MAX_STEPS
+ * \brief Largest number of steps of a compiled protocol, to catch runaway repeats.
+ */
+#define PROTOCOL_MAX_STEPS 100000
+
+/*! \def PROTOCOL_DEFAULT_MAX_MV
+ * \brief Default of ProtocolRules_t::maxAbsMv: an assumption, the device documentation gives no voltage range.
+ */
+#define PROTOCOL_DEFAULT_MAX_MV 500.0
+
+/*! \def PROTOCOL_ERROR_BYTES
+ * \brief Size of the compilation error message buffer.
+ */
+#define PROTOCOL_ERROR_BYTES 256
+
+/*! \struct ProtocolState_t
+ * \brief Protocol parameters in effect, as far as they are known.
+ */
+typedef struct {
+    double values[EdlCommandIdNum];
+    bool known[EdlCommandIdNum];
+} ProtocolState_t;
+
+/*! \struct ProtocolRules_t
+ * \brief Trial rules every apply is checked against before anything is sent.
+ * EDL::setCommand reports #EdlViolatedTrialRuleError without saying which rules it enforces: these are assumptions
+ * about them, to be adjusted to the device with protocolSetRules. A protocol that passes them may still be rejected.
+ */
+typedef struct {
+    double maxAbsMv; /*!< Largest absolute Vhold, Vfp, Vstep and Vamp, in mV; 0 leaves them unchecked. */
+    int nonNegativeTimes; /*!< Tstep, Tpu and Tpe must not be negative. */
+    int integerCounts; /*!< MainTrial, N and Ne must be non-negative integers. */
+    int pulseTimes; /*!< Every trial but the constant one (0) needs Tpu > 0 and Tpe >= Tpu. */
+} ProtocolRules_t;
+
+/*! \struct ProtocolStep_t
+ * \brief One command batch: the parameters set since the previous step, then EdlCommandApplyProtocol.
+ */
+typedef struct {
+    double atMs; /*!< Time of the step from the start of the protocol. */
+    unsigned int line; /*!< Line of the apply in the protocol file. */
+    unsigned int settingsNum;
+    EdlCommandId_t commandIds[EdlCommandIdNum];
+    double values[EdlCommandIdNum];
+} ProtocolStep_t;
+
+/*! \struct Protocol_t
+ * \brief Compiled protocol.
+ */
+typedef struct {
+    std::vector <ProtocolStep_t> steps;
+    double durationMs; /*!< Time of the last step plus the waits after it. */
+} Protocol_t;
+
+/*! \struct ProtocolMark_t
+ * \brief Record of an applied step, for aligning the analysis with the protocol.
+ */
+typedef struct {
+    unsigned int step; /*!< Index of the step in Protocol_t::steps. */
+    unsigned int line; /*!< Line of the apply in the protocol file. */
+    double plannedMs; /*!< ProtocolStep_t::atMs. */
+    double appliedMs; /*!< When the batch was actually sent, from the start of the protocol. */
+    long long streamPacket; /*!< First packet produced after the step was applied (see acquisitionStreamPosition); -1 if the acquisition is not running. */
+    long long recordingPacket; /*!< The same packet as an index of the current recording; -1 if not recording. */
+    int error; /*!< #EdlErrorCode_t returned by the device. A step with a rejected parameter is not applied. */
+    long long streamPacketBefore; /*!< First packet produced after the send started: the step took effect from a packet between
+                                   * this one and \a streamPacket. -1 if the acquisition is not running. */
+} ProtocolMark_t;
+
+/*! \brief Fills \a rules with the defaults: #PROTOCOL_DEFAULT_MAX_MV and every other rule checked. */
+void protocolRulesDefaults(ProtocolRules_t &rules);
+
+/*! \brief Sets the rules protocolCompile and protocolStart check from then on. */
+void protocolSetRules(const ProtocolRules_t &rules);
+
+/*! \brief Compiles protocol \a text and validates every step against the trial rules (see protocolSetRules).
+ *
+ * \param initial [in] Parameters assumed before the first statement, NULL if none is known.
+ * Rules that involve unknown parameters are checked again by protocolStart, with the parameters the device has.
+ * \param error [out] #PROTOCOL_ERROR_BYTES bytes, receives "line N: reason" on failure. Can be NULL.
+ * \return #EdlErrorCode_t Error code: #EdlViolatedTrialRuleError for rule violations, #EdlUnknownError for syntax errors.
+ */
+EdlErrorCode_t protocolCompile(const char * text, Protocol_t &protocol, const ProtocolState_t * initial, char * error);
+
+/*! \brief Reads and compiles the protocol file \a path, see protocolCompile. */
+EdlErrorCode_t protocolLoad(const char * path, Protocol_t &protocol, char * error);
+
+/*! \brief Runs \a protocol from a background thread, stopping any protocol still running first.
+ * The steps are validated again with the parameters the device currently has before anything is sent.
+ *
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t protocolStart(const Protocol_t &protocol, char * error);
+
+/*! \brief Returns the PROTOCOL_* status and the number of steps applied so far. */
+int protocolStatus(unsigned int &stepsApplied);
+
+/*! \brief Blocks until the protocol ends or \a timeoutMs expires. \return PROTOCOL_* status. */
+int protocolWait(unsigned int timeoutMs);
+
+/*! \brief Stops a running protocol between two steps and joins its thread. Applied steps stay in effect. */
+void protocolCancel();
+
+/*! \brief Copies the marks of the steps applied by the last protocol, from the \a first-th on.
+ * \return Number of marks copied, at most \a maxMarks.
+ */
+unsigned int protocolMarks(unsigned int first, ProtocolMark_t * marks, unsigned int maxMarks);
+
+#endif // E1_PROTOCOL_H
@@ -0,0 +1,145 @@
+/* e1_publisher.cpp
+Producer of the shared memory publish ring: one copy per read, never waiting for the readers */
+
+#include <cstring>
+#include <mutex>
+
+#include "e1_publisher.h"
+#include "e1_acquisition.h"
+
+static std::mutex publisherMutex;
+static ShmHeader_t * header = NULL;
+static float * data = NULL;
+static uint64_t bytes = 0;
+static void * handle = NULL;
+static char name[SHM_NAME_MAX];
+
+/*! Runs on the acquisition thread. The packets are announced in reserved before they are copied, so that the
+ * readers can tell which of the packets they hold may have been overwritten (see shmReaderRelease). */
+static void publisherSink(const float * packets, unsigned int packetsNum, void * context)
+{
+    (void)context;
+    uint32_t capacity = header->capacity;
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+
+    if (packetsNum > capacity) {
+        /*! Only the last capacity packets would survive: skip the others. */
+        head += packetsNum-capacity;
+        packets += (size_t)(packetsNum-capacity)*EDL_CHANNEL_NUM;
+        packetsNum = capacity;
+    }
+
+    header->reserved.store(head+packetsNum, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    unsigned int start = (unsigned int)(head & (capacity-1));
+    unsigned int first = capacity-start;
+    if (first > packetsNum) {first = packetsNum;}
+    memcpy(data+(size_t)start*EDL_CHANNEL_NUM, packets, (size_t)first*EDL_CHANNEL_NUM*sizeof(float));
+    if (packetsNum > first) {
+        memcpy(data, packets+(size_t)first*EDL_CHANNEL_NUM, (size_t)(packetsNum-first)*EDL_CHANNEL_NUM*sizeof(float));
+    }
+
+    header->samplingRateId.store(commandRadioId(EdlCommandSamplingRate), std::memory_order_relaxed);
+    header->rangeId.store(commandRadioId(EdlCommandRange), std::memory_order_relaxed);
+    header->head.store(head+packetsNum, std::memory_order_release);
+}
+
+/*! True if \a existing has the layout of a ring of \a capacity packets. */
+static bool sameLayout(const ShmHeader_t * existing, unsigned int capacity)
+{
+    return existing->magic == SHM_MAGIC && existing->version == SHM_VERSION &&
+           existing->channels == EDL_CHANNEL_NUM && existing->capacity == capacity;
+}
+
+EdlErrorCode_t publisherStart(const char * ringName, unsigned int packets, bool raw)
+{
+    bool created;
+    unsigned int capacity = 1;
+
+    std::lock_guard <std::mutex> lock(publisherMutex);
+    if (header != NULL) {return EdlDeviceAlreadyConnectedError;}
+    if (ringName == NULL) {ringName = SHM_DEFAULT_NAME;}
+    if (strlen(ringName) >= SHM_NAME_MAX) {return EdlUnknownError;}
+    if (packets == 0) {packets = PUBLISHER_DEFAULT_PACKETS;}
+    while (capacity < packets) {capacity <<= 1;}
+
+    bytes = shmBytes(capacity);
+    header = (ShmHeader_t *)shmMap(ringName, bytes, true, created, handle);
+    if (header != NULL && !created && !sameLayout(header, capacity)) {
+		/*! A stale ring of another size: start a new one (on Windows it is still in use, so give up). */
+        shmUnmap(ringName, header, bytes, handle, true);
+        header = (ShmHeader_t *)shmMap(ringName, bytes, true, created, handle);
+        if (header != NULL && !created) {
+            shmUnmap(ringName, header, bytes, handle, false);
+            header = NULL;
+        }
+    }
+    if (header == NULL) {return EdlDeviceConnectionError;}
+
+    strcpy(name, ringName);
+    data = (float *)((char *)header+sizeof(ShmHeader_t));
+    if (created) {
+        /*! The readers check the magic last: everything else must be in place before it. */
+        header->version = SHM_VERSION;
+        header->channels = EDL_CHANNEL_NUM;
+        header->capacity = capacity;
+        header->dataOffset = sizeof(ShmHeader_t);
+        header->session.store(0);
+        header->reserved.store(0);
+        header->head.store(0);
+        for (unsigned int slotIdx = 0; slotIdx < SHM_MAX_READERS; slotIdx++) {
+            header->readers[slotIdx].owner.store(0);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = SHM_MAGIC;
+    }
+    header->producerPid = shmProcessId();
+    header->samplingRateId.store(commandRadioId(EdlCommandSamplingRate));
+    header->rangeId.store(commandRadioId(EdlCommandRange));
+    header->session.fetch_add(1);
+    header->publishing.store(1);
+
+    acquisitionAddSink(publisherSink, NULL, raw);
+
+    return EdlSuccess;
+}
+
+void publisherStop(bool remove)
+{
+    std::lock_guard <std::mutex> lock(publisherMutex);
+    if (header == NULL) {return;}
+
+	/*! Removing the sink waits for the acquisition thread to leave it. */
+    acquisitionRemoveSink(publisherSink, NULL);
+    header->publishing.store(0);
+    shmUnmap(name, header, bytes, handle, remove);
+    header = NULL;
+    data = NULL;
+}
+
+bool publisherRunning()
+{
+    std::lock_guard <std::mutex> lock(publisherMutex);
+    return header != NULL;
+}
+
+uint64_t publisherReaders(unsigned int &readers, uint64_t &slowestCursor)
+{
+    std::lock_guard <std::mutex> lock(publisherMutex);
+    readers = 0;
+    slowestCursor = 0;
+    if (header == NULL) {return 0;}
+
+    uint64_t head = header->head.load();
+    slowestCursor = head;
+    for (unsigned int slotIdx = 0; slotIdx < SHM_MAX_READERS; slotIdx++) {
+        const ShmReaderSlot_t &slot = header->readers[slotIdx];
+        if (slot.owner.load() == 0) {continue;}
+        readers++;
+        uint64_t cursor = slot.cursor.load(std::memory_order_relaxed);
+        if (cursor < slowestCursor) {slowestCursor = cursor;}
+    }
+
+    return head;
+}
@@ -0,0 +1,38 @@
+/*! \file e1_publisher.h
+ * \brief Declares the producer of the shared memory publish ring (see e1_shm.h), fed by the acquisition thread.
+ */
+#ifndef E1_PUBLISHER_H
+#define E1_PUBLISHER_H
+
+#include "edl.h"
+#include "e1_shm.h"
+
+/*! \def PUBLISHER_DEFAULT_PACKETS
+ * \brief Default ring capacity: about 1.3 s at 200kHz.
+ */
+#define PUBLISHER_DEFAULT_PACKETS (1 << 18)
+
+/*! \brief Creates (or reuses) the shared memory ring \a name and publishes every packet read by the acquisition thread into it.
+ * A ring left by an earlier session with the same layout is reused, so attached readers keep their mapping and sequence numbers keep growing.
+ *
+ * \param name [in] Ring name, NULL for #SHM_DEFAULT_NAME.
+ * \param packets [in] Ring capacity, rounded up to a power of two; 0 for #PUBLISHER_DEFAULT_PACKETS.
+ * \param raw [in] Publish the packets before the filter stage (see acquisitionAddSink) instead of after it.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t publisherStart(const char * name, unsigned int packets, bool raw);
+
+/*! \brief Stops publishing. Readers see ShmHeader_t::publishing drop to 0 but stay attached.
+ * \param remove [in] Also remove the name, so that a later publisherStart creates a new ring.
+ */
+void publisherStop(bool remove);
+
+/*! \brief Returns true while publishing. */
+bool publisherRunning();
+
+/*! \brief Number of readers attached and the sequence number of the slowest one.
+ * \return Sequence number past the last packet published.
+ */
+uint64_t publisherReaders(unsigned int &readers, uint64_t &slowestCursor);
+
+#endif // E1_PUBLISHER_H
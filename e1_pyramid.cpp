@@ -0,0 +1,338 @@
+/* e1_pyramid.cpp
+Min/max/mean decimation pyramid fed by the acquisition thread, queried by the live plot */
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define E1_PYRAMID_SSE
+#endif
+
+#include "e1_pyramid.h"
+#include "e1_acquisition.h"
+
+static_assert(PYRAMID_FACTOR == 4, "the SSE kernel reduces groups of 4");
+static_assert(PYRAMID_LEVEL_BINS % PYRAMID_FACTOR == 0, "groups of bins must not straddle the end of a level");
+
+/*! Packets processed between two promotions: keeps the bins written per slice far below #PYRAMID_LEVEL_BINS. */
+#define PYRAMID_SLICE_PACKETS 4096
+
+/*! Bins a query keeps away from the oldest bin of a level, which the producer may be overwriting. */
+#define PYRAMID_GUARD_BINS (PYRAMID_LEVEL_BINS/4)
+
+/*! Longest gap filled by holding the last packet; a longer one restarts the pyramid. About 5 s at 200kHz. */
+#define PYRAMID_MAX_FILL_PACKETS (1 << 20)
+
+typedef struct {
+    float * minBins;
+    float * maxBins;
+    float * meanBins;
+    std::atomic <uint64_t> count; /*!< Bins completed since pyramidStart; bin i is stored at i % #PYRAMID_LEVEL_BINS. */
+    uint64_t promoted; /*!< Bins already merged into the next level. Producer only. */
+} PyramidLevel_t;
+
+/*! Allocated once and never released, so that a query racing a restart reads stale bins rather than freed memory. */
+static std::vector <float> storage;
+static PyramidLevel_t levels[EDL_CHANNEL_NUM][PYRAMID_LEVELS];
+static std::atomic <double> rateHz(0.0);
+static unsigned int rateId = 0;
+static bool feeding = false;
+/*! Odd while the pyramid restarts; queries overlapping a change of it return no data. */
+static std::atomic <unsigned int> generation(0);
+
+/*! Last packet seen, held over the gaps, and a slice of copies of it. */
+static float lastPacket[EDL_CHANNEL_NUM];
+static float held[(size_t)PYRAMID_SLICE_PACKETS*EDL_CHANNEL_NUM];
+static bool hasLastPacket = false;
+
+/*! Samples of the incomplete level 0 group, per channel. */
+static float pending[EDL_CHANNEL_NUM][PYRAMID_FACTOR];
+static unsigned int pendingNum = 0;
+
+/*! One channel of the current slice, deinterleaved. */
+static float scratch[PYRAMID_SLICE_PACKETS];
+
+/*! Reduces each group of #PYRAMID_FACTOR consecutive inputs into one output. */
+static void reduceGroups(const float * inMin, const float * inMax, const float * inMean, unsigned int groups,
+                         float * outMin, float * outMax, float * outMean)
+{
+    unsigned int g = 0;
+
+#ifdef E1_PYRAMID_SSE
+	/*! Four groups at a time: transpose the 4x4 block so that each lane holds one group, then reduce vertically. */
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    for (; g+4 <= groups; g += 4) {
+        const float * p;
+        __m128 r0, r1, r2, r3;
+
+        p = inMin+g*4;
+        r0 = _mm_loadu_ps(p); r1 = _mm_loadu_ps(p+4); r2 = _mm_loadu_ps(p+8); r3 = _mm_loadu_ps(p+12);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(outMin+g, _mm_min_ps(_mm_min_ps(r0, r1), _mm_min_ps(r2, r3)));
+
+        p = inMax+g*4;
+        r0 = _mm_loadu_ps(p); r1 = _mm_loadu_ps(p+4); r2 = _mm_loadu_ps(p+8); r3 = _mm_loadu_ps(p+12);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(outMax+g, _mm_max_ps(_mm_max_ps(r0, r1), _mm_max_ps(r2, r3)));
+
+        p = inMean+g*4;
+        r0 = _mm_loadu_ps(p); r1 = _mm_loadu_ps(p+4); r2 = _mm_loadu_ps(p+8); r3 = _mm_loadu_ps(p+12);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(outMean+g, _mm_mul_ps(_mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)), quarter));
+    }
+#endif
+
+    for (; g < groups; g++) {
+        const float * mn = inMin+g*4;
+        const float * mx = inMax+g*4;
+        const float * me = inMean+g*4;
+        outMin[g] = std::min(std::min(mn[0], mn[1]), std::min(mn[2], mn[3]));
+        outMax[g] = std::max(std::max(mx[0], mx[1]), std::max(mx[2], mx[3]));
+        outMean[g] = (me[0]+me[1]+me[2]+me[3])*0.25f;
+    }
+}
+
+/*! Appends \a groups bins to \a level, each summarizing #PYRAMID_FACTOR consecutive inputs. */
+static void appendBins(PyramidLevel_t &level, const float * inMin, const float * inMax, const float * inMean, unsigned int groups)
+{
+    uint64_t count = level.count.load(std::memory_order_relaxed);
+    unsigned int done = 0;
+
+    while (done < groups) {
+        unsigned int pos = (unsigned int)(count % PYRAMID_LEVEL_BINS);
+        unsigned int n = std::min(groups-done, (unsigned int)PYRAMID_LEVEL_BINS-pos);
+        size_t in = (size_t)done*PYRAMID_FACTOR;
+        reduceGroups(inMin+in, inMax+in, inMean+in, n, level.minBins+pos, level.maxBins+pos, level.meanBins+pos);
+        done += n;
+        count += n;
+    }
+
+    level.count.store(count, std::memory_order_release);
+}
+
+/*! Merges every complete group of bins of each level into the level above. */
+static void promote(unsigned int channel)
+{
+    for (unsigned int levelIdx = 0; levelIdx+1 < PYRAMID_LEVELS; levelIdx++) {
+        PyramidLevel_t &level = levels[channel][levelIdx];
+        uint64_t complete = level.count.load(std::memory_order_relaxed)/PYRAMID_FACTOR*PYRAMID_FACTOR;
+
+        while (level.promoted < complete) {
+            unsigned int pos = (unsigned int)(level.promoted % PYRAMID_LEVEL_BINS);
+            unsigned int groups = (unsigned int)std::min <uint64_t> ((complete-level.promoted)/PYRAMID_FACTOR,
+                                                                     (PYRAMID_LEVEL_BINS-pos)/PYRAMID_FACTOR);
+            appendBins(levels[channel][levelIdx+1], level.minBins+pos, level.maxBins+pos, level.meanBins+pos, groups);
+            level.promoted += (uint64_t)groups*PYRAMID_FACTOR;
+        }
+    }
+}
+
+/*! Forgets every bin and restarts the time axis at the next packet, at the current sampling rate. */
+static void restart()
+{
+    generation.fetch_add(1, std::memory_order_acq_rel);
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        for (unsigned int levelIdx = 0; levelIdx < PYRAMID_LEVELS; levelIdx++) {
+            levels[channelIdx][levelIdx].count.store(0, std::memory_order_relaxed);
+            levels[channelIdx][levelIdx].promoted = 0;
+        }
+    }
+    pendingNum = 0;
+    hasLastPacket = false;
+    rateId = commandRadioId(EdlCommandSamplingRate);
+    rateHz.store(samplingRateHz(rateId), std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+}
+
+static void appendPackets(const float * packets, unsigned int packetsNum)
+{
+    unsigned int packetIdx = 0;
+
+    while (packetIdx < packetsNum) {
+        /*! Complete the group left over by the previous batch. */
+        while (pendingNum > 0 && pendingNum < PYRAMID_FACTOR && packetIdx < packetsNum) {
+            for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+                pending[channelIdx][pendingNum] = packets[(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx];
+            }
+            pendingNum++;
+            packetIdx++;
+        }
+        if (pendingNum == PYRAMID_FACTOR) {
+            for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+                const float * p = pending[channelIdx];
+                appendBins(levels[channelIdx][0], p, p, p, 1);
+            }
+            pendingNum = 0;
+        }
+
+        unsigned int slice = std::min(packetsNum-packetIdx, (unsigned int)PYRAMID_SLICE_PACKETS);
+        unsigned int groups = slice/PYRAMID_FACTOR;
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            const float * src = packets+(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx;
+            for (unsigned int k = 0; k < groups*PYRAMID_FACTOR; k++) {
+                scratch[k] = src[(size_t)k*EDL_CHANNEL_NUM];
+            }
+            appendBins(levels[channelIdx][0], scratch, scratch, scratch, groups);
+            promote(channelIdx);
+        }
+        packetIdx += groups*PYRAMID_FACTOR;
+
+        /*! Keep the tail of the batch for the next call. */
+        if (packetsNum-packetIdx < PYRAMID_FACTOR) {
+            while (packetIdx < packetsNum) {
+                for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+                    pending[channelIdx][pendingNum] = packets[(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx];
+                }
+                pendingNum++;
+                packetIdx++;
+            }
+        }
+    }
+}
+
+static void pyramidSink(const float * packets, unsigned int packetsNum, void *)
+{
+    const AcquisitionBlock_t &batch = acquisitionBlock();
+
+	/*! Bins are a fixed number of samples wide: a new rate starts a new time axis. */
+    if (commandRadioId(EdlCommandSamplingRate) != rateId) {restart();}
+
+	/*! Keep the time axis on the device sample clock: fill the lost packets with the last one, or restart after a long gap. */
+    if (batch.missingPackets > PYRAMID_MAX_FILL_PACKETS) {
+        restart();
+    } else if (batch.missingPackets > 0 && hasLastPacket) {
+        unsigned int n = (unsigned int)std::min <uint64_t> (batch.missingPackets, PYRAMID_SLICE_PACKETS);
+        for (unsigned int k = 0; k < n; k++) {
+            memcpy(held+(size_t)k*EDL_CHANNEL_NUM, lastPacket, sizeof(lastPacket));
+        }
+        for (uint64_t missing = batch.missingPackets; missing > 0; missing -= n) {
+            n = (unsigned int)std::min <uint64_t> (missing, PYRAMID_SLICE_PACKETS);
+            appendPackets(held, n);
+        }
+    }
+
+    if (packetsNum == 0) {return;}
+    appendPackets(packets, packetsNum);
+    memcpy(lastPacket, packets+(size_t)(packetsNum-1)*EDL_CHANNEL_NUM, sizeof(lastPacket));
+    hasLastPacket = true;
+}
+
+EdlErrorCode_t pyramidStart()
+{
+    if (feeding) {pyramidStop();}
+
+    if (samplingRateHz(commandRadioId(EdlCommandSamplingRate)) <= 0.0) {return EdlUnknownError;}
+
+    if (storage.empty()) {
+        storage.assign((size_t)EDL_CHANNEL_NUM*PYRAMID_LEVELS*3*PYRAMID_LEVEL_BINS, 0.0f);
+        float * p = storage.data();
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            for (unsigned int levelIdx = 0; levelIdx < PYRAMID_LEVELS; levelIdx++) {
+                PyramidLevel_t &level = levels[channelIdx][levelIdx];
+                level.minBins = p;
+                level.maxBins = p+PYRAMID_LEVEL_BINS;
+                level.meanBins = p+2*PYRAMID_LEVEL_BINS;
+                p += 3*PYRAMID_LEVEL_BINS;
+            }
+        }
+    }
+    restart();
+
+    acquisitionAddSink(pyramidSink, NULL);
+    feeding = true;
+
+    return EdlSuccess;
+}
+
+void pyramidStop()
+{
+    if (!feeding) {return;}
+    acquisitionRemoveSink(pyramidSink, NULL);
+    feeding = false;
+}
+
+double pyramidLatestTime()
+{
+    double rate = rateHz.load(std::memory_order_relaxed);
+    if (generation.load(std::memory_order_acquire) == 0 || rate <= 0.0) {return 0.0;}
+    return levels[0][0].count.load()*PYRAMID_FACTOR/rate;
+}
+
+EdlErrorCode_t pyramidWindow(unsigned int channel, double t0, double t1, unsigned int pixels, float * out)
+{
+    const float nan = std::numeric_limits <float>::quiet_NaN();
+
+    if (channel >= EDL_CHANNEL_NUM || pixels == 0 || out == NULL || !(t1 > t0)) {return EdlUnknownError;}
+    std::fill(out, out+3*(size_t)pixels, nan);
+    unsigned int startGeneration = generation.load(std::memory_order_acquire);
+    if (startGeneration == 0 || (startGeneration & 1)) {return EdlSuccess;}
+    double rate = rateHz.load(std::memory_order_relaxed);
+    double s0 = t0*rate;
+    double samplesPerPixel = (t1-t0)*rate/pixels;
+
+	/*! Coarsest level whose bins fit in a column, then coarser still if that level no longer reaches back to t0. */
+    unsigned int levelIdx = 0;
+    double binSamples = PYRAMID_FACTOR;
+    while (levelIdx+1 < PYRAMID_LEVELS && binSamples*PYRAMID_FACTOR <= samplesPerPixel) {
+        levelIdx++;
+        binSamples *= PYRAMID_FACTOR;
+    }
+    uint64_t count = levels[channel][levelIdx].count.load(std::memory_order_acquire);
+    while (levelIdx+1 < PYRAMID_LEVELS && count > PYRAMID_LEVEL_BINS-PYRAMID_GUARD_BINS &&
+           s0/binSamples < (double)(count-(PYRAMID_LEVEL_BINS-PYRAMID_GUARD_BINS))) {
+        levelIdx++;
+        binSamples *= PYRAMID_FACTOR;
+        count = levels[channel][levelIdx].count.load(std::memory_order_acquire);
+    }
+
+    const PyramidLevel_t &level = levels[channel][levelIdx];
+    uint64_t oldest = count > PYRAMID_LEVEL_BINS-PYRAMID_GUARD_BINS ? count-(PYRAMID_LEVEL_BINS-PYRAMID_GUARD_BINS) : 0;
+    std::vector <uint64_t> firstBins(pixels);
+
+    for (unsigned int pixelIdx = 0; pixelIdx < pixels; pixelIdx++) {
+        double a = (s0+pixelIdx*samplesPerPixel)/binSamples;
+        double b = (s0+(pixelIdx+1)*samplesPerPixel)/binSamples;
+        if (b <= 0.0) {continue;}
+
+        uint64_t first = a > 0.0 ? (uint64_t)a : 0;
+        uint64_t last = (uint64_t)std::ceil(b);
+        if (last <= first) {last = first+1;}
+        if (first < oldest) {first = oldest;}
+        if (last > count) {last = count;}
+        firstBins[pixelIdx] = first;
+        if (first >= last) {continue;}
+
+        float mn = level.minBins[first % PYRAMID_LEVEL_BINS];
+        float mx = level.maxBins[first % PYRAMID_LEVEL_BINS];
+        double sum = 0.0;
+        for (uint64_t bin = first; bin < last; bin++) {
+            unsigned int pos = (unsigned int)(bin % PYRAMID_LEVEL_BINS);
+            mn = std::min(mn, level.minBins[pos]);
+            mx = std::max(mx, level.maxBins[pos]);
+            sum += level.meanBins[pos];
+        }
+        out[pixelIdx] = mn;
+        out[pixels+pixelIdx] = mx;
+        out[2*pixels+pixelIdx] = (float)(sum/(last-first));
+    }
+
+	/*! Discard the columns whose bins the producer overwrote while they were being read. */
+    uint64_t now = level.count.load(std::memory_order_acquire);
+    uint64_t valid = now > PYRAMID_LEVEL_BINS ? now-PYRAMID_LEVEL_BINS : 0;
+    for (unsigned int pixelIdx = 0; pixelIdx < pixels; pixelIdx++) {
+        if (firstBins[pixelIdx] < valid) {
+            out[pixelIdx] = out[pixels+pixelIdx] = out[2*pixels+pixelIdx] = nan;
+        }
+    }
+
+	/*! The pyramid restarted meanwhile: the columns may mix both time axes. */
+    if (generation.load(std::memory_order_acquire) != startGeneration) {std::fill(out, out+3*(size_t)pixels, nan);}
+
+    return EdlSuccess;
+}
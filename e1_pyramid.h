@@ -0,0 +1,52 @@
+/*! \file e1_pyramid.h
+ * \brief Declares the streaming min/max/mean decimation pyramid used for live display.
+ *
+ * Level 0 summarizes every #PYRAMID_FACTOR samples of a channel in one bin; each level above summarizes #PYRAMID_FACTOR
+ * bins of the level below. Every level keeps the latest #PYRAMID_LEVEL_BINS bins, so higher levels reach further back.
+ */
+#ifndef E1_PYRAMID_H
+#define E1_PYRAMID_H
+
+#include "edl.h"
+
+/*! \def PYRAMID_FACTOR
+ * \brief Decimation factor between consecutive levels, and between the samples and level 0.
+ */
+#define PYRAMID_FACTOR 4
+
+/*! \def PYRAMID_LEVELS
+ * \brief Number of levels: the top level bin summarizes 4^12 samples, about 84 s at 200kHz.
+ */
+#define PYRAMID_LEVELS 12
+
+/*! \def PYRAMID_LEVEL_BINS
+ * \brief Bins kept by each level. Must be a multiple of #PYRAMID_FACTOR.
+ */
+#define PYRAMID_LEVEL_BINS (1 << 16)
+
+/*! \brief Clears the pyramid and starts feeding it from the acquisition thread.
+ * Times passed to pyramidWindow are counted in device samples from this call: packets lost on the way are filled
+ * with the last packet received, up to about 5 s. A longer gap or a change of the sampling rate clears the pyramid
+ * again and restarts the times from there. Safe to call while another thread runs pyramidWindow.
+ *
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t pyramidStart();
+
+/*! \brief Stops feeding the pyramid. Its content stays available. */
+void pyramidStop();
+
+/*! \brief Time in seconds of the latest sample summarized by level 0. */
+double pyramidLatestTime();
+
+/*! \brief Summarizes channel \a channel between \a t0 and \a t1 seconds in \a pixels columns.
+ * The level used is the coarsest whose bins are no wider than a column, so the cost depends only on \a pixels.
+ *
+ * \param out [out] 3 * \a pixels floats: \a pixels minima, then \a pixels maxima, then \a pixels means.
+ * Columns with no data (not acquired yet or older than the pyramid history) are NaN, as are all of them if the
+ * pyramid restarted during the call.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t pyramidWindow(unsigned int channel, double t0, double t1, unsigned int pixels, float * out);
+
+#endif // E1_PYRAMID_H
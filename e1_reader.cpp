@@ -0,0 +1,468 @@
+/* e1_reader.cpp
+Memory-mapped random access to recordings: any packet is located from the header alone */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "e1_reader.h"
+#include "e1_codec.h"
+
+struct RecordingFile {
+    const char * base;
+    uint64_t size;
+    RecordingHeader_t header;
+    const ChunkIndexEntry_t * index; /*!< NULL if a version 1 recording was not finalized. */
+    std::vector <ChunkIndexEntry_t> recovered; /*!< Index rebuilt from the chunks of a packed recording that was not finalized. */
+    const SegmentIndexEntry_t * segments; /*!< NULL unless gated. */
+    std::vector <SegmentIndexEntry_t> recoveredSegments; /*!< Segment index rebuilt from the chunks if not finalized. */
+    const GapIndexEntry_t * gaps; /*!< NULL if there are none. */
+    std::vector <GapIndexEntry_t> recoveredGaps; /*!< Gap index rebuilt from the chunks if not finalized. */
+    bool packed; /*!< Chunks of variable size, located through the index. */
+    bool compressed;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+/*! Returned by findChunk for packets preceding the first chunk. */
+static const uint64_t noChunk = std::numeric_limits <uint64_t>::max();
+
+static const ChunkHeader_t * chunkAt(const RecordingFile_t * r, uint64_t chunkIdx)
+{
+    if (r->packed) {return (const ChunkHeader_t *)(r->base+r->index[chunkIdx].offset);}
+    return (const ChunkHeader_t *)(r->base+r->header.headerBytes+chunkIdx*r->header.chunkBytes);
+}
+
+static uint64_t chunkFirst(const RecordingFile_t * r, uint64_t chunkIdx)
+{
+    return r->index != NULL ? r->index[chunkIdx].firstPacket : chunkAt(r, chunkIdx)->firstPacket;
+}
+
+static uint64_t chunkPacketsAt(const RecordingFile_t * r, uint64_t chunkIdx)
+{
+    return r->index != NULL ? r->index[chunkIdx].packets : chunkAt(r, chunkIdx)->packets;
+}
+
+/*! Floats between the channels of an uncompressed chunk. */
+static uint64_t channelStride(const RecordingFile_t * r, uint64_t chunkIdx)
+{
+    return r->packed ? chunkPacketsAt(r, chunkIdx) : r->header.chunkPackets;
+}
+
+/*! Returns the last chunk starting at or before \a packet.
+ * Without dropped packets chunk \a packet / chunkPackets is the answer; otherwise it is an upper bound for a binary search.
+ * Gated recordings close a chunk at the end of every segment, so there the search covers every chunk. */
+static uint64_t findChunk(const RecordingFile_t * r, uint64_t packet)
+{
+    uint64_t chunkNum = r->header.chunkNum;
+    if (chunkNum == 0 || packet < chunkFirst(r, 0)) {return noChunk;}
+
+    uint64_t hi = (r->header.flags & E1_RECORDING_GATED) != 0 ? chunkNum-1 : packet/r->header.chunkPackets;
+    if (hi >= chunkNum) {hi = chunkNum-1;}
+    if (chunkFirst(r, hi) <= packet) {return hi;}
+
+    uint64_t lo = 0;
+    while (hi-lo > 1) {
+        uint64_t mid = lo+(hi-lo)/2;
+        if (chunkFirst(r, mid) <= packet) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*! Returns the entries of the table at \a offset: its 8 byte magic, its 64 bit count, then \a count entries.
+ * NULL if it is missing, holds another count or does not fit in the file. */
+static const char * findTable(const RecordingFile_t * r, uint64_t offset, const char * magic, uint64_t count, size_t entryBytes)
+{
+    uint64_t stored;
+
+    if (offset == 0 || offset > r->size || r->size-offset < 16 || memcmp(r->base+offset, magic, 8) != 0) {return NULL;}
+    memcpy(&stored, r->base+offset+8, sizeof(stored));
+    if (stored != count || count > (r->size-offset-16)/entryBytes) {return NULL;}
+    return r->base+offset+16;
+}
+
+static bool mapFile(const char * path, RecordingFile_t * r)
+{
+#ifdef _WIN32
+    LARGE_INTEGER size;
+
+    r->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (r->file == INVALID_HANDLE_VALUE) {return false;}
+    if (!GetFileSizeEx(r->file, &size) || size.QuadPart == 0) {return false;}
+    r->size = size.QuadPart;
+
+    r->mapping = CreateFileMappingA(r->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (r->mapping == NULL) {return false;}
+    r->base = (const char *)MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, 0);
+    return r->base != NULL;
+#else
+    struct stat st;
+
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {return false;}
+    if (fstat(r->fd, &st) != 0 || st.st_size == 0) {return false;}
+    r->size = st.st_size;
+
+    void * p = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (p == MAP_FAILED) {return false;}
+    r->base = (const char *)p;
+    return true;
+#endif
+}
+
+EdlErrorCode_t recordingOpen(const char * path, RecordingFile_t * &recording)
+{
+    RecordingFile_t * r = new RecordingFile_t();
+    recording = NULL;
+
+#ifdef _WIN32
+    r->file = INVALID_HANDLE_VALUE;
+    r->mapping = NULL;
+#else
+    r->fd = -1;
+#endif
+    if (path == NULL || !mapFile(path, r) || r->size < E1_RECORDING_HEADER_BYTES) {
+        recordingClose(r);
+        return EdlUnknownError;
+    }
+
+    RecordingHeader_t &h = r->header;
+    memcpy(&h, r->base, sizeof(h));
+	/*! Version 1 headers end before \a compression, which reads as the zero padding. */
+    r->packed = h.version == E1_RECORDING_VERSION_PACKED;
+    r->compressed = r->packed && h.compression == E1_COMPRESSION_DELTA_PACK;
+    if (memcmp(h.magic, E1_RECORDING_MAGIC, sizeof(h.magic)) != 0 || (h.version != E1_RECORDING_VERSION && !r->packed) ||
+        (r->packed && h.compression != E1_COMPRESSION_NONE && !r->compressed) || h.channelNum == 0 || h.chunkPackets == 0 ||
+        (uint64_t)h.chunkPackets*h.channelNum*sizeof(float)+sizeof(ChunkHeader_t) > h.chunkBytes ||
+        h.headerBytes < E1_RECORDING_HEADER_BYTES || h.headerBytes > r->size) {
+        recordingClose(r);
+        return EdlUnknownError;
+    }
+
+    r->index = (const ChunkIndexEntry_t *)findTable(r, h.indexOffset, E1_RECORDING_INDEX_MAGIC, h.chunkNum, sizeof(ChunkIndexEntry_t));
+
+    if (r->index == NULL && r->packed) {
+		/*! Not finalized: follow the chain of chunk sizes, up to the first invalid chunk. */
+        uint64_t offset = h.headerBytes;
+        while (r->size-offset >= sizeof(ChunkHeader_t)) {
+            const ChunkHeader_t * chunk = (const ChunkHeader_t *)(r->base+offset);
+            if (memcmp(chunk->magic, E1_CHUNK_MAGIC, sizeof(chunk->magic)) != 0 || chunk->chunkIdx != r->recovered.size() ||
+                chunk->storedBytes < sizeof(ChunkHeader_t) || chunk->storedBytes > r->size-offset) {break;}
+            ChunkIndexEntry_t entry;
+            entry.offset = offset;
+            entry.firstPacket = chunk->firstPacket;
+            entry.packets = chunk->packets;
+            entry.reserved = 0;
+            entry.hostTimeUs = chunk->hostTimeUs;
+            r->recovered.push_back(entry);
+            offset += chunk->storedBytes;
+        }
+        h.chunkNum = r->recovered.size();
+        h.packetNum = h.chunkNum > 0 ? r->recovered.back().firstPacket+r->recovered.back().packets : 0;
+        h.indexOffset = 0;
+        r->index = r->recovered.data();
+    } else if (r->index == NULL) {
+		/*! Not finalized: recover the chunks that made it to disk. The file may be preallocated, so stop at the first invalid chunk. */
+        uint64_t chunkIdx = 0;
+        while (chunkIdx < (r->size-h.headerBytes)/h.chunkBytes) {
+            const ChunkHeader_t * chunk = chunkAt(r, chunkIdx);
+            if (memcmp(chunk->magic, E1_CHUNK_MAGIC, sizeof(chunk->magic)) != 0 || chunk->chunkIdx != chunkIdx) {break;}
+            chunkIdx++;
+        }
+        h.chunkNum = chunkIdx;
+        h.packetNum = chunkIdx > 0 ? chunkFirst(r, chunkIdx-1)+chunkPacketsAt(r, chunkIdx-1) : 0;
+        h.indexOffset = 0;
+    }
+
+    if (r->packed) {
+		/*! Check every chunk once, and every section of compressed ones, so that reading can trust them. */
+        for (uint64_t chunkIdx = 0; chunkIdx < h.chunkNum; chunkIdx++) {
+            const ChunkIndexEntry_t &entry = r->index[chunkIdx];
+            if (entry.offset > r->size || r->size-entry.offset < sizeof(ChunkHeader_t) || (entry.offset & 15) != 0 ||
+                entry.packets > h.chunkPackets) {
+                recordingClose(r);
+                return EdlUnknownError;
+            }
+            const ChunkHeader_t * chunk = chunkAt(r, chunkIdx);
+            if (chunk->storedBytes > r->size-entry.offset ||
+                (!r->compressed && chunk->storedBytes < sizeof(ChunkHeader_t)+(uint64_t)h.channelNum*entry.packets*sizeof(float))) {
+                recordingClose(r);
+                return EdlUnknownError;
+            }
+            if (!r->compressed) {continue;}
+
+            const char * section = (const char *)(chunk+1);
+            const char * end = (const char *)chunk+chunk->storedBytes;
+            for (unsigned int channelIdx = 0; channelIdx < h.channelNum; channelIdx++) {
+                if (!codecValid(section, end-section, entry.packets)) {
+                    recordingClose(r);
+                    return EdlUnknownError;
+                }
+                section += ((const CodecSectionHeader_t *)section)->bytes;
+            }
+        }
+    } else {
+		/*! Version 1: every chunk at its fixed offset must lie within the file and hold no more than a full chunk. */
+        if (h.chunkNum > (r->size-h.headerBytes)/h.chunkBytes) {
+            recordingClose(r);
+            return EdlUnknownError;
+        }
+        for (uint64_t chunkIdx = 0; chunkIdx < h.chunkNum; chunkIdx++) {
+            if (chunkPacketsAt(r, chunkIdx) > h.chunkPackets ||
+                (r->index != NULL && r->index[chunkIdx].offset != h.headerBytes+chunkIdx*h.chunkBytes)) {
+                recordingClose(r);
+                return EdlUnknownError;
+            }
+        }
+    }
+
+    if ((h.flags & E1_RECORDING_GATED) != 0 && r->packed) {
+        r->segments = (const SegmentIndexEntry_t *)findTable(r, h.segmentOffset, E1_RECORDING_SEGMENTS_MAGIC, h.segmentNum,
+                                                             sizeof(SegmentIndexEntry_t));
+        if (r->segments == NULL) {
+			/*! Not finalized: a segment is a run of chunks opened by the same trigger. */
+            for (uint64_t chunkIdx = 0; chunkIdx < h.chunkNum; chunkIdx++) {
+                const ChunkHeader_t * chunk = chunkAt(r, chunkIdx);
+                if (r->recoveredSegments.empty() || r->recoveredSegments.back().triggerPacket != chunk->triggerPacket) {
+                    SegmentIndexEntry_t segment;
+                    segment.offset = r->index[chunkIdx].offset;
+                    segment.firstPacket = chunk->firstPacket;
+                    segment.triggerPacket = chunk->triggerPacket;
+                    segment.hostTimeUs = chunk->hostTimeUs;
+                    segment.firstChunk = chunkIdx;
+                    segment.chunks = 0;
+                    r->recoveredSegments.push_back(segment);
+                }
+                SegmentIndexEntry_t &segment = r->recoveredSegments.back();
+                segment.packets = chunk->firstPacket+chunk->packets-segment.firstPacket;
+                segment.chunks++;
+                segment.triggers = chunk->triggers;
+            }
+            h.segmentNum = r->recoveredSegments.size();
+            h.segmentOffset = 0;
+            r->segments = r->recoveredSegments.data();
+        }
+    } else {
+        h.segmentNum = 0;
+        h.segmentOffset = 0;
+    }
+
+    if ((h.flags & E1_RECORDING_SAMPLES) != 0) {
+        r->gaps = (const GapIndexEntry_t *)findTable(r, h.gapOffset, E1_RECORDING_GAPS_MAGIC, h.gapNum, sizeof(GapIndexEntry_t));
+        if (r->gaps == NULL) {
+			/*! Not finalized: the chunks only tell how many packets went missing between them, not where. */
+            uint64_t missing = 0;
+            h.missingPackets = 0;
+            for (uint64_t chunkIdx = 0; chunkIdx < h.chunkNum; chunkIdx++) {
+                const ChunkHeader_t * chunk = chunkAt(r, chunkIdx);
+                if (chunk->firstSample-chunk->firstPacket <= missing) {continue;}
+                GapIndexEntry_t gap;
+                gap.packet = chunk->firstPacket;
+                gap.firstSample = chunk->firstSample;
+                gap.missingPackets = chunk->firstSample-chunk->firstPacket-missing;
+                gap.hostTimeUs = chunk->hostTimeUs;
+                gap.cause = 0;
+                gap.reserved = 0;
+                r->recoveredGaps.push_back(gap);
+                missing += gap.missingPackets;
+                h.missingPackets = missing;
+            }
+            h.gapNum = r->recoveredGaps.size();
+            h.gapOffset = 0;
+            r->gaps = r->recoveredGaps.empty() ? NULL : r->recoveredGaps.data();
+        }
+    } else {
+        h.gapNum = 0;
+        h.gapOffset = 0;
+        h.missingPackets = 0;
+    }
+    if (h.gapNum == 0) {r->gaps = NULL;}
+
+    recording = r;
+    return EdlSuccess;
+}
+
+void recordingClose(RecordingFile_t * recording)
+{
+    if (recording == NULL) {return;}
+
+#ifdef _WIN32
+    if (recording->base != NULL) {UnmapViewOfFile(recording->base);}
+    if (recording->mapping != NULL) {CloseHandle(recording->mapping);}
+    if (recording->file != INVALID_HANDLE_VALUE) {CloseHandle(recording->file);}
+#else
+    if (recording->base != NULL) {munmap((void *)recording->base, recording->size);}
+    if (recording->fd >= 0) {close(recording->fd);}
+#endif
+    delete recording;
+}
+
+const RecordingHeader_t & recordingHeader(const RecordingFile_t * recording)
+{
+    return recording->header;
+}
+
+/*! Returns the last gap after which \a position is: compared with the stream packet index of the entries, or with their
+ * device sample index if \a bySample. gapNum if \a position precedes them all. */
+static uint64_t findGap(const RecordingFile_t * r, uint64_t position, bool bySample)
+{
+    uint64_t lo = 0;
+    uint64_t hi = r->gaps != NULL ? r->header.gapNum : 0;
+
+    while (lo < hi) {
+        uint64_t mid = lo+(hi-lo)/2;
+        if ((bySample ? r->gaps[mid].firstSample : r->gaps[mid].packet) <= position) {
+            lo = mid+1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? lo-1 : r->header.gapNum;
+}
+
+uint64_t recordingPacketAt(const RecordingFile_t * recording, double seconds)
+{
+    if (seconds <= 0.0) {return 0;}
+
+    uint64_t sample = (uint64_t)(seconds*recording->header.samplingRateHz+0.5);
+    uint64_t gapIdx = findGap(recording, sample, true);
+    uint64_t packet = sample;
+    uint64_t next = 0;
+    if (gapIdx != recording->header.gapNum) {
+        packet = recording->gaps[gapIdx].packet+(sample-recording->gaps[gapIdx].firstSample);
+        next = gapIdx+1;
+    }
+
+	/*! Samples that fell into the next gap map to the packet after it. */
+    if (next < recording->header.gapNum && packet > recording->gaps[next].packet) {packet = recording->gaps[next].packet;}
+    return packet;
+}
+
+uint64_t recordingSampleAt(const RecordingFile_t * recording, uint64_t packet)
+{
+    uint64_t gapIdx = findGap(recording, packet, false);
+    if (gapIdx == recording->header.gapNum) {return packet;}
+
+    const GapIndexEntry_t &gap = recording->gaps[gapIdx];
+    return gap.firstSample+(packet-gap.packet);
+}
+
+uint64_t recordingGaps(const RecordingFile_t * recording, const GapIndexEntry_t * &gaps)
+{
+    gaps = recording->gaps;
+    return recording->gaps != NULL ? recording->header.gapNum : 0;
+}
+
+uint64_t recordingSegments(const RecordingFile_t * recording, const SegmentIndexEntry_t * &segments)
+{
+    segments = recording->segments;
+    return recording->segments != NULL ? recording->header.segmentNum : 0;
+}
+
+const float * recordingChannelSpan(const RecordingFile_t * recording, unsigned int channel,
+                                   uint64_t firstPacket, unsigned int &contiguous)
+{
+    contiguous = 0;
+    if (channel >= recording->header.channelNum || recording->compressed) {return NULL;}
+
+    uint64_t chunkIdx = findChunk(recording, firstPacket);
+    if (chunkIdx == noChunk) {return NULL;}
+
+    uint64_t first = chunkFirst(recording, chunkIdx);
+    uint64_t packets = chunkPacketsAt(recording, chunkIdx);
+    if (firstPacket >= first+packets) {return NULL;}
+
+    const float * payload = (const float *)(chunkAt(recording, chunkIdx)+1);
+    contiguous = (unsigned int)(first+packets-firstPacket);
+    return payload+(size_t)channel*channelStride(recording, chunkIdx)+(firstPacket-first);
+}
+
+/*! Copies channel \a channel (or every channel, interleaved, if \a channel is channelNum) into \a dst. */
+static EdlErrorCode_t readRange(const RecordingFile_t * r, unsigned int channel,
+                                uint64_t firstPacket, unsigned int packets, float * dst, unsigned int &got)
+{
+    const unsigned int channelNum = r->header.channelNum;
+    const bool interleaved = channel == channelNum;
+    const unsigned int stride = interleaved ? channelNum : 1;
+    const float nan = std::numeric_limits <float>::quiet_NaN();
+
+    got = 0;
+    while (got < packets) {
+        uint64_t packet = firstPacket+got;
+        if (packet >= r->header.packetNum) {break;}
+
+        uint64_t chunkIdx = findChunk(r, packet);
+        uint64_t first = chunkIdx == noChunk ? 0 : chunkFirst(r, chunkIdx);
+        uint64_t end = chunkIdx == noChunk ? 0 : first+chunkPacketsAt(r, chunkIdx);
+        unsigned int n;
+
+        if (packet >= end) {
+			/*! Dropped packets: pad with NaN up to the next recorded one. */
+            uint64_t next = chunkIdx == noChunk ? chunkFirst(r, 0) :
+                            chunkIdx+1 < r->header.chunkNum ? chunkFirst(r, chunkIdx+1) : r->header.packetNum;
+            n = (unsigned int)std::min <uint64_t> (next-packet, packets-got);
+            std::fill(dst+(size_t)got*stride, dst+(size_t)(got+n)*stride, nan);
+        } else if (r->compressed) {
+            n = (unsigned int)std::min <uint64_t> (end-packet, packets-got);
+            const char * section = (const char *)(chunkAt(r, chunkIdx)+1);
+            for (unsigned int channelIdx = 0; channelIdx < channelNum; channelIdx++) {
+                if (interleaved) {
+                    codecDecode(section, (unsigned int)(packet-first), n, dst+(size_t)got*channelNum+channelIdx, channelNum);
+                } else if (channelIdx == channel) {
+                    codecDecode(section, (unsigned int)(packet-first), n, dst+got, 1);
+                }
+                section += ((const CodecSectionHeader_t *)section)->bytes;
+            }
+        } else {
+            n = (unsigned int)std::min <uint64_t> (end-packet, packets-got);
+            const float * payload = (const float *)(chunkAt(r, chunkIdx)+1)+(packet-first);
+            const size_t channelFloats = channelStride(r, chunkIdx);
+            if (interleaved) {
+                for (unsigned int channelIdx = 0; channelIdx < channelNum; channelIdx++) {
+                    const float * src = payload+(size_t)channelIdx*channelFloats;
+                    float * out = dst+(size_t)got*channelNum+channelIdx;
+                    for (unsigned int k = 0; k < n; k++) {
+                        out[(size_t)k*channelNum] = src[k];
+                    }
+                }
+            } else {
+                memcpy(dst+got, payload+(size_t)channel*channelFloats, (size_t)n*sizeof(float));
+            }
+        }
+        got += n;
+    }
+
+    return EdlSuccess;
+}
+
+EdlErrorCode_t recordingReadChannel(const RecordingFile_t * recording, unsigned int channel,
+                                    uint64_t firstPacket, unsigned int packets, float * dst, unsigned int &got)
+{
+    got = 0;
+    if (channel >= recording->header.channelNum) {return EdlUnknownError;}
+    return readRange(recording, channel, firstPacket, packets, dst, got);
+}
+
+EdlErrorCode_t recordingReadPackets(const RecordingFile_t * recording,
+                                    uint64_t firstPacket, unsigned int packets, float * dst, unsigned int &got)
+{
+    return readRange(recording, recording->header.channelNum, firstPacket, packets, dst, got);
+}
@@ -0,0 +1,77 @@
+/*! \file e1_reader.h
+ * \brief Declares the memory-mapped reader for recordings in the format described in e1_format.h.
+ */
+#ifndef E1_READER_H
+#define E1_READER_H
+
+#include <stdint.h>
+
+#include "edl.h"
+#include "e1_format.h"
+
+/*! \struct RecordingFile_t
+ * \brief Opaque handle to a mapped recording.
+ */
+typedef struct RecordingFile RecordingFile_t;
+
+/*! \brief Maps a recording in memory. Nothing but the header and the seek index is read,
+ * plus the block widths of compressed recordings, to check them once.
+ *
+ * \param path [in] Recording file.
+ * \param recording [out] Handle to pass to the other functions, valid until recordingClose.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t recordingOpen(const char * path, RecordingFile_t * &recording);
+
+/*! \brief Unmaps a recording. */
+void recordingClose(RecordingFile_t * recording);
+
+/*! \brief Returns the header. \a chunkNum and \a packetNum are recovered from the chunks if the recording was not finalized. */
+const RecordingHeader_t & recordingHeader(const RecordingFile_t * recording);
+
+/*! \brief Converts a time in seconds from the start of the recording into a stream packet index.
+ * The time spent in the gaps of the gap index counts: a time within a gap maps to the first packet after it.
+ */
+uint64_t recordingPacketAt(const RecordingFile_t * recording, double seconds);
+
+/*! \brief Converts a stream packet index into a device sample index: the packet index plus the packets missing before it. */
+uint64_t recordingSampleAt(const RecordingFile_t * recording, uint64_t packet);
+
+/*! \brief Returns the gap index, rebuilt from the chunks if the recording was not finalized: each entry is then placed at
+ * the start of the chunk that follows the gap.
+ *
+ * \param gaps [out] #RecordingHeader_t::gapNum entries, valid until recordingClose; NULL if nothing went missing.
+ * \return Number of gaps.
+ */
+uint64_t recordingGaps(const RecordingFile_t * recording, const GapIndexEntry_t * &gaps);
+
+/*! \brief Returns the segment index of a gated recording, rebuilt from the chunks if the recording was not finalized.
+ * Packets between segments read as NaN, like dropped ones.
+ *
+ * \param segments [out] #RecordingHeader_t::segmentNum entries, valid until recordingClose; NULL if the recording is not gated.
+ * \return Number of segments.
+ */
+uint64_t recordingSegments(const RecordingFile_t * recording, const SegmentIndexEntry_t * &segments);
+
+/*! \brief Returns a pointer into the mapping at the samples of channel \a channel starting from packet \a firstPacket.
+ *
+ * \param contiguous [out] Number of valid samples at the returned pointer, all within one chunk.
+ * \return NULL if \a firstPacket was not recorded, or if the recording is compressed: read those with recordingReadChannel.
+ */
+const float * recordingChannelSpan(const RecordingFile_t * recording, unsigned int channel,
+                                   uint64_t firstPacket, unsigned int &contiguous);
+
+/*! \brief Copies \a packets samples of channel \a channel starting from stream packet \a firstPacket into \a dst.
+ * Packets that were dropped while recording are returned as NaN.
+ *
+ * \param got [out] Number of samples written: less than \a packets only past the end of the recording.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t recordingReadChannel(const RecordingFile_t * recording, unsigned int channel,
+                                    uint64_t firstPacket, unsigned int packets, float * dst, unsigned int &got);
+
+/*! \brief Same as recordingReadChannel for all the channels, interleaved as returned by EDL::readData. */
+EdlErrorCode_t recordingReadPackets(const RecordingFile_t * recording,
+                                    uint64_t firstPacket, unsigned int packets, float * dst, unsigned int &got);
+
+#endif // E1_READER_H
@@ -0,0 +1,707 @@
+/* e1_recorder.cpp
+Asynchronous recorder: the reader thread fills large aligned blocks, a writer thread puts them on disk,
+compressor threads pack them in between for compressed recordings. Gated recordings only fill the blocks around triggers */
+
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include "windows.h"
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include "e1_recorder.h"
+#include "e1_acquisition.h"
+#include "e1_codec.h"
+#include "e1_format.h"
+#include "e1_gate.h"
+#include "e1_stats.h"
+
+/*! Each block is one chunk of the recording format, see e1_format.h. */
+static const unsigned int chunkPackets = (RECORDER_BLOCK_BYTES-sizeof(ChunkHeader_t))/(EDL_CHANNEL_NUM*sizeof(float));
+
+static char * blocks[RECORDER_BLOCKS_NUM];
+
+/*! Largest compressed chunk. */
+static const size_t packedBytes = sizeof(ChunkHeader_t)+EDL_CHANNEL_NUM*codecBound(chunkPackets);
+
+/*! Compressed copy of each block, written instead of the block in compressed recordings. */
+static char * packedBlocks[RECORDER_BLOCKS_NUM];
+
+/*! Blocks handed to the writer (written by the reader thread) and blocks put on disk (written by the writer thread).
+ * Block i lives in blocks[i % RECORDER_BLOCKS_NUM]; the reader owns it while filled - written < RECORDER_BLOCKS_NUM. */
+static std::atomic <uint64_t> filled(0);
+static std::atomic <uint64_t> written(0);
+
+/*! Compressed recordings: block i is compressed once compressedSeq[i % RECORDER_BLOCKS_NUM] is i+1.
+ * Compressor threads take the blocks in order under compressMutex, and finish them in any order. */
+static unsigned int compression = E1_COMPRESSION_NONE;
+static float codeScales[EDL_CHANNEL_NUM];
+static std::atomic <uint64_t> compressedSeq[RECORDER_BLOCKS_NUM];
+static uint64_t nextToCompress = 0;
+static std::vector <std::thread> compressors;
+static std::mutex compressMutex;
+static std::condition_variable compressCondition;
+
+/*! Reader thread side of the block being filled. */
+static bool haveBlock = false;
+static unsigned int fillPackets = 0;
+static uint64_t streamPackets = 0;
+/*! Acquisition stream index of the first recorded packet, set by the first call of the sink. */
+static std::atomic <uint64_t> streamOrigin(UINT64_MAX);
+static uint64_t chunkFirstPacket = 0;
+static uint64_t chunkFirstSample = 0;
+static int64_t chunkHostTimeUs = 0;
+/*! Device sample index (see acquisitionBlock) of the first recorded packet, and the gaps met since, in stream order. */
+static uint64_t sampleOrigin = 0;
+static std::vector <GapIndexEntry_t> gapIndex;
+
+/*! Gated recordings, reader thread side: packets reach the blocks only within segments, which open on a trigger with
+ * the history of the prePackets packets before it, and close postPackets packets after the last trigger. */
+static bool gated = false;
+static unsigned int gateChannel = 1;
+static TriggerGate gate;
+static PacketHistory preHistory;
+static unsigned int prePackets = 0;
+static unsigned int postPackets = 0;
+static bool inSegment = false;
+static uint64_t segmentTrigger = 0;
+static uint64_t segmentEnd = 0; /*!< Stream packet index at which the segment closes. */
+static uint32_t segmentTriggers = 0;
+static std::atomic <unsigned long long> seenPackets(0);
+static std::atomic <unsigned long long> keptPackets(0);
+static std::atomic <unsigned long long> segmentsOpened(0);
+
+static FILE * file = NULL;
+static bool fileOwned = false;
+static bool preallocated = false;
+static unsigned long long startOffset = 0;
+static RecordingHeader_t header;
+
+/*! Seek index and segment index, appended to by the writer thread. */
+static std::vector <ChunkIndexEntry_t> chunkIndex;
+static std::vector <SegmentIndexEntry_t> segmentIndex;
+/*! Offset of the next chunk from the start of the recording. */
+static uint64_t writeOffset = 0;
+
+static std::thread writer;
+static std::atomic <bool> recording(false);
+static std::atomic <bool> stopping(false);
+static std::mutex writerMutex;
+static std::condition_variable writerCondition;
+
+static std::atomic <unsigned long long> bytesWritten(0);
+static std::atomic <unsigned long long> uncompressedBytes(0);
+static std::atomic <unsigned long long> droppedPackets(0);
+static std::atomic <unsigned int> writeErrors(0);
+static std::atomic <unsigned int> maxQueueDepth(0);
+
+/*! When each block was handed to the writer, to measure the writer lag. Written before the block is published. */
+static uint64_t handoffNs[RECORDER_BLOCKS_NUM];
+static std::atomic <unsigned long long> writeMicroseconds(0);
+static std::atomic <unsigned long long> maxBlockWriteMicroseconds(0);
+
+static char * alignedAlloc(size_t bytes)
+{
+#ifdef _WIN32
+    return (char *)_aligned_malloc(bytes, RECORDER_BLOCK_ALIGNMENT);
+#else
+    void * p = NULL;
+    if (posix_memalign(&p, RECORDER_BLOCK_ALIGNMENT, bytes) != 0) {return NULL;}
+    return (char *)p;
+#endif
+}
+
+static void alignedFree(char * p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static unsigned long long fileTell(FILE * f)
+{
+#ifdef _WIN32
+    return _ftelli64(f);
+#else
+    return ftello(f);
+#endif
+}
+
+static void fileSeek(FILE * f, unsigned long long offset)
+{
+#ifdef _WIN32
+    _fseeki64(f, offset, SEEK_SET);
+#else
+    fseeko(f, offset, SEEK_SET);
+#endif
+}
+
+static int64_t hostTimeUs()
+{
+    return std::chrono::duration_cast <std::chrono::microseconds> (std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/*! Reserves disk space for \a bytes bytes after \a offset without writing them, then restores the file position. */
+static bool reserveFile(FILE * f, unsigned long long offset, unsigned long long bytes)
+{
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+    LARGE_INTEGER position;
+    position.QuadPart = offset+bytes;
+    if (!SetFilePointerEx(h, position, NULL, FILE_BEGIN) || !SetEndOfFile(h)) {return false;}
+    position.QuadPart = offset;
+    return SetFilePointerEx(h, position, NULL, FILE_BEGIN) != 0;
+#else
+    return posix_fallocate(fileno(f), offset, bytes) == 0;
+#endif
+}
+
+static void truncateFile(FILE * f, unsigned long long size)
+{
+    fflush(f);
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+    LARGE_INTEGER position;
+    position.QuadPart = size;
+    if (SetFilePointerEx(h, position, NULL, FILE_BEGIN)) {SetEndOfFile(h);}
+#else
+    if (ftruncate(fileno(f), size) != 0) {writeErrors.fetch_add(1);}
+#endif
+}
+
+/*! Size of an uncompressed chunk of \a packets packets in a packed recording: channels \a packets floats apart, padded to 16 bytes. */
+static uint32_t packedChunkBytes(unsigned int packets)
+{
+    return (uint32_t)((sizeof(ChunkHeader_t)+(size_t)EDL_CHANNEL_NUM*packets*sizeof(float)+15) & ~(size_t)15);
+}
+
+static void publishBlock()
+{
+    uint64_t f = filled.load(std::memory_order_relaxed);
+    ChunkHeader_t * chunk = (ChunkHeader_t *)blocks[f % RECORDER_BLOCKS_NUM];
+
+    memset(chunk, 0, sizeof(ChunkHeader_t));
+    memcpy(chunk->magic, E1_CHUNK_MAGIC, sizeof(chunk->magic));
+    chunk->packets = fillPackets;
+    chunk->chunkIdx = f;
+    chunk->firstPacket = chunkFirstPacket;
+    chunk->hostTimeUs = chunkHostTimeUs;
+    chunk->storedBytes = header.version == E1_RECORDING_VERSION ? RECORDER_BLOCK_BYTES : packedChunkBytes(fillPackets);
+    chunk->triggers = gated ? segmentTriggers : 0;
+    chunk->triggerPacket = gated ? segmentTrigger : 0;
+    chunk->firstSample = chunkFirstSample;
+
+    handoffNs[f % RECORDER_BLOCKS_NUM] = statsNowNs();
+    filled.store(f+1, std::memory_order_release);
+    haveBlock = false;
+
+    unsigned int depth = (unsigned int)(f+1-written.load(std::memory_order_acquire));
+    if (depth > maxQueueDepth.load(std::memory_order_relaxed)) {maxQueueDepth.store(depth, std::memory_order_relaxed);}
+
+    /*! notify_one does not need the mutex; the writer and the compressors also wake up on their own timeout. */
+    if (compression != E1_COMPRESSION_NONE) {
+        compressCondition.notify_one();
+    } else {
+        writerCondition.notify_one();
+    }
+}
+
+/*! Device sample index of the packet of stream index \a packet, counted from the first recorded packet. */
+static uint64_t sampleOf(uint64_t packet)
+{
+    for (size_t gapIdx = gapIndex.size(); gapIdx > 0; gapIdx--) {
+        const GapIndexEntry_t &gap = gapIndex[gapIdx-1];
+        if (gap.packet <= packet) {return gap.firstSample+(packet-gap.packet);}
+    }
+    return packet;
+}
+
+/*! Copies \a packetsNum packets of stream index \a firstPacket onwards into the current chunk, one channel after the other,
+ * and never waits for the disk. The packets must follow the ones already in the chunk. */
+static void appendPackets(const float * packets, unsigned int packetsNum, uint64_t firstPacket)
+{
+    unsigned int packetIdx = 0;
+
+    while (packetIdx < packetsNum) {
+        if (!haveBlock) {
+            uint64_t f = filled.load(std::memory_order_relaxed);
+            if (f-written.load(std::memory_order_acquire) >= RECORDER_BLOCKS_NUM) {
+                /*! Every block is waiting for the disk: drop rather than stall the driver.
+                 * The next chunk's firstPacket records the hole. */
+                droppedPackets.fetch_add(packetsNum-packetIdx, std::memory_order_relaxed);
+                statsCount(StatsRecorderDroppedPackets, packetsNum-packetIdx);
+                return;
+            }
+            haveBlock = true;
+            fillPackets = 0;
+            chunkFirstPacket = firstPacket+packetIdx;
+            chunkFirstSample = sampleOf(chunkFirstPacket);
+            chunkHostTimeUs = hostTimeUs();
+        }
+
+        float * payload = (float *)(blocks[filled.load(std::memory_order_relaxed) % RECORDER_BLOCKS_NUM]+sizeof(ChunkHeader_t));
+        unsigned int n = chunkPackets-fillPackets;
+        if (n > packetsNum-packetIdx) {n = packetsNum-packetIdx;}
+
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            float * dst = payload+(size_t)channelIdx*chunkPackets+fillPackets;
+            const float * src = packets+(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx;
+            for (unsigned int k = 0; k < n; k++) {
+                dst[k] = src[(size_t)k*EDL_CHANNEL_NUM];
+            }
+        }
+        fillPackets += n;
+        packetIdx += n;
+        keptPackets.fetch_add(n, std::memory_order_relaxed);
+
+        if (fillPackets == chunkPackets) {publishBlock();}
+    }
+}
+
+/*! Opens a segment on the trigger at stream index \a trigger: the history before it goes first, in a new chunk. */
+static void openSegment(uint64_t trigger)
+{
+    const float * first;
+    const float * second;
+    unsigned int firstNum, secondNum;
+
+    inSegment = true;
+    segmentTrigger = trigger;
+    segmentTriggers = 0;
+    segmentsOpened.fetch_add(1, std::memory_order_relaxed);
+
+    preHistory.spans(first, firstNum, second, secondNum);
+    appendPackets(first, firstNum, trigger-firstNum-secondNum);
+    appendPackets(second, secondNum, trigger-secondNum);
+    preHistory.clear();
+}
+
+/*! Closes the segment: its last chunk goes to the writer partially filled, so that the next segment starts a chunk. */
+static void closeSegment()
+{
+    inSegment = false;
+    if (haveBlock && fillPackets > 0) {publishBlock();}
+}
+
+/*! Acquisition sink of gated recordings: feeds the trigger and keeps only the segments around it. */
+static void gatedSink(const float * packets, unsigned int packetsNum)
+{
+    const float * samples = packets+gateChannel;
+    unsigned int k = 0;
+
+    while (k < packetsNum) {
+        uint64_t packet = streamPackets+k;
+
+        if (!inSegment) {
+            unsigned int j = k+gate.scan(samples+(size_t)k*EDL_CHANNEL_NUM, packetsNum-k, EDL_CHANNEL_NUM);
+            preHistory.push(packets+(size_t)k*EDL_CHANNEL_NUM, j-k);
+            if (j == packetsNum) {break;}
+
+            openSegment(streamPackets+j);
+            segmentTriggers = 1;
+            segmentEnd = streamPackets+j+1+postPackets;
+            appendPackets(packets+(size_t)j*EDL_CHANNEL_NUM, 1, streamPackets+j);
+            k = j+1;
+        } else {
+            unsigned int limit = (unsigned int)std::min <uint64_t> (packetsNum, k+(segmentEnd-packet));
+            uint64_t triggers = gate.triggers();
+            unsigned int j = k+gate.scan(samples+(size_t)k*EDL_CHANNEL_NUM, limit-k, EDL_CHANNEL_NUM);
+
+            appendPackets(packets+(size_t)k*EDL_CHANNEL_NUM, j-k, packet);
+            if (j < limit) {
+				/*! Still triggering: the segment goes on for postPackets more. */
+                if (gate.triggers() != triggers) {segmentTriggers++;}
+                segmentEnd = streamPackets+j+1+postPackets;
+                appendPackets(packets+(size_t)j*EDL_CHANNEL_NUM, 1, streamPackets+j);
+                j++;
+            }
+            k = j;
+            if (streamPackets+k == segmentEnd) {closeSegment();}
+        }
+    }
+}
+
+/*! Acquisition sink: records every packet, or only the segments of gated recordings. */
+static void recorderSink(const float * packets, unsigned int packetsNum, void *)
+{
+    const AcquisitionBlock_t &block = acquisitionBlock();
+
+    if (streamPackets == 0) {
+        streamOrigin.store(acquisitionStreamPackets()-packetsNum);
+        sampleOrigin = block.deviceSample;
+    } else if (block.gapCause != 0) {
+		/*! Losses before the first packet are not part of the recording. */
+        GapIndexEntry_t gap;
+        gap.packet = streamPackets;
+        gap.firstSample = block.deviceSample-sampleOrigin;
+        gap.missingPackets = block.missingPackets;
+        gap.hostTimeUs = hostTimeUs();
+        gap.cause = (block.gapCause & ACQUISITION_GAP_BUFFER_OVERFLOW ? E1_GAP_BUFFER_OVERFLOW : 0) |
+                    (block.gapCause & ACQUISITION_GAP_LOST_DATA ? E1_GAP_LOST_DATA : 0);
+        gap.reserved = 0;
+        gapIndex.push_back(gap);
+    }
+    if (gated) {
+        gatedSink(packets, packetsNum);
+    } else {
+        appendPackets(packets, packetsNum, streamPackets);
+    }
+    streamPackets += packetsNum;
+    seenPackets.store(streamPackets, std::memory_order_relaxed);
+}
+
+/*! Compresses block \a blockIdx into its packed copy: the chunk header, then one codec section per channel. */
+static void compressBlock(uint64_t blockIdx)
+{
+    const ChunkHeader_t * chunk = (const ChunkHeader_t *)blocks[blockIdx % RECORDER_BLOCKS_NUM];
+    const float * payload = (const float *)(chunk+1);
+    char * packed = packedBlocks[blockIdx % RECORDER_BLOCKS_NUM];
+    size_t bytes = sizeof(ChunkHeader_t);
+
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        const float * values = payload+(size_t)channelIdx*chunkPackets;
+        float scale = codecGridScale(values, chunk->packets, codeScales[channelIdx]);
+        bytes += codecEncode(values, chunk->packets, scale, packed+bytes);
+    }
+    memcpy(packed, chunk, sizeof(ChunkHeader_t));
+    ((ChunkHeader_t *)packed)->storedBytes = (uint32_t)bytes;
+}
+
+static void compressorLoop()
+{
+    while (true) {
+        uint64_t c;
+        {
+            std::unique_lock <std::mutex> lock(compressMutex);
+            while (nextToCompress == filled.load(std::memory_order_acquire)) {
+				/*! stopping is raised after the last block was published: nothing is left behind. */
+                if (stopping.load()) {return;}
+                compressCondition.wait_for(lock, std::chrono::milliseconds(10));
+            }
+            c = nextToCompress++;
+        }
+
+        compressBlock(c);
+        compressedSeq[c % RECORDER_BLOCKS_NUM].store(c+1, std::memory_order_release);
+        writerCondition.notify_one();
+    }
+}
+
+/*! Writes an uncompressed chunk of a packed recording, see packedChunkBytes. \return Bytes written. */
+static size_t writePackedChunk(const ChunkHeader_t * chunk)
+{
+    static const char padding[16] = {0};
+
+	/*! Full chunks already have this layout. */
+    if (chunk->packets == chunkPackets) {return fwrite(chunk, 1, chunk->storedBytes, file);}
+
+    const float * payload = (const float *)(chunk+1);
+    size_t n = fwrite(chunk, 1, sizeof(ChunkHeader_t), file);
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        n += fwrite(payload+(size_t)channelIdx*chunkPackets, 1, (size_t)chunk->packets*sizeof(float), file);
+    }
+    size_t pad = chunk->storedBytes-(sizeof(ChunkHeader_t)+(size_t)EDL_CHANNEL_NUM*chunk->packets*sizeof(float));
+    if (pad > 0) {n += fwrite(padding, 1, pad, file);}
+    return n;
+}
+
+/*! Starts a segment entry on the first chunk of each segment of a gated recording, and extends it on the next ones. */
+static void indexSegment(const ChunkHeader_t * chunk, uint64_t offset)
+{
+    if (segmentIndex.empty() || segmentIndex.back().triggerPacket != chunk->triggerPacket) {
+        SegmentIndexEntry_t segment;
+        segment.offset = offset;
+        segment.firstPacket = chunk->firstPacket;
+        segment.triggerPacket = chunk->triggerPacket;
+        segment.hostTimeUs = chunk->hostTimeUs;
+        segment.firstChunk = chunkIndex.size()-1;
+        segment.chunks = 0;
+        segmentIndex.push_back(segment);
+    }
+    SegmentIndexEntry_t &segment = segmentIndex.back();
+    segment.packets = chunk->firstPacket+chunk->packets-segment.firstPacket;
+    segment.chunks++;
+    segment.triggers = chunk->triggers;
+}
+
+static void writerLoop()
+{
+    while (true) {
+        uint64_t w = written.load(std::memory_order_relaxed);
+        bool ready = w != filled.load(std::memory_order_acquire) &&
+                     (compression == E1_COMPRESSION_NONE || compressedSeq[w % RECORDER_BLOCKS_NUM].load(std::memory_order_acquire) == w+1);
+        if (!ready) {
+            if (w == filled.load() && stopping.load()) {break;}
+            std::unique_lock <std::mutex> lock(writerMutex);
+            writerCondition.wait_for(lock, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        const ChunkHeader_t * chunk = (const ChunkHeader_t *)(compression == E1_COMPRESSION_NONE ?
+                                                              blocks[w % RECORDER_BLOCKS_NUM] : packedBlocks[w % RECORDER_BLOCKS_NUM]);
+        ChunkIndexEntry_t entry;
+        entry.offset = writeOffset;
+        entry.firstPacket = chunk->firstPacket;
+        entry.packets = chunk->packets;
+        entry.reserved = 0;
+        entry.hostTimeUs = chunk->hostTimeUs;
+        chunkIndex.push_back(entry);
+        if (gated) {indexSegment(chunk, writeOffset);}
+
+        /*! Version 1 chunks are always written whole, so every chunk starts at a fixed offset. */
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        size_t n;
+        if (header.version == E1_RECORDING_VERSION || compression != E1_COMPRESSION_NONE) {
+            n = fwrite(chunk, 1, chunk->storedBytes, file);
+        } else {
+            n = writePackedChunk(chunk);
+        }
+        unsigned long long us = std::chrono::duration_cast <std::chrono::microseconds> (std::chrono::steady_clock::now()-t0).count();
+
+        if (n != chunk->storedBytes) {writeErrors.fetch_add(1);}
+        writeOffset += chunk->storedBytes;
+        bytesWritten.fetch_add(n);
+        uncompressedBytes.fetch_add(header.version == E1_RECORDING_VERSION ? RECORDER_BLOCK_BYTES : packedChunkBytes(chunk->packets));
+        writeMicroseconds.fetch_add(us);
+        if (us > maxBlockWriteMicroseconds.load()) {maxBlockWriteMicroseconds.store(us);}
+
+        statsRecord(StatsWriterLagUs, (statsNowNs()-handoffNs[w % RECORDER_BLOCKS_NUM])/1000);
+        written.store(w+1, std::memory_order_release);
+    }
+}
+
+/*! Writes the header, padded to header.headerBytes, at startOffset and leaves the file position after it. */
+static bool writeHeader()
+{
+    static char padded[E1_RECORDING_HEADER_BYTES];
+
+    memset(padded, 0, sizeof(padded));
+    memcpy(padded, &header, sizeof(header));
+    fileSeek(file, startOffset);
+    return fwrite(padded, 1, sizeof(padded), file) == sizeof(padded);
+}
+
+/*! Appends the seek index, the segment index and the gap index after the last chunk and completes the header. */
+static void finalizeRecording()
+{
+    uint64_t count = chunkIndex.size();
+    unsigned long long end = startOffset+writeOffset;
+
+    header.chunkNum = count;
+    header.packetNum = count > 0 ? chunkIndex.back().firstPacket+chunkIndex.back().packets : 0;
+    header.indexOffset = end-startOffset;
+
+    fileSeek(file, end);
+    if (fwrite(E1_RECORDING_INDEX_MAGIC, 1, 8, file) != 8 ||
+        fwrite(&count, sizeof(count), 1, file) != 1 ||
+        (count > 0 && fwrite(chunkIndex.data(), sizeof(ChunkIndexEntry_t), count, file) != count)) {
+        writeErrors.fetch_add(1);
+        header.indexOffset = 0;
+    }
+
+    if (gated) {
+        uint64_t segments = segmentIndex.size();
+        header.segmentNum = segments;
+        header.segmentOffset = fileTell(file)-startOffset;
+        if (fwrite(E1_RECORDING_SEGMENTS_MAGIC, 1, 8, file) != 8 ||
+            fwrite(&segments, sizeof(segments), 1, file) != 1 ||
+            (segments > 0 && fwrite(segmentIndex.data(), sizeof(SegmentIndexEntry_t), segments, file) != segments)) {
+            writeErrors.fetch_add(1);
+            header.segmentOffset = 0;
+        }
+    }
+
+    uint64_t gaps = gapIndex.size();
+    header.gapNum = gaps;
+    header.gapOffset = fileTell(file)-startOffset;
+    header.missingPackets = 0;
+    for (size_t gapIdx = 0; gapIdx < gapIndex.size(); gapIdx++) {header.missingPackets += gapIndex[gapIdx].missingPackets;}
+    if (fwrite(E1_RECORDING_GAPS_MAGIC, 1, 8, file) != 8 ||
+        fwrite(&gaps, sizeof(gaps), 1, file) != 1 ||
+        (gaps > 0 && fwrite(gapIndex.data(), sizeof(GapIndexEntry_t), gaps, file) != gaps)) {
+        writeErrors.fetch_add(1);
+        header.gapOffset = 0;
+    }
+    end = fileTell(file);
+
+    if (!writeHeader()) {writeErrors.fetch_add(1);}
+    fileSeek(file, end);
+    if (preallocated) {truncateFile(file, end);}
+}
+
+EdlErrorCode_t recorderStart(FILE * f, unsigned long long preallocateBytes, bool ownsFile, unsigned int newCompression,
+                             const GateConfig_t * gateConfig)
+{
+    unsigned int windowPackets = 1;
+    double rateHz = samplingRateHz(commandRadioId(EdlCommandSamplingRate));
+
+    if (recording.load() || f == NULL) {return EdlUnknownError;}
+    if (newCompression != E1_COMPRESSION_NONE && newCompression != E1_COMPRESSION_DELTA_PACK) {return EdlUnknownError;}
+    if (gateConfig != NULL && !gatePackets(*gateConfig, rateHz, windowPackets, prePackets, postPackets)) {return EdlUnknownError;}
+
+    compression = newCompression;
+    for (unsigned int blockIdx = 0; blockIdx < RECORDER_BLOCKS_NUM; blockIdx++) {
+        if (blocks[blockIdx] == NULL) {blocks[blockIdx] = alignedAlloc(RECORDER_BLOCK_BYTES);}
+        if (blocks[blockIdx] == NULL) {return EdlUnknownError;}
+        if (compression != E1_COMPRESSION_NONE) {
+            if (packedBlocks[blockIdx] == NULL) {packedBlocks[blockIdx] = alignedAlloc(packedBytes);}
+            if (packedBlocks[blockIdx] == NULL) {return EdlUnknownError;}
+        }
+        compressedSeq[blockIdx].store(0);
+    }
+
+    file = f;
+    fileOwned = ownsFile;
+    setvbuf(file, NULL, _IONBF, 0);
+    startOffset = fileTell(file);
+    preallocated = preallocateBytes > 0 && reserveFile(file, startOffset, preallocateBytes);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, E1_RECORDING_MAGIC, sizeof(header.magic));
+    gated = gateConfig != NULL;
+    header.version = compression == E1_COMPRESSION_NONE && !gated ? E1_RECORDING_VERSION : E1_RECORDING_VERSION_PACKED;
+    header.headerBytes = E1_RECORDING_HEADER_BYTES;
+    header.channelNum = EDL_CHANNEL_NUM;
+    header.samplingRateId = commandRadioId(EdlCommandSamplingRate);
+    header.samplingRateHz = rateHz;
+    header.rangeId = commandRadioId(EdlCommandRange);
+    header.bandwidthId = commandRadioId(EdlCommandFinalBandwidth);
+    header.startTimeUs = hostTimeUs();
+    header.chunkBytes = RECORDER_BLOCK_BYTES;
+    header.chunkPackets = chunkPackets;
+    header.compression = compression;
+    header.flags = E1_RECORDING_SAMPLES | (gated ? E1_RECORDING_GATED : 0);
+    header.preTriggerPackets = gated ? prePackets : 0;
+    header.postTriggerPackets = gated ? postPackets : 0;
+    if (!writeHeader()) {return EdlUnknownError;}
+
+	/*! Nominal code of the range in use when the recording starts. Each block checks it against its samples and
+	 * derives the step from them when it does not fit; off any grid the samples are coded from their float bits. */
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        codeScales[channelIdx] = codecAdcScale(channelIdx, header.rangeId);
+    }
+
+    if (gated) {
+        gateChannel = gateConfig->channel;
+        gate.reset(*gateConfig, windowPackets);
+        preHistory.allocate(prePackets);
+    }
+    inSegment = false;
+
+    chunkIndex.clear();
+    segmentIndex.clear();
+    gapIndex.clear();
+    sampleOrigin = 0;
+    writeOffset = header.headerBytes;
+    nextToCompress = 0;
+    filled.store(0);
+    written.store(0);
+    haveBlock = false;
+    fillPackets = 0;
+    streamPackets = 0;
+    streamOrigin.store(UINT64_MAX);
+    bytesWritten.store(0);
+    uncompressedBytes.store(0);
+    seenPackets.store(0);
+    keptPackets.store(0);
+    segmentsOpened.store(0);
+    droppedPackets.store(0);
+    writeErrors.store(0);
+    maxQueueDepth.store(0);
+    writeMicroseconds.store(0);
+    maxBlockWriteMicroseconds.store(0);
+
+    stopping.store(false);
+    recording.store(true);
+    writer = std::thread(writerLoop);
+    if (compression != E1_COMPRESSION_NONE) {
+        unsigned int threads = std::max(1u, std::min((unsigned int)RECORDER_COMPRESSION_THREADS, std::thread::hardware_concurrency()/2));
+        for (unsigned int threadIdx = 0; threadIdx < threads; threadIdx++) {compressors.push_back(std::thread(compressorLoop));}
+    }
+    acquisitionAddSink(recorderSink, NULL, true);
+
+    return EdlSuccess;
+}
+
+void recorderStop()
+{
+    if (!recording.load()) {return;}
+
+	/*! Once the sink is removed the reader thread no longer touches the blocks. */
+    acquisitionRemoveSink(recorderSink, NULL);
+    if (haveBlock && fillPackets > 0) {
+        while (filled.load()-written.load() >= RECORDER_BLOCKS_NUM) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        publishBlock();
+    }
+
+    stopping.store(true);
+    compressCondition.notify_all();
+    for (size_t threadIdx = 0; threadIdx < compressors.size(); threadIdx++) {compressors[threadIdx].join();}
+    compressors.clear();
+    writerCondition.notify_one();
+    writer.join();
+
+    finalizeRecording();
+    preHistory.allocate(0);
+    for (unsigned int blockIdx = 0; blockIdx < RECORDER_BLOCKS_NUM; blockIdx++) {
+        alignedFree(blocks[blockIdx]);
+        blocks[blockIdx] = NULL;
+        if (packedBlocks[blockIdx] != NULL) {alignedFree(packedBlocks[blockIdx]);}
+        packedBlocks[blockIdx] = NULL;
+    }
+
+    if (fileOwned) {
+        fclose(file);
+    } else {
+        fflush(file);
+    }
+    file = NULL;
+    recording.store(false);
+}
+
+bool recorderRunning()
+{
+    return recording.load();
+}
+
+void recorderGetStats(RecorderStats_t &stats)
+{
+    stats.bytesWritten = bytesWritten.load();
+    stats.blocksWritten = written.load();
+    stats.droppedPackets = droppedPackets.load();
+    stats.writeErrors = writeErrors.load();
+    stats.queueDepth = (unsigned int)(filled.load()-written.load());
+    stats.maxQueueDepth = maxQueueDepth.load();
+
+    unsigned long long us = writeMicroseconds.load();
+    stats.writeMBps = us > 0 ? (double)stats.bytesWritten/us : 0.0;
+    stats.maxBlockWriteMs = maxBlockWriteMicroseconds.load()/1000.0;
+    stats.compressionRatio = stats.bytesWritten > 0 ? (double)uncompressedBytes.load()/stats.bytesWritten : 1.0;
+    stats.segments = segmentsOpened.load();
+	/*! Read while the reader thread counts: off by the packets of the batch in flight at most. */
+    unsigned long long seen = seenPackets.load();
+    unsigned long long kept = keptPackets.load()+stats.droppedPackets;
+    stats.skippedPackets = gated && seen > kept ? seen-kept : 0;
+}
+
+bool recorderStreamOrigin(uint64_t &origin)
+{
+    origin = streamOrigin.load();
+    return origin != UINT64_MAX;
+}
@@ -0,0 +1,80 @@
+/*! \file e1_recorder.h
+ * \brief Declares the asynchronous recorder that streams acquired packets to disk from a dedicated writer thread.
+ */
+#ifndef E1_RECORDER_H
+#define E1_RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "edl.h"
+#include "e1_gate.h"
+
+/*! \def RECORDER_BLOCK_BYTES
+ * \brief Size of each recorder block. Each block is one chunk of the recording format (see e1_format.h)
+ * and is written to disk whole, with one fwrite.
+ */
+#define RECORDER_BLOCK_BYTES (4 << 20)
+
+/*! \def RECORDER_BLOCKS_NUM
+ * \brief Number of recorder blocks: about 20 s of buffering at 200kHz before packets are dropped.
+ */
+#define RECORDER_BLOCKS_NUM 8
+
+/*! \def RECORDER_BLOCK_ALIGNMENT
+ * \brief Alignment of the recorder blocks in memory.
+ */
+#define RECORDER_BLOCK_ALIGNMENT 4096
+
+/*! \def RECORDER_COMPRESSION_THREADS
+ * \brief Most threads compressing blocks in compressed recordings; half the hardware threads are used up to this.
+ */
+#define RECORDER_COMPRESSION_THREADS 4
+
+/*! \struct RecorderStats_t
+ * \brief Recorder counters. Returned by getRecorderStats.
+ */
+typedef struct {
+    unsigned long long bytesWritten; /*!< Bytes written to disk since the recording started. */
+    unsigned long long blocksWritten; /*!< Blocks written to disk since the recording started. */
+    unsigned long long droppedPackets; /*!< Packets discarded because all the blocks were waiting for the disk. */
+    unsigned int writeErrors; /*!< Blocks that fwrite failed to write completely. */
+    unsigned int queueDepth; /*!< Full blocks currently waiting for the writer thread. */
+    unsigned int maxQueueDepth; /*!< Highest value of \a queueDepth since the recording started. */
+    double writeMBps; /*!< Average write throughput in MB/s, measured over the time spent inside fwrite. */
+    double maxBlockWriteMs; /*!< Slowest single block write in ms. */
+    double compressionRatio; /*!< Bytes the blocks written would take uncompressed, over \a bytesWritten: 1 for uncompressed recordings. */
+    unsigned long long segments; /*!< Gated recordings: segments opened by a trigger. */
+    unsigned long long skippedPackets; /*!< Gated recordings: packets outside every segment, never written. */
+} RecorderStats_t;
+
+/*! \brief Starts recording the packets read by the acquisition thread to \a f, in the format described in e1_format.h.
+ * The header records the sampling rate, range and bandwidth last sent through sendCommand.
+ *
+ * \param f [in] File open for binary writing. It is closed by recorderStop if \a ownsFile is true.
+ * \param preallocateBytes [in] Bytes to reserve on disk up front; the file is truncated to its real size on stop. 0 disables preallocation.
+ * \param ownsFile [in] Whether recorderStop closes \a f.
+ * \param compression [in] E1_COMPRESSION_*. With #E1_COMPRESSION_DELTA_PACK full blocks are compressed (see e1_codec.h)
+ * by a pool of threads between the reader thread and the writer thread; each block is compressed on its own.
+ * \param gate [in] If not NULL only the packets around the triggers of \a gate are recorded, as segments (see e1_gate.h).
+ * The pre-trigger history is held in memory, on the reader thread.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t recorderStart(FILE * f, unsigned long long preallocateBytes, bool ownsFile, unsigned int compression,
+                             const GateConfig_t * gate = NULL);
+
+/*! \brief Flushes the partially filled block, joins the writer thread, appends the seek index and releases the file. */
+void recorderStop();
+
+/*! \brief Returns true while a recording is in progress. */
+bool recorderRunning();
+
+/*! \brief Fills \a stats with the current recorder counters. */
+void recorderGetStats(RecorderStats_t &stats);
+
+/*! \brief Acquisition stream index (see acquisitionStreamPackets) of packet 0 of the current recording.
+ * \return false until the first packet was recorded.
+ */
+bool recorderStreamOrigin(uint64_t &origin);
+
+#endif // E1_RECORDER_H
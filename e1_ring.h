@@ -0,0 +1,192 @@
+/*! \file e1_ring.h
+ * \brief Declares class PacketRing, a single-producer/single-consumer lock-free ring of data packets,
+ * and class SpscQueue, its counterpart for records.
+ */
+#ifndef E1_RING_H
+#define E1_RING_H
+
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+#include "edl_devicespecs.h"
+
+/*! \class PacketRing
+ * \brief Preallocated ring of data packets of #EDL_CHANNEL_NUM samples each.
+ * Exactly one thread may call write (the producer) and exactly one thread may call read, peek and consume (the consumer).
+ * The capacity is rounded up to a power of two so that positions wrap with a mask.
+ * Positions are 64 bit packet counters that never wrap, so they double as packet indexes since the last reset.
+ */
+class PacketRing
+{
+public:
+    PacketRing() : mask(0), head(0), tail(0) {}
+
+    /*! \brief Allocates room for at least \a packets data packets and empties the ring.
+     * \note Not thread safe: call only while neither producer nor consumer are running.
+     */
+    void allocate(unsigned int packets)
+    {
+        unsigned int capacity = 1;
+        while (capacity < packets) {capacity <<= 1;}
+        buffer.assign((size_t)capacity*EDL_CHANNEL_NUM, 0.0f);
+        mask = capacity-1;
+        reset();
+    }
+
+    /*! \brief Empties the ring. \note Not thread safe, see allocate. */
+    void reset()
+    {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    unsigned int capacity() const {return mask+1;}
+
+    /*! \brief Number of packets written since the last reset. */
+    uint64_t written() const {return head.load(std::memory_order_acquire);}
+
+    /*! \brief Number of packets consumed since the last reset. */
+    uint64_t consumed() const {return tail.load(std::memory_order_acquire);}
+
+    unsigned int readable() const
+    {
+        return (unsigned int)(head.load(std::memory_order_acquire)-tail.load(std::memory_order_acquire));
+    }
+
+    /*! \brief Producer: copies up to \a packets packets from \a src.
+     * \return Number of packets actually written; fewer than requested only when the ring is full.
+     */
+    unsigned int write(const float * src, unsigned int packets)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t t = tail.load(std::memory_order_acquire);
+        unsigned int room = (unsigned int)(capacity()-(h-t));
+        if (packets > room) {packets = room;}
+
+        unsigned int start = (unsigned int)(h & mask);
+        unsigned int first = capacity()-start;
+        if (first > packets) {first = packets;}
+        memcpy(&buffer[(size_t)start*EDL_CHANNEL_NUM], src, (size_t)first*EDL_CHANNEL_NUM*sizeof(float));
+        if (packets > first) {
+            memcpy(&buffer[0], src+(size_t)first*EDL_CHANNEL_NUM, (size_t)(packets-first)*EDL_CHANNEL_NUM*sizeof(float));
+        }
+
+        head.store(h+packets, std::memory_order_release);
+        return packets;
+    }
+
+    /*! \brief Consumer: returns the readable packets as up to two contiguous spans without copying them.
+     * The spans stay valid until the matching call to consume.
+     * \return Total number of packets in the two spans.
+     */
+    unsigned int peek(const float * &first, unsigned int &firstPackets,
+                      const float * &second, unsigned int &secondPackets) const
+    {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        unsigned int available = (unsigned int)(head.load(std::memory_order_acquire)-t);
+        unsigned int start = (unsigned int)(t & mask);
+
+        firstPackets = capacity()-start;
+        if (firstPackets > available) {firstPackets = available;}
+        secondPackets = available-firstPackets;
+        first = buffer.empty() ? NULL : &buffer[(size_t)start*EDL_CHANNEL_NUM];
+        second = buffer.empty() ? NULL : &buffer[0];
+        return available;
+    }
+
+    /*! \brief Consumer: releases \a packets packets previously returned by peek. */
+    void consume(unsigned int packets)
+    {
+        tail.store(tail.load(std::memory_order_relaxed)+packets, std::memory_order_release);
+    }
+
+    /*! \brief Consumer: copies up to \a maxPackets packets into \a dst and releases them.
+     * \return Number of packets copied.
+     */
+    unsigned int read(float * dst, unsigned int maxPackets)
+    {
+        const float * first;
+        const float * second;
+        unsigned int firstPackets, secondPackets;
+        unsigned int available = peek(first, firstPackets, second, secondPackets);
+
+        if (available > maxPackets) {available = maxPackets;}
+        if (firstPackets > available) {firstPackets = available;}
+        secondPackets = available-firstPackets;
+        memcpy(dst, first, (size_t)firstPackets*EDL_CHANNEL_NUM*sizeof(float));
+        memcpy(dst+(size_t)firstPackets*EDL_CHANNEL_NUM, second, (size_t)secondPackets*EDL_CHANNEL_NUM*sizeof(float));
+
+        consume(available);
+        return available;
+    }
+
+private:
+    std::vector <float> buffer;
+    unsigned int mask;
+
+    /*! Producer and consumer positions live on separate cache lines to avoid false sharing. */
+    alignas(64) std::atomic <uint64_t> head;
+    alignas(64) std::atomic <uint64_t> tail;
+};
+
+/*! \class SpscQueue
+ * \brief Preallocated single-producer/single-consumer lock-free queue of POD records, e.g. detected events.
+ * The same threading rules as PacketRing apply.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue() : mask(0), head(0), tail(0) {}
+
+    /*! \brief Allocates room for at least \a records records and empties the queue. \note Not thread safe. */
+    void allocate(unsigned int records)
+    {
+        unsigned int capacity = 1;
+        while (capacity < records) {capacity <<= 1;}
+        buffer.assign(capacity, T());
+        mask = capacity-1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    unsigned int capacity() const {return mask+1;}
+
+    unsigned int size() const
+    {
+        return (unsigned int)(head.load(std::memory_order_acquire)-tail.load(std::memory_order_acquire));
+    }
+
+    /*! \brief Producer: appends \a record. \return false if the queue is full. */
+    bool push(const T &record)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (buffer.empty() || h-tail.load(std::memory_order_acquire) > mask) {return false;}
+        buffer[h & mask] = record;
+        head.store(h+1, std::memory_order_release);
+        return true;
+    }
+
+    /*! \brief Consumer: moves up to \a maxRecords records into \a dst. \return Number of records moved. */
+    unsigned int pop(T * dst, unsigned int maxRecords)
+    {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        unsigned int available = (unsigned int)(head.load(std::memory_order_acquire)-t);
+        if (available > maxRecords) {available = maxRecords;}
+        for (unsigned int idx = 0; idx < available; idx++) {
+            dst[idx] = buffer[(t+idx) & mask];
+        }
+        tail.store(t+available, std::memory_order_release);
+        return available;
+    }
+
+private:
+    std::vector <T> buffer;
+    unsigned int mask;
+    alignas(64) std::atomic <uint64_t> head;
+    alignas(64) std::atomic <uint64_t> tail;
+};
+
+#endif // E1_RING_H
@@ -0,0 +1,152 @@
+/* e1_scheduler.cpp
+Adaptive read scheduling: one driver read per period at any sampling rate, backing off on overflows */
+
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#ifdef _WIN32
+#include "windows.h"
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+#include "e1_scheduler.h"
+#include "e1_acquisition.h"
+#include "e1_stats.h"
+
+/*! Arrival rate assumed while the sampling rate is unknown: the highest one, so that the first waits are short. */
+#define SCHEDULER_DEFAULT_RATE_HZ 200000.0
+
+/*! Weight of each new observation in the arrival rate estimate. */
+#define SCHEDULER_RATE_ALPHA 0.2
+
+/*! Period growth per read that keeps up. */
+#define SCHEDULER_PERIOD_GROWTH 1.05
+
+/*! A read larger than this many target batches means the reader fell behind. */
+#define SCHEDULER_BACKLOG_BATCHES 4
+
+ReadScheduler::ReadScheduler()
+{
+    reset(0.0, SCHEDULER_MAX_PERIOD_S);
+}
+
+void ReadScheduler::reset(double newRateHz, double newMaxPeriodSeconds)
+{
+    maxPeriodSeconds = std::max(newMaxPeriodSeconds, SCHEDULER_MIN_PERIOD_S);
+    periodSeconds = maxPeriodSeconds;
+    lastReadNs = 0;
+    setRate(newRateHz);
+}
+
+void ReadScheduler::setRate(double newRateHz)
+{
+    nominalHz = newRateHz;
+    rateHz = newRateHz > 0.0 ? newRateHz : SCHEDULER_DEFAULT_RATE_HZ;
+}
+
+unsigned int ReadScheduler::targetBatch() const
+{
+    return std::max((unsigned int)(rateHz*periodSeconds), (unsigned int)MINIMUM_DATA_PACKETS_TO_READ);
+}
+
+bool ReadScheduler::poll(uint64_t nowNs, unsigned int available, bool overflow, uint64_t &waitNs)
+{
+    if (overflow) {
+		/*! The driver buffer or the device could not hold one period: read twice as often. */
+        periodSeconds = std::max(periodSeconds/2.0, SCHEDULER_MIN_PERIOD_S);
+    }
+
+    if (lastReadNs == 0) {lastReadNs = nowNs;}
+
+	/*! Each read empties the driver, so what is available now arrived since the last read. */
+    if (nowNs > lastReadNs && available > 0) {
+        double elapsed = (nowNs-lastReadNs)*1e-9;
+        if (elapsed >= 0.25*periodSeconds) {
+            double observed = available/elapsed;
+            rateHz += SCHEDULER_RATE_ALPHA*(observed-rateHz);
+        }
+    }
+
+    unsigned int target = targetBatch();
+    if (available >= target) {return true;}
+	/*! Whatever the estimate says, don't keep packets waiting longer than the longest period. */
+    if (available >= MINIMUM_DATA_PACKETS_TO_READ && nowNs-lastReadNs >= (uint64_t)(maxPeriodSeconds*1e9)) {return true;}
+
+    double wait = (target-available)/rateHz;
+    waitNs = (uint64_t)(std::min(wait, periodSeconds)*1e9);
+    return false;
+}
+
+void ReadScheduler::read(uint64_t nowNs, unsigned int packets)
+{
+    if (packets > SCHEDULER_BACKLOG_BATCHES*targetBatch()) {
+        periodSeconds = std::max(periodSeconds/2.0, SCHEDULER_MIN_PERIOD_S);
+    } else {
+        periodSeconds = std::min(periodSeconds*SCHEDULER_PERIOD_GROWTH, maxPeriodSeconds);
+    }
+    lastReadNs = nowNs;
+}
+
+#ifdef _WIN32
+/*! Per-thread waitable timer: high resolution where Windows supports it (10 1803+), the classic one otherwise. */
+class WaitableTimer
+{
+public:
+    WaitableTimer()
+    {
+        handle = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (handle == NULL) {handle = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);}
+    }
+
+    ~WaitableTimer()
+    {
+        if (handle != NULL) {CloseHandle(handle);}
+    }
+
+    void sleep(uint64_t ns)
+    {
+        LARGE_INTEGER due;
+        due.QuadPart = -(LONGLONG)(ns/100);
+        if (handle != NULL && SetWaitableTimer(handle, &due, 0, NULL, NULL, FALSE)) {
+            WaitForSingleObject(handle, INFINITE);
+        } else {
+            Sleep((DWORD)(ns/1000000));
+        }
+    }
+
+private:
+    HANDLE handle;
+};
+#endif
+
+void schedulerSleepUntil(uint64_t deadlineNs)
+{
+	/*! Running estimate of how late the OS wakes us up, per thread. */
+    static thread_local double oversleepNs = 50000.0;
+#ifdef _WIN32
+    static thread_local WaitableTimer timer;
+#endif
+
+    uint64_t nowNs = statsNowNs();
+    if (deadlineNs <= nowNs) {return;}
+
+    uint64_t spinNs = std::min((uint64_t)oversleepNs+20000, (uint64_t)SCHEDULER_MAX_SPIN_NS);
+    if (deadlineNs-nowNs > spinNs) {
+        uint64_t sleepNs = deadlineNs-nowNs-spinNs;
+#ifdef _WIN32
+        timer.sleep(sleepNs);
+#else
+        std::this_thread::sleep_for(std::chrono::nanoseconds(sleepNs));
+#endif
+        uint64_t sleptNs = statsNowNs()-nowNs;
+        double late = sleptNs > sleepNs ? (double)(sleptNs-sleepNs) : 0.0;
+        oversleepNs += 0.1*(late-oversleepNs);
+    }
+
+    while (statsNowNs() < deadlineNs) {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,74 @@
+/*! \file e1_scheduler.h
+ * \brief Declares the read scheduler of the acquisition thread: when to poll the driver and how many packets to wait for.
+ *
+ * The reader aims at one EDL::readData per read period, whatever the sampling rate: the batch it waits for is the
+ * arrival rate times the period. The arrival rate starts from the EdlCommandSamplingRate setting and follows the
+ * packets actually observed. The period shrinks (halves) whenever the driver reports an overflow or its backlog
+ * grows beyond a few periods, and grows back slowly while reads keep up.
+ */
+#ifndef E1_SCHEDULER_H
+#define E1_SCHEDULER_H
+
+#include <stdint.h>
+
+/*! \def SCHEDULER_MAX_PERIOD_S
+ * \brief Default (and longest) read period: bounds the latency of data reaching the consumers.
+ */
+#define SCHEDULER_MAX_PERIOD_S 0.01
+
+/*! \def SCHEDULER_MIN_PERIOD_S
+ * \brief Shortest read period the scheduler backs off to after overflows.
+ */
+#define SCHEDULER_MIN_PERIOD_S 0.00025
+
+/*! \def SCHEDULER_MAX_SPIN_NS
+ * \brief Longest busy wait at the end of a sleep, to absorb the oversleep of the OS timer.
+ */
+#define SCHEDULER_MAX_SPIN_NS 200000
+
+/*! \class ReadScheduler
+ * \brief Decides, at each driver poll, whether to read now or how long to wait.
+ */
+class ReadScheduler
+{
+public:
+    ReadScheduler();
+
+    /*! \brief Starts over with the nominal sampling rate \a rateHz (0 if unknown) and the longest period \a maxPeriodSeconds. */
+    void reset(double rateHz, double maxPeriodSeconds);
+
+    /*! \brief Adopts a new nominal sampling rate, e.g. after EdlCommandSamplingRate was sent during the acquisition. */
+    void setRate(double rateHz);
+
+    /*! \brief Called after each EDL::getDeviceStatus.
+     *
+     * \param available [in] Packets available in the driver.
+     * \param overflow [in] True if the driver reported bufferOverflowFlag or lostDataFlag.
+     * \param waitNs [out] When returning false, time to wait before polling again.
+     * \return true to read now.
+     */
+    bool poll(uint64_t nowNs, unsigned int available, bool overflow, uint64_t &waitNs);
+
+    /*! \brief Called after each EDL::readData. */
+    void read(uint64_t nowNs, unsigned int packets);
+
+    /*! \brief Packets the scheduler currently waits for before reading. */
+    unsigned int targetBatch() const;
+
+    double period() const {return periodSeconds;}
+    double arrivalRate() const {return rateHz;}
+
+private:
+    double nominalHz;
+    double rateHz; /*!< Observed arrival rate, packets/s. */
+    double periodSeconds;
+    double maxPeriodSeconds;
+    uint64_t lastReadNs; /*!< Time of the last read, or of the first poll; 0 after reset. */
+};
+
+/*! \brief Sleeps until \a deadlineNs (on the statsNowNs clock) with a high resolution timer,
+ * then spins for the last part, learning how much the OS oversleeps.
+ */
+void schedulerSleepUntil(uint64_t deadlineNs);
+
+#endif // E1_SCHEDULER_H
@@ -0,0 +1,247 @@
+/* e1_sealtest.cpp
+Seal test analyzer: pulse responses averaged in step with the voltage channel and fitted once per period */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "e1_sealtest.h"
+#include "e1_acquisition.h"
+
+/*! Steady state currents are averaged over the last 1/SEALTEST_PLATEAU_FRACTION of each half pulse. */
+#define SEALTEST_PLATEAU_FRACTION 5
+
+/*! The transient is fitted over this many time constants. */
+#define SEALTEST_FIT_TAUS 10.0
+
+/*! Samples by which a period may be longer or shorter than Tpe before the lock is considered lost. */
+#define SEALTEST_PERIOD_SLACK 2
+
+static SealTestConfig_t config;
+static bool active = false;
+
+/*! Analyzer state, touched only by the acquisition thread once the sink is installed. */
+static double rate = 0.0;
+static unsigned int periodSamples = 0;
+static unsigned int pulseSamples = 0; /*!< Expected length of the positive half pulse. */
+static double sign = 1.0; /*!< Sign of Vstep: voltage and current are multiplied by it so that the first half pulse is the high level. */
+static double level = -std::numeric_limits <double>::infinity(); /*!< High level of the voltage, learned over the previous period. */
+static double nextLevel = -std::numeric_limits <double>::infinity();
+static unsigned int learned = 0;
+static bool high = false;
+static bool collecting = false;
+static unsigned int fill = 0;
+static unsigned int fallIdx = 0; /*!< Sample of the current period where the voltage stepped down to the negative half pulse. */
+static std::vector <double> period;
+static std::vector <double> average;
+static unsigned int averageFallIdx = 0;
+static unsigned long long periods = 0;
+
+static std::mutex resultMutex;
+static SealTestResult_t result;
+
+void sealTestDefaults(SealTestConfig_t &defaults)
+{
+    EdlCommandStruct_t commandStruct;
+
+    defaults.vstepMv = configShadow(EdlCommandVstep, commandStruct) ? commandStruct.value : 50.0;
+    defaults.tpuMs = configShadow(EdlCommandTpu, commandStruct) ? commandStruct.value : 20.0;
+    defaults.tpeMs = configShadow(EdlCommandTpe, commandStruct) ? commandStruct.value : 50.0;
+    defaults.averagedPeriods = SEALTEST_AVERAGED_PERIODS;
+}
+
+/*! Starts over at sampling rate \a newRate. */
+static void resetState(double newRate)
+{
+    rate = newRate;
+    periodSamples = (unsigned int)std::min(config.tpeMs*0.001*rate, (double)SEALTEST_MAX_PERIOD_SAMPLES);
+    pulseSamples = (unsigned int)(config.tpuMs*0.001*rate)/2;
+    level = -std::numeric_limits <double>::infinity();
+    nextLevel = level;
+    learned = 0;
+    high = false;
+    collecting = false;
+    fill = 0;
+    period.assign(periodSamples+SEALTEST_PERIOD_SLACK, 0.0);
+    average.assign(periodSamples, 0.0);
+    periods = 0;
+}
+
+static double mean(const std::vector <double> &x, unsigned int from, unsigned int to)
+{
+    double sum = 0.0;
+    for (unsigned int idx = from; idx < to; idx++) {sum += x[idx];}
+    return to > from ? sum/(to-from) : 0.0;
+}
+
+/*! Fits the averaged period. The negative step (-2 Vstep, twice the amplitude of the first edge) carries the transient:
+ * for a sampled exponential d[k] = A r^k, sum(d) and sum(k d) over k >= 1 give r and A without the edge sample itself,
+ * which may straddle the step. */
+static void fit(SealTestResult_t &estimate)
+{
+    unsigned int half = averageFallIdx;
+    unsigned int end = std::min(2*half, periodSamples);
+    unsigned int plateau = std::max(1u, half/SEALTEST_PLATEAU_FRACTION);
+    double dv = 2.0*config.vstepMv;
+
+    estimate.valid = 0;
+    if (half < 4 || end <= half+2) {return;}
+
+    double ip = mean(average, half-plateau, half);
+    double in = mean(average, end-plateau, end);
+    estimate.holdingCurrentPa = sign*0.5*(ip+in);
+    estimate.totalResistanceGOhm = dv/(ip-in);
+
+	/*! First guess of the time constant: where the transient fell to 1/e of its first sample. */
+    double r = 0.0, a = 0.0;
+    unsigned int window = end-half-1;
+    double first = std::fabs(average[half+1]-in);
+    for (unsigned int k = 2; k <= window; k++) {
+        if (std::fabs(average[half+k]-in) < first/std::exp(1.0)) {
+            window = std::min(window, std::max(8u, (unsigned int)(SEALTEST_FIT_TAUS*(k-1))));
+            break;
+        }
+    }
+    for (int iteration = 0; iteration < 2; iteration++) {
+        double s0 = 0.0, s1 = 0.0;
+        for (unsigned int k = 1; k <= window; k++) {
+            double d = average[half+k]-in;
+            s0 += d;
+            s1 += k*d;
+        }
+        if (s0 == 0.0 || s1/s0 <= 1.0) {return;}
+        r = 1.0-s0/s1;
+        a = s0*(1.0-r)/r;
+		/*! Narrow the window to a few time constants: past them the sum only collects noise. */
+        double tauSamples = -1.0/std::log(r);
+        window = std::min(window, std::max(8u, (unsigned int)(SEALTEST_FIT_TAUS*tauSamples)));
+    }
+
+    double tau = -1.0/(rate*std::log(r));
+    double ra = -dv/(a+in-ip);
+    double rt = estimate.totalResistanceGOhm;
+    double rm = rt-ra;
+    if (!(tau > 0.0) || !(ra > 0.0) || !(rm > 0.0)) {return;}
+
+    estimate.tauUs = tau*1e6;
+    estimate.accessResistanceMOhm = ra*1e3;
+    estimate.sealResistanceGOhm = rm;
+	/*! tau = Cm Ra Rm / (Ra+Rm); with R in GOhm and tau in s, Cm is in nF. */
+    estimate.membraneCapacitancePf = tau*rt/(ra*rm)*1e3;
+    estimate.valid = 1;
+}
+
+/*! A full period was collected: fold it into the running average and refit. */
+static void endPeriod()
+{
+    unsigned int n = std::min(fill, periodSamples);
+    periods++;
+    double alpha = 1.0/std::min(periods, (unsigned long long)std::max(1u, config.averagedPeriods));
+    for (unsigned int idx = 0; idx < n; idx++) {
+        average[idx] += alpha*(period[idx]-average[idx]);
+    }
+    averageFallIdx = fallIdx > 0 ? fallIdx : pulseSamples;
+
+    SealTestResult_t estimate = result;
+    estimate.periods = periods;
+    fit(estimate);
+
+	/*! Never wait on the reader thread: if a getter holds the result, publish with the next period. */
+    if (resultMutex.try_lock()) {
+        result = estimate;
+        resultMutex.unlock();
+    }
+}
+
+static void sealTestSink(const float * packets, unsigned int packetsNum, void *)
+{
+    double newRate = samplingRateHz(commandRadioId(EdlCommandSamplingRate));
+    if (newRate != rate) {resetState(newRate);}
+    if (periodSamples < 8) {return;}
+
+    const double unit = commandRadioId(EdlCommandRange) == EDL_RADIO_RANGE_20_NA ? 1000.0 : 1.0;
+    const double step = std::fabs(config.vstepMv);
+
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        const float * packet = packets+(size_t)packetIdx*EDL_CHANNEL_NUM;
+        double v = sign*packet[0];
+
+        nextLevel = std::max(nextLevel, v);
+        if (learned < periodSamples) {
+			/*! Learn the high level over one whole period before locking. */
+            if (++learned == periodSamples) {
+                level = nextLevel;
+                nextLevel = -std::numeric_limits <double>::infinity();
+            }
+            continue;
+        }
+
+        bool nowHigh = v > level-0.5*step;
+        if (nowHigh && !high) {
+            /*! Rising edge: a new period starts. */
+            if (collecting && fill+SEALTEST_PERIOD_SLACK >= periodSamples) {endPeriod();}
+            collecting = true;
+            fill = 0;
+            fallIdx = 0;
+            level = nextLevel;
+            nextLevel = v;
+        }
+        high = nowHigh;
+
+        if (!collecting) {
+            /*! No rising edge for a whole period: the level learned is from another protocol. Learn it again. */
+            if (++fill == period.size()) {
+                learned = 0;
+                fill = 0;
+                nextLevel = -std::numeric_limits <double>::infinity();
+            }
+            continue;
+        }
+        if (fallIdx == 0 && fill > 0 && v < level-1.5*step) {fallIdx = fill;}
+        if (fill == period.size()) {
+            /*! No rising edge where expected: the protocol changed or the pulses stopped. Learn the level again. */
+            collecting = false;
+            learned = 0;
+            fill = 0;
+            nextLevel = -std::numeric_limits <double>::infinity();
+            continue;
+        }
+        period[fill++] = sign*packet[1]*unit;
+    }
+}
+
+EdlErrorCode_t sealTestStart(const SealTestConfig_t &newConfig)
+{
+    if (newConfig.tpuMs <= 0.0 || newConfig.tpeMs < newConfig.tpuMs || newConfig.vstepMv == 0.0) {return EdlViolatedTrialRuleError;}
+
+    sealTestStop();
+    config = newConfig;
+    sign = config.vstepMv > 0.0 ? 1.0 : -1.0;
+    config.vstepMv = std::fabs(config.vstepMv);
+    rate = 0.0;
+    {
+        std::lock_guard <std::mutex> lock(resultMutex);
+        result = SealTestResult_t();
+    }
+
+	/*! Before the filter: the capacitive transients must keep their shape. */
+    acquisitionAddSink(sealTestSink, NULL, true);
+    active = true;
+
+    return EdlSuccess;
+}
+
+void sealTestStop()
+{
+    if (!active) {return;}
+    acquisitionRemoveSink(sealTestSink, NULL);
+    active = false;
+}
+
+void sealTestGet(SealTestResult_t &copy)
+{
+    std::lock_guard <std::mutex> lock(resultMutex);
+    copy = result;
+}
@@ -0,0 +1,63 @@
+/*! \file e1_sealtest.h
+ * \brief Declares the streaming seal test analyzer: seal resistance, access resistance and membrane capacitance
+ * from the current response to the seal test pulses, updated on every pulse period.
+ *
+ * The seal test protocol steps the voltage to Vhold+Vstep for Tpu/2, then to Vhold-Vstep for Tpu/2, every Tpe.
+ * The analyzer locks on the rising edge of the voltage channel, averages the current over the last periods
+ * synchronously with the pulses, and fits the averaged response with the cell model:
+ * access resistance Ra in series with the membrane (seal) resistance Rm in parallel with the capacitance Cm.
+ */
+#ifndef E1_SEALTEST_H
+#define E1_SEALTEST_H
+
+#include "edl.h"
+
+/*! \def SEALTEST_AVERAGED_PERIODS
+ * \brief Default number of periods averaged: the estimates follow changes over about this many periods.
+ */
+#define SEALTEST_AVERAGED_PERIODS 8
+
+/*! \def SEALTEST_MAX_PERIOD_SAMPLES
+ * \brief Longest pulse period analyzed, in samples (5 s at 200kHz).
+ */
+#define SEALTEST_MAX_PERIOD_SAMPLES 1000000
+
+/*! \struct SealTestConfig_t
+ * \brief Seal test protocol parameters, as sent with EdlCommandVstep, EdlCommandTpu and EdlCommandTpe.
+ */
+typedef struct {
+    double vstepMv; /*!< Pulse amplitude. */
+    double tpuMs; /*!< Pulse length: the positive and negative halves last tpuMs/2 each. */
+    double tpeMs; /*!< Pulse period. */
+    unsigned int averagedPeriods; /*!< Periods averaged, see #SEALTEST_AVERAGED_PERIODS. */
+} SealTestConfig_t;
+
+/*! \struct SealTestResult_t
+ * \brief Latest estimates. Returned by getSealTest.
+ */
+typedef struct {
+    double sealResistanceGOhm; /*!< Rm: total resistance minus access resistance. */
+    double accessResistanceMOhm; /*!< Ra. */
+    double membraneCapacitancePf; /*!< Cm. */
+    double totalResistanceGOhm; /*!< Ra+Rm, from the steady state currents alone. */
+    double tauUs; /*!< Time constant of the capacitive transient. */
+    double holdingCurrentPa; /*!< Steady state current at Vhold+Vstep and Vhold-Vstep, averaged. */
+    unsigned long long periods; /*!< Periods analyzed since the analyzer started. */
+    int valid; /*!< 1 once the transients could be fitted, 0 otherwise (no pulses found, or too noisy). */
+} SealTestResult_t;
+
+/*! \brief Fills \a config from the parameters the device has (see configShadow), or the setSealTestProtocol defaults. */
+void sealTestDefaults(SealTestConfig_t &config);
+
+/*! \brief Starts analyzing the packets read by the acquisition thread. A running analyzer is restarted.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t sealTestStart(const SealTestConfig_t &config);
+
+/*! \brief Stops the analyzer. The last result stays available. */
+void sealTestStop();
+
+/*! \brief Copies the latest estimates; cheap enough to be called at display rate. */
+void sealTestGet(SealTestResult_t &result);
+
+#endif // E1_SEALTEST_H
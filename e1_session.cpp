@@ -0,0 +1,280 @@
+/* e1_session.cpp
+Device session: the saved device id is tried before detecting the devices, and a compensation that still holds is kept */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "e1_session.h"
+#include "e1_acquisition.h"
+#include "e1_config.h"
+
+/*! State file and the state last saved to it, guarded by stateMutex: the compensation thread saves its outcome. */
+static std::mutex stateMutex;
+static std::string statePath(SESSION_STATE_FILE);
+static SessionState_t state;
+
+/*! Connections and disconnections, one at a time. */
+static std::mutex connectMutex;
+static std::thread worker;
+
+static std::mutex statusMutex;
+static std::condition_variable statusCondition;
+static std::atomic <int> status(SESSION_IDLE);
+static std::atomic <int> lastError(EdlSuccess);
+static std::atomic <unsigned int> warmFlags(0);
+
+static int64_t hostTimeUs()
+{
+    return std::chrono::duration_cast <std::chrono::microseconds> (std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void setStatus(int newStatus, EdlErrorCode_t error)
+{
+    std::lock_guard <std::mutex> lock(statusMutex);
+    lastError.store(error);
+    status.store(newStatus);
+    statusCondition.notify_all();
+}
+
+static bool loadState(SessionState_t &saved)
+{
+    std::lock_guard <std::mutex> lock(stateMutex);
+    if (statePath.empty()) {return false;}
+
+    FILE * f = fopen(statePath.c_str(), "rb");
+    if (f == NULL) {return false;}
+    bool valid = fread(&saved, sizeof(saved), 1, f) == 1 && memcmp(saved.magic, SESSION_STATE_MAGIC, sizeof(saved.magic)) == 0 &&
+                 saved.version == SESSION_STATE_VERSION && memchr(saved.deviceId, 0, sizeof(saved.deviceId)) != NULL;
+    fclose(f);
+
+    return valid;
+}
+
+/*! Writes \a state through a temporary file, so that a crash never leaves half a state behind. Called under stateMutex. */
+static void saveState()
+{
+    if (statePath.empty()) {return;}
+
+    std::string temporary = statePath+".tmp";
+    FILE * f = fopen(temporary.c_str(), "wb");
+    if (f == NULL) {return;}
+    bool saved = fwrite(&state, sizeof(state), 1, f) == 1;
+    saved = fclose(f) == 0 && saved;
+
+	/*! rename does not replace an existing file on Windows. */
+    if (saved) {
+        remove(statePath.c_str());
+        saved = rename(temporary.c_str(), statePath.c_str()) == 0;
+    }
+    if (!saved) {remove(temporary.c_str());}
+}
+
+/*! Completion callback of the offset compensation, on its thread. */
+static void compensationDone(int result, double residual, void *)
+{
+    std::lock_guard <std::mutex> lock(stateMutex);
+    state.compensationStatus = result;
+    state.compensationResidual = residual;
+    state.compensationTimeUs = hostTimeUs();
+    saveState();
+}
+
+/*! EDL::disconnectDevice, retried for a short while if the driver refuses. */
+static EdlErrorCode_t disconnectLocked()
+{
+    EdlErrorCode_t res;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()+std::chrono::milliseconds(SESSION_DISCONNECT_TIMEOUT_MS);
+
+    while (true) {
+        {
+            std::lock_guard <std::mutex> lock(edlMutex());
+            res = disconnectDevice();
+        }
+        if (res == EdlSuccess || res == EdlDeviceNotConnectedError || std::chrono::steady_clock::now() >= deadline) {break;}
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    configInvalidate();
+
+    return res == EdlDeviceNotConnectedError ? EdlSuccess : res;
+}
+
+static EdlErrorCode_t connectLocked(const SessionConfig_t &config)
+{
+    EdlErrorCode_t res;
+    EdlCommandStruct_t commandStruct;
+    SessionState_t saved;
+    std::vector <std::string> devices;
+    std::string deviceId;
+    unsigned int warm = 0;
+
+    warmFlags.store(0);
+    res = init();
+    if (res != EdlSuccess) {return res;}
+
+    offsetCompensationCancel();
+    acquisitionStop();
+    disconnectLocked();
+
+	/*! Warm start: the device of the last session, if it is still there, without detecting the devices. */
+    bool haveSaved = loadState(saved);
+    if (haveSaved && saved.deviceId[0] != 0) {
+        std::lock_guard <std::mutex> lock(edlMutex());
+        if (connectDevice(saved.deviceId) == EdlSuccess) {
+            deviceId = saved.deviceId;
+            warm |= SESSION_WARM_DEVICE;
+        }
+    }
+    if (deviceId.empty()) {
+        std::lock_guard <std::mutex> lock(edlMutex());
+        res = detectDevices(devices);
+        if (res != EdlSuccess) {return res;}
+        if (devices.empty()) {return EdlNoDevicesError;}
+
+        res = connectDevice(devices[0]);
+        if (res != EdlSuccess) {return res;}
+        deviceId = devices[0];
+    }
+    configInvalidate();
+
+	/*! Working modality, applied with a single send: sampling rate, current range, and final bandwidth. */
+    {
+        ConfigTransaction transaction;
+        commandStruct.radioId = config.samplingRateId;
+        sendCommand(EdlCommandSamplingRate, commandStruct, false);
+        commandStruct.radioId = config.rangeId;
+        sendCommand(EdlCommandRange, commandStruct, false);
+        commandStruct.radioId = config.bandwidthId;
+        sendCommand(EdlCommandFinalBandwidth, commandStruct, false);
+        res = transaction.commit();
+    }
+    if (res != EdlSuccess) {return res;}
+
+	/*! The compensation done in the last session is kept if it was done for this device and modality, is recent enough,
+	 * and the offset is still within the tolerance: the device keeps it while powered, but not across a power cycle. */
+    double age = haveSaved ? (hostTimeUs()-saved.compensationTimeUs)*1e-6 : -1.0;
+    bool reusable = haveSaved && deviceId == saved.deviceId && saved.compensationStatus == OFFSET_COMPENSATION_CONVERGED &&
+                    saved.samplingRateId == config.samplingRateId && saved.rangeId == config.rangeId &&
+                    saved.bandwidthId == config.bandwidthId && age >= 0.0 && age <= config.maxCompensationAgeSeconds;
+    double residual = 0.0;
+    if (reusable && (offsetMeasure(config.compensation, residual) != EdlSuccess || residual > config.compensation.tolerance)) {
+        reusable = false;
+    }
+
+    {
+        std::lock_guard <std::mutex> lock(stateMutex);
+        memset(&state, 0, sizeof(state));
+        memcpy(state.magic, SESSION_STATE_MAGIC, sizeof(state.magic));
+        state.version = SESSION_STATE_VERSION;
+        state.samplingRateId = config.samplingRateId;
+        state.rangeId = config.rangeId;
+        state.bandwidthId = config.bandwidthId;
+        strncpy(state.deviceId, deviceId.c_str(), SESSION_MAX_DEVICE_ID-1);
+        if (reusable) {
+			/*! The age still counts from the compensation itself. */
+            state.compensationStatus = OFFSET_COMPENSATION_CONVERGED;
+            state.compensationResidual = residual;
+            state.compensationTimeUs = saved.compensationTimeUs;
+        } else {
+            state.compensationStatus = OFFSET_COMPENSATION_RUNNING;
+        }
+        saveState();
+    }
+
+    if (reusable) {
+        offsetCompensationRestore(residual);
+        warm |= SESSION_WARM_COMPENSATION;
+    } else {
+		/*! The compensation completes in the background and saves its outcome. */
+        res = offsetCompensationStart(config.compensation, compensationDone, NULL);
+        if (res != EdlSuccess) {return res;}
+    }
+    warmFlags.store(warm);
+
+    return EdlSuccess;
+}
+
+void sessionDefaults(SessionConfig_t &defaults)
+{
+    defaults.samplingRateId = EDL_RADIO_SAMPLING_RATE_5_KHZ;
+    defaults.rangeId = EDL_RADIO_RANGE_200_PA;
+	/*! Current filters disabled: final bandwidth equal to half the sampling rate. */
+    defaults.bandwidthId = EDL_RADIO_FINAL_BANDWIDTH_SR_2;
+    defaults.maxCompensationAgeSeconds = 8.0*3600.0;
+    offsetCompensationDefaults(defaults.compensation);
+}
+
+void sessionSetStatePath(const char * path)
+{
+    std::lock_guard <std::mutex> lock(stateMutex);
+    statePath = path != NULL ? path : "";
+}
+
+EdlErrorCode_t sessionConnect(const SessionConfig_t &config)
+{
+    EdlErrorCode_t res;
+
+    if (worker.joinable() && status.load() == SESSION_CONNECTING) {return EdlUnknownError;}
+    if (worker.joinable()) {worker.join();}
+
+    std::lock_guard <std::mutex> lock(connectMutex);
+    setStatus(SESSION_CONNECTING, EdlSuccess);
+    res = connectLocked(config);
+    setStatus(res == EdlSuccess ? SESSION_CONNECTED : SESSION_FAILED, res);
+
+    return res;
+}
+
+EdlErrorCode_t sessionConnectAsync(const SessionConfig_t &config)
+{
+    if (worker.joinable() && status.load() == SESSION_CONNECTING) {return EdlUnknownError;}
+    if (worker.joinable()) {worker.join();}
+
+	/*! Connecting from now on, so that sessionWait called right after this returns waits. */
+    setStatus(SESSION_CONNECTING, EdlSuccess);
+    worker = std::thread([config] {
+        std::lock_guard <std::mutex> lock(connectMutex);
+        EdlErrorCode_t res = connectLocked(config);
+        setStatus(res == EdlSuccess ? SESSION_CONNECTED : SESSION_FAILED, res);
+    });
+
+    return EdlSuccess;
+}
+
+int sessionStatus(EdlErrorCode_t &error, unsigned int &warm)
+{
+    error = (EdlErrorCode_t)lastError.load();
+    warm = warmFlags.load();
+    return status.load();
+}
+
+int sessionWait(unsigned int timeoutMs)
+{
+    std::unique_lock <std::mutex> lock(statusMutex);
+    statusCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [] {
+        return status.load() != SESSION_CONNECTING;
+    });
+
+    return status.load();
+}
+
+EdlErrorCode_t sessionDisconnect()
+{
+    EdlErrorCode_t res;
+
+    if (worker.joinable()) {worker.join();}
+
+    std::lock_guard <std::mutex> lock(connectMutex);
+	/*! A connection that just ended may have started a compensation. */
+    offsetCompensationCancel();
+    res = disconnectLocked();
+    setStatus(SESSION_DISCONNECTED, res);
+
+    return res;
+}
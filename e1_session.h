@@ -0,0 +1,108 @@
+/*! \file e1_session.h
+ * \brief Declares the device session: connection, working modality and offset compensation, with a warm start.
+ *
+ * The device id, the working modality and the outcome of the last offset compensation are saved to a small state file.
+ * A later connection (after a restart of the process, or a reconnection) first tries the saved device id without
+ * detecting the devices, and skips the compensation if it ran for the same device and modality and the offset
+ * measured right after connecting is still within its tolerance. Connections can run in the background.
+ */
+#ifndef E1_SESSION_H
+#define E1_SESSION_H
+
+#include <stdint.h>
+
+#include "edl.h"
+#include "e1_offset.h"
+
+/*! \def SESSION_STATE_FILE
+ * \brief Default state file, in the working directory. See sessionSetStatePath.
+ */
+#define SESSION_STATE_FILE "e1_session.dat"
+
+#define SESSION_STATE_MAGIC "E1SESSN\0"
+#define SESSION_STATE_VERSION 1
+
+/*! \def SESSION_MAX_DEVICE_ID
+ * \brief Longest device id saved, terminating zero included.
+ */
+#define SESSION_MAX_DEVICE_ID 64
+
+/*! \def SESSION_DISCONNECT_TIMEOUT_MS
+ * \brief Time sessionDisconnect keeps retrying EDL::disconnectDevice: the bound closeEDL always had (1000 retries
+ * 1 ms apart), since the driver can refuse for a while after the last transfer.
+ */
+#define SESSION_DISCONNECT_TIMEOUT_MS 1000
+
+/*! Values returned by sessionStatus and sessionWait. */
+#define SESSION_IDLE 0 /*!< Never connected. */
+#define SESSION_CONNECTING 1
+#define SESSION_CONNECTED 2 /*!< Connected and configured; the offset compensation may still be running, see offsetCompensationWait. */
+#define SESSION_FAILED 3 /*!< See the error returned by sessionStatus. */
+#define SESSION_DISCONNECTED 4
+
+/*! Bits of the \a warm flags returned by sessionStatus. */
+#define SESSION_WARM_DEVICE 1 /*!< Connected to the saved device id: the devices were not detected. */
+#define SESSION_WARM_COMPENSATION 2 /*!< The saved compensation still held: it was not run again. */
+
+/*! \struct SessionState_t
+ * \brief Content of the state file.
+ */
+typedef struct {
+    char magic[8]; /*!< #SESSION_STATE_MAGIC. */
+    uint32_t version; /*!< #SESSION_STATE_VERSION. */
+    uint32_t samplingRateId; /*!< Working modality the compensation ran with. */
+    uint32_t rangeId;
+    uint32_t bandwidthId;
+    char deviceId[SESSION_MAX_DEVICE_ID]; /*!< Device last connected. */
+    int32_t compensationStatus; /*!< OFFSET_COMPENSATION_* outcome of the last compensation, #OFFSET_COMPENSATION_RUNNING while it runs. */
+    uint32_t reserved;
+    double compensationResidual; /*!< Residual offset when the compensation ended. */
+    int64_t compensationTimeUs; /*!< Host time at which it ended, in microseconds since the Unix epoch. */
+} SessionState_t;
+
+/*! \struct SessionConfig_t
+ * \brief Connection settings. Passed to sessionConnect.
+ */
+typedef struct {
+    unsigned int samplingRateId; /*!< Working modality applied once connected. */
+    unsigned int rangeId;
+    unsigned int bandwidthId;
+    double maxCompensationAgeSeconds; /*!< Older compensations are run again even if they still hold. */
+    OffsetCompensationConfig_t compensation; /*!< Criterion of the compensation, and of the check of a saved one. */
+} SessionConfig_t;
+
+/*! \brief Fills \a config with the defaults: 5kHz, 200pA, no filter, compensations kept for 8 hours. */
+void sessionDefaults(SessionConfig_t &config);
+
+/*! \brief Sets the state file; an empty path disables the warm start. Default #SESSION_STATE_FILE. */
+void sessionSetStatePath(const char * path);
+
+/*! \brief Connects and configures the device on the calling thread, then starts the offset compensation in the
+ * background unless the saved one still holds. The acquisition thread, a running compensation and a connected device
+ * are stopped first.
+ * \return #EdlErrorCode_t Error code: #EdlUnknownError if a connection is already in progress.
+ */
+EdlErrorCode_t sessionConnect(const SessionConfig_t &config);
+
+/*! \brief Same as sessionConnect on a background thread: returns at once.
+ * \return #EdlErrorCode_t Error code: #EdlUnknownError if a connection is already in progress.
+ */
+EdlErrorCode_t sessionConnectAsync(const SessionConfig_t &config);
+
+/*! \brief Returns the SESSION_* status of the last connection.
+ *
+ * \param error [out] Error of a #SESSION_FAILED connection, #EdlSuccess otherwise.
+ * \param warm [out] SESSION_WARM_* bits of the last connection.
+ */
+int sessionStatus(EdlErrorCode_t &error, unsigned int &warm);
+
+/*! \brief Blocks until the connection in progress ends or \a timeoutMs expires. \return SESSION_* status. */
+int sessionWait(unsigned int timeoutMs);
+
+/*! \brief Waits for a connection in progress, then releases the device, retrying for #SESSION_DISCONNECT_TIMEOUT_MS at most.
+ * The threads using the device must be stopped first.
+ * \return #EdlErrorCode_t Error code: #EdlSuccess also if no device was connected.
+ */
+EdlErrorCode_t sessionDisconnect();
+
+#endif // E1_SESSION_H
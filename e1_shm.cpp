@@ -0,0 +1,301 @@
+/* e1_shm.cpp
+Shared memory publish ring: named mappings and the reader side, which needs nothing from the device or the vendor driver */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "e1_shm.h"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the shared ring needs lock free 64 bit atomics");
+
+struct ShmReader {
+    ShmHeader_t * header;
+    const float * data;
+    uint64_t bytes;
+    void * handle;
+    ShmReaderSlot_t * slot;
+    uint64_t cursor; /*!< Private copy of slot->cursor: the reader is its only writer. */
+    uint64_t lost; /*!< Overrun packets not yet reported. */
+    char name[SHM_NAME_MAX];
+};
+
+/*! Windows names live in the session namespace; POSIX names need a leading slash. */
+static std::string systemName(const char * name)
+{
+#ifdef _WIN32
+    return std::string("Local\\")+name;
+#else
+    return std::string("/")+name;
+#endif
+}
+
+void * shmMap(const char * name, uint64_t bytes, bool create, bool &created, void * &handle)
+{
+    std::string path = systemName(name);
+    void * base;
+
+    created = false;
+    handle = NULL;
+#ifdef _WIN32
+    HANDLE mapping;
+    if (create) {
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(bytes >> 32), (DWORD)bytes, path.c_str());
+        if (mapping == NULL) {return NULL;}
+        created = GetLastError() != ERROR_ALREADY_EXISTS;
+    } else {
+        mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, path.c_str());
+        if (mapping == NULL) {return NULL;}
+    }
+    base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)bytes);
+    if (base == NULL) {
+        CloseHandle(mapping);
+        return NULL;
+    }
+    handle = mapping;
+#else
+    int fd = -1;
+    if (create) {
+        fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+        created = fd >= 0;
+    }
+    if (fd < 0) {fd = shm_open(path.c_str(), O_RDWR, 0666);}
+    if (fd < 0) {return NULL;}
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((uint64_t)st.st_size < bytes && (!create || ftruncate(fd, (off_t)bytes) != 0))) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, (size_t)bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	/*! The mapping keeps the object alive: the descriptor is not needed any more. */
+    close(fd);
+    if (base == MAP_FAILED) {return NULL;}
+#endif
+
+    return base;
+}
+
+void shmUnmap(const char * name, void * base, uint64_t bytes, void * handle, bool unlink)
+{
+#ifdef _WIN32
+    /*! Windows removes the name with the last handle. */
+    (void)name;
+    (void)bytes;
+    (void)unlink;
+    if (base != NULL) {UnmapViewOfFile(base);}
+    if (handle != NULL) {CloseHandle((HANDLE)handle);}
+#else
+    (void)handle;
+    if (base != NULL) {munmap(base, (size_t)bytes);}
+    if (unlink) {shm_unlink(systemName(name).c_str());}
+#endif
+}
+
+uint64_t shmBytes(unsigned int capacity)
+{
+    return sizeof(ShmHeader_t)+(uint64_t)capacity*EDL_CHANNEL_NUM*sizeof(float);
+}
+
+uint64_t shmProcessId()
+{
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return (uint64_t)getpid();
+#endif
+}
+
+/*! False only if process \a pid certainly no longer exists: its slot can be taken over. */
+static bool processAlive(uint64_t pid)
+{
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (process == NULL) {return GetLastError() != ERROR_INVALID_PARAMETER;}
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+#endif
+}
+
+static bool claimSlot(ShmReader_t * reader, uint64_t pid)
+{
+    for (int pass = 0; pass < 2; pass++) {
+        for (unsigned int slotIdx = 0; slotIdx < SHM_MAX_READERS; slotIdx++) {
+            ShmReaderSlot_t &slot = reader->header->readers[slotIdx];
+            uint64_t owner = slot.owner.load();
+			/*! First pass: free slots only; second pass: slots left behind by readers that died attached. */
+            if (owner != 0 && (pass == 0 || processAlive(owner))) {continue;}
+            if (slot.owner.compare_exchange_strong(owner, pid)) {
+                reader->slot = &slot;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+EdlErrorCode_t shmReaderAttach(const char * name, ShmReader_t * &reader)
+{
+    bool created;
+    void * handle;
+
+    reader = NULL;
+    if (name == NULL) {name = SHM_DEFAULT_NAME;}
+    if (strlen(name) >= SHM_NAME_MAX) {return EdlUnknownError;}
+
+	/*! Map the header alone to learn the size of the ring, then the whole ring. */
+    ShmHeader_t * header = (ShmHeader_t *)shmMap(name, sizeof(ShmHeader_t), false, created, handle);
+    if (header == NULL) {return EdlDeviceNotConnectedError;}
+    uint32_t magic = header->magic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    bool valid = magic == SHM_MAGIC && header->version == SHM_VERSION && header->channels == EDL_CHANNEL_NUM;
+    uint64_t bytes = shmBytes(header->capacity);
+    shmUnmap(name, header, sizeof(ShmHeader_t), handle, false);
+    if (!valid) {return EdlDeviceNotConnectedError;}
+
+    header = (ShmHeader_t *)shmMap(name, bytes, false, created, handle);
+    if (header == NULL) {return EdlDeviceNotConnectedError;}
+
+    reader = new ShmReader_t;
+    reader->header = header;
+    reader->data = (const float *)((const char *)header+header->dataOffset);
+    reader->bytes = bytes;
+    reader->handle = handle;
+    reader->lost = 0;
+    strcpy(reader->name, name);
+    if (!claimSlot(reader, shmProcessId())) {
+        shmUnmap(name, header, bytes, handle, false);
+        delete reader;
+        reader = NULL;
+        return EdlDeviceNotConnectedError;
+    }
+
+    reader->cursor = header->head.load(std::memory_order_acquire);
+    reader->slot->overrunPackets.store(0);
+    reader->slot->cursor.store(reader->cursor);
+
+    return EdlSuccess;
+}
+
+void shmReaderDetach(ShmReader_t * reader)
+{
+    if (reader == NULL) {return;}
+    reader->slot->owner.store(0);
+    shmUnmap(reader->name, reader->header, reader->bytes, reader->handle, false);
+    delete reader;
+}
+
+const ShmHeader_t & shmReaderHeader(const ShmReader_t * reader)
+{
+    return *reader->header;
+}
+
+/*! Moves the cursor to the oldest packet the producer has not started overwriting, if it is behind it. */
+static void skipOverrun(ShmReader_t * reader)
+{
+    uint64_t reserved = reader->header->reserved.load(std::memory_order_acquire);
+    uint64_t capacity = reader->header->capacity;
+
+    if (reserved > capacity && reader->cursor < reserved-capacity) {
+        uint64_t skipped = reserved-capacity-reader->cursor;
+        reader->cursor += skipped;
+        reader->lost += skipped;
+        reader->slot->overrunPackets.fetch_add(skipped, std::memory_order_relaxed);
+        reader->slot->cursor.store(reader->cursor, std::memory_order_relaxed);
+    }
+}
+
+void shmReaderPeek(ShmReader_t * reader, const float * &data, unsigned int &packets, uint64_t &sequence, uint64_t &lost)
+{
+    uint64_t head = reader->header->head.load(std::memory_order_acquire);
+    unsigned int capacity = reader->header->capacity;
+
+    skipOverrun(reader);
+    unsigned int start = (unsigned int)(reader->cursor & (capacity-1));
+    uint64_t available = head > reader->cursor ? head-reader->cursor : 0;
+    packets = (unsigned int)std::min(available, (uint64_t)(capacity-start));
+    data = reader->data+(size_t)start*EDL_CHANNEL_NUM;
+    sequence = reader->cursor;
+    lost = reader->lost;
+    reader->lost = 0;
+}
+
+bool shmReaderRelease(ShmReader_t * reader, unsigned int packets)
+{
+	/*! Seqlock check: the reads of the samples happen before the load of reserved. */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t reserved = reader->header->reserved.load(std::memory_order_relaxed);
+    bool intact = reserved <= reader->cursor+reader->header->capacity;
+
+    reader->cursor += packets;
+    reader->slot->cursor.store(reader->cursor, std::memory_order_relaxed);
+
+    return intact;
+}
+
+void shmReaderRead(ShmReader_t * reader, float * dst, unsigned int packets, unsigned int &got, uint64_t &sequence, uint64_t &lost)
+{
+    const float * span;
+    unsigned int spanPackets;
+    uint64_t spanSequence, spanLost;
+
+    got = 0;
+    sequence = reader->cursor;
+    lost = 0;
+    while (got < packets) {
+        shmReaderPeek(reader, span, spanPackets, spanSequence, spanLost);
+        if (got == 0) {sequence = spanSequence;}
+        if (spanLost > 0 && got > 0) {
+			/*! The packets copied so far are no longer followed by the next ones: start over from the oldest. */
+            lost += got;
+            got = 0;
+            sequence = spanSequence;
+        }
+        lost += spanLost;
+        spanPackets = std::min(spanPackets, packets-got);
+        if (spanPackets == 0) {break;}
+
+        memcpy(dst+(size_t)got*EDL_CHANNEL_NUM, span, (size_t)spanPackets*EDL_CHANNEL_NUM*sizeof(float));
+        uint64_t cursor = reader->cursor;
+        if (!shmReaderRelease(reader, spanPackets)) {
+			/*! Overwritten while copying: discard everything and resume from the oldest intact packet. */
+            reader->cursor = cursor;
+            lost += got;
+            got = 0;
+            continue;
+        }
+        got += spanPackets;
+    }
+}
+
+unsigned int shmReaderWait(ShmReader_t * reader, unsigned int minPackets, unsigned int timeoutMs)
+{
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()+std::chrono::milliseconds(timeoutMs);
+    unsigned int capacity = reader->header->capacity;
+
+    while (true) {
+        uint64_t head = reader->header->head.load(std::memory_order_acquire);
+        uint64_t available = head > reader->cursor ? std::min(head-reader->cursor, (uint64_t)capacity) : 0;
+        if (available >= minPackets || std::chrono::steady_clock::now() >= end ||
+                reader->header->publishing.load(std::memory_order_relaxed) == 0) {
+            return (unsigned int)available;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
@@ -0,0 +1,140 @@
+/*! \file e1_shm.h
+ * \brief Declares the layout of the shared memory publish ring and the reader library that maps it from other processes.
+ *
+ * One producer (the process that owns the device, see e1_publisher.h) writes data packets into a named shared
+ * memory ring; any number of processes attach to it by name and read the packets in place, without the vendor driver.
+ * Packets are numbered by a 64 bit sequence number, the count of packets published since the ring was created,
+ * which never wraps. The producer never waits for the readers: a reader that falls more than the ring capacity
+ * behind is overrun, skips to the oldest packet still in the ring and is told how many packets it lost.
+ */
+#ifndef E1_SHM_H
+#define E1_SHM_H
+
+#include <atomic>
+#include <stdint.h>
+
+#include "edl.h"
+
+/*! \def SHM_MAGIC
+ * \brief First bytes of the shared memory: "E1SH".
+ */
+#define SHM_MAGIC 0x48533145
+
+/*! \def SHM_VERSION
+ * \brief Layout version. Readers refuse rings with a different version.
+ */
+#define SHM_VERSION 1
+
+/*! \def SHM_MAX_READERS
+ * \brief Number of reader slots, i.e. of readers attached at the same time.
+ */
+#define SHM_MAX_READERS 16
+
+/*! \def SHM_NAME_MAX
+ * \brief Longest ring name, terminator included.
+ */
+#define SHM_NAME_MAX 64
+
+/*! \def SHM_DEFAULT_NAME
+ * \brief Name of the ring when the producer is given none.
+ */
+#define SHM_DEFAULT_NAME "e1_live"
+
+/*! \struct ShmReaderSlot_t
+ * \brief Per-reader state, in shared memory so that the producer (and anyone else) can see how far behind each reader is.
+ */
+typedef struct {
+    std::atomic <uint64_t> owner; /*!< Process id of the reader owning the slot, 0 if free. */
+    std::atomic <uint64_t> cursor; /*!< Sequence number of the next packet the reader will read. */
+    std::atomic <uint64_t> overrunPackets; /*!< Packets the reader lost because the producer overwrote them first. */
+    uint64_t reserved[5]; /*!< Pads the slot to a cache line. */
+} ShmReaderSlot_t;
+
+/*! \struct ShmHeader_t
+ * \brief Start of the shared memory. The samples follow at \a dataOffset, \a capacity packets of \a channels floats.
+ *
+ * The producer announces the packets it is about to write in \a reserved, copies them, then publishes them in
+ * \a head. Packet s is in the ring while reserved-capacity <= s < head.
+ */
+typedef struct {
+    uint32_t magic; /*!< #SHM_MAGIC, written last when the ring is created. */
+    uint32_t version; /*!< #SHM_VERSION. */
+    uint32_t channels; /*!< Floats per packet: #EDL_CHANNEL_NUM. */
+    uint32_t capacity; /*!< Packets in the ring, a power of two. */
+    uint64_t dataOffset; /*!< Byte offset of the samples from the start of the shared memory. */
+    uint64_t producerPid; /*!< Process id of the producer. */
+    std::atomic <uint32_t> session; /*!< Incremented each time the producer (re)starts publishing into the ring. */
+    std::atomic <uint32_t> publishing; /*!< 1 while the producer is publishing, 0 once it stopped. */
+    std::atomic <uint32_t> samplingRateId; /*!< EdlCommandSamplingRate radio id of the published packets, or #UNKNOWN_RADIO_ID. */
+    std::atomic <uint32_t> rangeId; /*!< EdlCommandRange radio id of the published packets, or #UNKNOWN_RADIO_ID. */
+    uint64_t pad0[4];
+    std::atomic <uint64_t> reserved; /*!< Sequence number past the last packet being written. */
+    uint64_t pad1[7];
+    std::atomic <uint64_t> head; /*!< Sequence number past the last packet published. */
+    uint64_t pad2[7];
+    ShmReaderSlot_t readers[SHM_MAX_READERS];
+} ShmHeader_t;
+
+/*! \brief Creates or maps the shared memory \a name of \a bytes bytes.
+ * \param created [out] True if the shared memory did not exist.
+ * \return Base address of the mapping, NULL on failure.
+ */
+void * shmMap(const char * name, uint64_t bytes, bool create, bool &created, void * &handle);
+
+/*! \brief Unmaps a mapping returned by shmMap, removing the name if \a unlink is true. */
+void shmUnmap(const char * name, void * base, uint64_t bytes, void * handle, bool unlink);
+
+/*! \brief Bytes of shared memory of a ring of \a capacity packets. */
+uint64_t shmBytes(unsigned int capacity);
+
+/*! \brief Process id of the calling process. */
+uint64_t shmProcessId();
+
+/*! \struct ShmReader_t
+ * \brief Opaque handle to an attached reader.
+ */
+typedef struct ShmReader ShmReader_t;
+
+/*! \brief Attaches to the ring \a name and claims a reader slot. The reader starts at the newest packet.
+ *
+ * \param name [in] Ring name, NULL for #SHM_DEFAULT_NAME.
+ * \param reader [out] Handle to pass to the other functions, valid until shmReaderDetach.
+ * \return #EdlErrorCode_t Error code: #EdlDeviceNotConnectedError if the ring does not exist, is not valid or has no free slot.
+ */
+EdlErrorCode_t shmReaderAttach(const char * name, ShmReader_t * &reader);
+
+/*! \brief Releases the reader slot and unmaps the ring. */
+void shmReaderDetach(ShmReader_t * reader);
+
+/*! \brief Returns the header of the ring, for its capacity, session and settings. */
+const ShmHeader_t & shmReaderHeader(const ShmReader_t * reader);
+
+/*! \brief Returns the packets available to the reader as one contiguous span, in place in the ring.
+ * If the reader was overrun it first skips to the oldest packet still in the ring.
+ *
+ * \param data [out] First sample of the span, \a packets * channels floats, interleaved like EDL::readData.
+ * \param packets [out] Packets in the span; packets past the end of the ring are returned by the next call.
+ * \param sequence [out] Sequence number of the first packet of the span.
+ * \param lost [out] Packets skipped because of an overrun since the previous call.
+ */
+void shmReaderPeek(ShmReader_t * reader, const float * &data, unsigned int &packets, uint64_t &sequence, uint64_t &lost);
+
+/*! \brief Moves the cursor past the first \a packets packets of the last span returned by shmReaderPeek.
+ * \return true if these packets were still intact, false if the producer overwrote some while they were in use.
+ */
+bool shmReaderRelease(ShmReader_t * reader, unsigned int packets);
+
+/*! \brief Copies up to \a packets packets into \a dst, handling wrap and overruns.
+ *
+ * \param got [out] Packets copied.
+ * \param sequence [out] Sequence number of the first packet copied.
+ * \param lost [out] Packets lost to overruns before the first packet copied.
+ */
+void shmReaderRead(ShmReader_t * reader, float * dst, unsigned int packets, unsigned int &got, uint64_t &sequence, uint64_t &lost);
+
+/*! \brief Waits until at least \a minPackets packets are available or \a timeoutMs elapsed.
+ * \return Packets available.
+ */
+unsigned int shmReaderWait(ShmReader_t * reader, unsigned int minPackets, unsigned int timeoutMs);
+
+#endif // E1_SHM_H
@@ -0,0 +1,86 @@
+/* e1_shmreader.cpp
+Reader library of the shared memory publish ring: lets any process read the live stream without the device or the vendor driver */
+
+#include "e1_shm.h"
+
+extern "C" __declspec(dllexport) int attachPublisher(const char * name, void ** handle)
+{
+    EdlErrorCode_t res;
+    ShmReader_t * reader;
+
+    if (handle == NULL) {return -1;}
+    res = shmReaderAttach(name, reader);
+    if (res != EdlSuccess) {return res;}
+    *handle = reader;
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int detachPublisher(void * handle)
+{
+    shmReaderDetach((ShmReader_t *)handle);
+
+    return 0;
+}
+
+/*! Capacity in packets, session counter, publishing flag and the radio ids of the sampling rate and range. */
+extern "C" __declspec(dllexport) int getPublisherInfo(void * handle, unsigned int * capacity, unsigned int * session,
+                                                      int * publishing, unsigned int * samplingRateId, unsigned int * rangeId)
+{
+    if (handle == NULL) {return -1;}
+    const ShmHeader_t &header = shmReaderHeader((ShmReader_t *)handle);
+    if (capacity != NULL) {*capacity = header.capacity;}
+    if (session != NULL) {*session = header.session.load();}
+    if (publishing != NULL) {*publishing = (int)header.publishing.load();}
+    if (samplingRateId != NULL) {*samplingRateId = header.samplingRateId.load();}
+    if (rangeId != NULL) {*rangeId = header.rangeId.load();}
+
+    return 0;
+}
+
+/*! Zero-copy access: \a data points into the shared ring until releasePackets. */
+extern "C" __declspec(dllexport) int peekPackets(void * handle, const float ** data, unsigned int * packets,
+                                                 unsigned long long * sequence, unsigned long long * lost)
+{
+    const float * span;
+    unsigned int spanPackets;
+    uint64_t spanSequence, spanLost;
+
+    if (handle == NULL || data == NULL || packets == NULL) {return -1;}
+    shmReaderPeek((ShmReader_t *)handle, span, spanPackets, spanSequence, spanLost);
+    *data = span;
+    *packets = spanPackets;
+    if (sequence != NULL) {*sequence = spanSequence;}
+    if (lost != NULL) {*lost = spanLost;}
+
+    return 0;
+}
+
+/*! Returns 1 if the released packets were overwritten while in use, 0 otherwise. */
+extern "C" __declspec(dllexport) int releasePackets(void * handle, unsigned int packets)
+{
+    if (handle == NULL) {return -1;}
+    return shmReaderRelease((ShmReader_t *)handle, packets) ? 0 : 1;
+}
+
+extern "C" __declspec(dllexport) int readPackets(void * handle, float * dst, unsigned int packets, unsigned int * got,
+                                                 unsigned long long * sequence, unsigned long long * lost)
+{
+    unsigned int gotPackets;
+    uint64_t firstSequence, lostPackets;
+
+    if (handle == NULL || dst == NULL || got == NULL) {return -1;}
+    shmReaderRead((ShmReader_t *)handle, dst, packets, gotPackets, firstSequence, lostPackets);
+    *got = gotPackets;
+    if (sequence != NULL) {*sequence = firstSequence;}
+    if (lost != NULL) {*lost = lostPackets;}
+
+    return 0;
+}
+
+/*! Returns the packets available after waiting up to \a timeoutMs for \a minPackets. */
+extern "C" __declspec(dllexport) int waitPackets(void * handle, unsigned int minPackets, unsigned int timeoutMs)
+{
+    if (handle == NULL) {return -1;}
+    return (int)shmReaderWait((ShmReader_t *)handle, minPackets, timeoutMs);
+}
@@ -0,0 +1,334 @@
+/* e1_spectrum.cpp
+Noise analyzer: the acquisition thread fills a ring, a worker thread averages Hann windowed periodograms of every channel */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "e1_spectrum.h"
+#include "e1_acquisition.h"
+#include "e1_ring.h"
+
+/*! Packets taken from the ring per pass of the worker. */
+#define SPECTRUM_READ_PACKETS 4096
+
+static const double pi = 3.14159265358979323846;
+
+void spectrumDefaults(SpectrumConfig_t &config)
+{
+    config.length = 4096;
+    config.overlap = 0.5;
+    config.averages = 32;
+    config.raw = 1;
+    config.bandsNum = 3;
+    config.bandLowHz[0] = 1.0;
+    config.bandHighHz[0] = 1e3;
+    config.bandLowHz[1] = 1.0;
+    config.bandHighHz[1] = 1e4;
+    config.bandLowHz[2] = 1.0;
+    config.bandHighHz[2] = 1e9;
+}
+
+void RealFft::plan(unsigned int length)
+{
+    unsigned int half = length/2;
+    unsigned int bits = 0;
+
+    n = length;
+    while ((1u << bits) < half) {bits++;}
+    reversed.resize(half);
+    for (unsigned int k = 0; k < half; k++) {
+        unsigned int r = 0;
+        for (unsigned int b = 0; b < bits; b++) {r |= ((k >> b) & 1) << (bits-1-b);}
+        reversed[k] = r;
+    }
+
+    twiddles.resize(std::max(half/2, 1u));
+    for (unsigned int k = 0; k < twiddles.size(); k++) {twiddles[k] = std::polar(1.0, -2.0*pi*k/half);}
+    split.resize(half+1);
+    for (unsigned int k = 0; k <= half; k++) {split[k] = std::polar(1.0, -2.0*pi*k/n);}
+    z.resize(half);
+}
+
+void RealFft::power(const float * x, double * out)
+{
+    const unsigned int half = n/2;
+
+	/*! Even samples in the real part, odd ones in the imaginary part, in bit reversed order. */
+    for (unsigned int k = 0; k < half; k++) {
+        unsigned int m = reversed[k];
+        z[k] = std::complex <double> (x[2*m], x[2*m+1]);
+    }
+
+    for (unsigned int size = 2; size <= half; size <<= 1) {
+        unsigned int stride = half/size;
+        for (unsigned int start = 0; start < half; start += size) {
+            for (unsigned int k = 0; k < size/2; k++) {
+                std::complex <double> t = twiddles[k*stride]*z[start+k+size/2];
+                z[start+k+size/2] = z[start+k]-t;
+                z[start+k] += t;
+            }
+        }
+    }
+
+	/*! X[k] = E[k] + exp(-2 pi i k/n) O[k], with E and O the transforms of the even and odd samples. */
+    for (unsigned int k = 0; k <= half; k++) {
+        std::complex <double> a = z[k % half];
+        std::complex <double> b = std::conj(z[(half-k) % half]);
+        std::complex <double> even = 0.5*(a+b);
+        std::complex <double> odd = std::complex <double> (0.0, -0.5)*(a-b);
+        out[k] = std::norm(even+split[k]*odd);
+    }
+}
+
+static SpectrumConfig_t config;
+static bool active = false;
+
+static PacketRing ring;
+static std::atomic <unsigned long long> droppedPackets(0);
+static std::atomic <bool> restartRequested(false);
+static std::atomic <bool> stopping(false);
+static std::thread worker;
+static std::mutex wakeMutex;
+static std::condition_variable wakeCondition;
+
+/*! Worker state. */
+static RealFft fft;
+static std::vector <float> window;
+static double windowPower = 0.0; /*!< Sum of the squared window. */
+static unsigned int hop = 0;
+static std::vector <float> segments[EDL_CHANNEL_NUM]; /*!< Segment being filled, per channel. */
+static unsigned int fill = 0;
+static std::vector <float> windowed;
+static std::vector <double> periodogram;
+static unsigned int settings[3];
+static double rate = 0.0;
+static unsigned long long seenDropped = 0;
+
+/*! Averaged spectrum, written by the worker and copied by spectrumGet. */
+static std::mutex resultMutex;
+static std::vector <double> average[EDL_CHANNEL_NUM];
+static unsigned long long averaged = 0;
+static double resultRate = 0.0;
+static unsigned int restarts = 0;
+static bool started = false;
+
+static void spectrumSink(const float * packets, unsigned int packetsNum, void *)
+{
+    unsigned int n = ring.write(packets, packetsNum);
+    if (n < packetsNum) {droppedPackets.fetch_add(packetsNum-n, std::memory_order_relaxed);}
+    wakeCondition.notify_one();
+}
+
+/*! True if the sampling rate, range or bandwidth changed since the last call. */
+static bool settingsChanged()
+{
+    static const EdlCommandId_t commands[3] = {EdlCommandSamplingRate, EdlCommandRange, EdlCommandFinalBandwidth};
+    bool changed = false;
+
+    for (unsigned int idx = 0; idx < 3; idx++) {
+        unsigned int id = commandRadioId(commands[idx]);
+        if (id != settings[idx]) {changed = true;}
+        settings[idx] = id;
+    }
+    return changed;
+}
+
+/*! Forgets the average and the segments in progress; the packets already in the ring predate the change, so they go too.
+ * \param counted [in] Whether to count the restart in SpectrumInfo_t::restarts. */
+static void restartAverage(bool counted)
+{
+    ring.consume(ring.readable());
+    fill = 0;
+    rate = samplingRateHz(settings[0]);
+
+    std::lock_guard <std::mutex> lock(resultMutex);
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        std::fill(average[channelIdx].begin(), average[channelIdx].end(), 0.0);
+    }
+    averaged = 0;
+    resultRate = rate;
+    if (counted) {restarts++;}
+}
+
+/*! Folds the full segments into the average, then keeps their overlapping tail for the next ones.
+ * The mean of each segment is removed first, so that the offset does not leak into the lowest bins through the window. */
+static void analyzeSegments()
+{
+    const unsigned int length = fft.length();
+    const unsigned int bins = length/2+1;
+	/*! One-sided density: the power of the negative frequencies goes to the positive ones, except at 0 Hz and rate/2. */
+    const double scale = 1.0/(rate*windowPower);
+
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        const float * x = segments[channelIdx].data();
+        double sum = 0.0;
+        for (unsigned int k = 0; k < length; k++) {sum += x[k];}
+        float mean = (float)(sum/length);
+        for (unsigned int k = 0; k < length; k++) {windowed[k] = (x[k]-mean)*window[k];}
+        fft.power(windowed.data(), periodogram.data()+(size_t)channelIdx*bins);
+        memmove(segments[channelIdx].data(), x+hop, (size_t)(length-hop)*sizeof(float));
+    }
+    fill = length-hop;
+
+    std::lock_guard <std::mutex> lock(resultMutex);
+    unsigned long long count = averaged+1;
+    double alpha = 1.0/(config.averages > 0 ? std::min(count, (unsigned long long)config.averages) : count);
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        const double * p = periodogram.data()+(size_t)channelIdx*bins;
+        std::vector <double> &avg = average[channelIdx];
+        for (unsigned int k = 0; k < bins; k++) {
+            avg[k] += alpha*(p[k]*scale*(k == 0 || k == bins-1 ? 1.0 : 2.0)-avg[k]);
+        }
+    }
+    averaged = count;
+}
+
+static void workerLoop()
+{
+    const unsigned int length = fft.length();
+
+    settingsChanged();
+    restartAverage(false);
+    while (!stopping.load()) {
+        bool changed = settingsChanged();
+        bool requested = restartRequested.exchange(false);
+        if (changed || requested) {restartAverage(changed);}
+
+		/*! Packets lost in between: a segment across the hole would be wrong. */
+        unsigned long long dropped = droppedPackets.load(std::memory_order_relaxed);
+        if (dropped != seenDropped) {
+            seenDropped = dropped;
+            fill = 0;
+        }
+
+        const float * first;
+        const float * second;
+        unsigned int firstPackets, secondPackets;
+        unsigned int available = ring.peek(first, firstPackets, second, secondPackets);
+        if (available == 0 || rate <= 0.0) {
+            if (rate <= 0.0) {ring.consume(available);}
+            std::unique_lock <std::mutex> lock(wakeMutex);
+            wakeCondition.wait_for(lock, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        unsigned int n = std::min(std::min(available, length-fill), (unsigned int)SPECTRUM_READ_PACKETS);
+        for (unsigned int packetIdx = 0; packetIdx < n; packetIdx++) {
+            const float * packet = packetIdx < firstPackets ? first+(size_t)packetIdx*EDL_CHANNEL_NUM :
+                                                              second+(size_t)(packetIdx-firstPackets)*EDL_CHANNEL_NUM;
+            for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+                segments[channelIdx][fill+packetIdx] = packet[channelIdx];
+            }
+        }
+        ring.consume(n);
+        fill += n;
+        if (fill == length) {analyzeSegments();}
+    }
+}
+
+EdlErrorCode_t spectrumStart(const SpectrumConfig_t &newConfig)
+{
+    unsigned int length = newConfig.length;
+
+    if (length < SPECTRUM_MIN_LENGTH || length > SPECTRUM_MAX_LENGTH || (length & (length-1)) != 0) {return EdlUnknownError;}
+    if (!(newConfig.overlap >= 0.0 && newConfig.overlap <= 0.9) || newConfig.bandsNum > SPECTRUM_MAX_BANDS) {return EdlUnknownError;}
+
+    spectrumStop();
+
+    fft.plan(length);
+    window.resize(length);
+    windowPower = 0.0;
+    for (unsigned int k = 0; k < length; k++) {
+		/*! Periodic Hann window: the overlapped segments add up to a constant at half overlap. */
+        window[k] = (float)(0.5-0.5*std::cos(2.0*pi*k/length));
+        windowPower += (double)window[k]*window[k];
+    }
+    hop = std::max(1u, (unsigned int)std::floor(length*(1.0-newConfig.overlap)+0.5));
+    windowed.resize(length);
+    periodogram.resize((size_t)EDL_CHANNEL_NUM*(length/2+1));
+    {
+        std::lock_guard <std::mutex> lock(resultMutex);
+        config = newConfig;
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            segments[channelIdx].assign(length, 0.0f);
+            average[channelIdx].assign(length/2+1, 0.0);
+        }
+        averaged = 0;
+        restarts = 0;
+        started = true;
+    }
+
+    if (ring.capacity() < SPECTRUM_RING_PACKETS) {ring.allocate(SPECTRUM_RING_PACKETS);}
+    ring.reset();
+    droppedPackets.store(0);
+    seenDropped = 0;
+    restartRequested.store(false);
+    stopping.store(false);
+    worker = std::thread(workerLoop);
+    acquisitionAddSink(spectrumSink, NULL, config.raw != 0);
+    active = true;
+
+    return EdlSuccess;
+}
+
+void spectrumStop()
+{
+    if (!active) {return;}
+    acquisitionRemoveSink(spectrumSink, NULL);
+    stopping.store(true);
+    wakeCondition.notify_one();
+    worker.join();
+    active = false;
+}
+
+void spectrumRestart()
+{
+    restartRequested.store(true);
+    wakeCondition.notify_one();
+}
+
+bool spectrumGet(unsigned int channel, double * psd, unsigned int maxBins, SpectrumInfo_t &info)
+{
+    memset(&info, 0, sizeof(info));
+    if (channel >= EDL_CHANNEL_NUM) {return false;}
+
+    std::lock_guard <std::mutex> lock(resultMutex);
+    if (!started) {return false;}
+
+    unsigned int bins = (unsigned int)average[0].size();
+    info.samplingRateHz = resultRate;
+    info.binHz = resultRate/((bins-1)*2);
+    info.bins = bins;
+    info.segments = averaged;
+    info.droppedPackets = droppedPackets.load();
+    info.restarts = restarts;
+
+	/*! Integrated noise: the density summed over the bins whose frequency lies in the band, times the bin width. */
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+        const std::vector <double> &avg = average[channelIdx];
+        double total = 0.0;
+        for (unsigned int k = 1; k < bins; k++) {total += avg[k];}
+        info.totalRms[channelIdx] = std::sqrt(total*info.binHz);
+
+        for (unsigned int bandIdx = 0; bandIdx < config.bandsNum; bandIdx++) {
+            double sum = 0.0;
+            for (unsigned int k = 0; k < bins; k++) {
+                double f = k*info.binHz;
+                if (f >= config.bandLowHz[bandIdx] && f <= config.bandHighHz[bandIdx]) {sum += avg[k];}
+            }
+            info.bandRms[channelIdx][bandIdx] = std::sqrt(sum*info.binHz);
+        }
+    }
+
+    if (psd != NULL) {
+        unsigned int n = std::min(maxBins, bins);
+        std::copy(average[channel].begin(), average[channel].begin()+n, psd);
+    }
+    return true;
+}
@@ -0,0 +1,108 @@
+/*! \file e1_spectrum.h
+ * \brief Declares the background noise analyzer: a running Welch power spectral density of every channel,
+ * and the RMS noise integrated over frequency bands.
+ *
+ * The acquisition thread only copies the packets into a ring; a worker thread cuts them into overlapping segments,
+ * applies a Hann window and a real FFT, and averages the periodograms. The average starts over whenever the sampling
+ * rate, the range or the bandwidth changes, so the spectrum always describes the current settings.
+ */
+#ifndef E1_SPECTRUM_H
+#define E1_SPECTRUM_H
+
+#include <complex>
+#include <vector>
+
+#include "edl.h"
+
+/*! \def SPECTRUM_MIN_LENGTH
+ * \brief Shortest segment, in samples.
+ */
+#define SPECTRUM_MIN_LENGTH 64
+
+/*! \def SPECTRUM_MAX_LENGTH
+ * \brief Longest segment, in samples: 0.33 s and 3 Hz bins at 200kHz.
+ */
+#define SPECTRUM_MAX_LENGTH 65536
+
+/*! \def SPECTRUM_MAX_BANDS
+ * \brief Most bands whose RMS noise is reported.
+ */
+#define SPECTRUM_MAX_BANDS 8
+
+/*! \def SPECTRUM_RING_PACKETS
+ * \brief Packets buffered between the acquisition thread and the worker: about 1.3 s at 200kHz.
+ */
+#define SPECTRUM_RING_PACKETS (1 << 18)
+
+/*! \struct SpectrumConfig_t
+ * \brief Noise analyzer settings. Passed to startSpectrum.
+ */
+typedef struct {
+    unsigned int length; /*!< Segment length: a power of two from #SPECTRUM_MIN_LENGTH to #SPECTRUM_MAX_LENGTH. Bins are rate/length apart. */
+    double overlap; /*!< Fraction of each segment shared with the next one, from 0 to 0.9. */
+    unsigned int averages; /*!< Segments averaged: the spectrum follows changes over about this many; 0 averages every segment since the start. */
+    int raw; /*!< 1: analyze the packets before the filter stage (see acquisitionAddSink); 0: after it. */
+    unsigned int bandsNum; /*!< Bands in \a bandLowHz and \a bandHighHz, up to #SPECTRUM_MAX_BANDS. */
+    double bandLowHz[SPECTRUM_MAX_BANDS]; /*!< Lowest frequency of each band. */
+    double bandHighHz[SPECTRUM_MAX_BANDS]; /*!< Highest frequency of each band, capped at half the sampling rate. */
+} SpectrumConfig_t;
+
+/*! \struct SpectrumInfo_t
+ * \brief State of the averaged spectrum. Returned by getSpectrum.
+ */
+typedef struct {
+    double samplingRateHz; /*!< Sampling rate of the segments averaged. */
+    double binHz; /*!< Frequency step between bins. */
+    unsigned int bins; /*!< length/2 + 1 bins, from 0 Hz to half the sampling rate. */
+    unsigned long long segments; /*!< Segments averaged since the last restart. */
+    unsigned long long droppedPackets; /*!< Packets lost because the worker fell behind; each loss restarts the segments in progress. */
+    unsigned int restarts; /*!< Times the average started over after a settings change. */
+    double totalRms[EDL_CHANNEL_NUM]; /*!< RMS noise of each channel over every bin but 0 Hz, in the channel unit. */
+    double bandRms[EDL_CHANNEL_NUM][SPECTRUM_MAX_BANDS]; /*!< RMS noise of each channel over each band. */
+} SpectrumInfo_t;
+
+/*! \brief Fills \a config with the default settings: 4096 samples, half overlap, 32 averages, raw packets,
+ * RMS from 1 Hz up to 1 kHz, 10 kHz and half the sampling rate. */
+void spectrumDefaults(SpectrumConfig_t &config);
+
+/*! \class RealFft
+ * \brief Power spectrum of real segments of a fixed length, planned once: the bit reversal and every twiddle factor
+ * are tabulated, and the segment is transformed as a complex FFT of half its length.
+ */
+class RealFft
+{
+public:
+    /*! \brief Plans the transform of \a length samples, a power of two of at least 4. */
+    void plan(unsigned int length);
+
+    unsigned int length() const {return n;}
+
+    /*! \brief Writes |X[k]|^2 for k = 0 to length/2 into \a power, X being the DFT of the \a length samples at \a x. */
+    void power(const float * x, double * power);
+
+private:
+    unsigned int n;
+    std::vector <unsigned int> reversed; /*!< Bit reversal permutation of the half length transform. */
+    std::vector <std::complex <double> > twiddles; /*!< exp(-2 pi i k / (n/2)), k < n/4. */
+    std::vector <std::complex <double> > split; /*!< exp(-2 pi i k / n), k <= n/2: recovers the real transform. */
+    std::vector <std::complex <double> > z;
+};
+
+/*! \brief Starts analyzing the packets read by the acquisition thread. A running analyzer is restarted.
+ * \return #EdlErrorCode_t Error code.
+ */
+EdlErrorCode_t spectrumStart(const SpectrumConfig_t &config);
+
+/*! \brief Stops the analyzer and joins its worker. The last spectrum stays available. */
+void spectrumStop();
+
+/*! \brief Forgets the segments averaged so far. Changes of rate, range and bandwidth do so on their own. */
+void spectrumRestart();
+
+/*! \brief Copies up to \a maxBins bins of the averaged PSD of channel \a channel, in unit^2/Hz, and the noise figures.
+ * \param psd [out] May be NULL to get \a info alone.
+ * \return false if the analyzer was never started or \a channel does not exist.
+ */
+bool spectrumGet(unsigned int channel, double * psd, unsigned int maxBins, SpectrumInfo_t &info);
+
+#endif // E1_SPECTRUM_H
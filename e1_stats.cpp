@@ -0,0 +1,174 @@
+/* e1_stats.cpp
+Lock free telemetry: per-thread slots of relaxed atomics, summed and differenced only when a report is requested */
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+#include "e1_stats.h"
+#include "e1_acquisition.h"
+#include "e1_recorder.h"
+
+/*! Counters of the threads using a slot. A private slot has a single writer, which updates it with a plain
+ * load and store; the shared slot, used once every private slot is taken, needs atomic adds. */
+struct StatsSlot_t {
+    std::atomic <uint64_t> counters[StatsCountersNum];
+    std::atomic <uint64_t> buckets[StatsHistogramsNum][STATS_HISTOGRAM_BUCKETS];
+    std::atomic <uint64_t> samples[StatsHistogramsNum];
+    std::atomic <uint64_t> totals[StatsHistogramsNum];
+    std::atomic <bool> owned;
+};
+
+/*! Plain copy of the sum of the slots. */
+typedef struct {
+    uint64_t counters[StatsCountersNum];
+    uint64_t buckets[StatsHistogramsNum][STATS_HISTOGRAM_BUCKETS];
+    uint64_t samples[StatsHistogramsNum];
+    uint64_t totals[StatsHistogramsNum];
+} StatsSnapshot_t;
+
+static StatsSlot_t slots[STATS_MAX_THREADS+1];
+static StatsSlot_t &sharedSlot = slots[STATS_MAX_THREADS];
+
+/*! Baseline taken by statsReset, guarded by snapshotMutex: only statsGet and statsReset take it. */
+static std::mutex snapshotMutex;
+static StatsSnapshot_t baseline;
+static std::chrono::steady_clock::time_point baselineTime = std::chrono::steady_clock::now();
+
+/*! Claims a private slot for the lifetime of the thread; the counts stay in the slot for its next owner. */
+class StatsSlotHandle
+{
+public:
+    StatsSlotHandle() : slot(&sharedSlot), shared(true)
+    {
+        for (unsigned int slotIdx = 0; slotIdx < STATS_MAX_THREADS; slotIdx++) {
+            bool expected = false;
+            if (slots[slotIdx].owned.compare_exchange_strong(expected, true)) {
+                slot = &slots[slotIdx];
+                shared = false;
+                break;
+            }
+        }
+    }
+
+    ~StatsSlotHandle()
+    {
+        if (!shared) {slot->owned.store(false);}
+    }
+
+    void add(std::atomic <uint64_t> &value, uint64_t n)
+    {
+        if (shared) {
+            value.fetch_add(n, std::memory_order_relaxed);
+        } else {
+            value.store(value.load(std::memory_order_relaxed)+n, std::memory_order_relaxed);
+        }
+    }
+
+    StatsSlot_t * slot;
+    bool shared;
+};
+
+static thread_local StatsSlotHandle handle;
+
+static unsigned int bucketOf(uint64_t value)
+{
+    unsigned int bucket;
+
+    if (value == 0) {return 0;}
+#if defined(__GNUC__)
+    bucket = 63-__builtin_clzll(value);
+#else
+    bucket = 0;
+    while (value >>= 1) {bucket++;}
+#endif
+
+    return bucket < STATS_HISTOGRAM_BUCKETS ? bucket : STATS_HISTOGRAM_BUCKETS-1;
+}
+
+void statsCount(StatsCounter_t counter, uint64_t n)
+{
+    handle.add(handle.slot->counters[counter], n);
+}
+
+void statsRecord(StatsHistogramId_t histogram, uint64_t value)
+{
+    StatsSlot_t * slot = handle.slot;
+
+    handle.add(slot->buckets[histogram][bucketOf(value)], 1);
+    handle.add(slot->samples[histogram], 1);
+    handle.add(slot->totals[histogram], value);
+}
+
+uint64_t statsNowNs()
+{
+    return std::chrono::duration_cast <std::chrono::nanoseconds> (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void sumSlots(StatsSnapshot_t &snapshot)
+{
+    memset(&snapshot, 0, sizeof(snapshot));
+    for (unsigned int slotIdx = 0; slotIdx <= STATS_MAX_THREADS; slotIdx++) {
+        const StatsSlot_t &slot = slots[slotIdx];
+        for (unsigned int counterIdx = 0; counterIdx < StatsCountersNum; counterIdx++) {
+            snapshot.counters[counterIdx] += slot.counters[counterIdx].load(std::memory_order_relaxed);
+        }
+        for (unsigned int histogramIdx = 0; histogramIdx < StatsHistogramsNum; histogramIdx++) {
+            for (unsigned int bucketIdx = 0; bucketIdx < STATS_HISTOGRAM_BUCKETS; bucketIdx++) {
+                snapshot.buckets[histogramIdx][bucketIdx] += slot.buckets[histogramIdx][bucketIdx].load(std::memory_order_relaxed);
+            }
+            snapshot.samples[histogramIdx] += slot.samples[histogramIdx].load(std::memory_order_relaxed);
+            snapshot.totals[histogramIdx] += slot.totals[histogramIdx].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static void fillHistogram(const StatsSnapshot_t &now, StatsHistogramId_t histogram, StatsHistogram_t &out)
+{
+    for (unsigned int bucketIdx = 0; bucketIdx < STATS_HISTOGRAM_BUCKETS; bucketIdx++) {
+        out.counts[bucketIdx] = now.buckets[histogram][bucketIdx]-baseline.buckets[histogram][bucketIdx];
+    }
+    out.samples = now.samples[histogram]-baseline.samples[histogram];
+    out.total = now.totals[histogram]-baseline.totals[histogram];
+}
+
+void statsGet(Stats_t &stats)
+{
+    StatsSnapshot_t now;
+    RecorderStats_t recorderStats;
+
+    std::lock_guard <std::mutex> lock(snapshotMutex);
+    sumSlots(now);
+
+    stats.seconds = std::chrono::duration <double> (std::chrono::steady_clock::now()-baselineTime).count();
+    stats.packetsRead = now.counters[StatsPacketsRead]-baseline.counters[StatsPacketsRead];
+    stats.readCalls = now.counters[StatsReadCalls]-baseline.counters[StatsReadCalls];
+    stats.bufferOverflowEvents = now.counters[StatsBufferOverflowEvents]-baseline.counters[StatsBufferOverflowEvents];
+    stats.lostDataEvents = now.counters[StatsLostDataEvents]-baseline.counters[StatsLostDataEvents];
+    stats.ringDroppedPackets = now.counters[StatsRingDroppedPackets]-baseline.counters[StatsRingDroppedPackets];
+    stats.recorderDroppedPackets = now.counters[StatsRecorderDroppedPackets]-baseline.counters[StatsRecorderDroppedPackets];
+    stats.commandsSent = now.counters[StatsCommandsSent]-baseline.counters[StatsCommandsSent];
+    stats.commandErrors = now.counters[StatsCommandErrors]-baseline.counters[StatsCommandErrors];
+    stats.missingPackets = now.counters[StatsMissingPackets]-baseline.counters[StatsMissingPackets];
+    stats.driverErrors = now.counters[StatsDriverErrors]-baseline.counters[StatsDriverErrors];
+    stats.packetsPerSecond = stats.seconds > 0.0 ? stats.packetsRead/stats.seconds : 0.0;
+
+    stats.ringOccupancy = acquisitionRing().readable();
+    stats.ringCapacity = acquisitionRing().capacity();
+    recorderGetStats(recorderStats);
+    stats.writerQueueDepth = recorderStats.queueDepth;
+
+    fillHistogram(now, StatsReadLatencyNs, stats.readLatencyNs);
+    fillHistogram(now, StatsBatchPackets, stats.batchPackets);
+    fillHistogram(now, StatsRingOccupancyPackets, stats.ringOccupancyPackets);
+    fillHistogram(now, StatsWriterLagUs, stats.writerLagUs);
+    fillHistogram(now, StatsCommandRttNs, stats.commandRttNs);
+}
+
+void statsReset()
+{
+    std::lock_guard <std::mutex> lock(snapshotMutex);
+    sumSlots(baseline);
+    baselineTime = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,98 @@
+/*! \file e1_stats.h
+ * \brief Declares the acquisition telemetry: counters and log2-bucket histograms recorded on the hot paths.
+ *
+ * Every thread that records owns a slot of counters that only it writes, so recording takes no lock and no locked
+ * instruction; statsGet sums the slots. statsReset does not touch the slots either: it snapshots them, and later
+ * reports are differences from the snapshot.
+ */
+#ifndef E1_STATS_H
+#define E1_STATS_H
+
+#include <stdint.h>
+
+/*! \def STATS_HISTOGRAM_BUCKETS
+ * \brief Buckets per histogram: bucket k counts the values in [2^k, 2^(k+1)); bucket 0 also counts 0.
+ */
+#define STATS_HISTOGRAM_BUCKETS 40
+
+/*! \def STATS_MAX_THREADS
+ * \brief Threads that can record concurrently with a private slot; further threads share one slot with atomic adds.
+ */
+#define STATS_MAX_THREADS 16
+
+/*! \struct StatsHistogram_t
+ * \brief Distribution of a recorded quantity.
+ */
+typedef struct {
+    unsigned long long counts[STATS_HISTOGRAM_BUCKETS];
+    unsigned long long samples; /*!< Values recorded. */
+    unsigned long long total; /*!< Sum of the values recorded: total / samples is the mean. */
+} StatsHistogram_t;
+
+/*! \struct Stats_t
+ * \brief Acquisition telemetry since the last resetStats. Returned by getStats.
+ */
+typedef struct {
+    double seconds; /*!< Time covered by the counters. */
+    unsigned long long packetsRead; /*!< Packets returned by EDL::readData to the reader thread. */
+    unsigned long long readCalls; /*!< Calls to EDL::readData by the reader thread. */
+    unsigned long long bufferOverflowEvents; /*!< EDL::getDeviceStatus polls of the reader thread that found bufferOverflowFlag set,
+                                              * or that were handed it by an acquisitionStreamPosition call in between; counted
+                                              * whether or not the poll goes on to read. */
+    unsigned long long lostDataEvents; /*!< The same for lostDataFlag. */
+    unsigned long long ringDroppedPackets; /*!< Packets dropped because the ring was full. */
+    unsigned long long recorderDroppedPackets; /*!< Packets dropped because every recorder block was waiting for the disk. */
+    unsigned long long commandsSent; /*!< Calls to EDL::setCommand. */
+    unsigned long long commandErrors; /*!< Calls to EDL::setCommand that returned an error. */
+    double packetsPerSecond; /*!< packetsRead / seconds. */
+    unsigned int ringOccupancy; /*!< Packets in the ring now. */
+    unsigned int ringCapacity;
+    unsigned int writerQueueDepth; /*!< Recorder blocks waiting for the disk now. */
+    StatsHistogram_t readLatencyNs; /*!< Duration of each EDL::readData call. */
+    StatsHistogram_t batchPackets; /*!< Packets returned by each EDL::readData call. */
+    StatsHistogram_t ringOccupancyPackets; /*!< Ring occupancy after each write by the reader thread. */
+    StatsHistogram_t writerLagUs; /*!< Time from a recorder block being full to it being on disk. */
+    StatsHistogram_t commandRttNs; /*!< Duration of each EDL::setCommand call. */
+    unsigned long long missingPackets; /*!< Packets estimated lost by the device or the driver, see acquisitionGaps. */
+    unsigned long long driverErrors; /*!< Calls to EDL::getDeviceStatus or EDL::readData by the reader thread that failed. */
+} Stats_t;
+
+typedef enum {
+    StatsPacketsRead,
+    StatsReadCalls,
+    StatsBufferOverflowEvents,
+    StatsLostDataEvents,
+    StatsRingDroppedPackets,
+    StatsRecorderDroppedPackets,
+    StatsCommandsSent,
+    StatsCommandErrors,
+    StatsMissingPackets,
+    StatsDriverErrors,
+    StatsCountersNum
+} StatsCounter_t;
+
+typedef enum {
+    StatsReadLatencyNs,
+    StatsBatchPackets,
+    StatsRingOccupancyPackets,
+    StatsWriterLagUs,
+    StatsCommandRttNs,
+    StatsHistogramsNum
+} StatsHistogramId_t;
+
+/*! \brief Adds \a n to a counter of the calling thread. */
+void statsCount(StatsCounter_t counter, uint64_t n = 1);
+
+/*! \brief Records \a value in a histogram of the calling thread. */
+void statsRecord(StatsHistogramId_t histogram, uint64_t value);
+
+/*! \brief Monotonic clock in ns, for latencies. */
+uint64_t statsNowNs();
+
+/*! \brief Fills \a stats with the telemetry since the last statsReset. */
+void statsGet(Stats_t &stats);
+
+/*! \brief Restarts the counters and histograms from zero. */
+void statsReset();
+
+#endif // E1_STATS_H
@@ -0,0 +1,301 @@
+/* e1_subscription.cpp
+Subscriptions: blocks gathered on the acquisition thread and handed to the callbacks as soon as they are due */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "e1_subscription.h"
+#include "e1_acquisition.h"
+#include "e1_scheduler.h"
+#include "e1_stats.h"
+
+typedef struct {
+    int id;
+    SubscriptionConfig_t config;
+    SubscriptionCallback_t callback;
+    void * context;
+    uint64_t latencyNs; /*!< config.maxLatencySeconds, 0 without bound. */
+
+	/*! Block being gathered, touched by the reader thread only. */
+    std::vector <float> buffer;
+    unsigned int filled;
+    SubscriptionBlock_t pending;
+    uint64_t lastBatchNs; /*!< Read time of the previous batch. */
+
+	/*! Written by the reader thread only. */
+    std::atomic <unsigned long long> blocks;
+    std::atomic <unsigned long long> skippedBlocks;
+    std::atomic <unsigned long long> partialBlocks;
+    std::atomic <unsigned long long> maxLatencyNs;
+    std::atomic <unsigned long long> maxCallbackNs;
+} Subscription_t;
+
+/*! Active subscriptions. Never held while adding or removing a sink: callbacks may read the stats. */
+static std::mutex subscriptionsMutex;
+static Subscription_t * subscriptions[SUBSCRIPTION_MAX];
+static int nextId = 1;
+/*! Read period before the latency bounds lowered it. */
+static bool periodLowered = false;
+static double savedPeriod = SCHEDULER_MAX_PERIOD_S;
+
+/*! Set on the reader thread during a callback: unsubscribing from there would wait for the callback itself. */
+static thread_local bool inCallback = false;
+
+static int firstMatch(const SubscriptionConfig_t &config, const float * packets, unsigned int packetsNum)
+{
+    const float * x = packets+config.channel;
+    float level = (float)config.level;
+
+    for (unsigned int k = 0; k < packetsNum; k++, x += EDL_CHANNEL_NUM) {
+        bool match = false;
+        switch (config.predicate) {
+        case SUBSCRIPTION_PREDICATE_ABOVE: match = *x > level; break;
+        case SUBSCRIPTION_PREDICATE_BELOW: match = *x < level; break;
+        case SUBSCRIPTION_PREDICATE_MAGNITUDE_ABOVE: match = std::fabs(*x) > level; break;
+        case SUBSCRIPTION_PREDICATE_MAGNITUDE_BELOW: match = std::fabs(*x) < level; break;
+        }
+        if (match) {return (int)k;}
+    }
+    return -1;
+}
+
+static void storeMax(std::atomic <unsigned long long> &value, unsigned long long sample)
+{
+    if (sample > value.load(std::memory_order_relaxed)) {value.store(sample, std::memory_order_relaxed);}
+}
+
+static void deliver(Subscription_t &s, const float * packets, SubscriptionBlock_t &block, bool partial)
+{
+    block.matchPacket = -1;
+    block.reserved = 0;
+    if (s.config.predicate != SUBSCRIPTION_PREDICATE_NONE) {
+        block.matchPacket = firstMatch(s.config, packets, block.packets);
+        if (block.matchPacket < 0) {
+            s.skippedBlocks.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    uint64_t startNs = statsNowNs();
+    inCallback = true;
+    s.callback(packets, &block, s.context);
+    inCallback = false;
+    uint64_t endNs = statsNowNs();
+
+    s.blocks.fetch_add(1, std::memory_order_relaxed);
+    if (partial) {s.partialBlocks.fetch_add(1, std::memory_order_relaxed);}
+    storeMax(s.maxLatencyNs, startNs-std::min(startNs, block.firstTimeNs));
+    storeMax(s.maxCallbackNs, endNs-startNs);
+}
+
+static void subscriptionSink(const float * packets, unsigned int packetsNum, void * context)
+{
+    Subscription_t &s = *(Subscription_t *)context;
+    const AcquisitionBlock_t &batch = acquisitionBlock();
+    SubscriptionBlock_t block;
+
+    if (s.config.blockPackets == 0) {
+        block.streamPacket = batch.streamPacket;
+        block.deviceSample = batch.deviceSample;
+        block.firstTimeNs = batch.hostTimeNs;
+        block.lastTimeNs = batch.hostTimeNs;
+        block.packets = packetsNum;
+        block.gapCause = batch.gapCause;
+        deliver(s, packets, block, false);
+        return;
+    }
+
+	/*! A partial block left by a stopped acquisition does not continue into this batch. */
+    if (s.filled > 0 && s.pending.streamPacket+s.filled != batch.streamPacket) {s.filled = 0;}
+
+    const unsigned int blockPackets = s.config.blockPackets;
+    unsigned int idx = 0;
+    while (idx < packetsNum) {
+        unsigned int n = std::min(blockPackets-s.filled, packetsNum-idx);
+
+        if (s.filled == 0) {
+            s.pending.streamPacket = batch.streamPacket+idx;
+            s.pending.deviceSample = batch.deviceSample+idx;
+            s.pending.firstTimeNs = batch.hostTimeNs;
+            s.pending.gapCause = idx == 0 ? batch.gapCause : 0;
+            if (n == blockPackets) {
+                /*! Whole block within the batch: passed without copying it. */
+                block = s.pending;
+                block.lastTimeNs = batch.hostTimeNs;
+                block.packets = blockPackets;
+                deliver(s, packets+(size_t)idx*EDL_CHANNEL_NUM, block, false);
+                idx += n;
+                continue;
+            }
+        } else if (idx == 0) {
+            s.pending.gapCause |= batch.gapCause;
+        }
+
+        memcpy(s.buffer.data()+(size_t)s.filled*EDL_CHANNEL_NUM, packets+(size_t)idx*EDL_CHANNEL_NUM,
+               (size_t)n*EDL_CHANNEL_NUM*sizeof(float));
+        s.filled += n;
+        idx += n;
+        if (s.filled == blockPackets) {
+            block = s.pending;
+            block.lastTimeNs = batch.hostTimeNs;
+            block.packets = blockPackets;
+            s.filled = 0;
+            deliver(s, s.buffer.data(), block, false);
+        }
+    }
+
+	/*! The first packet reached the driver up to one read interval before it was read, and the next read comes about
+	 * one interval from now: deliver the partial block now if waiting for it could exceed the bound. The interval is
+	 * the read period, or the last interval observed if the reads fall behind it. */
+    uint64_t intervalNs = (uint64_t)(acquisitionReadPeriod()*1e9);
+    if (s.lastBatchNs > 0 && batch.hostTimeNs > s.lastBatchNs) {intervalNs = std::max(intervalNs, batch.hostTimeNs-s.lastBatchNs);}
+    s.lastBatchNs = batch.hostTimeNs;
+    if (s.filled > 0 && s.latencyNs > 0) {
+        if (batch.hostTimeNs-s.pending.firstTimeNs+2*intervalNs > s.latencyNs) {
+            block = s.pending;
+            block.lastTimeNs = batch.hostTimeNs;
+            block.packets = s.filled;
+            s.filled = 0;
+            deliver(s, s.buffer.data(), block, true);
+        }
+    }
+}
+
+/*! Lowers the read period to the tightest latency bound, or restores it once there is none. Called under subscriptionsMutex. */
+static void updateReadPeriod()
+{
+    double latency = 0.0;
+
+    for (unsigned int slot = 0; slot < SUBSCRIPTION_MAX; slot++) {
+        if (subscriptions[slot] == NULL || !(subscriptions[slot]->config.maxLatencySeconds > 0.0)) {continue;}
+        if (latency == 0.0 || subscriptions[slot]->config.maxLatencySeconds < latency) {latency = subscriptions[slot]->config.maxLatencySeconds;}
+    }
+
+    if (latency > 0.0) {
+        if (!periodLowered) {
+            savedPeriod = acquisitionReadPeriod();
+            periodLowered = true;
+        }
+        acquisitionSetReadPeriod(std::min(savedPeriod, latency/SUBSCRIPTION_PERIOD_DIVIDER));
+    } else if (periodLowered) {
+        acquisitionSetReadPeriod(savedPeriod);
+        periodLowered = false;
+    }
+}
+
+void subscriptionDefaults(SubscriptionConfig_t &config)
+{
+    config.blockPackets = 0;
+    config.maxLatencySeconds = 0.0;
+    config.raw = 0;
+    config.predicate = SUBSCRIPTION_PREDICATE_NONE;
+    config.channel = 1;
+    config.level = 0.0;
+}
+
+EdlErrorCode_t subscriptionAdd(const SubscriptionConfig_t &config, SubscriptionCallback_t callback, void * context, int &id)
+{
+    if (callback == NULL || config.blockPackets > SUBSCRIPTION_MAX_BLOCK_PACKETS ||
+        config.predicate > SUBSCRIPTION_PREDICATE_MAGNITUDE_BELOW || config.channel >= EDL_CHANNEL_NUM ||
+        !(config.maxLatencySeconds >= 0.0) || std::isinf(config.maxLatencySeconds)) {return EdlUnknownError;}
+
+    Subscription_t * s = new Subscription_t;
+    s->config = config;
+    s->callback = callback;
+    s->context = context;
+    s->latencyNs = (uint64_t)(config.maxLatencySeconds*1e9);
+    s->buffer.resize((size_t)config.blockPackets*EDL_CHANNEL_NUM);
+    s->filled = 0;
+    s->lastBatchNs = 0;
+    s->blocks.store(0);
+    s->skippedBlocks.store(0);
+    s->partialBlocks.store(0);
+    s->maxLatencyNs.store(0);
+    s->maxCallbackNs.store(0);
+
+    {
+        std::lock_guard <std::mutex> lock(subscriptionsMutex);
+        unsigned int slot = 0;
+        while (slot < SUBSCRIPTION_MAX && subscriptions[slot] != NULL) {slot++;}
+        if (slot == SUBSCRIPTION_MAX) {
+            delete s;
+            return EdlUnknownError;
+        }
+        s->id = nextId++;
+        subscriptions[slot] = s;
+        updateReadPeriod();
+    }
+    acquisitionAddSink(subscriptionSink, s, config.raw != 0);
+    id = s->id;
+
+    return EdlSuccess;
+}
+
+EdlErrorCode_t subscriptionRemove(int id)
+{
+    Subscription_t * s = NULL;
+
+    if (inCallback) {return EdlUnknownError;}
+
+    {
+        std::lock_guard <std::mutex> lock(subscriptionsMutex);
+        for (unsigned int slot = 0; slot < SUBSCRIPTION_MAX; slot++) {
+            if (subscriptions[slot] != NULL && subscriptions[slot]->id == id) {
+                s = subscriptions[slot];
+                subscriptions[slot] = NULL;
+                break;
+            }
+        }
+        if (s == NULL) {return EdlUnknownError;}
+        updateReadPeriod();
+    }
+
+	/*! Waits for a callback in progress. */
+    acquisitionRemoveSink(subscriptionSink, s);
+    delete s;
+
+    return EdlSuccess;
+}
+
+void subscriptionRemoveAll()
+{
+    std::vector <Subscription_t *> removed;
+
+    if (inCallback) {return;}
+
+    {
+        std::lock_guard <std::mutex> lock(subscriptionsMutex);
+        for (unsigned int slot = 0; slot < SUBSCRIPTION_MAX; slot++) {
+            if (subscriptions[slot] == NULL) {continue;}
+            removed.push_back(subscriptions[slot]);
+            subscriptions[slot] = NULL;
+        }
+        updateReadPeriod();
+    }
+
+    for (size_t idx = 0; idx < removed.size(); idx++) {
+        acquisitionRemoveSink(subscriptionSink, removed[idx]);
+        delete removed[idx];
+    }
+}
+
+bool subscriptionStats(int id, SubscriptionStats_t &stats)
+{
+    std::lock_guard <std::mutex> lock(subscriptionsMutex);
+
+    for (unsigned int slot = 0; slot < SUBSCRIPTION_MAX; slot++) {
+        const Subscription_t * s = subscriptions[slot];
+        if (s == NULL || s->id != id) {continue;}
+        stats.blocks = s->blocks.load();
+        stats.skippedBlocks = s->skippedBlocks.load();
+        stats.partialBlocks = s->partialBlocks.load();
+        stats.maxLatencyNs = s->maxLatencyNs.load();
+        stats.maxCallbackNs = s->maxCallbackNs.load();
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,110 @@
+/*! \file e1_subscription.h
+ * \brief Declares the subscriptions: callbacks fed by the acquisition thread with blocks of packets, without polling.
+ *
+ * A subscription either passes every batch read from the driver as is, or gathers the packets into blocks of a fixed
+ * size, delivering a partial block rather than exceeding its latency bound. A predicate on one channel can restrict
+ * the calls to the blocks holding a matching sample. Callbacks run on the acquisition thread: they can send commands
+ * (sendCommand never waits for the reader), but must return quickly and must not unsubscribe.
+ */
+#ifndef E1_SUBSCRIPTION_H
+#define E1_SUBSCRIPTION_H
+
+#include <stdint.h>
+
+#include "edl.h"
+
+/*! \def SUBSCRIPTION_MAX
+ * \brief Subscriptions active at the same time.
+ */
+#define SUBSCRIPTION_MAX 16
+
+/*! \def SUBSCRIPTION_MAX_BLOCK_PACKETS
+ * \brief Largest block size accepted.
+ */
+#define SUBSCRIPTION_MAX_BLOCK_PACKETS (1 << 20)
+
+/*! \def SUBSCRIPTION_PERIOD_DIVIDER
+ * \brief A latency bound lowers the read period of the acquisition thread to this fraction of it, so that blocks
+ * can still gather packets over a few reads.
+ */
+#define SUBSCRIPTION_PERIOD_DIVIDER 4
+
+/*! Values of SubscriptionConfig_t::predicate: which samples of SubscriptionConfig_t::channel match. */
+#define SUBSCRIPTION_PREDICATE_NONE 0 /*!< Every block is delivered. */
+#define SUBSCRIPTION_PREDICATE_ABOVE 1 /*!< Samples above \a level. */
+#define SUBSCRIPTION_PREDICATE_BELOW 2 /*!< Samples below \a level. */
+#define SUBSCRIPTION_PREDICATE_MAGNITUDE_ABOVE 3 /*!< Samples farther than \a level from zero. */
+#define SUBSCRIPTION_PREDICATE_MAGNITUDE_BELOW 4 /*!< Samples closer than \a level to zero, e.g. the current during a blockade. */
+
+/*! \struct SubscriptionConfig_t
+ * \brief Subscription settings. Passed to subscriptionAdd.
+ */
+typedef struct {
+    unsigned int blockPackets; /*!< Packets per call; 0 passes every batch read from the driver as is, without copying it. */
+    double maxLatencySeconds; /*!< Longest time from a packet reaching the driver to its callback, up to the timer
+                               * accuracy of the acquisition thread: partial blocks are delivered rather than held longer.
+                               * 0 always waits for full blocks. */
+    int raw; /*!< Packets before the filter stage (see acquisitionAddSink) instead of after it. */
+    unsigned int predicate; /*!< SUBSCRIPTION_PREDICATE_*. */
+    unsigned int channel; /*!< Channel the predicate tests. */
+    double level; /*!< Threshold of the predicate, in the channel unit. */
+} SubscriptionConfig_t;
+
+/*! \struct SubscriptionBlock_t
+ * \brief Position of a delivered block in the stream.
+ */
+typedef struct {
+    uint64_t streamPacket; /*!< Stream index of the first packet (see acquisitionStreamPackets). */
+    uint64_t deviceSample; /*!< Device sample index of the first packet (see acquisitionDeviceSamples). */
+    uint64_t firstTimeNs; /*!< statsNowNs when the first packet was read from the driver. */
+    uint64_t lastTimeNs; /*!< statsNowNs when the last packet was read from the driver. */
+    unsigned int packets; /*!< Packets in the block. */
+    int matchPacket; /*!< Index in the block of the first packet matching the predicate; -1 without predicate. */
+    unsigned int gapCause; /*!< ACQUISITION_GAP_* bits of the losses right before or within the block, 0 if none. */
+    unsigned int reserved;
+} SubscriptionBlock_t;
+
+/*! \struct SubscriptionStats_t
+ * \brief Counters of a subscription.
+ */
+typedef struct {
+    unsigned long long blocks; /*!< Blocks passed to the callback. */
+    unsigned long long skippedBlocks; /*!< Blocks without a sample matching the predicate. */
+    unsigned long long partialBlocks; /*!< Blocks delivered before filling up, to keep the latency bound. */
+    unsigned long long maxLatencyNs; /*!< Longest time from the read of a block's first packet to the start of its callback. */
+    unsigned long long maxCallbackNs; /*!< Longest callback. */
+} SubscriptionStats_t;
+
+/*! \brief Function called from the acquisition thread with each block.
+ *
+ * \param packets [in] \a block->packets interleaved data packets of #EDL_CHANNEL_NUM samples each, valid during the call only.
+ * \param block [in] Position of the block, valid during the call only.
+ * \param context [in] Pointer given to subscriptionAdd.
+ */
+typedef void (*SubscriptionCallback_t)(const float * packets, const SubscriptionBlock_t * block, void * context);
+
+/*! \brief Fills \a config with the defaults: every batch as read, after the filters, without predicate. */
+void subscriptionDefaults(SubscriptionConfig_t &config);
+
+/*! \brief Registers \a callback. Subscriptions outlive acquisitionStop and acquisitionStart; a partial block left by a
+ * stopped acquisition is discarded.
+ *
+ * \param id [out] Handle to pass to the other functions, from 1 on.
+ * \return #EdlErrorCode_t Error code: #EdlUnknownError if \a config is invalid or #SUBSCRIPTION_MAX subscriptions are active.
+ */
+EdlErrorCode_t subscriptionAdd(const SubscriptionConfig_t &config, SubscriptionCallback_t callback, void * context, int &id);
+
+/*! \brief Unregisters a subscription. After this returns its callback is no longer being called.
+ * The read period lowered for the latency bounds is restored once the last of them is removed.
+ *
+ * \return #EdlErrorCode_t Error code: #EdlUnknownError for an unknown \a id, or if called from a callback.
+ */
+EdlErrorCode_t subscriptionRemove(int id);
+
+/*! \brief Unregisters every subscription. */
+void subscriptionRemoveAll();
+
+/*! \brief Returns the counters of subscription \a id. \return false for an unknown \a id. */
+bool subscriptionStats(int id, SubscriptionStats_t &stats);
+
+#endif // E1_SUBSCRIPTION_H
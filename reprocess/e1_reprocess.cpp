@@ -0,0 +1,359 @@
+/* e1_reprocess.cpp
+Offline reprocessing of recordings with the filters and the event detector of the acquisition, on every core.
+Usage: e1_reprocess [options] recording...
+Each recording is cut into chunks processed in parallel. A chunk starts early enough for the filters and the baseline
+to settle, and runs past its end until the event open there closes: it keeps the events that start within it.
+The events of each recording are merged into one table, written as <recording>.events.csv */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "edl.h"
+#include "e1_events.h"
+#include "e1_filter.h"
+#include "e1_reader.h"
+
+/*! Samples read and filtered per call. */
+#define REPROCESS_BLOCK_PACKETS 65536
+
+/*! Default chunk length. */
+#define REPROCESS_CHUNK_SECONDS 30.0
+
+/*! Baseline time constants processed before a chunk: the baseline is then within exp(-8) of the one of a single pass. */
+#define REPROCESS_WARMUP_TAUS 8.0
+
+/*! Chunks are at least this many warm-ups long, so that the overlap costs 1/8 of the work at most. */
+#define REPROCESS_MIN_CHUNK_WARMUPS 8
+
+static const double pi = 3.14159265358979323846;
+
+typedef struct {
+    FilterSpec_t filter;
+    EventDetectorConfig_t events;
+    double chunkSeconds;
+    unsigned int threadsNum;
+    std::string outputDir; /*!< Empty: the tables go next to the recordings. */
+} ReprocessConfig_t;
+
+typedef struct {
+    std::string path;
+    RecordingFile_t * recording;
+    double rateHz;
+    uint64_t packetNum;
+    uint64_t warmupPackets;
+    size_t firstTask;
+    size_t tasksNum;
+} Run_t;
+
+typedef struct {
+    size_t run;
+    uint64_t firstPacket; /*!< The task keeps the events starting from firstPacket to endPacket excluded. */
+    uint64_t endPacket;
+    uint64_t processedPackets; /*!< Overlap included. */
+    bool failed;
+    std::vector <DetectedEvent_t> events;
+} Task_t;
+
+/*! Deque of task indexes of one worker: the owner takes from the front, thieves from the back. */
+typedef struct {
+    std::mutex mutex;
+    std::deque <size_t> tasks;
+} WorkerQueue_t;
+
+static bool takeTask(WorkerQueue_t &queue, bool front, size_t &taskIdx)
+{
+    std::lock_guard <std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {return false;}
+    if (front) {
+        taskIdx = queue.tasks.front();
+        queue.tasks.pop_front();
+    } else {
+        taskIdx = queue.tasks.back();
+        queue.tasks.pop_back();
+    }
+    return true;
+}
+
+/*! Runs \a work(taskIdx, workerIdx) for every task on \a threadsNum threads. Each thread starts with a contiguous share
+ * of the tasks, so that it reads the recordings in order; once its share is done it steals the last tasks of the others.
+ * No task is added while running, so a thread that finds every queue empty is done. */
+template <typename Work>
+static void runStealing(size_t tasksNum, unsigned int threadsNum, Work work)
+{
+    std::vector <WorkerQueue_t> queues(threadsNum);
+    std::vector <std::thread> threads;
+
+    for (size_t taskIdx = 0; taskIdx < tasksNum; taskIdx++) {
+        queues[taskIdx*threadsNum/tasksNum].tasks.push_back(taskIdx);
+    }
+
+    for (unsigned int workerIdx = 0; workerIdx < threadsNum; workerIdx++) {
+        threads.push_back(std::thread([&queues, &work, threadsNum, workerIdx] {
+            size_t taskIdx;
+            while (true) {
+                bool found = takeTask(queues[workerIdx], true, taskIdx);
+                for (unsigned int victim = 1; !found && victim < threadsNum; victim++) {
+                    found = takeTask(queues[(workerIdx+victim)%threadsNum], false, taskIdx);
+                }
+                if (!found) {break;}
+                work(taskIdx, workerIdx);
+            }
+        }));
+    }
+    for (size_t threadIdx = 0; threadIdx < threads.size(); threadIdx++) {threads[threadIdx].join();}
+}
+
+/*! Time the filters of \a spec take to forget their initial state: about ten time constants of the lowpass and of the notch. */
+static double filterSettleSeconds(const FilterSpec_t &spec, double rateHz)
+{
+    double seconds = (spec.firLowpassHz > 0.0 ? spec.firLowpassTaps : spec.firTaps.size())/rateHz;
+
+    if (spec.lowpassType != FILTER_LOWPASS_NONE && spec.lowpassHz > 0.0) {seconds += 2.0/spec.lowpassHz;}
+    if (spec.notchHz > 0.0) {seconds += 10.0*spec.notchQ/(pi*spec.notchHz);}
+
+    return seconds;
+}
+
+static void processTask(const Run_t &run, const ReprocessConfig_t &config, Task_t &task, std::vector <float> &buffer)
+{
+    FilterChain filter;
+    EventDetector detector;
+    std::vector <DetectedEvent_t> events;
+    uint64_t packet = task.firstPacket > run.warmupPackets ? task.firstPacket-run.warmupPackets : 0;
+
+    filter.configure(config.filter, run.rateHz);
+    detector.reset(config.events, run.rateHz, packet);
+    task.processedPackets = 0;
+
+    while (packet < run.packetNum && (packet < task.endPacket || detector.inEvent())) {
+        unsigned int got;
+        uint64_t stop = packet < task.endPacket ? task.endPacket : run.packetNum;
+        unsigned int packets = (unsigned int)std::min(stop-packet, (uint64_t)REPROCESS_BLOCK_PACKETS);
+
+        if (recordingReadChannel(run.recording, config.events.channel, packet, packets, buffer.data(), got) != EdlSuccess) {
+            task.failed = true;
+            return;
+        }
+        if (got == 0) {break;}
+
+        unsigned int idx = 0;
+        while (idx < got) {
+			/*! Dropped packets and the space between the segments of gated recordings read as NaN:
+			 * the filters and the detector start over after them, as the live ones would after a restart. */
+            if (std::isnan(buffer[idx])) {
+                while (idx < got && std::isnan(buffer[idx])) {idx++;}
+                filter.configure(config.filter, run.rateHz);
+                detector.reset(config.events, run.rateHz, packet+idx);
+                continue;
+            }
+
+            unsigned int end = idx;
+            while (end < got && !std::isnan(buffer[end])) {end++;}
+            filter.process(buffer.data()+idx, end-idx);
+            detector.process(buffer.data()+idx, end-idx, events);
+            idx = end;
+        }
+
+        packet += got;
+        task.processedPackets += got;
+    }
+
+    for (size_t eventIdx = 0; eventIdx < events.size(); eventIdx++) {
+        if (events[eventIdx].startSample >= task.firstPacket && events[eventIdx].startSample < task.endPacket) {
+            task.events.push_back(events[eventIdx]);
+        }
+    }
+}
+
+static std::string tablePath(const std::string &recordingPath, const std::string &outputDir)
+{
+    if (outputDir.empty()) {return recordingPath+".events.csv";}
+
+    size_t slash = recordingPath.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? recordingPath : recordingPath.substr(slash+1);
+    return outputDir+"/"+name+".events.csv";
+}
+
+/*! Writes the events of the tasks of \a run, which are in file order. Times are device sample indexes over the sampling rate. */
+static bool writeTable(const Run_t &run, const std::vector <Task_t> &tasks, const std::string &path, size_t &eventsNum)
+{
+    FILE * f = fopen(path.c_str(), "w");
+    if (f == NULL) {return false;}
+
+    fprintf(f, "start_packet,end_packet,start_sample,start_seconds,dwell_seconds,baseline,baseline_sigma,mean_blockade,max_blockade\n");
+    eventsNum = 0;
+    for (size_t taskIdx = run.firstTask; taskIdx < run.firstTask+run.tasksNum; taskIdx++) {
+        for (size_t eventIdx = 0; eventIdx < tasks[taskIdx].events.size(); eventIdx++) {
+            const DetectedEvent_t &event = tasks[taskIdx].events[eventIdx];
+            uint64_t sample = recordingSampleAt(run.recording, event.startSample);
+            fprintf(f, "%llu,%llu,%llu,%.9f,%.9g,%.9g,%.9g,%.9g,%.9g\n", event.startSample, event.endSample,
+                    (unsigned long long)sample, sample/run.rateHz, event.dwellSeconds, event.baseline,
+                    event.baselineSigma, event.meanBlockade, event.maxBlockade);
+        }
+        eventsNum += tasks[taskIdx].events.size();
+    }
+
+    return fclose(f) == 0;
+}
+
+static void usage()
+{
+    printf("usage: e1_reprocess [options] recording...\n"
+           "  -j threads       worker threads (default: every core)\n"
+           "  -s seconds       chunk length (default %.0f)\n"
+           "  -c channel       current channel (default 1)\n"
+           "  -l hz            Bessel lowpass of order 4 (default none)\n"
+           "  -n hz            mains notch, 3 harmonics (default none)\n"
+           "  -b seconds       baseline time constant\n"
+           "  -t sigmas        event start threshold\n"
+           "  -e sigmas        event end threshold\n"
+           "  -m seconds       shortest event kept\n"
+           "  -M seconds       longest event kept\n"
+           "  -o directory     where the event tables go (default: next to the recordings)\n", REPROCESS_CHUNK_SECONDS);
+}
+
+int main(int argc, char ** argv)
+{
+    ReprocessConfig_t config;
+    std::vector <std::string> paths;
+
+    config.filter = filterSpecNone();
+    eventDetectorDefaults(config.events);
+    config.chunkSeconds = REPROCESS_CHUNK_SECONDS;
+    config.threadsNum = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (int argIdx = 1; argIdx < argc; argIdx++) {
+        const char * arg = argv[argIdx];
+        if (arg[0] != '-' || arg[1] == 0) {
+            paths.push_back(arg);
+            continue;
+        }
+        if (argIdx+1 >= argc || arg[2] != 0) {
+            usage();
+            return 1;
+        }
+        const char * value = argv[++argIdx];
+        switch (arg[1]) {
+        case 'j': config.threadsNum = std::max(atoi(value), 1); break;
+        case 's': config.chunkSeconds = atof(value); break;
+        case 'c': config.events.channel = (unsigned int)atoi(value); break;
+        case 'l':
+            config.filter.lowpassType = FILTER_LOWPASS_BESSEL;
+            config.filter.lowpassOrder = 4;
+            config.filter.lowpassHz = atof(value);
+            break;
+        case 'n':
+            config.filter.notchHz = atof(value);
+            config.filter.notchQ = 30.0;
+            config.filter.notchHarmonics = 3;
+            break;
+        case 'b': config.events.baselineSeconds = atof(value); break;
+        case 't': config.events.startSigmas = atof(value); break;
+        case 'e': config.events.endSigmas = atof(value); break;
+        case 'm': config.events.minDwellSeconds = atof(value); break;
+        case 'M': config.events.maxDwellSeconds = atof(value); break;
+        case 'o': config.outputDir = value; break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (paths.empty() || !(config.chunkSeconds > 0.0) || config.events.channel < 1 || config.events.channel >= EDL_CHANNEL_NUM ||
+        !(config.events.baselineSeconds > 0.0) || config.events.endSigmas > config.events.startSigmas) {
+        usage();
+        return 1;
+    }
+
+	/*! Chunks of every recording, in file order. */
+    std::vector <Run_t> runs;
+    std::vector <Task_t> tasks;
+    for (size_t pathIdx = 0; pathIdx < paths.size(); pathIdx++) {
+        Run_t run;
+        run.path = paths[pathIdx];
+        if (recordingOpen(run.path.c_str(), run.recording) != EdlSuccess) {
+            printf("%s: cannot open\n", run.path.c_str());
+            continue;
+        }
+
+        const RecordingHeader_t &header = recordingHeader(run.recording);
+        FilterChain check;
+        run.rateHz = header.samplingRateHz;
+        run.packetNum = header.packetNum;
+        if (!(run.rateHz > 0.0) || config.events.channel >= header.channelNum || !check.configure(config.filter, run.rateHz)) {
+            printf("%s: settings not applicable at %.0fHz\n", run.path.c_str(), run.rateHz);
+            recordingClose(run.recording);
+            continue;
+        }
+
+        double warmupSeconds = REPROCESS_WARMUP_TAUS*config.events.baselineSeconds+filterSettleSeconds(config.filter, run.rateHz);
+        run.warmupPackets = (uint64_t)std::ceil(warmupSeconds*run.rateHz);
+        uint64_t chunkPackets = std::max((uint64_t)(config.chunkSeconds*run.rateHz), run.warmupPackets*REPROCESS_MIN_CHUNK_WARMUPS);
+        chunkPackets = std::max(chunkPackets, (uint64_t)REPROCESS_BLOCK_PACKETS);
+
+        run.firstTask = tasks.size();
+        for (uint64_t packet = 0; packet < run.packetNum; packet += chunkPackets) {
+            Task_t task;
+            task.run = runs.size();
+            task.firstPacket = packet;
+            task.endPacket = std::min(packet+chunkPackets, run.packetNum);
+            task.processedPackets = 0;
+            task.failed = false;
+            tasks.push_back(task);
+        }
+        run.tasksNum = tasks.size()-run.firstTask;
+        runs.push_back(run);
+    }
+    if (runs.empty()) {return 1;}
+
+    unsigned int threadsNum = (unsigned int)std::max(std::min((size_t)config.threadsNum, tasks.size()), (size_t)1);
+    std::vector <std::vector <float> > buffers(threadsNum, std::vector <float> (REPROCESS_BLOCK_PACKETS));
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    runStealing(tasks.size(), threadsNum, [&](size_t taskIdx, unsigned int workerIdx) {
+        processTask(runs[tasks[taskIdx].run], config, tasks[taskIdx], buffers[workerIdx]);
+    });
+
+    double elapsed = std::chrono::duration <double> (std::chrono::steady_clock::now()-start).count();
+
+    int status = 0;
+    uint64_t packetsNum = 0;
+    uint64_t processedNum = 0;
+    for (size_t runIdx = 0; runIdx < runs.size(); runIdx++) {
+        const Run_t &run = runs[runIdx];
+        bool failed = false;
+        for (size_t taskIdx = run.firstTask; taskIdx < run.firstTask+run.tasksNum; taskIdx++) {
+            failed = failed || tasks[taskIdx].failed;
+            processedNum += tasks[taskIdx].processedPackets;
+        }
+        packetsNum += run.packetNum;
+
+        size_t eventsNum = 0;
+        std::string path = tablePath(run.path, config.outputDir);
+        if (failed) {
+            printf("%s: read error\n", run.path.c_str());
+            status = 1;
+        } else if (!writeTable(run, tasks, path, eventsNum)) {
+            printf("%s: cannot write %s\n", run.path.c_str(), path.c_str());
+            status = 1;
+        } else {
+            printf("%s: %llu packets, %llu chunks, %llu events -> %s\n", run.path.c_str(), (unsigned long long)run.packetNum,
+                   (unsigned long long)run.tasksNum, (unsigned long long)eventsNum, path.c_str());
+        }
+        recordingClose(run.recording);
+    }
+
+    printf("%llu packets in %.3fs on %u threads: %.1f Mpackets/s, overlap %.1f%%\n", (unsigned long long)packetsNum, elapsed,
+           threadsNum, elapsed > 0.0 ? packetsNum/elapsed*1e-6 : 0.0,
+           packetsNum > 0 ? (double)(processedNum-std::min(processedNum, packetsNum))*100.0/packetsNum : 0.0);
+
+    return status;
+}
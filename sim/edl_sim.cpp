@@ -0,0 +1,493 @@
+/* edl_sim.cpp
+Simulated e1 device: implements EDL/edl.h without hardware. Packets are counted in real time and generated lazily,
+when read, so an idle device costs nothing */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+
+#include "edl_sim.h"
+#include "e1_codec.h"
+
+/*! Generation state, reset on connection. Every entry point holds simMutex. */
+static std::mutex simMutex;
+
+static SimConfig_t config;
+static bool configured = false;
+static bool connected = false;
+
+/*! Device settings: what the device applies, and what setCommand stacked for the next send. */
+static EdlCommandStruct_t settings[EdlCommandIdNum];
+static EdlCommandStruct_t stacked[EdlCommandIdNum];
+static bool stackedValid[EdlCommandIdNum];
+
+/*! Protocol applied by the last EdlCommandApplyProtocol. */
+static bool sealTest = false;
+static double vhold = 0.0;
+static double vstep = 0.0;
+static unsigned long long pulseSamples = 0;
+static unsigned long long periodSamples = 1;
+
+/*! Protocol applied at packet \a at: packets produced before the apply but read after it keep the previous protocol. */
+typedef struct {
+    unsigned long long at;
+    bool sealTest;
+    double vhold;
+    double vstep;
+    unsigned long long pulseSamples;
+    unsigned long long periodSamples;
+} SimProtocol_t;
+static std::deque <SimProtocol_t> protocolChanges;
+
+/*! Device clock: packets sampled since connection. Lost packets never reach the driver buffer, which holds the packets
+ * in [readPos, produced). */
+static std::chrono::steady_clock::time_point epoch;
+static double epochPackets = 0.0;
+static unsigned long long sampled = 0;
+static unsigned long long produced = 0;
+static unsigned long long readPos = 0;
+static unsigned long long lostPending = 0;
+static std::deque <std::pair <unsigned long long, unsigned long long> > gaps; /*!< Buffer position and length of each device loss. */
+static bool overflowFlag = false;
+static bool lostFlag = false;
+static SimStats_t stats;
+
+/*! Waveform generator, positioned at readPos. */
+static unsigned long long phase = 0;
+static double voltage = 0.0;
+static double capacitive = 0.0;
+static double offset = 0.0; /*!< Survives disconnections, like on a device that stays powered. */
+static bool powered = false;
+static bool inEvent = false;
+static double untilToggle = 0.0; /*!< Samples left before the next event starts or the current one ends. */
+static uint64_t rngState = 0x9E3779B97F4A7C15ull;
+
+static double rateHz()
+{
+    static const double rates[] = {1250.0, 5000.0, 10000.0, 20000.0, 50000.0, 100000.0, 200000.0};
+
+    unsigned int rateId = settings[EdlCommandSamplingRate].radioId;
+    return rates[rateId > EDL_RADIO_SAMPLING_RATE_200_KHZ ? EDL_RADIO_SAMPLING_RATE_200_KHZ : rateId];
+}
+
+static uint64_t nextRandom()
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState*0x2545F4914F6CDD1Dull;
+}
+
+/*! Uniform in (0, 1]. */
+static double uniform()
+{
+    return ((nextRandom() >> 11)+1)*(1.0/9007199254740992.0);
+}
+
+/*! Approximately normal: sum of four uniforms (Irwin-Hall) from a single draw, rescaled to unit variance. */
+static double normal()
+{
+    uint64_t r = nextRandom();
+    double sum = (double)(r & 0xFFFF)+(double)((r >> 16) & 0xFFFF)+(double)((r >> 32) & 0xFFFF)+(double)(r >> 48);
+    return (sum/65536.0-2.0)*1.7320508075688772;
+}
+
+static void scheduleToggle()
+{
+    double meanSeconds = inEvent ? config.eventDwellSeconds : (config.eventRateHz > 0.0 ? 1.0/config.eventRateHz : 0.0);
+    untilToggle = meanSeconds > 0.0 ? -std::log(uniform())*meanSeconds*rateHz() : 1e300;
+}
+
+static void simDefaultsLocked()
+{
+    simDefaults(config);
+    configured = true;
+}
+
+static void resetSettings()
+{
+    for (unsigned int commandIdx = 0; commandIdx < EdlCommandIdNum; commandIdx++) {
+        settings[commandIdx].radioId = 0;
+        settings[commandIdx].checkboxChecked = EDL_CHECKBOX_UNCHECKED;
+        settings[commandIdx].buttonPressed = EDL_BUTTON_RELEASED;
+        settings[commandIdx].value = 0.0;
+        stackedValid[commandIdx] = false;
+    }
+    settings[EdlCommandSamplingRate].radioId = EDL_RADIO_SAMPLING_RATE_1_25_KHZ;
+    settings[EdlCommandRange].radioId = EDL_RADIO_RANGE_200_PA;
+    settings[EdlCommandFinalBandwidth].radioId = EDL_RADIO_FINAL_BANDWIDTH_SR_2;
+    sealTest = false;
+    vhold = 0.0;
+    vstep = 0.0;
+    protocolChanges.clear();
+}
+
+/*! Restarts the device clock from now, e.g. when the sampling rate changes. */
+static void rebaseClock()
+{
+    epoch = std::chrono::steady_clock::now();
+    epochPackets = (double)sampled;
+}
+
+/*! Advances the waveform over \a packets packets that are never read. */
+static void skipWaveform(unsigned long long packets)
+{
+    if (periodSamples > 0) {phase = (phase+packets)%periodSamples;}
+    capacitive = 0.0;
+    inEvent = false;
+    scheduleToggle();
+}
+
+/*! Brings the device clock to now: new packets enter the driver buffer, overwriting the oldest when it is full. */
+static void advance()
+{
+    double elapsed = std::chrono::duration <double> (std::chrono::steady_clock::now()-epoch).count();
+    unsigned long long target = (unsigned long long)(epochPackets+elapsed*rateHz()*config.timeScale);
+    if (target <= sampled) {return;}
+
+    unsigned long long fresh = target-sampled;
+    sampled = target;
+    if (lostPending > 0) {
+        unsigned long long lost = std::min(fresh, lostPending);
+        lostPending -= lost;
+        fresh -= lost;
+        gaps.push_back(std::make_pair(produced, lost));
+        stats.lostPackets += lost;
+        lostFlag = true;
+    }
+    stats.producedPackets += fresh;
+    produced += fresh;
+
+    if (produced-readPos > config.driverBufferPackets) {
+        unsigned long long overwritten = produced-readPos-config.driverBufferPackets;
+        unsigned long long skipped = overwritten;
+        readPos += overwritten;
+        while (!gaps.empty() && gaps.front().first <= readPos) {
+            skipped += gaps.front().second;
+            gaps.pop_front();
+        }
+        skipWaveform(skipped);
+        stats.overflowPackets += overwritten;
+        stats.overflowEvents++;
+        overflowFlag = true;
+    }
+}
+
+/*! Generates \a packets consecutive packets at readPos. */
+static void generate(float * out, unsigned int packets)
+{
+    const double rate = rateHz();
+    const bool nanoAmps = settings[EdlCommandRange].radioId == EDL_RADIO_RANGE_20_NA;
+    const double unit = nanoAmps ? 0.001 : 1.0;
+    const double fullScale = nanoAmps ? 20.0 : 200.0;
+	/*! Steps of the converter the codec assumes (codecAdcScale): the samples are whole codes, as on the device. */
+    const double codes = (double)(1 << (CODEC_ADC_BITS-1));
+    const float currentLsb = (float)(fullScale/codes);
+    const float voltageLsb = CODEC_VOLTAGE_FULL_SCALE_MV/(float)codes;
+    const double tau = config.accessResistanceMOhm*config.membraneCapacitancePf*1e-6*rate;
+    const double capacitiveDecay = tau > 0.0 ? std::exp(-1.0/tau) : 0.0;
+    const double compensationDecay = std::exp(-1.0/std::max(config.compensationSeconds*rate, 1.0));
+    const bool compensating = settings[EdlCommandDigitalCompensation].checkboxChecked == EDL_CHECKBOX_CHECKED;
+    const double sealConductance = config.sealResistanceGOhm > 0.0 ? 1.0/config.sealResistanceGOhm : 0.0;
+    const double accessConductance = config.accessResistanceMOhm > 0.0 ? 1000.0/config.accessResistanceMOhm : 0.0;
+
+    for (unsigned int packetIdx = 0; packetIdx < packets; packetIdx++) {
+        while (!gaps.empty() && gaps.front().first == readPos+packetIdx) {
+            skipWaveform(gaps.front().second);
+            gaps.pop_front();
+        }
+        while (!protocolChanges.empty() && protocolChanges.front().at <= readPos+packetIdx) {
+            const SimProtocol_t &change = protocolChanges.front();
+            sealTest = change.sealTest;
+            vhold = change.vhold;
+            vstep = change.vstep;
+            pulseSamples = change.pulseSamples;
+            periodSamples = change.periodSamples;
+            phase = 0;
+            protocolChanges.pop_front();
+        }
+
+        double v = vhold;
+        if (sealTest) {
+            if (phase < pulseSamples/2) {
+                v = vhold+vstep;
+            } else if (phase < pulseSamples) {
+                v = vhold-vstep;
+            }
+            if (++phase >= periodSamples) {phase = 0;}
+        }
+        if (v != voltage) {
+            /*! Voltage step: charge the membrane through the access resistance (mV / MOhm = nA). */
+            capacitive += (v-voltage)*accessConductance;
+            voltage = v;
+        }
+
+        untilToggle -= 1.0;
+        if (untilToggle <= 0.0) {
+            inEvent = !inEvent;
+            scheduleToggle();
+        }
+
+        double poreConductance = config.poreConductanceNs*(inEvent ? 1.0-config.eventBlockade : 1.0);
+        double current = (poreConductance+sealConductance)*v+capacitive+offset+config.noiseRmsPa*normal();
+        capacitive *= capacitiveDecay;
+        if (compensating) {offset *= compensationDecay;}
+
+        current *= unit;
+        double currentCode = std::max(-codes, std::min(codes-1.0, std::floor(current/currentLsb+0.5)));
+        double voltageCode = std::max(-codes, std::min(codes-1.0, std::floor(v/voltageLsb+0.5)));
+        out[(size_t)packetIdx*EDL_CHANNEL_NUM] = (float)voltageCode*voltageLsb;
+        for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            out[(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx] = (float)currentCode*currentLsb;
+        }
+    }
+    readPos += packets;
+}
+
+/*! Applies a command that reached the device. */
+static EdlErrorCode_t apply(EdlCommandId_t commandId, const EdlCommandStruct_t &commandStruct)
+{
+    unsigned int previousRate = settings[EdlCommandSamplingRate].radioId;
+
+    if (commandId == EdlCommandApplyProtocol) {
+        double rate = rateHz();
+        double tpu = settings[EdlCommandTpu].value;
+        double tpe = settings[EdlCommandTpe].value;
+        bool pulses = settings[EdlCommandMainTrial].value != 0.0;
+
+        if (std::fabs(settings[EdlCommandVhold].value) > 500.0 ||
+            (pulses && (tpu <= 0.0 || tpe < tpu || std::fabs(settings[EdlCommandVstep].value) > 500.0))) {
+            return EdlViolatedTrialRuleError;
+        }
+
+		/*! The new protocol starts with the next packet the device produces. */
+        advance();
+        SimProtocol_t change;
+        change.at = produced;
+        change.sealTest = pulses;
+        change.vhold = settings[EdlCommandVhold].value;
+        change.vstep = settings[EdlCommandVstep].value;
+        change.pulseSamples = (unsigned long long)(tpu*0.001*rate);
+        change.periodSamples = std::max(1ull, (unsigned long long)(tpe*0.001*rate));
+        protocolChanges.push_back(change);
+        return EdlSuccess;
+    }
+
+    settings[commandId] = commandStruct;
+    if (commandId == EdlCommandReset && commandStruct.checkboxChecked == EDL_CHECKBOX_CHECKED) {
+        resetSettings();
+    }
+    if (settings[EdlCommandSamplingRate].radioId != previousRate) {
+        rebaseClock();
+        scheduleToggle();
+    }
+
+    return EdlSuccess;
+}
+
+void simDefaults(SimConfig_t &defaults)
+{
+    defaults.timeScale = 1.0;
+    defaults.driverBufferPackets = 1 << 20;
+    defaults.poreConductanceNs = 1.0;
+    defaults.sealResistanceGOhm = 0.0;
+    defaults.accessResistanceMOhm = 10.0;
+    defaults.membraneCapacitancePf = 10.0;
+    defaults.noiseRmsPa = 2.0;
+    defaults.offsetPa = 20.0;
+    defaults.compensationSeconds = 0.1;
+    defaults.eventRateHz = 10.0;
+    defaults.eventDwellSeconds = 1e-3;
+    defaults.eventBlockade = 0.5;
+    defaults.devicesNum = 1;
+}
+
+void simConfigure(const SimConfig_t &newConfig)
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (connected) {advance();}
+    if (newConfig.offsetPa != config.offsetPa) {offset = newConfig.offsetPa;}
+    config = newConfig;
+    configured = true;
+    if (connected) {rebaseClock();}
+}
+
+void simInjectBufferOverflow(unsigned int packets)
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!connected) {return;}
+    advance();
+
+    unsigned long long overwritten = std::min((unsigned long long)packets, produced-readPos);
+    unsigned long long skipped = overwritten;
+    readPos += overwritten;
+    while (!gaps.empty() && gaps.front().first <= readPos) {
+        skipped += gaps.front().second;
+        gaps.pop_front();
+    }
+    skipWaveform(skipped);
+    stats.overflowPackets += overwritten;
+    stats.overflowEvents++;
+    overflowFlag = true;
+}
+
+void simInjectLostData(unsigned int packets)
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!connected) {return;}
+    lostPending += packets;
+    stats.lostDataEvents++;
+}
+
+void simGetStats(SimStats_t &copy)
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (connected) {advance();}
+    copy = stats;
+}
+
+EdlErrorCode_t init()
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!configured) {simDefaultsLocked();}
+    return EdlSuccess;
+}
+
+EdlErrorCode_t detectDevices(std::vector <std::string> &deviceIds)
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!configured) {simDefaultsLocked();}
+
+    deviceIds.clear();
+    for (unsigned int deviceIdx = 0; deviceIdx < config.devicesNum; deviceIdx++) {
+        char id[32];
+        snprintf(id, sizeof(id), "E1SIM%04u", deviceIdx);
+        deviceIds.push_back(id);
+    }
+
+    return deviceIds.empty() ? EdlNoDevicesError : EdlSuccess;
+}
+
+EdlErrorCode_t connectDevice(std::string deviceId)
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!configured) {simDefaultsLocked();}
+    if (connected) {return EdlDeviceAlreadyConnectedError;}
+
+    unsigned int deviceIdx;
+    if (sscanf(deviceId.c_str(), "E1SIM%u", &deviceIdx) != 1 || deviceIdx >= config.devicesNum) {return EdlDeviceConnectionError;}
+
+    resetSettings();
+    stats = SimStats_t();
+    sampled = 0;
+    produced = 0;
+    readPos = 0;
+    lostPending = 0;
+    gaps.clear();
+    overflowFlag = false;
+    lostFlag = false;
+    phase = 0;
+    voltage = 0.0;
+    capacitive = 0.0;
+    if (!powered) {offset = config.offsetPa;}
+    powered = true;
+    inEvent = false;
+    rebaseClock();
+    scheduleToggle();
+    connected = true;
+
+    return EdlSuccess;
+}
+
+EdlErrorCode_t disconnectDevice()
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!connected) {return EdlDeviceNotConnectedError;}
+    connected = false;
+
+    return EdlSuccess;
+}
+
+EdlErrorCode_t getDeviceStatus(EdlDeviceStatus_t &status)
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!connected) {return EdlDeviceNotConnectedError;}
+    advance();
+
+    unsigned long long available = produced-readPos;
+    status.availableDataPackets = (unsigned int)std::min(available, 0xFFFFFFFFull);
+    status.bufferOverflowFlag = overflowFlag;
+    status.lostDataFlag = lostFlag;
+    overflowFlag = false;
+    lostFlag = false;
+
+    return EdlSuccess;
+}
+
+EdlErrorCode_t readData(unsigned int dataToRead, unsigned int &dataRead, std::vector <float> &buffer)
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    dataRead = 0;
+    if (!connected) {return EdlDeviceNotConnectedError;}
+    advance();
+
+    unsigned long long available = produced-readPos;
+    dataRead = (unsigned int)std::min((unsigned long long)dataToRead, available);
+    buffer.resize((size_t)dataRead*EDL_CHANNEL_NUM);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    generate(buffer.data(), dataRead);
+    stats.generateSeconds += std::chrono::duration <double> (std::chrono::steady_clock::now()-start).count();
+    stats.readPackets += dataRead;
+
+    return dataRead < dataToRead ? EdlNotEnoughAvailableDataError : EdlSuccess;
+}
+
+EdlErrorCode_t purgeData()
+{
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!connected) {return EdlDeviceNotConnectedError;}
+    advance();
+
+    unsigned long long purged = produced-readPos;
+    unsigned long long skipped = purged;
+    readPos = produced;
+    while (!gaps.empty()) {
+        skipped += gaps.front().second;
+        gaps.pop_front();
+    }
+    skipWaveform(skipped);
+    stats.purgedPackets += purged;
+
+    return EdlSuccess;
+}
+
+EdlErrorCode_t setCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct, bool sendFlag)
+{
+    EdlErrorCode_t res = EdlSuccess;
+
+    std::lock_guard <std::mutex> lock(simMutex);
+    if (!connected) {return EdlDeviceNotConnectedError;}
+    if (commandId < 0 || commandId >= EdlCommandIdNum) {return EdlCommandIdOutOfRangeError;}
+    if (commandId >= EdlCommandMainTrial && sendFlag) {return EdlTrialValueSendNotDisabledError;}
+    if (commandId == EdlCommandApplyProtocol && !sendFlag) {return EdlPushButtonSendDisabledError;}
+    advance();
+
+    if (commandId != EdlCommandApplyProtocol) {
+        stacked[commandId] = commandStruct;
+        stackedValid[commandId] = true;
+    }
+    if (!sendFlag) {return EdlSuccess;}
+
+    for (unsigned int commandIdx = 0; commandIdx < EdlCommandIdNum; commandIdx++) {
+        if (!stackedValid[commandIdx]) {continue;}
+        stackedValid[commandIdx] = false;
+        apply((EdlCommandId_t)commandIdx, stacked[commandIdx]);
+    }
+    if (commandId == EdlCommandApplyProtocol) {res = apply(commandId, commandStruct);}
+
+    return res;
+}
@@ -0,0 +1,64 @@
+/*! \file edl_sim.h
+ * \brief Declares the controls of the simulated EDL device.
+ *
+ * edl_sim.cpp implements every function of EDL/edl.h against a simulated e1 device, so the library can be built,
+ * benchmarked and exercised where edl.lib is not available. The device produces packets in real time (optionally
+ * faster) into a simulated driver buffer; a nanopore trace with translocation events, a cell model for the seal test,
+ * noise and a digital offset are generated when the packets are read, as whole codes of the converter (see codecAdcScale).
+ */
+#ifndef EDL_SIM_H
+#define EDL_SIM_H
+
+#include "edl.h"
+
+/*! \struct SimConfig_t
+ * \brief Simulated device and driver parameters.
+ */
+typedef struct {
+    double timeScale; /*!< Device clock speed relative to real time: above 1 the device produces packets faster than any
+                       * real sampling rate, to measure the sustained throughput of the host. */
+    unsigned int driverBufferPackets; /*!< Driver buffer capacity; older packets are overwritten and bufferOverflowFlag is raised. */
+    double poreConductanceNs; /*!< Open pore conductance: the current is conductance * voltage. */
+    double sealResistanceGOhm; /*!< Resistance in parallel with the pore. */
+    double accessResistanceMOhm; /*!< Series resistance: with \a membraneCapacitancePf it sets the capacitive transients. */
+    double membraneCapacitancePf;
+    double noiseRmsPa; /*!< Gaussian current noise. */
+    double offsetPa; /*!< Current offset removed by the digital compensation. The compensated offset survives reconnections;
+                      * it is reset by the first connection and by a new \a offsetPa. */
+    double compensationSeconds; /*!< Time constant of the digital compensation. */
+    double eventRateHz; /*!< Mean rate of translocation events (Poisson arrivals). */
+    double eventDwellSeconds; /*!< Mean event duration (exponential). */
+    double eventBlockade; /*!< Fraction of the pore conductance blocked during an event. */
+    unsigned int devicesNum; /*!< Devices reported by detectDevices; 0 simulates no device plugged in. */
+} SimConfig_t;
+
+/*! \struct SimStats_t
+ * \brief Counters of the simulated device since the last connection.
+ */
+typedef struct {
+    unsigned long long producedPackets; /*!< Packets delivered to the driver buffer: lost packets excluded. */
+    unsigned long long readPackets; /*!< Packets returned by readData. */
+    unsigned long long overflowPackets; /*!< Packets overwritten in the driver buffer. */
+    unsigned long long lostPackets; /*!< Packets lost by the device (lostDataFlag). */
+    unsigned long long purgedPackets;
+    unsigned int overflowEvents;
+    unsigned int lostDataEvents;
+    double generateSeconds; /*!< Time spent generating packets inside readData: the cost of the simulation itself. */
+} SimStats_t;
+
+/*! \brief Fills \a config with the default parameters: real time, a 1 nS pore with 10 events/s. */
+void simDefaults(SimConfig_t &config);
+
+/*! \brief Applies \a config. Can be called at any time, also before init. */
+void simConfigure(const SimConfig_t &config);
+
+/*! \brief Overwrites the oldest \a packets packets of the driver buffer and raises bufferOverflowFlag. */
+void simInjectBufferOverflow(unsigned int packets);
+
+/*! \brief Loses the next \a packets packets of the device, leaving a gap in the data, and raises lostDataFlag. */
+void simInjectLostData(unsigned int packets);
+
+/*! \brief Copies the counters of the simulated device. */
+void simGetStats(SimStats_t &stats);
+
+#endif // EDL_SIM_H
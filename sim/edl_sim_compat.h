@@ -0,0 +1,12 @@
+/*! \file edl_sim_compat.h
+ * \brief Force-included in every translation unit built against the simulated device outside Windows.
+ * __declspec only marks dll exports and imports, which the default symbol visibility already provides.
+ */
+#ifndef EDL_SIM_COMPAT_H
+#define EDL_SIM_COMPAT_H
+
+#ifndef _WIN32
+#define __declspec(x)
+#endif
+
+#endif // EDL_SIM_COMPAT_H
@@ -0,0 +1,118 @@
+/* e1_codec_test.cpp
+Round trip of the sample codec: converter codes at the nominal step, at a step derived from the samples, and floats off any grid.
+Exits with the number of failed checks */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+#include <stdint.h>
+
+#include "e1_codec.h"
+#include "e1_test.h"
+
+#define TEST_SAMPLES 1000 /*!< Not a multiple of #E1_CODEC_BLOCK_VALUES: the last block is partial. */
+
+/*! Section buffer aligned to 16 bytes, as codecEncode requires. */
+class Section
+{
+public:
+    explicit Section(unsigned int samples) : storage(codecBound(samples)+15) {}
+    char * data() {return (char *)(((uintptr_t)storage.data()+15) & ~(uintptr_t)15);}
+
+private:
+    std::vector <char> storage;
+};
+
+static bool sameBits(const float * a, const float * b, unsigned int samples)
+{
+    return memcmp(a, b, (size_t)samples*sizeof(float)) == 0;
+}
+
+/*! Encodes \a values with \a scale, then checks that whole and partial decoding give back the same bits.
+ * \return Encoding of the section. */
+static uint32_t roundTrip(const std::vector <float> &values, float scale)
+{
+    const unsigned int samples = (unsigned int)values.size();
+    Section section(samples);
+    size_t bytes = codecEncode(values.data(), samples, scale, section.data());
+
+    CHECK(bytes <= codecBound(samples));
+    CHECK(codecValid(section.data(), bytes, samples));
+    CHECK(!codecValid(section.data(), bytes-1, samples));
+    CHECK(!codecValid(section.data(), bytes, samples+E1_CODEC_BLOCK_VALUES));
+
+    std::vector <float> decoded(samples);
+    codecDecode(section.data(), 0, samples, decoded.data(), 1);
+    CHECK(sameBits(values.data(), decoded.data(), samples));
+
+	/*! A range straddling two blocks, interleaved like the packets. */
+    const unsigned int first = E1_CODEC_BLOCK_VALUES-7, count = 300;
+    std::vector <float> strided(2*count, 0.0f);
+    codecDecode(section.data(), first, count, strided.data()+1, 2);
+    bool same = true;
+    for (unsigned int k = 0; k < count; k++) {
+        if (memcmp(&strided[2*k+1], &values[first+k], sizeof(float)) != 0 || strided[2*k] != 0.0f) {same = false;}
+    }
+    CHECK(same);
+
+    CodecSectionHeader_t header;
+    memcpy(&header, section.data(), sizeof(header));
+    return header.encoding;
+}
+
+/*! Random walk of converter codes times \a scale, clamped to the converter. */
+static std::vector <float> codes(float scale, std::mt19937 &rng)
+{
+    const int limit = 1 << (CODEC_ADC_BITS-1);
+    std::uniform_int_distribution <int> step(-3, 3);
+    std::vector <float> values(TEST_SAMPLES);
+    int code = 1000;
+
+    for (unsigned int k = 0; k < TEST_SAMPLES; k++) {
+        code = std::max(-limit, std::min(limit-1, code+step(rng)));
+        values[k] = (float)code*scale;
+    }
+    return values;
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+
+	/*! On the nominal grid: kept as codes. */
+    const float nominal = codecAdcScale(1, EDL_RADIO_RANGE_200_PA);
+    std::vector <float> onGrid = codes(nominal, rng);
+    CHECK(codecGridScale(onGrid.data(), TEST_SAMPLES, nominal) == nominal);
+    CHECK(roundTrip(onGrid, nominal) == E1_CODEC_ADC_CODES);
+
+	/*! On a grid the nominal step does not fit: the step is derived from the samples. */
+    const float actual = 0.0123f;
+    std::vector <float> otherGrid = codes(actual, rng);
+    float derived = codecGridScale(otherGrid.data(), TEST_SAMPLES, nominal);
+    CHECK(derived > 0.0f && std::fabs(derived-actual) < 1e-6f*actual);
+    CHECK(roundTrip(otherGrid, derived) == E1_CODEC_ADC_CODES);
+    CHECK(roundTrip(otherGrid, nominal) == E1_CODEC_FLOAT_BITS);
+
+	/*! Off any grid, signed zeros and extreme values included: coded from the float bits. */
+    std::normal_distribution <float> noise(0.0f, 50.0f);
+    std::vector <float> offGrid(TEST_SAMPLES);
+    for (unsigned int k = 0; k < TEST_SAMPLES; k++) {offGrid[k] = noise(rng);}
+    offGrid[3] = -0.0f;
+    offGrid[4] = 0.0f;
+    offGrid[5] = std::numeric_limits <float>::max();
+    offGrid[6] = -std::numeric_limits <float>::denorm_min();
+    offGrid[7] = std::numeric_limits <float>::infinity();
+    CHECK(codecGridScale(offGrid.data(), TEST_SAMPLES, nominal) == 0.0f);
+    CHECK(roundTrip(offGrid, 0.0f) == E1_CODEC_FLOAT_BITS);
+    CHECK(roundTrip(offGrid, nominal) == E1_CODEC_FLOAT_BITS);
+
+	/*! A constant channel packs to zero width blocks. */
+    std::vector <float> constant(TEST_SAMPLES, 5.0f*nominal);
+    CHECK(roundTrip(constant, nominal) == E1_CODEC_ADC_CODES);
+
+    return testResult("codec");
+}
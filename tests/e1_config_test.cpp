@@ -0,0 +1,151 @@
+/* e1_config_test.cpp
+Shadow configuration and transactions on the simulated device: redundant commands skipped, stacked ones flushed,
+settings reaching the device only when a transaction is committed, and aborted transactions releasing the others.
+Exits with the number of failed checks */
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "e1_config.h"
+#include "e1_sim_test.h"
+#include "e1_stats.h"
+#include "e1_test.h"
+
+/*! Calls to EDL::setCommand so far. */
+static unsigned long long commandsSent()
+{
+    Stats_t stats;
+    statsGet(stats);
+    return stats.commandsSent;
+}
+
+/*! Packets the simulated device produces per second now. */
+static double producedRateHz()
+{
+    SimStats_t before, after;
+    simGetStats(before);
+    sleepMs(100);
+    simGetStats(after);
+    return (after.producedPackets-before.producedPackets)/0.1;
+}
+
+static EdlErrorCode_t sendRadio(EdlCommandId_t commandId, unsigned int radioId, bool sendFlag)
+{
+    EdlCommandStruct_t commandStruct;
+    commandStruct.radioId = radioId;
+    return sendCommand(commandId, commandStruct, sendFlag);
+}
+
+static EdlErrorCode_t sendCheckbox(EdlCommandId_t commandId, bool checked)
+{
+    EdlCommandStruct_t commandStruct;
+    commandStruct.checkboxChecked = checked;
+    return sendCommand(commandId, commandStruct, true);
+}
+
+int main()
+{
+    SimConfig_t sim;
+    simDefaults(sim);
+    CHECK(simConnect(sim, EDL_RADIO_SAMPLING_RATE_1_25_KHZ) == EdlSuccess);
+    statsReset();
+
+	/*! Radio settings and the compensation checkbox already on the device are skipped; other commands never are. */
+    unsigned long long sent = commandsSent(), skipped = configSkippedCommands();
+    CHECK(sendRadio(EdlCommandSamplingRate, EDL_RADIO_SAMPLING_RATE_1_25_KHZ, true) == EdlSuccess);
+    CHECK(commandsSent() == sent && configSkippedCommands() == skipped+1);
+    CHECK(sendCheckbox(EdlCommandDigitalCompensation, EDL_CHECKBOX_UNCHECKED) == EdlSuccess);
+    CHECK(sendCheckbox(EdlCommandDigitalCompensation, EDL_CHECKBOX_UNCHECKED) == EdlSuccess);
+    CHECK(commandsSent() == sent+1 && configSkippedCommands() == skipped+2);
+    EdlCommandStruct_t value;
+    value.value = 10.0;
+    CHECK(sendCommand(EdlCommandVhold, value, false) == EdlSuccess);
+    CHECK(sendCommand(EdlCommandVhold, value, false) == EdlSuccess);
+    CHECK(commandsSent() == sent+3 && configSkippedCommands() == skipped+2);
+
+	/*! After an invalidation nothing is known, so nothing is skipped. */
+    configInvalidate();
+    CHECK(commandRadioId(EdlCommandSamplingRate) == UNKNOWN_RADIO_ID);
+    CHECK(sendRadio(EdlCommandSamplingRate, EDL_RADIO_SAMPLING_RATE_1_25_KHZ, true) == EdlSuccess);
+    CHECK(commandsSent() == sent+4 && commandRadioId(EdlCommandSamplingRate) == EDL_RADIO_SAMPLING_RATE_1_25_KHZ);
+
+	/*! A stacked setting is applied by the next send, even one that is redundant itself. */
+    CHECK(sendRadio(EdlCommandRange, EDL_RADIO_RANGE_20_NA, false) == EdlSuccess);
+    CHECK(commandRadioId(EdlCommandRange) != EDL_RADIO_RANGE_20_NA);
+    CHECK(sendRadio(EdlCommandSamplingRate, EDL_RADIO_SAMPLING_RATE_1_25_KHZ, true) == EdlSuccess);
+    CHECK(commandRadioId(EdlCommandRange) == EDL_RADIO_RANGE_20_NA);
+    CHECK(commandsSent() == sent+6);
+
+	/*! In a transaction the settings only reach the device on commit, in one send. */
+    CHECK(producedRateHz() < 5000.0);
+    sent = commandsSent();
+    {
+        ConfigTransaction transaction;
+        CHECK(configInTransaction());
+        CHECK(sendRadio(EdlCommandSamplingRate, EDL_RADIO_SAMPLING_RATE_50_KHZ, true) == EdlSuccess);
+        CHECK(sendRadio(EdlCommandRange, EDL_RADIO_RANGE_200_PA, true) == EdlSuccess);
+        CHECK(commandRadioId(EdlCommandSamplingRate) == EDL_RADIO_SAMPLING_RATE_1_25_KHZ);
+        CHECK(producedRateHz() < 5000.0);
+        CHECK(transaction.commit() == EdlSuccess);
+        CHECK(!configInTransaction());
+    }
+    CHECK(commandsSent() == sent+3);
+    CHECK(commandRadioId(EdlCommandSamplingRate) == EDL_RADIO_SAMPLING_RATE_50_KHZ);
+    CHECK(commandRadioId(EdlCommandRange) == EDL_RADIO_RANGE_200_PA);
+    CHECK(producedRateHz() > 25000.0);
+
+	/*! A push button in a transaction waits for the commit. */
+    sent = commandsSent();
+    {
+        ConfigTransaction transaction;
+        value.value = 0.0;
+        CHECK(sendCommand(EdlCommandMainTrial, value, false) == EdlSuccess);
+        EdlCommandStruct_t button;
+        button.buttonPressed = EDL_BUTTON_PRESSED;
+        CHECK(sendCommand(EdlCommandApplyProtocol, button, true) == EdlSuccess);
+        CHECK(commandsSent() == sent+1);
+        CHECK(transaction.commit() == EdlSuccess);
+    }
+    CHECK(commandsSent() == sent+2);
+
+	/*! Aborted when it goes out of scope: the push button is dropped, the settings stay stacked until the next send,
+	 * and a transaction of another thread waiting meanwhile can begin. */
+    std::atomic <bool> begun(false);
+    std::thread other;
+    sent = commandsSent();
+    {
+        ConfigTransaction transaction;
+        other = std::thread([&begun]() {
+            ConfigTransaction otherTransaction;
+            begun.store(true);
+        });
+        CHECK(sendRadio(EdlCommandSamplingRate, EDL_RADIO_SAMPLING_RATE_1_25_KHZ, true) == EdlSuccess);
+        EdlCommandStruct_t button;
+        button.buttonPressed = EDL_BUTTON_PRESSED;
+        CHECK(sendCommand(EdlCommandApplyProtocol, button, true) == EdlSuccess);
+        sleepMs(50);
+        CHECK(!begun.load());
+    }
+    other.join();
+    CHECK(begun.load());
+    CHECK(!configInTransaction());
+    CHECK(commandsSent() == sent+1);
+    CHECK(commandRadioId(EdlCommandSamplingRate) == EDL_RADIO_SAMPLING_RATE_50_KHZ);
+    CHECK(sendCheckbox(EdlCommandDigitalCompensation, EDL_CHECKBOX_CHECKED) == EdlSuccess);
+    CHECK(commandRadioId(EdlCommandSamplingRate) == EDL_RADIO_SAMPLING_RATE_1_25_KHZ);
+    CHECK(sendCheckbox(EdlCommandDigitalCompensation, EDL_CHECKBOX_UNCHECKED) == EdlSuccess);
+
+	/*! Outside a transaction, commit and abort do nothing. */
+    configAbort();
+    CHECK(configCommit() == EdlSuccess);
+
+	/*! A failed send forgets what was stacked: the device may or may not have it. */
+    CHECK(sendRadio(EdlCommandRange, EDL_RADIO_RANGE_20_NA, false) == EdlSuccess);
+    disconnectDevice();
+    CHECK(sendRadio(EdlCommandSamplingRate, EDL_RADIO_SAMPLING_RATE_5_KHZ, true) == EdlDeviceNotConnectedError);
+    CHECK(commandRadioId(EdlCommandRange) == UNKNOWN_RADIO_ID);
+    CHECK(commandRadioId(EdlCommandSamplingRate) == EDL_RADIO_SAMPLING_RATE_1_25_KHZ);
+
+    return testResult("config");
+}
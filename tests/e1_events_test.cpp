@@ -0,0 +1,138 @@
+/* e1_events_test.cpp
+Event detector: the hysteresis on a synthetic trace fed in blocks of any size, then the live detector on the simulated
+pore across a loss of packets and a change of the sampling rate.
+Exits with the number of failed checks */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "e1_acquisition.h"
+#include "e1_events.h"
+#include "e1_sim_test.h"
+#include "e1_test.h"
+
+/*! Baseline of 100 with a noise of exactly 1 standard deviation (+1, -1 alternately), and \a depth from \a start for
+ * \a length samples. */
+static void blockade(std::vector <float> &trace, size_t start, size_t length, float depth)
+{
+    for (size_t k = start; k < start+length; k++) {trace[k] -= depth;}
+}
+
+/*! Runs a detector over \a trace in blocks of \a blockNum. */
+static std::vector <DetectedEvent_t> detect(const std::vector <float> &trace, unsigned int blockNum)
+{
+    EventDetectorConfig_t config;
+    EventDetector detector;
+    std::vector <DetectedEvent_t> events;
+
+    eventDetectorDefaults(config);
+    config.baselineSeconds = 1.0;
+    detector.reset(config, 1000.0, 5000);
+    for (size_t position = 0; position < trace.size(); position += blockNum) {
+        detector.process(trace.data()+position, (unsigned int)std::min((size_t)blockNum, trace.size()-position), events);
+    }
+    return events;
+}
+
+/*! Pops every event detected so far. */
+static std::vector <DetectedEvent_t> popEvents()
+{
+    std::vector <DetectedEvent_t> events(EVENT_QUEUE_SIZE);
+    events.resize(eventsPop(events.data(), EVENT_QUEUE_SIZE));
+    return events;
+}
+
+int main()
+{
+	/*! 1 s at 1 kHz learns the baseline (100, sigma 1) with the default 5 and 1 sigma thresholds: 95 and 99. */
+    std::vector <float> trace(4000);
+    for (size_t k = 0; k < trace.size(); k++) {trace[k] = k % 2 == 0 ? 101.0f : 99.0f;}
+	/*! Deep for 20 samples, then shallow (between the thresholds) for 30: one event of 50 samples. */
+    blockade(trace, 1500, 20, 20.0f);
+    blockade(trace, 1520, 30, 3.0f);
+	/*! Shallow only: never crosses the start threshold. */
+    blockade(trace, 2000, 100, 3.0f);
+	/*! Deep, straddling many blocks of any size. */
+    blockade(trace, 3001, 333, 20.0f);
+
+    const unsigned int blocks[] = {1, 3, 64, 100, 4000};
+    for (size_t blockIdx = 0; blockIdx < sizeof(blocks)/sizeof(blocks[0]); blockIdx++) {
+        std::vector <DetectedEvent_t> events = detect(trace, blocks[blockIdx]);
+        CHECK(events.size() == 2);
+        if (events.size() != 2) {continue;}
+        CHECK(events[0].startSample == 5000+1500 && events[0].endSample == 5000+1550);
+        CHECK(std::fabs(events[0].dwellSeconds-0.05) < 1e-9);
+        CHECK(std::fabs(events[0].baseline-100.0) < 0.1 && std::fabs(events[0].baselineSigma-1.0) < 0.1);
+        CHECK(std::fabs(events[0].meanBlockade-(20.0*20+3.0*30)/50) < 0.1);
+        CHECK(std::fabs(events[0].maxBlockade-21.0) < 0.1);
+        CHECK(events[1].startSample == 5000+3001 && events[1].endSample == 5000+3334);
+    }
+
+	/*! The simulated pore at +100 mV: 100 pA open, half of it during the events, about 1 ms long, 50 per second. */
+    SimConfig_t sim;
+    simDefaults(sim);
+    sim.eventRateHz = 50.0;
+    sim.noiseRmsPa = 1.0;
+    CHECK(simConnect(sim, EDL_RADIO_SAMPLING_RATE_200_KHZ) == EdlSuccess);
+    EdlCommandStruct_t commandStruct;
+    commandStruct.value = 100.0;
+    CHECK(sendCommand(EdlCommandVhold, commandStruct, false) == EdlSuccess);
+    commandStruct.value = 0.0;
+    CHECK(sendCommand(EdlCommandMainTrial, commandStruct, false) == EdlSuccess);
+    commandStruct.buttonPressed = EDL_BUTTON_PRESSED;
+    CHECK(sendCommand(EdlCommandApplyProtocol, commandStruct, true) == EdlSuccess);
+
+    EventDetectorConfig_t config;
+    eventDetectorDefaults(config);
+    config.baselineSeconds = 0.2;
+	/*! The warmup learns the events too: a lower start threshold gets past the variance they add. */
+    config.startSigmas = 3.0;
+    config.minDwellSeconds = 1e-4;
+    config.maxDwellSeconds = 0.1;
+    const double warmupSeconds = 0.25*config.baselineSeconds;
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    CHECK(eventsStart(config) == EdlSuccess);
+    sleepMs(500);
+
+	/*! A loss discards the open event and learns the baseline again: no event starts within the warmup after it. */
+    simInjectLostData(20000);
+    sleepMs(800);
+    AcquisitionGap_t gap;
+    CHECK(acquisitionGaps(0, &gap, 1) == 1);
+    std::vector <DetectedEvent_t> events = popEvents();
+    unsigned int before = 0, after = 0;
+    for (size_t eventIdx = 0; eventIdx < events.size(); eventIdx++) {
+        const DetectedEvent_t &event = events[eventIdx];
+        if (event.endSample <= gap.deviceSample-gap.missingPackets) {
+            before++;
+        } else {
+            CHECK(event.startSample >= gap.deviceSample+warmupSeconds*200000.0);
+            after++;
+        }
+		/*! Once the baseline settled on the open pore, 120 pA with the offset, the depth is the blocked half. */
+        if (std::fabs(event.baseline-120.0) < 2.0 && event.dwellSeconds > 2e-4) {CHECK(std::fabs(event.meanBlockade-50.0) < 5.0);}
+    }
+    CHECK(before > 3 && after > 3);
+    CHECK(!events.empty() && std::fabs(events.back().baseline-120.0) < 2.0);
+
+	/*! At half the rate the dwell times are counted at the new rate. */
+    CHECK(simSetRate(EDL_RADIO_SAMPLING_RATE_100_KHZ) == EdlSuccess);
+    sleepMs(50);
+    popEvents();
+    sleepMs(500);
+    events = popEvents();
+    CHECK(events.size() > 3);
+    for (size_t eventIdx = 0; eventIdx < events.size(); eventIdx++) {
+        const DetectedEvent_t &event = events[eventIdx];
+        CHECK(std::fabs(event.dwellSeconds*100000.0-(double)(event.endSample-event.startSample)) < 1e-6);
+    }
+
+    eventsStop();
+    acquisitionStop();
+    CHECK(eventsDropped() == 0);
+    disconnectDevice();
+
+    return testResult("events");
+}
@@ -0,0 +1,129 @@
+/* e1_filter_test.cpp
+Filter chain against a scalar reference: IIR sections run in SSE2 pairs, the FIR four outputs at a time, any block size.
+Exits with the number of failed checks */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "e1_filter.h"
+#include "e1_test.h"
+
+/*! \a sections one after the other on the whole of \a x, in transposed direct form II and double precision. */
+static std::vector <double> referenceIir(const std::vector <Biquad_t> &sections, const std::vector <float> &x)
+{
+    std::vector <double> y(x.begin(), x.end());
+
+    for (size_t sectionIdx = 0; sectionIdx < sections.size(); sectionIdx++) {
+        const Biquad_t &c = sections[sectionIdx];
+        double z1 = 0.0, z2 = 0.0;
+        for (size_t i = 0; i < y.size(); i++) {
+            double in = y[i];
+            double out = c.b0*in+z1;
+            z1 = c.b1*in-c.a1*out+z2;
+            z2 = c.b2*in-c.a2*out;
+            y[i] = out;
+        }
+    }
+    return y;
+}
+
+/*! \a taps convolved with \a x, the samples before it taken as 0. */
+static std::vector <double> referenceFir(const std::vector <float> &taps, const std::vector <float> &x)
+{
+    std::vector <double> y(x.size(), 0.0);
+
+    for (size_t i = 0; i < x.size(); i++) {
+        for (size_t m = 0; m < taps.size() && m <= i; m++) {y[i] += (double)taps[m]*x[i-m];}
+    }
+    return y;
+}
+
+/*! Runs \a chain on \a x in blocks of \a blockNum. \return Largest difference from \a expected. */
+static double worstError(FilterChain &chain, const std::vector <float> &x, unsigned int blockNum, const std::vector <double> &expected)
+{
+    std::vector <float> y(x);
+    double worst = 0.0;
+
+    for (size_t position = 0; position < y.size(); position += blockNum) {
+        chain.process(y.data()+position, (unsigned int)std::min((size_t)blockNum, y.size()-position));
+    }
+    for (size_t i = 0; i < y.size(); i++) {worst = std::max(worst, std::fabs(y[i]-expected[i]));}
+    return worst;
+}
+
+int main()
+{
+    const double rateHz = 10000.0;
+    const unsigned int blocks[] = {1, 2, 3, 4, 5, 7, 64, 1000, 4096};
+    std::mt19937 rng(1);
+    std::normal_distribution <float> noise(0.0f, 1.0f);
+
+	/*! Noise after a zero: the chain primes on its first sample, so it starts from rest like the reference. */
+    std::vector <float> x(4096);
+    for (size_t i = 1; i < x.size(); i++) {x[i] = 10.0f*noise(rng);}
+
+	/*! 4 lowpass sections (two pairs), then 4 notch sections (two more pairs), then 3 sections: one left alone. */
+    for (unsigned int order = 7; order <= 8; order++) {
+        FilterSpec_t spec = filterSpecNone();
+        spec.lowpassType = FILTER_LOWPASS_BUTTERWORTH;
+        spec.lowpassOrder = order;
+        spec.lowpassHz = 1000.0;
+        spec.notchHz = 50.0;
+        spec.notchQ = 10.0;
+        spec.notchHarmonics = order == 8 ? 3 : 0;
+
+        std::vector <Biquad_t> sections;
+        CHECK(designLowpass(spec.lowpassType, order, spec.lowpassHz, rateHz, sections));
+        for (unsigned int harmonic = 1; harmonic <= spec.notchHarmonics+1; harmonic++) {
+            sections.push_back(designNotch(harmonic*spec.notchHz, spec.notchQ, rateHz));
+        }
+        std::vector <double> expected = referenceIir(sections, x);
+
+        for (size_t blockIdx = 0; blockIdx < sizeof(blocks)/sizeof(blocks[0]); blockIdx++) {
+            FilterChain chain;
+            CHECK(chain.configure(spec, rateHz));
+            double worst = worstError(chain, x, blocks[blockIdx], expected);
+            if (!(worst < 1e-3)) {
+                printf("order %u in blocks of %u: largest error %g\n", order, blocks[blockIdx], worst);
+                testFailures++;
+            }
+        }
+    }
+
+	/*! FIR of an odd length, so that the four-wide loop leaves a tail in most blocks. */
+    FilterSpec_t firSpec = filterSpecNone();
+    for (unsigned int k = 0; k < 37; k++) {firSpec.firTaps.push_back(0.01f*noise(rng));}
+    std::vector <double> firExpected = referenceFir(firSpec.firTaps, x);
+    for (size_t blockIdx = 0; blockIdx < sizeof(blocks)/sizeof(blocks[0]); blockIdx++) {
+        FilterChain chain;
+        CHECK(chain.configure(firSpec, rateHz));
+        CHECK(worstError(chain, x, blocks[blockIdx], firExpected) < 1e-4);
+    }
+
+	/*! A FIR lowpass given in Hz is designed for each rate: its impulse response is the design at that rate. */
+    FilterSpec_t lowpassSpec = filterSpecNone();
+    lowpassSpec.firLowpassHz = 1000.0;
+    lowpassSpec.firLowpassTaps = 31;
+    const double rates[] = {5000.0, 50000.0};
+    for (unsigned int rateIdx = 0; rateIdx < 2; rateIdx++) {
+        std::vector <float> designed = designFirLowpass(1000.0, 31, rates[rateIdx]);
+        std::vector <float> impulse(64, 0.0f);
+        impulse[1] = 1.0f;
+        FilterChain chain;
+        CHECK(chain.configure(lowpassSpec, rates[rateIdx]));
+        chain.process(impulse.data(), (unsigned int)impulse.size());
+        bool same = designed.size() == 31;
+        for (size_t k = 0; k < designed.size(); k++) {
+            if (std::fabs(impulse[1+k]-designed[k]) > 1e-6f) {same = false;}
+        }
+        CHECK(same);
+    }
+    CHECK(!FilterChain().configure(lowpassSpec, 1500.0));
+    CHECK(!FilterChain().configure(lowpassSpec, 0.0));
+    CHECK(FilterChain().configure(filterSpecNone(), 0.0));
+
+    return testResult("filter");
+}
@@ -0,0 +1,134 @@
+/* e1_gate_test.cpp
+Trigger of gated recordings: threshold, slope and RMS triggers fed in blocks, the settings check and the packet history.
+Exits with the number of failed checks */
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "e1_gate.h"
+#include "e1_test.h"
+
+static GateConfig_t config(unsigned int trigger, double level, int direction)
+{
+    GateConfig_t gate;
+    gateDefaults(gate);
+    gate.trigger = trigger;
+    gate.level = level;
+    gate.direction = direction;
+    return gate;
+}
+
+/*! Feeds \a samples to \a gate in blocks of \a blockNum, resuming after each sample that fires.
+ * \return Indices of the samples that fired. */
+static std::vector <unsigned int> firing(TriggerGate &gate, const std::vector <float> &samples, unsigned int blockNum)
+{
+    std::vector <unsigned int> fired;
+    unsigned int position = 0;
+
+    while (position < samples.size()) {
+        unsigned int n = std::min(blockNum, (unsigned int)samples.size()-position);
+        unsigned int k = gate.scan(samples.data()+position, n, 1);
+        if (k < n) {fired.push_back(position+k);}
+        position += k < n ? k+1 : n;
+    }
+    return fired;
+}
+
+int main()
+{
+    TriggerGate gate;
+
+	/*! Threshold: the samples above the level fire, each run of them counts as one trigger, whatever the blocks. */
+    const float levels[] = {0.0f, 2.0f, 2.0f, 0.5f, 3.0f, 1.0f, 4.0f};
+    std::vector <float> steps(levels, levels+7);
+    for (unsigned int blockNum = 1; blockNum <= 7; blockNum++) {
+        gate.reset(config(GATE_TRIGGER_THRESHOLD, 1.0, 1), 1);
+        std::vector <unsigned int> fired = firing(gate, steps, blockNum);
+        CHECK(fired.size() == 4 && fired[0] == 1 && fired[1] == 2 && fired[2] == 4 && fired[3] == 6);
+        CHECK(gate.triggers() == 3);
+    }
+    gate.reset(config(GATE_TRIGGER_THRESHOLD, 1.0, -1), 1);
+    CHECK(firing(gate, steps, 3).size() == 2 && gate.triggers() == 2);
+
+	/*! Every other float: the packets of two channels, the second one tested. */
+    const float packets[] = {9.0f, 0.0f, 9.0f, 0.0f, 0.0f, 5.0f};
+    gate.reset(config(GATE_TRIGGER_THRESHOLD, 1.0, 1), 1);
+    CHECK(gate.scan(packets+1, 3, 2) == 2);
+
+	/*! Slope over 4 samples of a ramp rising by 1 per sample: 4, which only fires once a whole window was seen. */
+    std::vector <float> ramp(20);
+    for (unsigned int k = 0; k < 20; k++) {ramp[k] = 1000.0f+k;}
+    gate.reset(config(GATE_TRIGGER_SLOPE, 3.5, 1), 4);
+    CHECK(gate.scan(ramp.data(), 20, 1) == 4);
+    gate.reset(config(GATE_TRIGGER_SLOPE, 4.5, 1), 4);
+    CHECK(gate.scan(ramp.data(), 20, 1) == 20 && gate.triggers() == 0);
+    gate.reset(config(GATE_TRIGGER_SLOPE, -3.5, -1), 4);
+    CHECK(gate.scan(ramp.data(), 20, 1) == 20);
+
+	/*! RMS over 64 samples: a square wave of amplitude 5 on a large offset, after a flat start. Its RMS grows to 5 and
+	 * stays there over many windows, so the running sums must not drift. */
+    const unsigned int window = 64, flat = 200, wave = 100000;
+    std::vector <float> square(flat+wave+flat, 30000.0f);
+    for (unsigned int k = 0; k < wave; k++) {square[flat+k] += k % 2 == 0 ? 5.0f : -5.0f;}
+
+    gate.reset(config(GATE_TRIGGER_RMS, 4.9, 1), window);
+    std::vector <unsigned int> fired = firing(gate, square, 1000);
+    CHECK(!fired.empty() && fired[0] > flat && fired[0] < flat+window);
+    CHECK(fired.size() > wave-window && fired.back() < flat+wave+window);
+    CHECK(gate.triggers() == 1);
+
+    gate.reset(config(GATE_TRIGGER_RMS, 5.01, 1), window);
+    CHECK(firing(gate, square, 777).empty());
+    gate.reset(config(GATE_TRIGGER_RMS, 0.01, -1), window);
+    fired = firing(gate, square, 4096);
+    CHECK(!fired.empty() && fired[0] == window-1 && gate.triggers() == 2);
+
+	/*! Settings converted at 10 kHz, and the ones out of range. */
+    unsigned int windowPackets, prePackets, postPackets;
+    GateConfig_t gateConfig;
+    gateDefaults(gateConfig);
+    CHECK(gatePackets(gateConfig, 10000.0, windowPackets, prePackets, postPackets));
+    CHECK(windowPackets == 10 && prePackets == 500 && postPackets == 1000);
+    gateConfig = config(GATE_TRIGGER_THRESHOLD, 1.0, 1);
+    gateConfig.windowSeconds = 0.0;
+    CHECK(gatePackets(gateConfig, 10000.0, windowPackets, prePackets, postPackets) && windowPackets == 1);
+    gateConfig.channel = 0;
+    CHECK(!gatePackets(gateConfig, 10000.0, windowPackets, prePackets, postPackets));
+    gateConfig = config(GATE_TRIGGER_RMS, 1.0, 0);
+    CHECK(!gatePackets(gateConfig, 10000.0, windowPackets, prePackets, postPackets));
+    gateConfig = config(GATE_TRIGGER_RMS, 1.0, 1);
+    gateConfig.windowSeconds = 1e-4;
+    CHECK(!gatePackets(gateConfig, 10000.0, windowPackets, prePackets, postPackets));
+    gateConfig = config(GATE_TRIGGER_RMS, 1.0, 1);
+    gateConfig.preSeconds = 1000.0;
+    CHECK(!gatePackets(gateConfig, 10000.0, windowPackets, prePackets, postPackets));
+    CHECK(!gatePackets(config(GATE_TRIGGER_RMS, 1.0, 1), 0.0, windowPackets, prePackets, postPackets));
+
+	/*! History of 3 packets fed 5 then 2 more: the last 3, oldest first, across the wrap. */
+    PacketHistory history;
+    history.allocate(3);
+    std::vector <float> fed(7*EDL_CHANNEL_NUM);
+    for (unsigned int k = 0; k < fed.size(); k++) {fed[k] = (float)k;}
+    history.push(fed.data(), 5);
+    history.push(fed.data()+5*EDL_CHANNEL_NUM, 2);
+    CHECK(history.size() == 3);
+
+    const float * first;
+    const float * second;
+    unsigned int firstNum, secondNum;
+    history.spans(first, firstNum, second, secondNum);
+    CHECK(firstNum+secondNum == 3);
+    bool same = firstNum+secondNum == 3;
+    for (unsigned int k = 0; k < 3 && same; k++) {
+        const float * packet = k < firstNum ? first+(size_t)k*EDL_CHANNEL_NUM : second+(size_t)(k-firstNum)*EDL_CHANNEL_NUM;
+        for (unsigned int c = 0; c < EDL_CHANNEL_NUM; c++) {
+            if (packet[c] != fed[(size_t)(4+k)*EDL_CHANNEL_NUM+c]) {same = false;}
+        }
+    }
+    CHECK(same);
+    history.clear();
+    CHECK(history.size() == 0);
+
+    return testResult("gate");
+}
@@ -0,0 +1,125 @@
+/* e1_offset_test.cpp
+Offset compensation on the simulated device, whose offset decays while the compensation is enabled: convergence through
+direct driver reads and through the acquisition thread, stale packets ignored, timeout and cancellation.
+Exits with the number of failed checks */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "e1_acquisition.h"
+#include "e1_offset.h"
+#include "e1_sim_test.h"
+#include "e1_test.h"
+
+static int callbackStatus = OFFSET_COMPENSATION_IDLE;
+static double callbackResidual = -1.0;
+
+static void compensationDone(int status, double residual, void *)
+{
+    callbackStatus = status;
+    callbackResidual = residual;
+}
+
+/*! Runs a compensation to its end. \return Its status; \a seconds is the time it took. */
+static int compensate(const OffsetCompensationConfig_t &config, double &seconds)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    callbackStatus = OFFSET_COMPENSATION_IDLE;
+    if (offsetCompensationStart(config, compensationDone, NULL) != EdlSuccess) {return OFFSET_COMPENSATION_FAILED;}
+    int status = offsetCompensationWait(config.timeoutMs+1000);
+    seconds = std::chrono::duration <double> (std::chrono::steady_clock::now()-start).count();
+    offsetCompensationCancel();
+    return status;
+}
+
+/*! Gives the simulated device a new offset of \a offsetPa, decaying with \a compensationSeconds while compensated. */
+static void setOffset(SimConfig_t &sim, double offsetPa, double compensationSeconds)
+{
+    sim.offsetPa = offsetPa;
+    sim.compensationSeconds = compensationSeconds;
+    simConfigure(sim);
+}
+
+/*! True if the compensation was left disabled on the device. */
+static bool compensationDisabled()
+{
+    EdlCommandStruct_t commandStruct;
+    return configShadow(EdlCommandDigitalCompensation, commandStruct) && commandStruct.checkboxChecked == EDL_CHECKBOX_UNCHECKED;
+}
+
+int main()
+{
+    SimConfig_t sim;
+    simDefaults(sim);
+    sim.eventRateHz = 0.0;
+    CHECK(simConnect(sim, EDL_RADIO_SAMPLING_RATE_10_KHZ) == EdlSuccess);
+
+    OffsetCompensationConfig_t config;
+    offsetCompensationDefaults(config);
+    double residual, seconds;
+
+	/*! The measure leaves the offset alone: 20 pA. */
+    CHECK(offsetMeasure(config, residual) == EdlSuccess);
+    CHECK(std::fabs(residual-20.0) < 1.0);
+
+	/*! Direct reads: it takes 0.1 s * ln(20) for the offset to fall below 1 pA, then 3 windows of 20 ms. */
+    CHECK(compensate(config, seconds) == OFFSET_COMPENSATION_CONVERGED);
+    CHECK(seconds > 0.3 && seconds < 2.0);
+    CHECK(offsetCompensationStatus(residual) == OFFSET_COMPENSATION_CONVERGED && residual <= config.tolerance);
+    CHECK(callbackStatus == OFFSET_COMPENSATION_CONVERGED && callbackResidual == residual);
+    CHECK(compensationDisabled());
+    CHECK(offsetMeasure(config, residual) == EdlSuccess);
+    CHECK(residual < 1.5);
+
+	/*! Packets without offset left in the ring and in the driver by an acquisition, then an offset of 40 pA: these
+	 * stale packets would pass the tolerance at once. The compensation must judge only the packets acquired after it
+	 * was enabled, and leave the ring alone. */
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    sleepMs(200);
+    acquisitionStop();
+    unsigned int stale = acquisitionRing().readable();
+    CHECK(stale > 1000);
+    setOffset(sim, 40.0, 0.1);
+    CHECK(compensate(config, seconds) == OFFSET_COMPENSATION_CONVERGED);
+    CHECK(seconds > 0.3);
+    CHECK(acquisitionRing().readable() == stale);
+
+	/*! Through the acquisition thread. */
+    setOffset(sim, 25.0, 0.1);
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    CHECK(compensate(config, seconds) == OFFSET_COMPENSATION_CONVERGED);
+    CHECK(seconds > 0.3 && seconds < 2.0);
+    CHECK(compensationDisabled());
+    acquisitionStop();
+
+	/*! An offset that decays too slowly: the compensation is disabled at the timeout anyway. */
+    setOffset(sim, 30.0, 100.0);
+    config.timeoutMs = 300;
+    CHECK(compensate(config, seconds) == OFFSET_COMPENSATION_TIMED_OUT);
+    CHECK(seconds > 0.25 && seconds < 1.0);
+    CHECK(offsetCompensationStatus(residual) == OFFSET_COMPENSATION_TIMED_OUT && residual > 25.0);
+    CHECK(compensationDisabled());
+
+	/*! Cancelled. */
+    config.timeoutMs = OFFSET_COMPENSATION_TIMEOUT_MS;
+    CHECK(offsetCompensationStart(config, compensationDone, NULL) == EdlSuccess);
+    sleepMs(50);
+    CHECK(offsetCompensationStatus(residual) == OFFSET_COMPENSATION_RUNNING);
+    offsetCompensationCancel();
+    CHECK(offsetCompensationStatus(residual) == OFFSET_COMPENSATION_CANCELLED);
+    CHECK(callbackStatus == OFFSET_COMPENSATION_CANCELLED);
+    CHECK(compensationDisabled());
+
+    config.tolerance = 0.0;
+    CHECK(offsetCompensationStart(config, NULL, NULL) == EdlUnknownError);
+    offsetCompensationDefaults(config);
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    CHECK(offsetMeasure(config, residual) == EdlUnknownError);
+    acquisitionStop();
+
+    disconnectDevice();
+
+    return testResult("offset");
+}
@@ -0,0 +1,143 @@
+/* e1_protocol_test.cpp
+Protocol compiler: expansion of the statements into timed steps, syntax errors and the trial rules.
+Exits with the number of failed checks */
+
+#include <cstdio>
+#include <cstring>
+
+#include "e1_protocol.h"
+#include "e1_test.h"
+
+/*! Value given to \a commandId by \a step, or -1e9 if it does not set it. */
+static double setting(const ProtocolStep_t &step, EdlCommandId_t commandId)
+{
+    for (unsigned int settingIdx = 0; settingIdx < step.settingsNum; settingIdx++) {
+        if (step.commandIds[settingIdx] == commandId) {return step.values[settingIdx];}
+    }
+    return -1e9;
+}
+
+/*! Compiles \a text, which must fail with \a expected on line \a line, and leave no steps behind. */
+static void rejects(const char * text, const ProtocolState_t * initial, EdlErrorCode_t expected, unsigned int line)
+{
+    Protocol_t protocol;
+    char error[PROTOCOL_ERROR_BYTES];
+    char prefix[32];
+
+    protocol.steps.resize(1);
+    CHECK(protocolCompile(text, protocol, initial, error) == expected);
+    CHECK(protocol.steps.empty());
+    snprintf(prefix, sizeof(prefix), "line %u: ", line);
+    if (strncmp(error, prefix, strlen(prefix)) != 0) {
+        printf("expected \"%s...\", got \"%s\"\n", prefix, error);
+        testFailures++;
+    }
+}
+
+int main()
+{
+    Protocol_t protocol;
+    char error[PROTOCOL_ERROR_BYTES];
+
+	/*! Every statement kind, nested in a repeat, with comments and blank lines. */
+    const char * text =
+        "# pulses around a sweep\n"
+        "set MainTrial 1\n"
+        "set Tpu 10\n"
+        "set tpe 20   # names ignore the case\n"
+        "set Vhold 50\n"
+        "set Vhold 100\n"
+        "apply\n"
+        "\n"
+        "wait 5\n"
+        "sweep Vhold 100 0 50 10\n"
+        "repeat 2\n"
+        "    ramp Vfp 0 10 2 4\n"
+        "end\n"
+        "wait 1.5\n";
+    CHECK(protocolCompile(text, protocol, NULL, error) == EdlSuccess);
+    CHECK(error[0] == '\0');
+    CHECK(protocol.steps.size() == 10);
+    if (protocol.steps.size() == 10) {
+        const ProtocolStep_t &first = protocol.steps[0];
+        CHECK(first.line == 7 && first.atMs == 0.0);
+        CHECK(first.settingsNum == 4);
+        CHECK(setting(first, EdlCommandVhold) == 100.0);
+        CHECK(setting(first, EdlCommandTpe) == 20.0);
+
+		/*! The sweep counts down, both ends included, one step per value. */
+        const double sweepMs[] = {5.0, 15.0, 25.0}, sweepMv[] = {100.0, 50.0, 0.0};
+        for (unsigned int k = 0; k < 3; k++) {
+            const ProtocolStep_t &step = protocol.steps[1+k];
+            CHECK(step.line == 10 && step.atMs == sweepMs[k]);
+            CHECK(step.settingsNum == 1 && setting(step, EdlCommandVhold) == sweepMv[k]);
+        }
+
+		/*! Each ramp applies its 3 values over 4 ms; the second one starts where the first ended. */
+        const double rampMs[] = {35.0, 37.0, 39.0, 39.0, 41.0, 43.0}, rampMv[] = {0.0, 5.0, 10.0};
+        for (unsigned int k = 0; k < 6; k++) {
+            const ProtocolStep_t &step = protocol.steps[4+k];
+            CHECK(step.line == 12 && step.atMs == rampMs[k]);
+            CHECK(step.settingsNum == 1 && setting(step, EdlCommandVfp) == rampMv[k % 3]);
+        }
+    }
+    CHECK(protocol.durationMs == 44.5);
+
+	/*! An empty protocol compiles to nothing. */
+    CHECK(protocolCompile("# nothing\n\n", protocol, NULL, error) == EdlSuccess);
+    CHECK(protocol.steps.empty() && protocol.durationMs == 0.0);
+    CHECK(protocolCompile("repeat 0\nset Vhold 900\napply\nend\n", protocol, NULL, error) == EdlSuccess);
+    CHECK(protocol.steps.empty());
+
+	/*! Syntax. */
+    rejects("set Vhold 10\napply\njump 3\n", NULL, EdlUnknownError, 3);
+    rejects("set Vnone 10\napply\n", NULL, EdlUnknownError, 1);
+    rejects("set Vhold ten\napply\n", NULL, EdlUnknownError, 1);
+    rejects("wait 1 2\n", NULL, EdlUnknownError, 1);
+    rejects("wait -1\n", NULL, EdlUnknownError, 1);
+    rejects("sweep Vhold 0 10 0 1\n", NULL, EdlUnknownError, 1);
+    rejects("ramp Vhold 0 10 1.5 1\n", NULL, EdlUnknownError, 1);
+    rejects("repeat 2\napply\n", NULL, EdlUnknownError, 2);
+    rejects("apply\nend\n", NULL, EdlUnknownError, 2);
+    rejects("set Vhold 10\napply\nset Vhold 20\n", NULL, EdlUnknownError, 3);
+
+	/*! Trial rules, checked on every apply. */
+    rejects("set Vhold 10\napply\nset Vhold -501\napply\n", NULL, EdlViolatedTrialRuleError, 4);
+    rejects("sweep Vamp 400 600 50 1\n", NULL, EdlViolatedTrialRuleError, 1);
+    rejects("set Tstep -1\napply\n", NULL, EdlViolatedTrialRuleError, 2);
+    rejects("set N 2.5\napply\n", NULL, EdlViolatedTrialRuleError, 2);
+    rejects("set MainTrial 2\nset Tpu 0\napply\n", NULL, EdlViolatedTrialRuleError, 3);
+    rejects("set MainTrial 2\nset Tpu 10\nset Tpe 5\napply\n", NULL, EdlViolatedTrialRuleError, 4);
+    CHECK(protocolCompile("set MainTrial 0\nset Tpu 10\nset Tpe 5\napply\n", protocol, NULL, error) == EdlSuccess);
+
+	/*! Rules on parameters the file leaves alone use the initial ones, and pass while these are unknown. */
+    ProtocolState_t initial;
+    memset(&initial, 0, sizeof(initial));
+    initial.values[EdlCommandMainTrial] = 1.0;
+    initial.known[EdlCommandMainTrial] = true;
+    initial.values[EdlCommandTpu] = 10.0;
+    initial.known[EdlCommandTpu] = true;
+    CHECK(protocolCompile("set Tpe 5\napply\n", protocol, NULL, error) == EdlSuccess);
+    rejects("set Tpe 5\napply\n", &initial, EdlViolatedTrialRuleError, 2);
+    CHECK(protocolCompile("set Tpe 15\napply\n", protocol, &initial, error) == EdlSuccess);
+
+	/*! The rules are assumptions, set to match the device. */
+    ProtocolRules_t rules;
+    protocolRulesDefaults(rules);
+    rules.maxAbsMv = 1000.0;
+    rules.pulseTimes = 0;
+    protocolSetRules(rules);
+    CHECK(protocolCompile("set Vhold -800\nset MainTrial 2\nset Tpu 10\nset Tpe 5\napply\n", protocol, NULL, error) == EdlSuccess);
+    rejects("set Vhold 1001\napply\n", NULL, EdlViolatedTrialRuleError, 2);
+    rules.maxAbsMv = 0.0;
+    protocolSetRules(rules);
+    CHECK(protocolCompile("set Vhold 1e6\napply\n", protocol, NULL, error) == EdlSuccess);
+    protocolRulesDefaults(rules);
+    protocolSetRules(rules);
+    rejects("set Vhold 501\napply\n", NULL, EdlViolatedTrialRuleError, 2);
+
+    CHECK(protocolCompile(NULL, protocol, NULL, error) == EdlUnknownError);
+    CHECK(protocolCompile("set Vhold 10\napply\n", protocol, NULL, NULL) == EdlSuccess);
+
+    return testResult("protocol");
+}
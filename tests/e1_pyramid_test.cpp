@@ -0,0 +1,142 @@
+/* e1_pyramid_test.cpp
+Decimation pyramid fed by the simulated device: its columns against the samples, the gaps held on the device clock, and
+queries racing the restarts caused by sampling rate changes.
+Exits with the number of failed checks */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "e1_acquisition.h"
+#include "e1_pyramid.h"
+#include "e1_sim_test.h"
+#include "e1_test.h"
+
+/*! Current samples seen by the sinks since the acquisition started, and the packets reported lost meanwhile. */
+static std::vector <float> current;
+static uint64_t missing = 0;
+
+static void recordSink(const float * packets, unsigned int packetsNum, void *)
+{
+    missing += acquisitionBlock().missingPackets;
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        current.push_back(packets[(size_t)packetIdx*EDL_CHANNEL_NUM+1]);
+    }
+}
+
+/*! Queries \a pixels columns of 18/16 bins of \a binSamples samples from 1/16 bin on, and compares them with the
+ * samples. Column edges fall an odd number of sixteenths of a bin into it, so rounding never moves them. */
+static void compareColumns(double rateHz, unsigned int binSamples, unsigned int pixels)
+{
+    std::vector <float> out(3*(size_t)pixels);
+    double t0 = binSamples/16.0/rateHz;
+
+    CHECK(pyramidWindow(1, t0, t0+pixels*binSamples*18.0/16.0/rateHz, pixels, out.data()) == EdlSuccess);
+    unsigned int wrong = 0;
+    for (unsigned int pixelIdx = 0; pixelIdx < pixels; pixelIdx++) {
+        size_t first = (size_t)(1+18*pixelIdx)/16*binSamples;
+        size_t last = ((size_t)(1+18*(pixelIdx+1))/16+1)*binSamples;
+        if (last > current.size()) {break;}
+        float mn = current[first], mx = current[first];
+        double sum = 0.0;
+        for (size_t k = first; k < last; k++) {
+            mn = std::min(mn, current[k]);
+            mx = std::max(mx, current[k]);
+            sum += current[k];
+        }
+        if (out[pixelIdx] != mn || out[pixels+pixelIdx] != mx || std::fabs(out[2*pixels+pixelIdx]-sum/(last-first)) > 1e-3) {wrong++;}
+    }
+    if (wrong > 0) {
+        printf("bins of %u samples: %u of %u columns differ from the samples\n", binSamples, wrong, pixels);
+        testFailures++;
+    }
+}
+
+int main()
+{
+    SimConfig_t sim;
+    simDefaults(sim);
+    CHECK(simConnect(sim, EDL_RADIO_SAMPLING_RATE_200_KHZ) == EdlSuccess);
+    const double rateHz = 200000.0;
+
+	/*! Columns of levels 0, 2 and 4 on a gapless stream, against the samples the sinks saw. */
+    current.reserve(1 << 20);
+    CHECK(pyramidStart() == EdlSuccess);
+    acquisitionAddSink(recordSink, NULL);
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    for (unsigned int k = 0; k < 100 && acquisitionStreamPackets() < 150000; k++) {sleepMs(10);}
+    acquisitionStop();
+    acquisitionRemoveSink(recordSink, NULL);
+    pyramidStop();
+
+    CHECK(missing == 0);
+    CHECK(current.size() >= 150000);
+    CHECK(std::fabs(pyramidLatestTime()*rateHz-(double)(current.size()/4*4)) < 0.5);
+    compareColumns(rateHz, 4, 1000);
+    compareColumns(rateHz, 64, 1000);
+    compareColumns(rateHz, 1024, 100);
+
+	/*! Columns beyond the latest sample have no data. */
+    std::vector <float> out(30);
+    double latest = pyramidLatestTime();
+    CHECK(pyramidWindow(1, latest+1.0, latest+2.0, 10, out.data()) == EdlSuccess);
+    CHECK(std::isnan(out[0]) && std::isnan(out[19]) && std::isnan(out[29]));
+    CHECK(pyramidWindow(EDL_CHANNEL_NUM, 0.0, 1.0, 10, out.data()) == EdlUnknownError);
+    CHECK(pyramidWindow(1, 1.0, 1.0, 10, out.data()) == EdlUnknownError);
+
+	/*! A loss is filled with the last packet: the time axis follows the device samples, lost ones included. */
+    CHECK(pyramidStart() == EdlSuccess);
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    sleepMs(100);
+    simInjectLostData(20000);
+    sleepMs(300);
+    acquisitionStop();
+    pyramidStop();
+    CHECK(acquisitionDeviceSamples() > acquisitionStreamPackets());
+    CHECK(std::fabs(pyramidLatestTime()*rateHz-(double)(acquisitionDeviceSamples()/4*4)) < 0.5);
+
+	/*! Queries on another thread while the rate keeps changing restart the pyramid: every column stays whole, either
+	 * all NaN or a minimum, mean and maximum that bracket each other. */
+    std::atomic <bool> querying(true);
+    std::atomic <unsigned int> queries(0), inconsistent(0), answered(0);
+    std::thread reader([&]() {
+        std::vector <float> columns(3*256);
+        while (querying.load()) {
+            double t1 = pyramidLatestTime();
+            if (pyramidWindow(1, 0.0, t1 > 0.0 ? t1 : 1.0, 256, columns.data()) != EdlSuccess) {inconsistent++;}
+            for (unsigned int pixelIdx = 0; pixelIdx < 256; pixelIdx++) {
+                float mn = columns[pixelIdx], mx = columns[256+pixelIdx], mean = columns[512+pixelIdx];
+                if (std::isnan(mn) != std::isnan(mx) || std::isnan(mn) != std::isnan(mean)) {
+                    inconsistent++;
+                } else if (!std::isnan(mn)) {
+                    if (!(mn <= mean+1e-3f && mean <= mx+1e-3f)) {inconsistent++;}
+                    answered++;
+                }
+            }
+            queries++;
+        }
+    });
+
+    CHECK(pyramidStart() == EdlSuccess);
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    for (unsigned int change = 0; change < 20; change++) {
+        CHECK(simSetRate(change % 2 == 0 ? EDL_RADIO_SAMPLING_RATE_100_KHZ : EDL_RADIO_SAMPLING_RATE_200_KHZ) == EdlSuccess);
+        sleepMs(25);
+    }
+    acquisitionStop();
+    querying.store(false);
+    reader.join();
+    pyramidStop();
+
+    CHECK(inconsistent.load() == 0);
+    CHECK(queries.load() > 20 && answered.load() > 0);
+	/*! The last restart started the time axis over at 200kHz: at most one period of changes is on it. */
+    CHECK(pyramidLatestTime() > 0.0 && pyramidLatestTime() < 0.1);
+
+    disconnectDevice();
+
+    return testResult("pyramid");
+}
@@ -0,0 +1,267 @@
+/* e1_reader_test.cpp
+Reader of recordings that were never finalized: the chunks, gaps and segments recovered from the file alone, in the fixed
+chunk layout and in the packed one, compressed or not. Torn and corrupt chunks must be cut off or rejected.
+Exits with the number of failed checks */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#include "e1_reader.h"
+#include "e1_codec.h"
+#include "e1_test.h"
+
+#define TEST_CHANNELS EDL_CHANNEL_NUM
+#define TEST_CHUNK_PACKETS 200
+#define TEST_SCALE 0.25f /*!< Step of the samples, so that compressed chunks hold codes. */
+
+static const char * testPath = "e1_reader_test.e1rec";
+
+/*! Sample of \a channel in stream packet \a packet. */
+static float value(uint64_t packet, unsigned int channel)
+{
+    return (float)((int)((packet*7+channel*13) % 2001)-1000)*TEST_SCALE;
+}
+
+static RecordingHeader_t header(uint32_t version, uint32_t compression, uint32_t flags)
+{
+    RecordingHeader_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, E1_RECORDING_MAGIC, sizeof(h.magic));
+    h.version = version;
+    h.headerBytes = E1_RECORDING_HEADER_BYTES;
+    h.channelNum = TEST_CHANNELS;
+    h.samplingRateId = EDL_RADIO_SAMPLING_RATE_5_KHZ;
+    h.samplingRateHz = 5000.0;
+    h.chunkBytes = sizeof(ChunkHeader_t)+TEST_CHUNK_PACKETS*TEST_CHANNELS*sizeof(float);
+    h.chunkPackets = TEST_CHUNK_PACKETS;
+    h.compression = compression;
+    h.flags = flags;
+    return h;
+}
+
+/*! File image: the header, then the chunks appended as the recorder writes them, without index. */
+class Image
+{
+public:
+    explicit Image(const RecordingHeader_t &fileHeader) : h(fileHeader), bytes(E1_RECORDING_HEADER_BYTES, 0), chunks(0)
+    {
+        memcpy(bytes.data(), &h, sizeof(h));
+    }
+
+    /*! Appends a chunk of \a packets packets from stream packet \a firstPacket. \return Its offset. */
+    size_t chunk(uint64_t firstPacket, unsigned int packets, uint64_t firstSample, uint64_t triggerPacket)
+    {
+        ChunkHeader_t c;
+        memset(&c, 0, sizeof(c));
+        memcpy(c.magic, E1_CHUNK_MAGIC, sizeof(c.magic));
+        c.packets = packets;
+        c.chunkIdx = chunks++;
+        c.firstPacket = firstPacket;
+        c.hostTimeUs = 1000*(int64_t)firstPacket;
+        c.triggerPacket = triggerPacket;
+        c.firstSample = firstSample;
+
+        const bool packed = h.version == E1_RECORDING_VERSION_PACKED;
+        const unsigned int stride = packed ? packets : h.chunkPackets;
+        std::vector <float> payload((size_t)stride*h.channelNum, 0.0f);
+        for (unsigned int channelIdx = 0; channelIdx < h.channelNum; channelIdx++) {
+            for (unsigned int k = 0; k < packets; k++) {payload[(size_t)channelIdx*stride+k] = value(firstPacket+k, channelIdx);}
+        }
+
+        std::vector <char> stored;
+        if (h.compression == E1_COMPRESSION_DELTA_PACK) {
+            for (unsigned int channelIdx = 0; channelIdx < h.channelNum; channelIdx++) {
+                std::vector <char> section(codecBound(packets)+15);
+                char * aligned = (char *)(((uintptr_t)section.data()+15) & ~(uintptr_t)15);
+                size_t sectionBytes = codecEncode(payload.data()+(size_t)channelIdx*stride, packets, TEST_SCALE, aligned);
+                stored.insert(stored.end(), aligned, aligned+sectionBytes);
+            }
+        } else {
+            stored.assign((const char *)payload.data(), (const char *)(payload.data()+payload.size()));
+        }
+        size_t storedBytes = sizeof(c)+stored.size();
+        storedBytes = packed ? (storedBytes+15) & ~(size_t)15 : h.chunkBytes;
+        c.storedBytes = (uint32_t)storedBytes;
+
+        size_t offset = bytes.size();
+        bytes.resize(offset+storedBytes, 0);
+        memcpy(&bytes[offset], &c, sizeof(c));
+        memcpy(&bytes[offset+sizeof(c)], stored.data(), stored.size());
+        return offset;
+    }
+
+    const RecordingHeader_t h;
+    std::vector <char> bytes;
+    uint64_t chunks;
+};
+
+static bool save(const std::vector <char> &bytes)
+{
+    FILE * f = fopen(testPath, "wb");
+    if (f == NULL) {return false;}
+    bool written = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return fclose(f) == 0 && written;
+}
+
+static RecordingFile_t * openImage(const std::vector <char> &bytes)
+{
+    RecordingFile_t * recording = NULL;
+    if (!save(bytes) || recordingOpen(testPath, recording) != EdlSuccess) {return NULL;}
+    return recording;
+}
+
+/*! Checks that packets [\a first, \a first + \a count) read back as recorded, or as NaN if \a dropped. */
+static bool readsBack(const RecordingFile_t * recording, uint64_t first, unsigned int count, bool dropped)
+{
+    std::vector <float> packets((size_t)count*TEST_CHANNELS);
+    unsigned int got;
+    if (recordingReadPackets(recording, first, count, packets.data(), got) != EdlSuccess || got != count) {return false;}
+
+    for (unsigned int k = 0; k < count; k++) {
+        for (unsigned int channelIdx = 0; channelIdx < TEST_CHANNELS; channelIdx++) {
+            float x = packets[(size_t)k*TEST_CHANNELS+channelIdx];
+            if (dropped ? !std::isnan(x) : x != value(first+k, channelIdx)) {return false;}
+        }
+    }
+
+    std::vector <float> channel(count);
+    if (recordingReadChannel(recording, TEST_CHANNELS-1, first, count, channel.data(), got) != EdlSuccess || got != count) {return false;}
+    for (unsigned int k = 0; k < count; k++) {
+        if (dropped ? !std::isnan(channel[k]) : channel[k] != value(first+k, TEST_CHANNELS-1)) {return false;}
+    }
+    return true;
+}
+
+int main()
+{
+    RecordingFile_t * recording;
+    std::vector <float> dst(TEST_CHUNK_PACKETS*TEST_CHANNELS);
+    unsigned int got;
+
+	/*! Version 1 with device samples: two full chunks, 7 packets lost before the second one, 50 stream packets
+	 * dropped before a partial third one, then preallocated zeros. */
+    Image fixed(header(E1_RECORDING_VERSION, E1_COMPRESSION_NONE, E1_RECORDING_SAMPLES));
+    fixed.chunk(0, TEST_CHUNK_PACKETS, 0, 0);
+    fixed.chunk(200, TEST_CHUNK_PACKETS, 207, 0);
+    fixed.chunk(450, 40, 457, 0);
+    std::vector <char> preallocated = fixed.bytes;
+    preallocated.resize(preallocated.size()+2*fixed.h.chunkBytes, 0);
+
+    recording = openImage(preallocated);
+    CHECK(recording != NULL);
+    if (recording != NULL) {
+        const RecordingHeader_t &h = recordingHeader(recording);
+        CHECK(h.chunkNum == 3 && h.packetNum == 490 && h.indexOffset == 0);
+        CHECK(readsBack(recording, 0, 400, false));
+        CHECK(readsBack(recording, 400, 50, true));
+        CHECK(readsBack(recording, 450, 40, false));
+        CHECK(recordingReadPackets(recording, 480, 50, dst.data(), got) == EdlSuccess && got == 10);
+
+        const GapIndexEntry_t * gaps;
+        CHECK(recordingGaps(recording, gaps) == 1);
+        CHECK(gaps != NULL && gaps[0].packet == 200 && gaps[0].firstSample == 207 && gaps[0].missingPackets == 7);
+        CHECK(h.missingPackets == 7);
+        CHECK(recordingSampleAt(recording, 150) == 150 && recordingSampleAt(recording, 460) == 467);
+
+        unsigned int contiguous;
+        const float * span = recordingChannelSpan(recording, 1, 250, contiguous);
+        CHECK(span != NULL && contiguous == 150 && span[0] == value(250, 1) && span[149] == value(399, 1));
+        CHECK(recordingChannelSpan(recording, 1, 420, contiguous) == NULL);
+        recordingClose(recording);
+    }
+
+	/*! Torn in the middle of the third chunk: the first two are kept. */
+    std::vector <char> torn(fixed.bytes.begin(), fixed.bytes.begin()+E1_RECORDING_HEADER_BYTES+2*fixed.h.chunkBytes+100);
+    recording = openImage(torn);
+    CHECK(recording != NULL);
+    if (recording != NULL) {
+        CHECK(recordingHeader(recording).chunkNum == 2 && recordingHeader(recording).packetNum == 400);
+        CHECK(readsBack(recording, 0, 400, false));
+        recordingClose(recording);
+    }
+
+	/*! Finalized: the index is used as written, and rejected if it places a chunk anywhere else. */
+    std::vector <char> finalized = fixed.bytes;
+    RecordingHeader_t h = fixed.h;
+    h.chunkNum = 3;
+    h.packetNum = 490;
+    h.indexOffset = finalized.size();
+    finalized.insert(finalized.end(), E1_RECORDING_INDEX_MAGIC, E1_RECORDING_INDEX_MAGIC+8);
+    finalized.resize(finalized.size()+sizeof(uint64_t), 0);
+    memcpy(&finalized[finalized.size()-sizeof(uint64_t)], &h.chunkNum, sizeof(uint64_t));
+    const uint64_t firstPackets[] = {0, 200, 450};
+    for (unsigned int chunkIdx = 0; chunkIdx < 3; chunkIdx++) {
+        ChunkIndexEntry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.offset = E1_RECORDING_HEADER_BYTES+(uint64_t)chunkIdx*h.chunkBytes;
+        entry.firstPacket = firstPackets[chunkIdx];
+        entry.packets = chunkIdx < 2 ? TEST_CHUNK_PACKETS : 40;
+        finalized.insert(finalized.end(), (const char *)&entry, (const char *)(&entry+1));
+    }
+    memcpy(finalized.data(), &h, sizeof(h));
+    recording = openImage(finalized);
+    CHECK(recording != NULL);
+    if (recording != NULL) {
+        CHECK(recordingHeader(recording).indexOffset == h.indexOffset && recordingHeader(recording).chunkNum == 3);
+        CHECK(readsBack(recording, 0, 400, false) && readsBack(recording, 400, 50, true) && readsBack(recording, 450, 40, false));
+        recordingClose(recording);
+    }
+    ((ChunkIndexEntry_t *)&finalized[h.indexOffset+16])[1].offset += 16;
+    CHECK(openImage(finalized) == NULL);
+
+	/*! Compressed: the chain of stored sizes, up to a torn chunk whose size runs past the end of the file. */
+    Image compressed(header(E1_RECORDING_VERSION_PACKED, E1_COMPRESSION_DELTA_PACK, 0));
+    compressed.chunk(0, TEST_CHUNK_PACKETS, 0, 0);
+    compressed.chunk(200, 77, 0, 0);
+    size_t tornOffset = compressed.chunk(300, TEST_CHUNK_PACKETS, 0, 0);
+    std::vector <char> chain(compressed.bytes.begin(), compressed.bytes.begin()+tornOffset+sizeof(ChunkHeader_t)+32);
+    recording = openImage(chain);
+    CHECK(recording != NULL);
+    if (recording != NULL) {
+        CHECK(recordingHeader(recording).chunkNum == 2 && recordingHeader(recording).packetNum == 277);
+        CHECK(readsBack(recording, 0, 277, false));
+        CHECK(readsBack(recording, 150, 100, false));
+        unsigned int contiguous;
+        CHECK(recordingChannelSpan(recording, 0, 0, contiguous) == NULL);
+        recordingClose(recording);
+    }
+
+	/*! A corrupt block width is caught on opening, not while reading. */
+    std::vector <char> corrupt = compressed.bytes;
+    corrupt[E1_RECORDING_HEADER_BYTES+sizeof(ChunkHeader_t)+sizeof(CodecSectionHeader_t)] = 40;
+    CHECK(openImage(corrupt) == NULL);
+
+	/*! Gated and packed: the segments are the runs of chunks opened by the same trigger. */
+    Image gated(header(E1_RECORDING_VERSION_PACKED, E1_COMPRESSION_NONE, E1_RECORDING_GATED));
+    gated.chunk(0, TEST_CHUNK_PACKETS, 0, 10);
+    gated.chunk(200, 30, 0, 10);
+    gated.chunk(500, 60, 0, 520);
+    recording = openImage(gated.bytes);
+    CHECK(recording != NULL);
+    if (recording != NULL) {
+        CHECK(recordingHeader(recording).chunkNum == 3 && recordingHeader(recording).packetNum == 560);
+        const SegmentIndexEntry_t * segments;
+        CHECK(recordingSegments(recording, segments) == 2);
+        CHECK(segments[0].firstPacket == 0 && segments[0].packets == 230 && segments[0].chunks == 2 && segments[0].triggerPacket == 10);
+        CHECK(segments[1].firstPacket == 500 && segments[1].packets == 60 && segments[1].firstChunk == 2);
+        CHECK(readsBack(recording, 0, 230, false));
+        CHECK(readsBack(recording, 230, 270, true));
+        CHECK(readsBack(recording, 500, 60, false));
+        unsigned int contiguous;
+        const float * span = recordingChannelSpan(recording, 1, 210, contiguous);
+        CHECK(span != NULL && contiguous == 20 && span[0] == value(210, 1) && span[19] == value(229, 1));
+        CHECK(recordingChannelSpan(recording, TEST_CHANNELS, 210, contiguous) == NULL);
+        recordingClose(recording);
+    }
+
+	/*! Not a recording. */
+    std::vector <char> garbage(2*E1_RECORDING_HEADER_BYTES, 'x');
+    CHECK(openImage(garbage) == NULL);
+    CHECK(openImage(std::vector <char> (100, 0)) == NULL);
+
+    remove(testPath);
+    return testResult("reader");
+}
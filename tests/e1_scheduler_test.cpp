@@ -0,0 +1,135 @@
+/* e1_scheduler_test.cpp
+Read scheduler on a simulated clock (period, rate estimate, back off after overflows and backlogs), then the reader
+thread on the simulated device: one read per period whatever the sampling rate.
+Exits with the number of failed checks */
+
+#include <cmath>
+#include <cstdio>
+
+#include "e1_acquisition.h"
+#include "e1_scheduler.h"
+#include "e1_sim_test.h"
+#include "e1_stats.h"
+#include "e1_test.h"
+
+/*! Outcome of feeding a scheduler packets arriving at a steady rate. */
+typedef struct {
+    unsigned int reads;
+    double meanBatch;
+    double meanIntervalSeconds;
+} Feed_t;
+
+/*! Polls \a scheduler as the reader thread does, on a clock that only advances by the waits it asks for and 20 us
+ * per driver call, while packets arrive at \a arrivalHz from \a nowNs on, for \a seconds. */
+static Feed_t feed(ReadScheduler &scheduler, double arrivalHz, uint64_t &nowNs, double seconds)
+{
+    const uint64_t startNs = nowNs, endNs = nowNs+(uint64_t)(seconds*1e9);
+    uint64_t consumed = 0, firstReadNs = 0, lastReadNs = 0;
+    unsigned long long packets = 0;
+    Feed_t result = {0, 0.0, 0.0};
+
+    while (nowNs < endNs) {
+        uint64_t waitNs = 0;
+        unsigned int available = (unsigned int)((nowNs-startNs)*1e-9*arrivalHz)-(unsigned int)consumed;
+        nowNs += 20000;
+        if (scheduler.poll(nowNs, available, false, waitNs)) {
+            nowNs += 20000;
+            scheduler.read(nowNs, available);
+            consumed += available;
+            packets += available;
+            if (result.reads == 0) {firstReadNs = nowNs;}
+            lastReadNs = nowNs;
+            result.reads++;
+        } else {
+            nowNs += waitNs;
+        }
+    }
+    if (result.reads > 1) {
+        result.meanBatch = (double)packets/result.reads;
+        result.meanIntervalSeconds = (lastReadNs-firstReadNs)*1e-9/(result.reads-1);
+    }
+    return result;
+}
+
+static bool near(double value, double expected, double relative)
+{
+    return std::fabs(value-expected) <= relative*expected;
+}
+
+int main()
+{
+    ReadScheduler scheduler;
+    uint64_t nowNs = 1000000000ull, waitNs = 0;
+
+	/*! One read per period of 10 ms: 100 packets at 10 kHz. Short of them it waits for the rest to arrive. */
+    scheduler.reset(10000.0, SCHEDULER_MAX_PERIOD_S);
+    CHECK(scheduler.targetBatch() == 100);
+    CHECK(!scheduler.poll(nowNs, 50, false, waitNs));
+    CHECK(waitNs == 5000000);
+    Feed_t result = feed(scheduler, 10000.0, nowNs, 1.0);
+    CHECK(near(result.meanIntervalSeconds, 0.01, 0.1) && near(result.meanBatch, 100.0, 0.1));
+
+	/*! The rate set is wrong: the estimate follows the packets observed, so the reads stay 10 ms apart. */
+    scheduler.setRate(10000.0);
+    result = feed(scheduler, 40000.0, nowNs, 1.0);
+    CHECK(near(scheduler.arrivalRate(), 40000.0, 0.1));
+    CHECK(near(result.meanIntervalSeconds, 0.01, 0.1) && near(result.meanBatch, 400.0, 0.1));
+
+	/*! Unknown rate: the highest one is assumed until packets are observed. */
+    scheduler.reset(0.0, SCHEDULER_MAX_PERIOD_S);
+    CHECK(scheduler.arrivalRate() == 200000.0 && scheduler.targetBatch() == 2000);
+    result = feed(scheduler, 1250.0, nowNs, 2.0);
+    CHECK(near(scheduler.arrivalRate(), 1250.0, 0.1) && near(result.meanIntervalSeconds, 0.01, 0.15));
+
+	/*! Overflows halve the period down to the shortest one, reads that keep up grow it back to the longest. */
+    scheduler.reset(10000.0, SCHEDULER_MAX_PERIOD_S);
+    for (unsigned int overflow = 0; overflow < 20; overflow++) {scheduler.poll(nowNs, 0, true, waitNs);}
+    CHECK(scheduler.period() == SCHEDULER_MIN_PERIOD_S);
+    CHECK(scheduler.targetBatch() == MINIMUM_DATA_PACKETS_TO_READ);
+    result = feed(scheduler, 10000.0, nowNs, 2.0);
+    CHECK(scheduler.period() == SCHEDULER_MAX_PERIOD_S);
+
+	/*! A read of more than 4 batches means the reader fell behind: the period halves. */
+    scheduler.read(nowNs, 5*scheduler.targetBatch());
+    CHECK(scheduler.period() == SCHEDULER_MAX_PERIOD_S/2.0);
+    scheduler.read(nowNs, scheduler.targetBatch());
+    CHECK(near(scheduler.period(), SCHEDULER_MAX_PERIOD_S/2.0*1.05, 1e-9));
+
+	/*! Whatever the estimate, packets don't wait longer than the longest period. */
+    scheduler.reset(10000.0, SCHEDULER_MAX_PERIOD_S);
+    CHECK(!scheduler.poll(nowNs, 0, false, waitNs));
+    CHECK(scheduler.poll(nowNs+(uint64_t)(SCHEDULER_MAX_PERIOD_S*1e9), MINIMUM_DATA_PACKETS_TO_READ, false, waitNs));
+    scheduler.reset(10000.0, 0.0);
+    CHECK(scheduler.period() == SCHEDULER_MIN_PERIOD_S);
+
+	/*! The reader thread on the simulated device: about 100 reads per second at 200 kHz, then at 20 kHz once the rate
+	 * changes, and 1000 per second with a period of 1 ms. */
+    SimConfig_t sim;
+    simDefaults(sim);
+    CHECK(simConnect(sim, EDL_RADIO_SAMPLING_RATE_200_KHZ) == EdlSuccess);
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    const unsigned int rates[] = {EDL_RADIO_SAMPLING_RATE_200_KHZ, EDL_RADIO_SAMPLING_RATE_20_KHZ, EDL_RADIO_SAMPLING_RATE_20_KHZ};
+    const double periods[] = {SCHEDULER_MAX_PERIOD_S, SCHEDULER_MAX_PERIOD_S, 0.001};
+    for (unsigned int runIdx = 0; runIdx < 3; runIdx++) {
+        CHECK(simSetRate(rates[runIdx]) == EdlSuccess);
+        acquisitionSetReadPeriod(periods[runIdx]);
+        sleepMs(100);
+        statsReset();
+        sleepMs(500);
+        Stats_t stats;
+        statsGet(stats);
+        double readsPerSecond = stats.readCalls/stats.seconds;
+        double meanBatch = stats.readCalls > 0 ? (double)stats.packetsRead/stats.readCalls : 0.0;
+        double rateHz = samplingRateHz(rates[runIdx]);
+        if (!near(readsPerSecond, 1.0/periods[runIdx], 0.25) || !near(meanBatch, rateHz*periods[runIdx], 0.25)) {
+            printf("%g Hz every %g s: %g reads/s of %g packets\n", rateHz, periods[runIdx], readsPerSecond, meanBatch);
+            testFailures++;
+        }
+        acquisitionRing().consume(acquisitionRing().readable());
+    }
+    acquisitionStop();
+    CHECK(acquisitionLastError() == EdlSuccess);
+    disconnectDevice();
+
+    return testResult("scheduler");
+}
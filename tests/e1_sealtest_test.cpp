@@ -0,0 +1,129 @@
+/* e1_sealtest_test.cpp
+Seal test analyzer on the simulated cell: the access resistance, membrane capacitance and seal resistance it fits
+against the ones the device simulates, for either sign of Vstep, and after a sampling rate change.
+Exits with the number of failed checks */
+
+#include <cmath>
+#include <cstdio>
+
+#include "e1_acquisition.h"
+#include "e1_sealtest.h"
+#include "e1_sim_test.h"
+#include "e1_test.h"
+
+/*! Sends the seal test protocol of \a config to the device, pulses on if \a pulses. */
+static EdlErrorCode_t applyPulses(const SealTestConfig_t &config, bool pulses)
+{
+    EdlCommandStruct_t commandStruct;
+    EdlErrorCode_t err;
+
+    commandStruct.value = 0.0;
+    if ((err = sendCommand(EdlCommandVhold, commandStruct, false)) != EdlSuccess) {return err;}
+    commandStruct.value = config.vstepMv;
+    if ((err = sendCommand(EdlCommandVstep, commandStruct, false)) != EdlSuccess) {return err;}
+    commandStruct.value = config.tpuMs;
+    if ((err = sendCommand(EdlCommandTpu, commandStruct, false)) != EdlSuccess) {return err;}
+    commandStruct.value = config.tpeMs;
+    if ((err = sendCommand(EdlCommandTpe, commandStruct, false)) != EdlSuccess) {return err;}
+    commandStruct.value = pulses ? 1.0 : 0.0;
+    if ((err = sendCommand(EdlCommandMainTrial, commandStruct, false)) != EdlSuccess) {return err;}
+    commandStruct.buttonPressed = EDL_BUTTON_PRESSED;
+    return sendCommand(EdlCommandApplyProtocol, commandStruct, true);
+}
+
+static bool near(double value, double expected, double relative)
+{
+    return std::fabs(value-expected) <= relative*expected;
+}
+
+/*! Waits for a restarted analyzer to fit \a periods periods, then checks the estimates against the simulated cell. */
+static void checkEstimates(const SimConfig_t &sim, unsigned int periods, const char * what)
+{
+    SealTestResult_t result;
+    sealTestGet(result);
+    for (unsigned int k = 0; k < 300 && result.periods < periods; k++) {
+        sleepMs(10);
+        sealTestGet(result);
+    }
+
+	/*! The simulated membrane charges through Ra alone (tau = Ra Cm), while the model puts Rm in parallel with it:
+	 * Cm comes out (Ra+Rm)/Rm too large. */
+    double totalGOhm = 1.0/(sim.poreConductanceNs+1.0/sim.sealResistanceGOhm);
+    double sealGOhm = totalGOhm-sim.accessResistanceMOhm*1e-3;
+    bool good = result.valid == 1 && result.periods >= periods &&
+                near(result.totalResistanceGOhm, totalGOhm, 0.03) &&
+                near(result.sealResistanceGOhm, sealGOhm, 0.03) &&
+                near(result.accessResistanceMOhm, sim.accessResistanceMOhm, 0.05) &&
+                near(result.membraneCapacitancePf, sim.membraneCapacitancePf*totalGOhm/sealGOhm, 0.05) &&
+                near(result.tauUs, sim.accessResistanceMOhm*sim.membraneCapacitancePf, 0.05) &&
+                std::fabs(result.holdingCurrentPa-sim.offsetPa) < 2.0;
+    if (!good) {
+        printf("%s: valid %d after %llu periods, Rt %g GOhm, Rm %g GOhm, Ra %g MOhm, Cm %g pF, tau %g us, I %g pA\n",
+               what, result.valid, result.periods, result.totalResistanceGOhm, result.sealResistanceGOhm,
+               result.accessResistanceMOhm, result.membraneCapacitancePf, result.tauUs, result.holdingCurrentPa);
+        testFailures++;
+    }
+}
+
+int main()
+{
+	/*! A sealed cell: no pore, 1 GOhm seal, Ra 10 MOhm and Cm 10 pF (tau 100 us). The transients of 50 mV steps
+	 * reach 10 nA: the 20 nA range. */
+    SimConfig_t sim;
+    simDefaults(sim);
+    sim.eventRateHz = 0.0;
+    sim.poreConductanceNs = 0.0;
+    sim.sealResistanceGOhm = 1.0;
+    CHECK(simConnect(sim, EDL_RADIO_SAMPLING_RATE_200_KHZ) == EdlSuccess);
+    EdlCommandStruct_t commandStruct;
+    commandStruct.radioId = EDL_RADIO_RANGE_20_NA;
+    CHECK(sendCommand(EdlCommandRange, commandStruct, true) == EdlSuccess);
+
+    SealTestConfig_t config;
+    sealTestDefaults(config);
+    config.vstepMv = 50.0;
+    config.tpuMs = 20.0;
+    config.tpeMs = 50.0;
+    CHECK(applyPulses(config, true) == EdlSuccess);
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    CHECK(sealTestStart(config) == EdlSuccess);
+    checkEstimates(sim, 2*config.averagedPeriods, "200 kHz");
+
+	/*! Negative steps, a leakier seal and a slower membrane (Ra 20 MOhm, Cm 30 pF: tau 600 us). */
+    sim.sealResistanceGOhm = 0.5;
+    sim.accessResistanceMOhm = 20.0;
+    sim.membraneCapacitancePf = 30.0;
+    simConfigure(sim);
+    config.vstepMv = -20.0;
+    CHECK(applyPulses(config, true) == EdlSuccess);
+    CHECK(sealTestStart(config) == EdlSuccess);
+    checkEstimates(sim, 2*config.averagedPeriods, "negative Vstep");
+
+	/*! At 50 kHz the analyzer starts over at the new rate. */
+    SealTestResult_t result;
+    sealTestGet(result);
+    unsigned long long periods = result.periods;
+    CHECK(simSetRate(EDL_RADIO_SAMPLING_RATE_50_KHZ) == EdlSuccess);
+    CHECK(applyPulses(config, true) == EdlSuccess);
+    for (unsigned int k = 0; k < 100 && result.periods >= periods; k++) {
+        sleepMs(10);
+        sealTestGet(result);
+    }
+    CHECK(result.periods < periods);
+    checkEstimates(sim, 2*config.averagedPeriods, "50 kHz");
+
+	/*! Without pulses nothing can be fitted. */
+    CHECK(applyPulses(config, false) == EdlSuccess);
+    CHECK(sealTestStart(config) == EdlSuccess);
+    sleepMs(300);
+    sealTestGet(result);
+    CHECK(result.valid == 0 && result.periods == 0);
+
+    sealTestStop();
+    acquisitionStop();
+    config.tpeMs = config.tpuMs/2.0;
+    CHECK(sealTestStart(config) == EdlViolatedTrialRuleError);
+    disconnectDevice();
+
+    return testResult("sealtest");
+}
@@ -0,0 +1,126 @@
+/* e1_session_test.cpp
+Device session on the simulated device: a cold connection detects the device and compensates the offset, a warm one
+reuses both, and a different modality, a drifted offset, an old compensation or a missing device each force a new run.
+Exits with the number of failed checks */
+
+#include <cstdio>
+#include <cstring>
+
+#include "e1_offset.h"
+#include "e1_session.h"
+#include "e1_sim_test.h"
+#include "e1_test.h"
+
+static const char * path = "e1_session_test.dat";
+
+static bool readState(SessionState_t &saved)
+{
+    FILE * f = fopen(path, "rb");
+    if (f == NULL) {return false;}
+    bool valid = fread(&saved, sizeof(saved), 1, f) == 1;
+    fclose(f);
+    return valid;
+}
+
+static bool writeState(const SessionState_t &saved)
+{
+    FILE * f = fopen(path, "wb");
+    if (f == NULL) {return false;}
+    bool valid = fwrite(&saved, sizeof(saved), 1, f) == 1;
+    return fclose(f) == 0 && valid;
+}
+
+/*! Connects with \a config, lets the compensation end, and disconnects. \return The SESSION_WARM_* bits, or -1 if the
+ * connection or the compensation failed. */
+static int connectOnce(const SessionConfig_t &config)
+{
+    EdlErrorCode_t error;
+    unsigned int warm;
+
+    if (sessionConnect(config) != EdlSuccess || sessionStatus(error, warm) != SESSION_CONNECTED) {return -1;}
+    int compensation = offsetCompensationWait(config.compensation.timeoutMs+1000);
+    sessionDisconnect();
+    return compensation == OFFSET_COMPENSATION_CONVERGED ? (int)warm : -1;
+}
+
+int main()
+{
+    remove(path);
+    sessionSetStatePath(path);
+
+    SimConfig_t sim;
+    simDefaults(sim);
+    sim.eventRateHz = 0.0;
+    sim.devicesNum = 2;
+    simConfigure(sim);
+    SessionConfig_t config;
+    sessionDefaults(config);
+    SessionState_t saved;
+
+	/*! Cold: the devices are detected, the first one connected, and the compensation runs and saves its outcome. */
+    CHECK(connectOnce(config) == 0);
+    CHECK(readState(saved));
+    CHECK(strcmp(saved.deviceId, "E1SIM0000") == 0 && saved.compensationStatus == OFFSET_COMPENSATION_CONVERGED);
+    CHECK(saved.samplingRateId == config.samplingRateId && saved.rangeId == config.rangeId && saved.bandwidthId == config.bandwidthId);
+    CHECK(saved.compensationResidual <= config.compensation.tolerance);
+    int64_t compensatedUs = saved.compensationTimeUs;
+
+	/*! Warm: the saved device is connected directly, the compensation still holds and is not run again, and it keeps
+	 * its age. */
+    EdlErrorCode_t error;
+    unsigned int warm;
+    double residual;
+    CHECK(sessionConnect(config) == EdlSuccess);
+    CHECK(sessionStatus(error, warm) == SESSION_CONNECTED && error == EdlSuccess);
+    CHECK(warm == (SESSION_WARM_DEVICE | SESSION_WARM_COMPENSATION));
+    CHECK(offsetCompensationStatus(residual) == OFFSET_COMPENSATION_CONVERGED && residual <= config.compensation.tolerance);
+    CHECK(commandRadioId(EdlCommandSamplingRate) == config.samplingRateId);
+    CHECK(sessionDisconnect() == EdlSuccess);
+    CHECK(readState(saved) && saved.compensationTimeUs == compensatedUs);
+
+	/*! Another modality: same device, but the compensation runs again, and is saved for the new modality. */
+    config.samplingRateId = EDL_RADIO_SAMPLING_RATE_10_KHZ;
+    CHECK(connectOnce(config) == SESSION_WARM_DEVICE);
+    CHECK(readState(saved) && saved.samplingRateId == EDL_RADIO_SAMPLING_RATE_10_KHZ && saved.compensationTimeUs > compensatedUs);
+    CHECK(connectOnce(config) == (SESSION_WARM_DEVICE | SESSION_WARM_COMPENSATION));
+
+	/*! A power cycle brings a new offset: the measure after connecting rejects the saved compensation. */
+    sim.offsetPa = 35.0;
+    simConfigure(sim);
+    CHECK(connectOnce(config) == SESSION_WARM_DEVICE);
+    CHECK(connectOnce(config) == (SESSION_WARM_DEVICE | SESSION_WARM_COMPENSATION));
+
+	/*! Too old. */
+    config.maxCompensationAgeSeconds = 0.0;
+    CHECK(connectOnce(config) == SESSION_WARM_DEVICE);
+    sessionDefaults(config);
+    config.samplingRateId = EDL_RADIO_SAMPLING_RATE_10_KHZ;
+
+	/*! The saved device is gone: the devices are detected, and its compensation does not apply to the one found. */
+    CHECK(readState(saved));
+    strcpy(saved.deviceId, "E1SIM0001");
+    CHECK(writeState(saved));
+    sim.devicesNum = 1;
+    simConfigure(sim);
+    CHECK(connectOnce(config) == 0);
+    CHECK(readState(saved) && strcmp(saved.deviceId, "E1SIM0000") == 0);
+
+	/*! In the background. */
+    CHECK(sessionConnectAsync(config) == EdlSuccess);
+    CHECK(sessionWait(5000) == SESSION_CONNECTED);
+    CHECK(sessionStatus(error, warm) == SESSION_CONNECTED && warm == (SESSION_WARM_DEVICE | SESSION_WARM_COMPENSATION));
+    CHECK(sessionDisconnect() == EdlSuccess);
+    CHECK(sessionStatus(error, warm) == SESSION_DISCONNECTED);
+
+	/*! Without a state file nothing is warm; without a device the connection fails. */
+    sessionSetStatePath("");
+    CHECK(connectOnce(config) == 0);
+    sim.devicesNum = 0;
+    simConfigure(sim);
+    CHECK(sessionConnect(config) == EdlNoDevicesError);
+    CHECK(sessionStatus(error, warm) == SESSION_FAILED && error == EdlNoDevicesError && warm == 0);
+
+    remove(path);
+
+    return testResult("session");
+}
@@ -0,0 +1,123 @@
+/* e1_shm_test.cpp
+Shared memory ring published from the simulated device: a reader that keeps up sees every packet in order, one that
+falls behind is told how many packets it lost, and spans overwritten while in use are reported.
+Exits with the number of failed checks */
+
+#include <cstdio>
+#include <vector>
+
+#include "e1_acquisition.h"
+#include "e1_publisher.h"
+#include "e1_shm.h"
+#include "e1_sim_test.h"
+#include "e1_test.h"
+
+/*! Slot of the only reader of this process. */
+static const ShmReaderSlot_t * ownSlot(const ShmReader_t * reader)
+{
+    const ShmHeader_t &header = shmReaderHeader(reader);
+    for (unsigned int slotIdx = 0; slotIdx < SHM_MAX_READERS; slotIdx++) {
+        if (header.readers[slotIdx].owner.load() == shmProcessId()) {return &header.readers[slotIdx];}
+    }
+    return NULL;
+}
+
+int main()
+{
+    char name[SHM_NAME_MAX];
+    snprintf(name, sizeof(name), "e1_shm_test_%llu", (unsigned long long)shmProcessId());
+    ShmReader_t * reader;
+
+    SimConfig_t sim;
+    simDefaults(sim);
+    CHECK(simConnect(sim, EDL_RADIO_SAMPLING_RATE_20_KHZ) == EdlSuccess);
+    CHECK(shmReaderAttach(name, reader) == EdlDeviceNotConnectedError);
+
+	/*! 3000 packets rounded up to 4096: 200 ms at 20 kHz, 20 ms at 200 kHz. */
+    CHECK(publisherStart(name, 3000, false) == EdlSuccess);
+    CHECK(publisherRunning());
+    CHECK(publisherStart(name, 3000, false) == EdlDeviceAlreadyConnectedError);
+    CHECK(shmReaderAttach(name, reader) == EdlSuccess);
+    if (reader == NULL) {
+        publisherStop(true);
+        disconnectDevice();
+        return testResult("shm");
+    }
+    const ShmHeader_t &header = shmReaderHeader(reader);
+    const ShmReaderSlot_t * slot = ownSlot(reader);
+    CHECK(header.capacity == 4096 && header.publishing.load() == 1);
+    CHECK(slot != NULL);
+    uint32_t session = header.session.load();
+    unsigned int readers;
+    uint64_t slowest;
+    publisherReaders(readers, slowest);
+    CHECK(readers == 1);
+
+	/*! Reading every 2 ms at 20 kHz: each read starts where the previous one ended, nothing is lost. */
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    std::vector <float> packets((size_t)header.capacity*EDL_CHANNEL_NUM);
+    unsigned int got;
+    uint64_t sequence, lost, next = 0, total = 0, lostTotal = 0;
+    bool continuous = true;
+    for (unsigned int readIdx = 0; readIdx < 200; readIdx++) {
+        sleepMs(2);
+        shmReaderRead(reader, packets.data(), header.capacity, got, sequence, lost);
+        if (readIdx > 0 && (sequence != next || lost != 0)) {continuous = false;}
+        next = sequence+got;
+        total += got;
+    }
+    CHECK(continuous);
+    CHECK(total > 4000);
+    CHECK(slot != NULL && slot->overrunPackets.load() == 0 && slot->cursor.load() == next);
+
+	/*! The sampling rate is published with the packets. */
+    CHECK(header.samplingRateId.load() == EDL_RADIO_SAMPLING_RATE_20_KHZ);
+    CHECK(simSetRate(EDL_RADIO_SAMPLING_RATE_200_KHZ) == EdlSuccess);
+    sleepMs(50);
+    CHECK(header.samplingRateId.load() == EDL_RADIO_SAMPLING_RATE_200_KHZ);
+
+	/*! 100 ms behind at 200 kHz, 5 times the capacity: the reader resumes from the oldest packet left and the packets skipped are
+	 * reported as lost, to it and in its slot. */
+    for (unsigned int lapIdx = 0; lapIdx < 3; lapIdx++) {
+        sleepMs(100);
+        shmReaderRead(reader, packets.data(), header.capacity, got, sequence, lost);
+        CHECK(lost > 2*header.capacity && sequence == next+lost);
+        CHECK(got > 0 && sequence+got <= header.head.load());
+        lostTotal += lost;
+        next = sequence+got;
+    }
+    CHECK(slot != NULL && slot->overrunPackets.load() >= lostTotal);
+    publisherReaders(readers, slowest);
+    CHECK(readers == 1 && slowest <= header.head.load());
+
+	/*! A span held while the producer laps it: its release reports the samples may be torn. */
+    const float * span;
+    unsigned int spanPackets;
+    shmReaderWait(reader, 1, 100);
+    shmReaderPeek(reader, span, spanPackets, sequence, lost);
+    CHECK(spanPackets > 0);
+    CHECK(shmReaderRelease(reader, spanPackets));
+    shmReaderWait(reader, 1, 100);
+    shmReaderPeek(reader, span, spanPackets, sequence, lost);
+    sleepMs(100);
+    CHECK(!shmReaderRelease(reader, spanPackets));
+
+	/*! Stopped, the ring says so and waits return at once; started again, the session changes. */
+    publisherStop(false);
+    CHECK(!publisherRunning());
+    CHECK(header.publishing.load() == 0);
+    do {shmReaderRead(reader, packets.data(), header.capacity, got, sequence, lost);} while (got > 0);
+    CHECK(shmReaderWait(reader, 1, 10000) == 0);
+    CHECK(publisherStart(name, 4096, false) == EdlSuccess);
+    CHECK(header.publishing.load() == 1 && header.session.load() == session+1);
+
+    shmReaderDetach(reader);
+    publisherReaders(readers, slowest);
+    CHECK(readers == 0);
+    acquisitionStop();
+    publisherStop(true);
+    CHECK(shmReaderAttach(name, reader) == EdlDeviceNotConnectedError);
+    disconnectDevice();
+
+    return testResult("shm");
+}
@@ -0,0 +1,53 @@
+/*! \file e1_sim_test.h
+ * \brief Connection to the simulated device, shared by the unit tests that run the acquisition paths end to end.
+ */
+#ifndef E1_SIM_TEST_H
+#define E1_SIM_TEST_H
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "edl.h"
+#include "edl_sim.h"
+#include "e1_config.h"
+
+/*! \brief Applies \a config to the simulated device, connects to it afresh and sets the sampling rate \a samplingRateId.
+ * \return #EdlErrorCode_t Error code.
+ */
+static inline EdlErrorCode_t simConnect(const SimConfig_t &config, unsigned int samplingRateId)
+{
+    EdlErrorCode_t res;
+    EdlCommandStruct_t commandStruct;
+    std::vector <std::string> devices;
+
+    disconnectDevice();
+    simConfigure(config);
+    init();
+    res = detectDevices(devices);
+    if (res != EdlSuccess) {return res;}
+    res = connectDevice(devices.at(0));
+    if (res != EdlSuccess) {return res;}
+    configInvalidate();
+
+    commandStruct.radioId = samplingRateId;
+    return sendCommand(EdlCommandSamplingRate, commandStruct, true);
+}
+
+/*! \brief Sends the sampling rate \a samplingRateId. \return #EdlErrorCode_t Error code. */
+static inline EdlErrorCode_t simSetRate(unsigned int samplingRateId)
+{
+    EdlCommandStruct_t commandStruct;
+
+    commandStruct.radioId = samplingRateId;
+    return sendCommand(EdlCommandSamplingRate, commandStruct, true);
+}
+
+/*! \brief Sleeps \a ms milliseconds. */
+static inline void sleepMs(unsigned int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+#endif // E1_SIM_TEST_H
@@ -0,0 +1,76 @@
+/* e1_spectrum_test.cpp
+Real FFT of the spectrum analyzer against a direct DFT, for every length from the smallest planned one.
+Exits with the number of failed checks */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "e1_spectrum.h"
+#include "e1_test.h"
+
+static const double pi = 3.14159265358979323846;
+
+/*! |X[k]|^2 for k = 0 to length/2, summed term by term. */
+static std::vector <double> directPower(const std::vector <float> &x)
+{
+    const size_t n = x.size();
+    std::vector <double> power(n/2+1);
+
+    for (size_t k = 0; k <= n/2; k++) {
+        double re = 0.0, im = 0.0;
+        for (size_t t = 0; t < n; t++) {
+            double phase = -2.0*pi*(double)((k*t) % n)/(double)n;
+            re += x[t]*std::cos(phase);
+            im += x[t]*std::sin(phase);
+        }
+        power[k] = re*re+im*im;
+    }
+    return power;
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+    std::normal_distribution <float> noise(0.0f, 1.0f);
+    RealFft fft;
+
+	/*! Noise on an offset: errors are compared to the total power, which Parseval ties to the samples. */
+    for (unsigned int length = 4; length <= 4096; length *= 2) {
+        std::vector <float> x(length);
+        for (unsigned int t = 0; t < length; t++) {x[t] = 3.0f+noise(rng);}
+
+        fft.plan(length);
+        CHECK(fft.length() == length);
+        std::vector <double> power(length/2+1);
+        fft.power(x.data(), power.data());
+        std::vector <double> expected = directPower(x);
+
+        double total = 0.0, worst = 0.0;
+        for (unsigned int k = 0; k <= length/2; k++) {
+            total += expected[k];
+            worst = std::max(worst, std::fabs(power[k]-expected[k]));
+        }
+        if (!(worst <= 1e-9*total)) {
+            printf("length %u: largest error %g of a total power of %g\n", length, worst, total);
+            testFailures++;
+        }
+    }
+
+	/*! A cosine on bin 5 of 64 samples: all the power in that bin, (A n / 2)^2. */
+    std::vector <float> tone(64);
+    for (unsigned int t = 0; t < 64; t++) {tone[t] = (float)(2.0*std::cos(2.0*pi*5.0*t/64.0));}
+    fft.plan(64);
+    std::vector <double> power(33);
+    fft.power(tone.data(), power.data());
+    CHECK(std::fabs(power[5]-64.0*64.0) < 1e-2);
+    double leaked = 0.0;
+    for (unsigned int k = 0; k <= 32; k++) {
+        if (k != 5) {leaked += power[k];}
+    }
+    CHECK(leaked < 1e-6);
+
+    return testResult("spectrum");
+}
@@ -0,0 +1,132 @@
+/* e1_subscription_test.cpp
+Subscriptions fed by the simulated device: blocks that follow each other in the stream, partial blocks delivered to
+keep the latency bound when the packets arrive too slowly to fill them, and the read period lowered meanwhile.
+Exits with the number of failed checks */
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+
+#include "e1_acquisition.h"
+#include "e1_stats.h"
+#include "e1_subscription.h"
+#include "e1_sim_test.h"
+#include "e1_test.h"
+
+/*! Blocks seen by a subscription, checked as they arrive. */
+typedef struct {
+    std::mutex mutex;
+    unsigned long long blocks;
+    unsigned long long partial;
+    unsigned long long packets;
+    unsigned long long discontinuities;
+    uint64_t nextStreamPacket;
+    uint64_t maxLatencyNs;
+    unsigned int blockPackets;
+    int removeResult;
+    int id;
+} Record_t;
+
+static void resetRecord(Record_t &record, unsigned int blockPackets)
+{
+    std::lock_guard <std::mutex> lock(record.mutex);
+    record.blocks = 0;
+    record.partial = 0;
+    record.packets = 0;
+    record.discontinuities = 0;
+    record.nextStreamPacket = 0;
+    record.maxLatencyNs = 0;
+    record.blockPackets = blockPackets;
+    record.removeResult = EdlSuccess;
+}
+
+static void recordBlock(const float *, const SubscriptionBlock_t * block, void * context)
+{
+    Record_t &record = *(Record_t *)context;
+    uint64_t nowNs = statsNowNs();
+
+    std::lock_guard <std::mutex> lock(record.mutex);
+    if (record.blocks > 0 && block->streamPacket != record.nextStreamPacket) {record.discontinuities++;}
+    record.nextStreamPacket = block->streamPacket+block->packets;
+    record.blocks++;
+    record.packets += block->packets;
+    if (block->packets < record.blockPackets) {record.partial++;}
+    record.maxLatencyNs = std::max(record.maxLatencyNs, nowNs-std::min(nowNs, block->firstTimeNs));
+    record.removeResult = subscriptionRemove(record.id);
+}
+
+/*! Subscribes \a record with \a config for \a ms milliseconds of acquisition. \return The counters of the subscription. */
+static SubscriptionStats_t run(const SubscriptionConfig_t &config, Record_t &record, unsigned int ms)
+{
+    SubscriptionStats_t stats = SubscriptionStats_t(), removed;
+
+    resetRecord(record, config.blockPackets);
+    CHECK(subscriptionAdd(config, recordBlock, &record, record.id) == EdlSuccess);
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    sleepMs(ms);
+    acquisitionStop();
+    CHECK(subscriptionStats(record.id, stats));
+    CHECK(subscriptionRemove(record.id) == EdlSuccess);
+    CHECK(!subscriptionStats(record.id, removed));
+    return stats;
+}
+
+int main()
+{
+    SimConfig_t sim;
+    simDefaults(sim);
+    sim.eventRateHz = 0.0;
+    CHECK(simConnect(sim, EDL_RADIO_SAMPLING_RATE_1_25_KHZ) == EdlSuccess);
+    const double period = acquisitionReadPeriod();
+    Record_t record;
+    SubscriptionConfig_t config;
+    subscriptionDefaults(config);
+
+	/*! Every batch as read: they follow each other, and a callback cannot unsubscribe. */
+    SubscriptionStats_t stats = run(config, record, 300);
+    CHECK(record.blocks > 5 && record.discontinuities == 0 && stats.blocks == record.blocks);
+    CHECK(record.removeResult == EdlUnknownError);
+
+	/*! Blocks of 250 packets without a latency bound: full blocks only, 200 ms apart at 1.25 kHz, held until full. */
+    config.blockPackets = 250;
+    stats = run(config, record, 1100);
+    CHECK(record.blocks >= 3 && record.partial == 0 && record.discontinuities == 0);
+    CHECK(stats.partialBlocks == 0 && record.maxLatencyNs > 100000000ull);
+
+	/*! Blocks of 1000 packets (0.8 s) with a bound of 40 ms: partial blocks, each delivered within the bound, and the
+	 * read period lowered to a quarter of it while subscribed. */
+    config.blockPackets = 1000;
+    config.maxLatencySeconds = 0.04;
+    resetRecord(record, config.blockPackets);
+    CHECK(subscriptionAdd(config, recordBlock, &record, record.id) == EdlSuccess);
+    CHECK(acquisitionReadPeriod() == std::min(period, config.maxLatencySeconds/SUBSCRIPTION_PERIOD_DIVIDER));
+    CHECK(acquisitionStart(ACQUISITION_RING_PACKETS) == EdlSuccess);
+    sleepMs(1000);
+    acquisitionStop();
+    CHECK(subscriptionStats(record.id, stats));
+    CHECK(subscriptionRemove(record.id) == EdlSuccess);
+    CHECK(acquisitionReadPeriod() == period);
+    CHECK(record.blocks > 10 && record.partial == record.blocks && stats.partialBlocks == record.blocks);
+    CHECK(record.discontinuities == 0 && record.packets > 1000);
+    if (record.maxLatencyNs > config.maxLatencySeconds*1e9 || stats.maxLatencyNs > config.maxLatencySeconds*1e9) {
+        printf("partial blocks %g ms late, bound %g ms\n", record.maxLatencyNs*1e-6, config.maxLatencySeconds*1e3);
+        testFailures++;
+    }
+
+	/*! At 200 kHz the same blocks fill within the bound: only a read the host delays can still force one out early. */
+    CHECK(simSetRate(EDL_RADIO_SAMPLING_RATE_200_KHZ) == EdlSuccess);
+    stats = run(config, record, 300);
+    CHECK(record.blocks > 30 && record.partial*10 < record.blocks && record.discontinuities == 0);
+
+	/*! A predicate no sample matches: every block is skipped. */
+    config.predicate = SUBSCRIPTION_PREDICATE_MAGNITUDE_ABOVE;
+    config.level = 1e9;
+    stats = run(config, record, 200);
+    CHECK(record.blocks == 0 && stats.blocks == 0 && stats.skippedBlocks > 10);
+
+    config.channel = EDL_CHANNEL_NUM;
+    CHECK(subscriptionAdd(config, recordBlock, &record, record.id) == EdlUnknownError);
+    disconnectDevice();
+
+    return testResult("subscription");
+}
@@ -0,0 +1,30 @@
+/*! \file e1_test.h
+ * \brief Checks shared by the unit tests: each test is one translation unit whose main returns #testFailures.
+ */
+#ifndef E1_TEST_H
+#define E1_TEST_H
+
+#include <cstdio>
+
+/*! Number of failed checks so far. */
+static int testFailures = 0;
+
+/*! \def CHECK
+ * \brief Reports \a condition with its location if it does not hold, and counts it as a failure.
+ */
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            testFailures++; \
+        } \
+    } while (0)
+
+/*! \brief Prints the outcome of test \a name. \return The value for main to return: the number of failed checks. */
+static inline int testResult(const char * name)
+{
+    if (testFailures == 0) {printf("%s: all checks passed\n", name);}
+    return testFailures;
+}
+
+#endif // E1_TEST_H